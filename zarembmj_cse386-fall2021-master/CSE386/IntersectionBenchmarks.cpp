@@ -0,0 +1,826 @@
+#include <chrono>
+#include <random>
+#include <functional>
+#include <sstream>
+#include "ishape.h"
+#include "bvh.h"
+#include "compactscene.h"
+#include "grid.h"
+#include "iscene.h"
+#include "sphereset.h"
+#include "heightfield.h"
+#include "trianglemesh.h"
+#include "io.h"
+#include "raytracer.h"
+
+// Times the ways a scene's shapes can be searched for the closest hit and for shadow
+// occlusion: a linear pass over the vector<VisibleIShapePtr> (one heap object and one
+// virtual call per shape), the same linear pass over a CompactScene's typed arrays, the
+// BVH and the grid. Every method must find exactly the hits the vector<VisibleIShapePtr> does;
+// the number of disagreements is reported with the timings.
+//
+// Scenes: the shapes of exercisecomposite3dshapes.cpp, then growing sets of random
+// spheres, disks, cylinders and ellipsoids above a ground plane.
+//
+// A cloud of tens of thousands of small spheres, too many for a linear search, compares
+// the BVH and the grid on their build times as well, and checks that they agree.
+//
+// The same kind of cloud, as separate ISpheres in a BVH and as one ISphereSet, compares
+// the memory each takes and how quickly each is searched.
+//
+// Terrain is compared as an IHeightField and as a triangle mesh made from its samples.
+//
+// Each kind of quadric with a closed-form intersector is timed against the general
+// quadric code, one ray or one packet at a time; their hits must agree within rounding.
+//
+// The linear search of a random scene is timed with each candidate's whole HitRecord
+// filled in and copied, as it used to be, and with only t and a primitive tracked until
+// the closest shape is known.
+//
+// Rays looking through a stack of glass panes find every layer, either by spawning a new
+// ray past each pane, as the ray tracer used to, or with one multi-hit query.
+//
+// Shadow rays from the hits of neighboring primary rays toward one light are traced one
+// at a time and as packets, which must be exactly as occluded. The same shadow rays are
+// traced through a scene with and without its occluder cache, and through a scene
+// before and after half its shapes are hidden from shadow rays. Last, several lights
+// shadow the same hits, first lighting and shadowed by every shape, then each linked to
+// its own share of the shapes.
+//
+// A scene lit by a crowd of short-range point and spot lights is rendered with every
+// light shading every pixel, then with each tile of the image shaded by only the lights
+// that can reach it. The two images must be identical.
+//
+// Then a few spheres of the largest random scene wander about, frame after frame, and
+// the time to refit the BVH around them is compared with rebuilding it every frame.
+
+const int NUM_RAYS = 200000;
+const double SHADOW_RAY_LENGTH = 10.0;
+const int NUM_DENSE_SPHERES = 20000;
+const int NUM_PARTICLES = 200000;
+const int TERRAIN_SAMPLES = 1025;
+const int NUM_FRAMES = 200;
+const int NUM_MOVING = 8;
+const double MOVE_STEP = 0.25;
+const int NUM_PANES = 6;
+const int SHADOW_IMAGE_SIZE = 400;
+const dvec3 SHADOW_LIGHT_POS(10.0, 40.0, 20.0);
+const int NUM_LINKED_LIGHTS = 8;
+const int NUM_MANY_LIGHTS = 256;
+const int MANY_LIGHTS_IMAGE_SIZE = 200;
+
+vector<VisibleIShapePtr> buildCompositeShapes() {
+	vector<VisibleIShapePtr> shapes;
+	IClosedCylinderY* closedCylinder = new IClosedCylinderY(dvec3(4.0, 1.0, -8.0), 3.0, 5.0);
+	shapes.push_back(new VisibleIShape(new IPlane(dvec3(0, -4, 0), Y_AXIS), tin));
+	shapes.push_back(new VisibleIShape(new ICylinderY(dvec3(0.0, 0.0, 6.5), 2, 4.0), gold));
+	shapes.push_back(new VisibleIShape(new ICylinderZ(dvec3(8.0, -2.0, 0.5), 1.5, 5.0), polishedBronze));
+	shapes.push_back(new VisibleIShape(new ISphere(dvec3(0.0, 0.0, 0.0), 4.0), copper));
+	shapes.push_back(new VisibleIShape(new IConeY(dvec3(13.0, -4.0, -4.0), 3, 8), polishedSilver));
+	shapes.push_back(new VisibleIShape(closedCylinder->diskBottom, chrome));
+	shapes.push_back(new VisibleIShape(closedCylinder->diskTop, chrome));
+	shapes.push_back(new VisibleIShape(closedCylinder->cylinder, chrome));
+	VisibleIShapePtr transparentPlane = new VisibleIShape(new IPlane(dvec3(0, 0, 0), X_AXIS), polishedGold);
+	transparentPlane->material.alpha = 0.4;
+	shapes.push_back(transparentPlane);
+	return shapes;
+}
+
+vector<VisibleIShapePtr> buildRandomShapes(int count) {
+	std::mt19937 rng(count);
+	std::uniform_real_distribution<double> pos(-15.0, 15.0);
+	std::uniform_real_distribution<double> size(0.2, 1.5);
+	const Material palette[] = { gold, copper, chrome, redPlastic, cyanPlastic, polishedSilver };
+	vector<VisibleIShapePtr> shapes;
+	shapes.push_back(new VisibleIShape(new IPlane(dvec3(0, -16, 0), Y_AXIS), tin));
+	for (int i = 0; i < count; i++) {
+		dvec3 center(pos(rng), pos(rng), pos(rng));
+		const Material &mat = palette[i % 6];
+		switch (i % 4) {
+		case 0:	shapes.push_back(new VisibleIShape(new ISphere(center, size(rng)), mat)); break;
+		case 1:	shapes.push_back(new VisibleIShape(new IDisk(center, glm::normalize(dvec3(pos(rng), pos(rng), pos(rng))), size(rng)), mat)); break;
+		case 2:	shapes.push_back(new VisibleIShape(new ICylinderY(center, size(rng), size(rng)), mat)); break;
+		case 3:	shapes.push_back(new VisibleIShape(new IEllipsoid(center, dvec3(size(rng), size(rng), size(rng))), mat)); break;
+		}
+	}
+	return shapes;
+}
+
+vector<Ray> buildRays() {
+	std::mt19937 rng(386);
+	std::uniform_real_distribution<double> pos(-15.0, 15.0);
+	std::uniform_real_distribution<double> dir(-1.0, 1.0);
+	vector<Ray> rays;
+	for (int i = 0; i < NUM_RAYS; i++) {
+		dvec3 d(dir(rng), dir(rng), dir(rng));
+		if (glm::length(d) < 0.01) {
+			d = -Y_AXIS;
+		}
+		rays.push_back(Ray(dvec3(pos(rng), pos(rng), pos(rng)), d));
+	}
+	return rays;
+}
+
+bool sameHit(const HitRecord& a, const HitRecord& b) {
+	return a.t == b.t && a.interceptPt == b.interceptPt && a.normal == b.normal &&
+			a.u == b.u && a.v == b.v && a.texture == b.texture &&
+			a.material.diffuse == b.material.diffuse && a.material.alpha == b.material.alpha;
+}
+
+double linearOcclusion(const Ray& ray, const vector<VisibleIShapePtr>& shapes) {
+	double sha = 0.0;
+	for (size_t i = 0; i < shapes.size(); i++) {
+		if (shapes[i]->shape->hasIntersection(ray, 0.0, SHADOW_RAY_LENGTH)) {
+			sha += shapes[i]->material.alpha;
+			if (sha >= 1.0) {
+				return 1.0;
+			}
+		}
+	}
+	return sha;
+}
+
+double secondsFor(const std::function<void()>& work) {
+	auto start = std::chrono::steady_clock::now();
+	work();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const std::string& method, double closestSecs, double shadowSecs, long long mismatches) {
+	cout << "  " << method << ": closest hit " << NUM_RAYS / closestSecs / 1.0e6 << " Mrays/sec, "
+		<< "shadow " << NUM_RAYS / shadowSecs / 1.0e6 << " Mrays/sec, mismatches " << mismatches << endl;
+}
+
+long long benchmark(const std::string& name, const vector<VisibleIShapePtr>& shapes, const vector<Ray>& rays) {
+	CompactScene compact;
+	compact.build(shapes);
+	BVH bvh;
+	bvh.build(shapes);
+	Grid grid;
+	grid.build(shapes);
+	cout << name << ": " << shapes.size() << " shapes, " << compact.numMaterials() << " materials" << endl;
+
+	vector<HitRecord> expected(rays.size()), hits(rays.size());
+	vector<double> expectedSha(rays.size()), sha(rays.size());
+	long long totalMismatches = 0;
+
+	double closestSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) VisibleIShape::findIntersection(rays[i], shapes, expected[i]);
+	});
+	double shadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) expectedSha[i] = linearOcclusion(rays[i], shapes);
+	});
+	report("vector<VisibleIShapePtr>", closestSecs, shadowSecs, 0);
+
+	auto check = [&](const std::string& method, double closest, double shadow) {
+		long long mismatches = 0;
+		for (size_t i = 0; i < rays.size(); i++) {
+			mismatches += !sameHit(hits[i], expected[i]);
+			mismatches += std::abs(sha[i] - expectedSha[i]) > 1.0e-12;
+		}
+		report(method, closest, shadow, mismatches);
+		totalMismatches += mismatches;
+	};
+
+	closestSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) compact.findIntersection(rays[i], hits[i]);
+	});
+	shadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) sha[i] = compact.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	check("CompactScene", closestSecs, shadowSecs);
+
+	closestSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) { hits[i] = HitRecord(); bvh.findIntersection(rays[i], hits[i]); }
+	});
+	shadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) sha[i] = bvh.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	check("BVH", closestSecs, shadowSecs);
+
+	closestSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) { hits[i] = HitRecord(); grid.findIntersection(rays[i], hits[i]); }
+	});
+	shadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) sha[i] = grid.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	check("Grid", closestSecs, shadowSecs);
+	return totalMismatches;
+}
+
+long long denseBenchmark(int count, const vector<Ray>& rays) {
+	std::mt19937 rng(count);
+	std::uniform_real_distribution<double> pos(-15.0, 15.0);
+	std::uniform_real_distribution<double> size(0.1, 0.2);
+	vector<VisibleIShapePtr> shapes;
+	for (int i = 0; i < count; i++) {
+		shapes.push_back(new VisibleIShape(new ISphere(dvec3(pos(rng), pos(rng), pos(rng)), size(rng)), gold));
+	}
+	cout << "Dense scene: " << count << " spheres" << endl;
+
+	BVH bvh;
+	Grid grid;
+	double bvhBuildSecs = secondsFor([&]() { bvh.build(shapes); });
+	double gridBuildSecs = secondsFor([&]() { grid.build(shapes); });
+	vector<HitRecord> expected(rays.size()), hits(rays.size());
+	vector<double> expectedSha(rays.size()), sha(rays.size());
+	double bvhSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) bvh.findIntersection(rays[i], expected[i]);
+	});
+	double bvhShadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) expectedSha[i] = bvh.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	double gridSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) grid.findIntersection(rays[i], hits[i]);
+	});
+	double gridShadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) sha[i] = grid.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	long long mismatches = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		mismatches += !sameHit(hits[i], expected[i]);
+		mismatches += sha[i] != expectedSha[i];
+	}
+	cout << "  BVH: build " << 1000.0 * bvhBuildSecs << " msec, " << bvh.numNodes() << " nodes" << endl;
+	report("BVH", bvhSecs, bvhShadowSecs, 0);
+	cout << "  Grid: build " << 1000.0 * gridBuildSecs << " msec, " << grid.numCells() << " cells" << endl;
+	report("Grid", gridSecs, gridShadowSecs, mismatches);
+	return mismatches;
+}
+
+long long particleBenchmark(int count, const vector<Ray>& rays) {
+	// Centers and radii on a grid of 1/1024ths are exact as floats, so both versions
+	// have exactly the same spheres
+	std::mt19937 rng(count);
+	std::uniform_real_distribution<double> pos(-15.0, 15.0);
+	std::uniform_real_distribution<double> size(0.1, 0.2);
+	const Material palette[] = { gold, copper, chrome, redPlastic, cyanPlastic, polishedSilver };
+	ISphereSet sphereSet(vector<Material>(palette, palette + 6));
+	vector<VisibleIShapePtr> shapes;
+	for (int i = 0; i < count; i++) {
+		dvec3 center(glm::round(dvec3(pos(rng), pos(rng), pos(rng)) * 1024.0) / 1024.0);
+		double radius = std::round(size(rng) * 1024.0) / 1024.0;
+		shapes.push_back(new VisibleIShape(new ISphere(center, radius), palette[i % 6]));
+		sphereSet.add(center, radius, i % 6);
+	}
+	cout << "Particles: " << count << " spheres" << endl;
+
+	BVH bvh;
+	double bvhBuildSecs = secondsFor([&]() { bvh.build(shapes); });
+	double setBuildSecs = secondsFor([&]() { sphereSet.build(); });
+	VisibleIShape visibleSet(&sphereSet, tin);
+	vector<VisibleIShapePtr> setShapes(1, &visibleSet);
+	BVH setBVH;
+	setBVH.build(setShapes);
+
+	// The shapes and the BVH's arrays; heap and hash table overheads are not counted.
+	size_t bvhBytes = shapes.size() * (sizeof(VisibleIShape) + sizeof(ISphere) + sizeof(VisibleIShapePtr)
+										+ 2 * sizeof(int)) + bvh.numNodes() * (sizeof(BVHNode) + sizeof(int));
+
+	vector<HitRecord> expected(rays.size()), hits(rays.size());
+	vector<double> expectedSha(rays.size()), sha(rays.size());
+	double bvhSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) bvh.findIntersection(rays[i], expected[i]);
+	});
+	double bvhShadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) expectedSha[i] = bvh.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	double setSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) setBVH.findIntersection(rays[i], hits[i]);
+	});
+	double setShadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) sha[i] = setBVH.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	long long mismatches = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		mismatches += (hits[i].t == FLT_MAX) != (expected[i].t == FLT_MAX);
+		mismatches += hits[i].t != FLT_MAX && (std::abs(hits[i].t - expected[i].t) > 1.0e-9 * (1.0 + hits[i].t) ||
+												hits[i].material.diffuse != expected[i].material.diffuse);
+		mismatches += sha[i] != expectedSha[i];
+	}
+	cout << "  BVH of ISpheres: build " << 1000.0 * bvhBuildSecs << " msec, "
+		<< bvhBytes / (1024.0 * 1024.0) << " MB" << endl;
+	report("BVH of ISpheres", bvhSecs, bvhShadowSecs, 0);
+	cout << "  ISphereSet: build " << 1000.0 * setBuildSecs << " msec, "
+		<< sphereSet.memoryBytes() / (1024.0 * 1024.0) << " MB" << endl;
+	report("ISphereSet", setSecs, setShadowSecs, mismatches);
+	return mismatches;
+}
+
+long long terrainBenchmark(int samples, const vector<Ray>& rays) {
+	vector<float> elevations;
+	for (int z = 0; z < samples; z++) {
+		for (int x = 0; x < samples; x++) {
+			elevations.push_back((float)(0.5 + 0.3 * std::sin(x / 40.0) * std::cos(z / 30.0) + 0.1 * std::sin((x + z) / 9.0)));
+		}
+	}
+	IHeightField* field = nullptr;
+	double fieldBuildSecs = secondsFor([&]() {
+		field = new IHeightField(samples, samples, elevations, dvec3(-15.0, -15.0, -15.0), dvec3(30.0, 10.0, 30.0));
+	});
+	vector<dvec3> verts;
+	vector<unsigned int> tris;
+	for (int z = 0; z < samples; z++) {
+		for (int x = 0; x < samples; x++) {
+			verts.push_back(field->samplePoint(x, z));
+		}
+	}
+	for (int z = 0; z + 1 < samples; z++) {
+		for (int x = 0; x + 1 < samples; x++) {
+			unsigned int a = z * samples + x, b = a + 1, c = a + samples, d = c + 1;
+			tris.insert(tris.end(), { a, d, b, a, c, d });
+		}
+	}
+	ITriangleMesh* mesh = nullptr;
+	double meshBuildSecs = secondsFor([&]() { mesh = new ITriangleMesh(verts, tris); });
+	cout << "Terrain: " << samples << "x" << samples << " samples" << endl;
+
+	// The mesh's buffers and its hierarchy
+	size_t meshBytes = mesh->vertices.size() * sizeof(dvec3) + mesh->indices.size() * sizeof(unsigned int)
+						+ mesh->numNodes() * sizeof(BVHNode);
+
+	vector<HitRecord> expected(rays.size()), hits(rays.size());
+	vector<bool> expectedSha(rays.size()), sha(rays.size());
+	double meshSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) mesh->findClosestIntersection(rays[i], expected[i]);
+	});
+	double meshShadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) expectedSha[i] = mesh->hasIntersection(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	double fieldSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) field->findClosestIntersection(rays[i], hits[i]);
+	});
+	double fieldShadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) sha[i] = field->hasIntersection(rays[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	long long mismatches = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		mismatches += hits[i].t != expected[i].t;
+		mismatches += sha[i] != expectedSha[i];
+	}
+	cout << "  ITriangleMesh: build " << 1000.0 * meshBuildSecs << " msec, "
+		<< meshBytes / (1024.0 * 1024.0) << " MB" << endl;
+	report("ITriangleMesh", meshSecs, meshShadowSecs, 0);
+	cout << "  IHeightField: build " << 1000.0 * fieldBuildSecs << " msec, "
+		<< field->memoryBytes() / (1024.0 * 1024.0) << " MB" << endl;
+	report("IHeightField", fieldSecs, fieldShadowSecs, mismatches);
+	delete mesh;
+	delete field;
+	return mismatches;
+}
+
+long long quadricBenchmark(const std::string& name, const IQuadricSurface& quadric, const vector<Ray>& rays) {
+	// Aim the rays near the shape, so that most of them hit it
+	vector<Ray> aimed;
+	for (size_t i = 0; i < rays.size(); i++) {
+		aimed.push_back(Ray(rays[i].origin, quadric.center + 3.0 * rays[i].dir - rays[i].origin));
+	}
+	vector<HitRecord> expected(aimed.size()), hits(aimed.size());
+	vector<bool> expectedSha(aimed.size()), sha(aimed.size());
+	vector<double> expectedT(aimed.size()), t(aimed.size());
+	double generalSecs = secondsFor([&]() {
+		for (size_t i = 0; i < aimed.size(); i++) quadric.IQuadricSurface::findClosestIntersection(aimed[i], expected[i]);
+	});
+	double generalShadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < aimed.size(); i++) expectedSha[i] = quadric.IQuadricSurface::hasIntersection(aimed[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	double generalPacketSecs = secondsFor([&]() {
+		for (size_t i = 0; i + PACKET_SIZE <= aimed.size(); i += PACKET_SIZE) {
+			quadric.IQuadricSurface::findClosestIntersections(RayPacket(&aimed[i]), &expectedT[i]);
+		}
+	});
+	double closedSecs = secondsFor([&]() {
+		for (size_t i = 0; i < aimed.size(); i++) quadric.findClosestIntersection(aimed[i], hits[i]);
+	});
+	double closedShadowSecs = secondsFor([&]() {
+		for (size_t i = 0; i < aimed.size(); i++) sha[i] = quadric.hasIntersection(aimed[i], 0.0, SHADOW_RAY_LENGTH);
+	});
+	double closedPacketSecs = secondsFor([&]() {
+		for (size_t i = 0; i + PACKET_SIZE <= aimed.size(); i += PACKET_SIZE) {
+			quadric.findClosestIntersections(RayPacket(&aimed[i]), &t[i]);
+		}
+	});
+	long long mismatches = 0, numHits = 0;
+	for (size_t i = 0; i < aimed.size(); i++) {
+		const HitRecord& hit = hits[i];
+		if ((hit.t == FLT_MAX) != (expected[i].t == FLT_MAX)) {
+			mismatches++;
+		} else if (hit.t != FLT_MAX && (std::abs(hit.t - expected[i].t) > 1.0E-9 * (1.0 + hit.t) ||
+					glm::distance(hit.normal, expected[i].normal) > 1.0E-6)) {
+			mismatches++;
+		}
+		mismatches += sha[i] != expectedSha[i] && std::abs(expected[i].t - SHADOW_RAY_LENGTH) > 1.0E-9;
+		mismatches += t[i] != hit.t;
+		numHits += hit.t != FLT_MAX;
+	}
+	cout << "  " << name << ": " << 100.0 * numHits / aimed.size() << "% of rays hit" << endl;
+	report("  general quadric", generalSecs, generalShadowSecs, 0);
+	report("  closed form", closedSecs, closedShadowSecs, mismatches);
+	cout << "    packets: general quadric " << aimed.size() / generalPacketSecs / 1.0e6 << " Mrays/sec, closed form "
+		<< aimed.size() / closedPacketSecs / 1.0e6 << " Mrays/sec" << endl;
+	return mismatches;
+}
+
+long long deferredBenchmark(int count, const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildRandomShapes(count);
+	cout << "Deferred hit attributes: " << shapes.size() << " shapes" << endl;
+	vector<HitRecord> eagerHits(rays.size()), deferredHits(rays.size());
+	double eagerSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) {
+			HitRecord &theHit = eagerHits[i];
+			for (size_t s = 0; s < shapes.size(); s++) {
+				HitRecord thisHit;
+				shapes[s]->findClosestIntersection(rays[i], thisHit);
+				if (thisHit.t < theHit.t) {
+					theHit = thisHit;
+				}
+			}
+		}
+	});
+	double deferredSecs = secondsFor([&]() {
+		for (size_t i = 0; i < rays.size(); i++) {
+			VisibleIShape::findIntersection(rays[i], shapes, deferredHits[i]);
+		}
+	});
+	long long mismatches = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		mismatches += !sameHit(eagerHits[i], deferredHits[i]);
+	}
+	cout << "  every candidate's attributes: " << NUM_RAYS / eagerSecs / 1.0e6 << " Mrays/sec" << endl;
+	cout << "  closest hit's attributes only: " << NUM_RAYS / deferredSecs / 1.0e6 << " Mrays/sec, mismatches "
+		<< mismatches << endl;
+	return mismatches;
+}
+
+long long panesBenchmark(int count, const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildRandomShapes(count);
+	for (int i = 0; i < NUM_PANES; i++) {
+		VisibleIShapePtr pane = new VisibleIShape(new IDisk(dvec3(0.0, 0.0, 20.0 + 2.0 * i), -Z_AXIS, 10.0), cyanPlastic);
+		pane->material.alpha = 0.5;
+		shapes.push_back(pane);
+	}
+	shapes.push_back(new VisibleIShape(new IDisk(dvec3(0.0, 0.0, 20.0 + 2.0 * NUM_PANES), -Z_AXIS, 10.0), tin));
+	BVH bvh;
+	bvh.build(shapes);
+	vector<Ray> aimed;
+	for (size_t i = 0; i < rays.size(); i++) {
+		aimed.push_back(Ray(dvec3(rays[i].origin.x / 3.0, rays[i].origin.y / 3.0, 18.0), Z_AXIS + 0.1 * rays[i].dir));
+	}
+	cout << "Glass panes: " << NUM_PANES << " panes in front of " << shapes.size() - NUM_PANES << " other shapes" << endl;
+
+	vector<int> spawnedLayers(aimed.size()), listedLayers(aimed.size());
+	double spawnSecs = secondsFor([&]() {
+		for (size_t i = 0; i < aimed.size(); i++) {
+			Ray ray = aimed[i];
+			HitRecord hit;
+			bvh.findIntersection(ray, hit);
+			while (hit.t != FLT_MAX) {
+				spawnedLayers[i]++;
+				if (hit.material.alpha >= 1.0) {
+					break;
+				}
+				ray = Ray(IShape::movePointOffSurface(hit.interceptPt, -hit.normal), ray.dir);
+				bvh.findIntersection(ray, hit);
+			}
+		}
+	});
+	double listSecs = secondsFor([&]() {
+		for (size_t i = 0; i < aimed.size(); i++) {
+			RayHits hits;
+			bvh.findHits(aimed[i], hits);
+			for (int j = 0; j < hits.count; j++) {
+				HitRecord hit;
+				hits.getHit(aimed[i], j, hit);
+			}
+			listedLayers[i] = hits.count;
+		}
+	});
+	long long mismatches = 0;
+	for (size_t i = 0; i < aimed.size(); i++) {
+		mismatches += spawnedLayers[i] != listedLayers[i];
+	}
+	cout << "  new ray per layer: " << aimed.size() / spawnSecs / 1.0e6 << " Mrays/sec" << endl;
+	cout << "  multi-hit query: " << aimed.size() / listSecs / 1.0e6 << " Mrays/sec, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+vector<HitRecord> buildPrimaryHits(const BVH& bvh) {
+	// A camera in front of the scene, one ray per pixel, in rows
+	vector<HitRecord> hits(SHADOW_IMAGE_SIZE * SHADOW_IMAGE_SIZE);
+	for (int y = 0; y < SHADOW_IMAGE_SIZE; y++) {
+		for (int x = 0; x < SHADOW_IMAGE_SIZE; x++) {
+			double u = 2.0 * x / SHADOW_IMAGE_SIZE - 1.0, v = 2.0 * y / SHADOW_IMAGE_SIZE - 1.0;
+			bvh.findIntersection(Ray(dvec3(0.0, 0.0, 45.0), dvec3(0.6 * u, 0.6 * v, -1.0)), hits[y * SHADOW_IMAGE_SIZE + x]);
+		}
+	}
+	return hits;
+}
+
+long long shadowPacketBenchmark(int count) {
+	vector<VisibleIShapePtr> shapes = buildRandomShapes(count);
+	BVH bvh;
+	bvh.build(shapes);
+
+	vector<HitRecord> hits = buildPrimaryHits(bvh);
+	vector<Ray> shadowRays;
+	vector<double> lightDistance;
+	for (size_t i = 0; i < hits.size(); i++) {
+		if (hits[i].t == FLT_MAX) {
+			shadowRays.push_back(Ray(ORIGIN3D, Y_AXIS));
+			lightDistance.push_back(-1.0);
+		} else {
+			dvec3 Po = IShape::movePointOffSurface(hits[i].interceptPt, hits[i].normal);
+			shadowRays.push_back(Ray(Po, SHADOW_LIGHT_POS - Po));
+			lightDistance.push_back(glm::distance(SHADOW_LIGHT_POS, Po));
+		}
+	}
+	cout << "Shadow packets: " << shapes.size() << " shapes, " << shadowRays.size() << " pixels" << endl;
+
+	vector<double> single(shadowRays.size()), packet(shadowRays.size());
+	double singleSecs = secondsFor([&]() {
+		for (size_t i = 0; i < shadowRays.size(); i++) {
+			if (lightDistance[i] >= 0.0) {
+				single[i] = bvh.findOcclusion(shadowRays[i], SHADOW_RAY_TMIN, lightDistance[i]);
+			}
+		}
+	});
+	double packetSecs = secondsFor([&]() {
+		for (size_t i = 0; i + PACKET_SIZE <= shadowRays.size(); i += PACKET_SIZE) {
+			bvh.findOcclusions(&shadowRays[i], SHADOW_RAY_TMIN, &lightDistance[i], &packet[i]);
+		}
+	});
+	long long mismatches = 0, occluded = 0;
+	for (size_t i = 0; i < shadowRays.size(); i++) {
+		if (lightDistance[i] >= 0.0) {
+			mismatches += single[i] != packet[i];
+			occluded += single[i] > 0.0;
+		}
+	}
+	cout << "  one ray at a time: " << shadowRays.size() / singleSecs / 1.0e6 << " Mrays/sec" << endl;
+	cout << "  packets: " << shadowRays.size() / packetSecs / 1.0e6 << " Mrays/sec, "
+		<< occluded << " in shadow, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+long long occluderCacheBenchmark(int count) {
+	IScene scene(nullptr);
+	vector<VisibleIShapePtr> shapes = buildRandomShapes(count);
+	for (size_t i = 0; i < shapes.size(); i++) {
+		scene.addOpaqueObject(shapes[i]);
+	}
+	scene.buildAccelerator();
+	vector<HitRecord> hits = buildPrimaryHits(scene.bvh);
+	cout << "Occluder cache: " << shapes.size() << " shapes, " << hits.size() << " pixels" << endl;
+
+	vector<double> uncached(hits.size()), cached(hits.size());
+	auto traceAll = [&](vector<double>& sha) {
+		for (size_t i = 0; i < hits.size(); i++) {
+			if (hits[i].t != FLT_MAX) {
+				dvec3 Po = IShape::movePointOffSurface(hits[i].interceptPt, hits[i].normal);
+				sha[i] = scene.inShadow(SHADOW_LIGHT_POS, Po, hits[i].normal, 0);
+			}
+		}
+	};
+	scene.useOccluderCache = false;
+	double uncachedSecs = secondsFor([&]() { traceAll(uncached); });
+	scene.useOccluderCache = true;
+	IScene::takeOccluderCacheStats();
+	double cachedSecs = secondsFor([&]() { traceAll(cached); });
+	OccluderCacheStats stats = IScene::takeOccluderCacheStats();
+	long long mismatches = 0;
+	for (size_t i = 0; i < hits.size(); i++) {
+		mismatches += uncached[i] != cached[i];
+	}
+	cout << "  no cache: " << hits.size() / uncachedSecs / 1.0e6 << " Mrays/sec" << endl;
+	cout << "  cache: " << hits.size() / cachedSecs / 1.0e6 << " Mrays/sec, hit rate "
+		<< 100.0 * stats.hitRate() << "% of " << stats.lookups << ", mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+long long visibilityBenchmark(int count) {
+	vector<VisibleIShapePtr> shapes = buildRandomShapes(count);
+	BVH bvh;
+	bvh.build(shapes);
+	vector<HitRecord> hits = buildPrimaryHits(bvh);
+	vector<double> allVisible(hits.size()), masked(hits.size());
+	auto traceAll = [&](vector<double>& sha) {
+		for (size_t i = 0; i < hits.size(); i++) {
+			if (hits[i].t != FLT_MAX) {
+				dvec3 Po = IShape::movePointOffSurface(hits[i].interceptPt, hits[i].normal);
+				sha[i] = bvh.findOcclusion(Ray(Po, SHADOW_LIGHT_POS - Po), SHADOW_RAY_TMIN,
+											glm::distance(SHADOW_LIGHT_POS, Po));
+			}
+		}
+	};
+	double allSecs = secondsFor([&]() { traceAll(allVisible); });
+
+	// The shapes on one side of the scene no longer cast shadows
+	int hidden = 0;
+	for (size_t i = 0; i < shapes.size(); i++) {
+		BoundingBox box;
+		if (shapes[i]->shape->getBoundingBox(box) && box.lo.x + box.hi.x < 0.0) {
+			shapes[i]->visibility = ALL_RAYS & ~SHADOW_RAYS;
+			hidden++;
+		}
+	}
+	long long mismatches = bvh.refit(shapes) ? 0 : 1;
+	cout << "Visibility masks: " << shapes.size() << " shapes, " << hidden << " hidden from shadow rays, "
+		<< hits.size() << " pixels" << endl;
+	double maskedSecs = secondsFor([&]() { traceAll(masked); });
+	long long lit = 0;
+	for (size_t i = 0; i < hits.size(); i++) {
+		if (hits[i].t != FLT_MAX) {
+			dvec3 Po = IShape::movePointOffSurface(hits[i].interceptPt, hits[i].normal);
+			mismatches += masked[i] != inShadow(SHADOW_LIGHT_POS, Po, hits[i].normal, shapes, vector<VisibleIShapePtr>());
+			lit += allVisible[i] > 0.0 && masked[i] == 0.0;
+		}
+	}
+	cout << "  every shape casts shadows: " << hits.size() / allSecs / 1.0e6 << " Mrays/sec" << endl;
+	cout << "  half hidden from shadow rays: " << hits.size() / maskedSecs / 1.0e6 << " Mrays/sec, "
+		<< lit << " pixels no longer shadowed, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+long long lightLinkingBenchmark(int count) {
+	IScene scene(nullptr);
+	vector<VisibleIShapePtr> shapes = buildRandomShapes(count);
+	for (size_t i = 0; i < shapes.size(); i++) {
+		scene.addOpaqueObject(shapes[i]);
+	}
+	scene.buildAccelerator();
+	for (int light = 0; light < NUM_LINKED_LIGHTS; light++) {
+		scene.addLight(new PositionalLight(dvec3(10.0 * light - 35.0, 40.0, 20.0), pureWhiteLight));
+	}
+	vector<HitRecord> hits = buildPrimaryHits(scene.bvh);
+	cout << "Light linking: " << shapes.size() << " shapes, " << NUM_LINKED_LIGHTS << " lights, "
+		<< hits.size() << " pixels" << endl;
+
+	vector<double> unlinked(hits.size() * NUM_LINKED_LIGHTS), linked(hits.size() * NUM_LINKED_LIGHTS);
+	auto traceAll = [&](vector<double>& sha) {
+		for (size_t i = 0; i + PACKET_SIZE <= hits.size(); i += PACKET_SIZE) {
+			for (int light = 0; light < NUM_LINKED_LIGHTS; light++) {
+				scene.inShadow(scene.Plights[light]->pos, &hits[i], &sha[light * hits.size() + i], light);
+			}
+		}
+	};
+	double unlinkedSecs = secondsFor([&]() { traceAll(unlinked); });
+
+	// Each light shines on, and is blocked by, every NUM_LINKED_LIGHTS'th shape
+	for (size_t i = 0; i < shapes.size(); i++) {
+		scene.Plights[i % NUM_LINKED_LIGHTS]->litObjects.include.insert(shapes[i]);
+		scene.Plights[i % NUM_LINKED_LIGHTS]->shadowCasters.include.insert(shapes[i]);
+	}
+	scene.buildAccelerator();
+	double linkedSecs = secondsFor([&]() { traceAll(linked); });
+	long long mismatches = 0, skipped = 0;
+	scene.useOccluderCache = false;
+	for (int light = 0; light < NUM_LINKED_LIGHTS; light++) {
+		const PositionalLight& Light = *scene.Plights[light];
+		for (size_t i = 0; i < hits.size(); i++) {
+			double expected = 0.0;
+			if (hits[i].t != FLT_MAX && Light.illuminates(hits[i].object)) {
+				dvec3 Po = IShape::movePointOffSurface(hits[i].interceptPt, hits[i].normal);
+				expected = scene.inShadow(Light.pos, Po, hits[i].normal, light);
+			} else {
+				skipped++;
+			}
+			mismatches += linked[light * hits.size() + i] != expected;
+		}
+	}
+	cout << "  every light on every shape: " << hits.size() * NUM_LINKED_LIGHTS / unlinkedSecs / 1.0e6
+		<< " Mrays/sec" << endl;
+	cout << "  each light linked to its shapes: " << hits.size() * NUM_LINKED_LIGHTS / linkedSecs / 1.0e6
+		<< " Mrays/sec, " << skipped << " shadow rays skipped, mismatches " << mismatches << endl;
+	for (int light = 0; light < NUM_LINKED_LIGHTS; light++) {
+		delete scene.Plights[light];
+	}
+	return mismatches;
+}
+
+long long manyLightsBenchmark(int count) {
+	PerspectiveCamera camera(dvec3(0.0, 0.0, 45.0), ORIGIN3D, Y_AXIS, glm::radians(60.0),
+								MANY_LIGHTS_IMAGE_SIZE, MANY_LIGHTS_IMAGE_SIZE);
+	IScene scene(&camera);
+	vector<VisibleIShapePtr> shapes = buildRandomShapes(count);
+	for (size_t i = 0; i < shapes.size(); i++) {
+		scene.addOpaqueObject(shapes[i]);
+	}
+
+	// Every fourth light is a spot light shining down; each fades out within a few units
+	std::mt19937 rng(NUM_MANY_LIGHTS);
+	std::uniform_real_distribution<double> pos(-15.0, 15.0), spread(-0.5, 0.5);
+	const LightATParams params(1.0, 0.5, 0.25, 0.05);
+	for (int i = 0; i < NUM_MANY_LIGHTS; i++) {
+		dvec3 lightPos(pos(rng), pos(rng), pos(rng));
+		PositionalLight* light;
+		if (i % 4 == 0) {
+			SpotLight* spot = new SpotLight(lightPos, glm::normalize(dvec3(spread(rng), -1.0, spread(rng))),
+											glm::radians(30.0), pureWhiteLight);
+			scene.addLight(spot);
+			light = spot;
+		} else {
+			light = new PositionalLight(lightPos, pureWhiteLight);
+			scene.addLight(light);
+		}
+		light->setAttenuation(true);
+		light->setAttenuationParams(params);
+	}
+	cout << "Many lights: " << shapes.size() << " shapes, " << NUM_MANY_LIGHTS << " lights reaching "
+		<< params.range() << " units, " << MANY_LIGHTS_IMAGE_SIZE * MANY_LIGHTS_IMAGE_SIZE << " pixels" << endl;
+
+	// The renderer's progress reports are dropped
+	FrameBuffer allLights(MANY_LIGHTS_IMAGE_SIZE, MANY_LIGHTS_IMAGE_SIZE), culled(MANY_LIGHTS_IMAGE_SIZE, MANY_LIGHTS_IMAGE_SIZE);
+	RayTracer rayTracer(black, 1);
+	std::ostringstream progress;
+	std::streambuf* coutBuffer = cout.rdbuf(progress.rdbuf());
+	rayTracer.cullLights = false;
+	double allSecs = secondsFor([&]() { rayTracer.raytraceScene(allLights, 0, scene); });
+	rayTracer.cullLights = true;
+	double culledSecs = secondsFor([&]() { rayTracer.raytraceScene(culled, 0, scene); });
+	cout.rdbuf(coutBuffer);
+
+	long long mismatches = 0;
+	for (int y = 0; y < MANY_LIGHTS_IMAGE_SIZE; y++) {
+		for (int x = 0; x < MANY_LIGHTS_IMAGE_SIZE; x++) {
+			mismatches += allLights.getColor(x, y) != culled.getColor(x, y);
+		}
+	}
+	cout << "  every light: " << allSecs << " secs" << endl;
+	cout << "  lights culled per tile: " << culledSecs << " secs, mismatches " << mismatches << endl;
+	for (size_t i = 0; i < scene.Plights.size(); i++) {
+		delete scene.Plights[i];
+	}
+	for (size_t i = 0; i < scene.Slights.size(); i++) {
+		delete scene.Slights[i];
+	}
+	return mismatches;
+}
+
+long long animationBenchmark(int count, const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildRandomShapes(count);
+	BVH refitted, rebuilt;
+	refitted.build(shapes);
+	cout << "Animated scene: " << NUM_MOVING << " of " << shapes.size() << " shapes moving, "
+		<< NUM_FRAMES << " frames" << endl;
+
+	// buildRandomShapes makes every fourth shape a sphere, after the plane
+	vector<VisibleIShapePtr> moving;
+	for (int i = 0; i < NUM_MOVING; i++) {
+		moving.push_back(shapes[1 + 4 * i]);
+	}
+	std::mt19937 rng(count);
+	std::uniform_real_distribution<double> step(-MOVE_STEP, MOVE_STEP);
+	double refitSecs = 0.0, rebuildSecs = 0.0;
+	int rebuilds = 0;
+	for (int frame = 0; frame < NUM_FRAMES; frame++) {
+		for (size_t i = 0; i < moving.size(); i++) {
+			dynamic_cast<ISphere*>(moving[i]->shape)->center += dvec3(step(rng), step(rng), step(rng));
+		}
+		refitSecs += secondsFor([&]() {
+			if (!refitted.refit(moving) || refitted.needsRebuild()) {
+				refitted.build(shapes);
+				rebuilds++;
+			}
+		});
+		rebuildSecs += secondsFor([&]() { rebuilt.build(shapes); });
+	}
+	cout << "  rebuild every frame: " << 1.0e6 * rebuildSecs / NUM_FRAMES << " usec/frame" << endl;
+	cout << "  refit: " << 1.0e6 * refitSecs / NUM_FRAMES << " usec/frame, " << rebuilds << " rebuilds" << endl;
+
+	long long mismatches = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		HitRecord a, b;
+		refitted.findIntersection(rays[i], a);
+		rebuilt.findIntersection(rays[i], b);
+		mismatches += !sameHit(a, b);
+	}
+	cout << "  mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+int main(int argc, char* argv[]) {
+	vector<Ray> rays = buildRays();
+	long long mismatches = benchmark("Composite scene", buildCompositeShapes(), rays);
+	for (int count = 16; count <= 1024; count *= 4) {
+		mismatches += benchmark("Random scene", buildRandomShapes(count), rays);
+	}
+	mismatches += denseBenchmark(NUM_DENSE_SPHERES, rays);
+	mismatches += particleBenchmark(NUM_PARTICLES, rays);
+	mismatches += terrainBenchmark(TERRAIN_SAMPLES, rays);
+	cout << "Quadrics" << endl;
+	mismatches += quadricBenchmark("ISphere", ISphere(ORIGIN3D, 2.0), rays);
+	mismatches += quadricBenchmark("ICylinderY", ICylinderY(ORIGIN3D, 2.0, 3.0), rays);
+	mismatches += quadricBenchmark("ICylinderZ", ICylinderZ(ORIGIN3D, 2.0, 3.0), rays);
+	mismatches += quadricBenchmark("IConeY", IConeY(dvec3(0.0, -3.0, 0.0), 2.0, 6.0), rays);
+	mismatches += quadricBenchmark("IEllipsoid", IEllipsoid(ORIGIN3D, dvec3(3.0, 1.0, 2.0)), rays);
+	mismatches += deferredBenchmark(256, rays);
+	mismatches += panesBenchmark(256, rays);
+	mismatches += shadowPacketBenchmark(4096);
+	mismatches += occluderCacheBenchmark(4096);
+	mismatches += visibilityBenchmark(4096);
+	mismatches += lightLinkingBenchmark(4096);
+	mismatches += manyLightsBenchmark(1024);
+	mismatches += animationBenchmark(1024, rays);
+	cout << (mismatches == 0 ? "PASSED" : "FAILED") << endl;
+	return mismatches == 0 ? 0 : 1;
+}
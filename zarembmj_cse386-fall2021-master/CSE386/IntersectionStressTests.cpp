@@ -0,0 +1,1090 @@
+#include <thread>
+#include <atomic>
+#include <random>
+#include <typeinfo>
+#include "ishape.h"
+#include "bvh.h"
+#include "grid.h"
+#include "compactscene.h"
+#include "iscene.h"
+#include "lightculler.h"
+#include "trianglemesh.h"
+#include "instance.h"
+#include "sphereset.h"
+#include "heightfield.h"
+#include "utilities.h"
+#include "eshape.h"
+#include "io.h"
+
+// Fires rays from many threads at the shapes used in ExerciseRaytrace.cpp and
+// exercisecomposite3dshapes.cpp and checks that every thread gets exactly the
+// same hits as a single-threaded pass. Build with -fsanitize=thread to also
+// have ThreadSanitizer watch the intersection code. The same rays are also used
+// to check that the BVH finds exactly the hits a linear search over the shapes does,
+// and that its any-hit shadow query agrees with the closest hit. Finally, the rays
+// are traced PACKET_SIZE at a time, through every shape's packet intersection
+// routine and through the BVH, and each ray must get exactly its scalar result.
+
+const int NUM_THREADS = 8;
+const int NUM_RAYS = 20000;
+const int NUM_PASSES = 10;
+const double SHADOW_RAY_LENGTH = 10.0;
+const dvec3 SPHERE_MESH_CENTER(-8.0, 4.0, 8.0);
+const double SPHERE_MESH_RADIUS = 3.0;
+const int NUM_CLUMP_SPHERES = 2000;
+const int NUM_SET_SPHERES = 3001;
+const int TERRAIN_WIDTH = 97;
+const int TERRAIN_DEPTH = 61;
+const int NUM_CULLED_LIGHTS = 300;
+const int NUM_CULLED_TILES = 400;
+const Accelerator ACCELERATORS[3] = { Accelerator::BVH, Accelerator::GRID, Accelerator::COMPACT_LIST };
+
+ITriangleMesh* buildSphereMesh(const dvec3& center, double radius, int slices, int stacks) {
+	vector<dvec3> verts, normals;
+	vector<unsigned int> tris;
+	for (int i = 0; i <= stacks; i++) {
+		double phi = PI * i / stacks;
+		for (int j = 0; j < slices; j++) {
+			double theta = 2.0 * PI * j / slices;
+			dvec3 n(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+			verts.push_back(center + radius * n);
+			normals.push_back(n);
+		}
+	}
+	for (int i = 0; i < stacks; i++) {
+		for (int j = 0; j < slices; j++) {
+			unsigned int a = i * slices + j, b = i * slices + (j + 1) % slices;
+			unsigned int c = a + slices, d = b + slices;
+			tris.insert(tris.end(), { a, b, c, b, d, c });
+		}
+	}
+	return new ITriangleMesh(verts, tris, normals);
+}
+
+ITriangleMesh* buildCheckerBoardMesh(double y) {
+	EShapeData soup = EShape::createECheckerBoard(gold, copper, 10.0, 10.0, 8);
+	for (size_t i = 0; i < soup.size(); i++) {
+		soup[i].pos.y += y;
+	}
+	return new ITriangleMesh(soup);
+}
+
+vector<VisibleIShapePtr> buildShapes() {
+	vector<VisibleIShapePtr> shapes;
+
+	// ExerciseRaytrace.cpp
+	shapes.push_back(new VisibleIShape(new IPlane(dvec3(0.0, -2.0, 0.0), dvec3(0.0, 1.0, 0.0)), tin));
+	shapes.push_back(new VisibleIShape(new ISphere(dvec3(0.0, 0.0, 0.0), 2.0), silver));
+	shapes.push_back(new VisibleIShape(new ISphere(dvec3(-2.0, 0.0, -8.0), 2.0), bronze));
+	shapes.push_back(new VisibleIShape(new IEllipsoid(dvec3(4.0, 0.0, 3.0), dvec3(2.0, 1.0, 2.0)), redPlastic));
+	shapes.push_back(new VisibleIShape(new IDisk(dvec3(15.0, 0.0, 0.0), dvec3(0.0, 0.0, 1.0), 5.0), cyanPlastic));
+	shapes.push_back(new VisibleIShape(new IDisk(dvec3(-5.0, 0.0, 0.0), dvec3(1.0, 0.0, 1.0), 2.0), gold));
+
+	// exercisecomposite3dshapes.cpp
+	IClosedCylinderY* closedCylinder = new IClosedCylinderY(dvec3(4.0, 1.0, -8.0), 3.0, 5.0);
+	shapes.push_back(new VisibleIShape(new IPlane(dvec3(0, -4, 0), Y_AXIS), tin));
+	shapes.push_back(new VisibleIShape(new ICylinderY(dvec3(0.0, 0.0, 6.5), 2, 4.0), gold));
+	shapes.push_back(new VisibleIShape(new ICylinderZ(dvec3(8.0, -2.0, 0.5), 1.5, 5.0), polishedBronze));
+	shapes.push_back(new VisibleIShape(new ISphere(dvec3(0.0, 0.0, 0.0), 4.0), copper));
+	shapes.push_back(new VisibleIShape(new IConeY(dvec3(13.0, -4.0, -4.0), 3, 8), polishedSilver));
+	shapes.push_back(new VisibleIShape(closedCylinder->diskBottom, chrome));
+	shapes.push_back(new VisibleIShape(closedCylinder->diskTop, chrome));
+	shapes.push_back(new VisibleIShape(closedCylinder->cylinder, chrome));
+	shapes.push_back(new VisibleIShape(new IPlane(dvec3(0, 0, 0), X_AXIS), polishedGold));
+
+	// triangle meshes
+	shapes.push_back(new VisibleIShape(buildSphereMesh(SPHERE_MESH_CENTER, SPHERE_MESH_RADIUS, 24, 12), brass));
+	shapes.push_back(new VisibleIShape(buildCheckerBoardMesh(6.0), redPlastic));
+
+	// instances of shared shapes
+	ITriangleMesh* sharedMesh = buildSphereMesh(ORIGIN3D, 1.0, 16, 8);
+	ISphere* sharedSphere = new ISphere(ORIGIN3D, 1.0);
+	shapes.push_back(new VisibleIShape(new IInstance(sharedMesh, T(8, -2, -10) * Ry(0.7) * S(1.5, 0.5, 1.0)), gold));
+	shapes.push_back(new VisibleIShape(new IInstance(sharedMesh, T(-10, 8, 3) * Rx(-0.4)), copper));
+	shapes.push_back(new VisibleIShape(new IInstance(sharedSphere, T(-10, 2, -4) * S(3, 1, 2)), silver));
+	return shapes;
+}
+
+vector<Ray> buildRays() {
+	std::mt19937 rng(386);
+	std::uniform_real_distribution<double> pos(-15.0, 15.0);
+	std::uniform_real_distribution<double> dir(-1.0, 1.0);
+	vector<Ray> rays;
+	for (int i = 0; i < NUM_RAYS; i++) {
+		dvec3 origin(pos(rng), pos(rng), pos(rng));
+		dvec3 d(dir(rng), dir(rng), dir(rng));
+		if (glm::length(d) < 0.01) {
+			d = -Y_AXIS;
+		}
+		rays.push_back(Ray(origin, d));
+	}
+	return rays;
+}
+
+vector<VisibleIShapePtr> buildSeeThroughShapes() {
+	vector<VisibleIShapePtr> shapes = buildShapes();
+	for (size_t s = 0; s < shapes.size(); s++) {
+		shapes[s]->material.alpha = s % 2 == 0 ? 0.5 : 1.0;
+	}
+	return shapes;
+}
+
+vector<HitRecord> findExpectedHits(const vector<Ray>& rays, const vector<VisibleIShapePtr>& shapes) {
+	vector<HitRecord> expected(rays.size());
+	for (size_t i = 0; i < rays.size(); i++) {
+		VisibleIShape::findIntersection(rays[i], shapes, expected[i]);
+	}
+	return expected;
+}
+
+bool sameHit(const HitRecord& a, const HitRecord& b) {
+	return a.t == b.t && a.interceptPt == b.interceptPt && a.normal == b.normal &&
+			a.u == b.u && a.v == b.v && a.texture == b.texture;
+}
+
+// Every thread must get exactly the hits of a single-threaded pass, from the shapes
+// and from the grid, which keeps separate mailboxes for each thread.
+long long checkThreads(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildShapes();
+	vector<HitRecord> expected = findExpectedHits(rays, shapes);
+
+	Grid grid;
+	grid.build(shapes);
+	std::atomic<long long> mismatches(0);
+	std::atomic<long long> raysFired(0);
+	vector<std::thread> threads;
+	for (int id = 0; id < NUM_THREADS; id++) {
+		threads.push_back(std::thread([&, id]() {
+			for (int pass = 0; pass < NUM_PASSES; pass++) {
+				// Each thread walks the rays in a different order so that
+				// threads are working on different shapes at the same time.
+				for (size_t k = 0; k < rays.size(); k++) {
+					size_t i = (k * (2 * id + 1) + pass) % rays.size();
+					HitRecord hit;
+					VisibleIShape::findIntersection(rays[i], shapes, hit);
+					if (!sameHit(hit, expected[i])) {
+						mismatches++;
+					}
+					grid.findIntersection(rays[i], hit);
+					if (!sameHit(hit, expected[i])) {
+						mismatches++;
+					}
+					double occlusion = grid.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+					if (occlusion != (expected[i].t <= SHADOW_RAY_LENGTH ? 1.0 : 0.0)) {
+						mismatches++;
+					}
+				}
+				raysFired += rays.size() * shapes.size();
+			}
+		}));
+	}
+	for (std::thread& t : threads) {
+		t.join();
+	}
+
+	cout << "Threads: " << raysFired << " ray/shape tests, " << grid.numCells() << " grid cells, mismatches "
+		<< mismatches << endl;
+	return mismatches;
+}
+
+// The BVH must find exactly the hits a linear search does, and its any-hit shadow
+// query must agree with the closest hit.
+long long checkBvh(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildShapes();
+	vector<HitRecord> expected = findExpectedHits(rays, shapes);
+	long long mismatches = 0;
+
+	BVH bvh;
+	bvh.build(shapes);
+	for (size_t i = 0; i < rays.size(); i++) {
+		HitRecord hit;
+		bvh.findIntersection(rays[i], hit);
+		if (!sameHit(hit, expected[i])) {
+			mismatches++;
+		}
+
+		// Every shape is opaque, so the segment is fully occluded iff the closest
+		// hit lies on it.
+		double occlusion = bvh.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+		if (occlusion != (expected[i].t <= SHADOW_RAY_LENGTH ? 1.0 : 0.0)) {
+			mismatches++;
+		}
+	}
+
+	cout << "BVH: " << bvh.numNodes() << " nodes, " << bvh.numUnboundedObjects() << " unbounded objects, mismatches "
+		<< mismatches << endl;
+	return mismatches;
+}
+
+// Rays traced PACKET_SIZE at a time, through every shape's packet routine and through
+// the BVH, must each get exactly their scalar result.
+long long checkPackets(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildShapes();
+	vector<HitRecord> expected = findExpectedHits(rays, shapes);
+	BVH bvh;
+	bvh.build(shapes);
+	long long mismatches = 0;
+
+	for (size_t i = 0; i + PACKET_SIZE <= rays.size(); i += PACKET_SIZE) {
+		RayPacket packet(&rays[i]);
+		for (size_t s = 0; s < shapes.size(); s++) {
+			double t[PACKET_SIZE];
+			shapes[s]->shape->findClosestIntersections(packet, t);
+			for (int k = 0; k < PACKET_SIZE; k++) {
+				HitRecord hit;
+				shapes[s]->shape->findClosestIntersection(rays[i + k], hit);
+				if (t[k] != hit.t) {
+					mismatches++;
+				}
+			}
+		}
+
+		HitRecord hits[PACKET_SIZE];
+		bvh.findIntersections(&rays[i], hits);
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			if (!sameHit(hits[k], expected[i + k])) {
+				mismatches++;
+			}
+		}
+	}
+
+	cout << "Packets: mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// Rays from inside a closed mesh at its vertices and edges must all hit, and list
+// each hit once, and the barycentric u,v of a hit must give back the intercept.
+long long checkTriangleMeshes(const vector<Ray>& rays) {
+	long long mismatches = 0;
+	ITriangleMesh* closed = buildSphereMesh(SPHERE_MESH_CENTER, SPHERE_MESH_RADIUS, 24, 12);
+	vector<dvec3> targets;
+	for (int i = 0; i < closed->numTriangles(); i++) {
+		for (int j = 0; j < 3; j++) {
+			dvec3 p = closed->vertices[closed->indices[3 * i + j]];
+			dvec3 q = closed->vertices[closed->indices[3 * i + (j + 1) % 3]];
+			targets.push_back(p);
+			targets.push_back((p + q) / 2.0);
+		}
+	}
+	for (size_t i = 0; i < rays.size(); i++) {
+		targets.push_back(SPHERE_MESH_CENTER + rays[i].dir);
+	}
+	for (size_t i = 0; i < targets.size(); i++) {
+		Ray ray(SPHERE_MESH_CENTER, targets[i] - SPHERE_MESH_CENTER);
+		HitRecord hit;
+		closed->findClosestIntersection(ray, hit);
+		if (hit.t == FLT_MAX || !closed->hasIntersection(ray, 0.0, 2.0 * SPHERE_MESH_RADIUS)) {
+			mismatches++;
+		}
+	}
+	for (size_t i = 0; i < rays.size(); i++) {
+		HitRecord hit;
+		closed->findClosestIntersection(rays[i], hit);
+		if (hit.t == FLT_MAX) {
+			continue;
+		}
+		// Find the triangle that was hit: the one whose barycentric point is the intercept.
+		bool found = false;
+		for (int k = 0; k < closed->numTriangles() && !found; k++) {
+			dvec3 p = (1.0 - hit.u - hit.v) * closed->vertices[closed->indices[3 * k]] +
+						hit.u * closed->vertices[closed->indices[3 * k + 1]] +
+						hit.v * closed->vertices[closed->indices[3 * k + 2]];
+			found = glm::distance(p, hit.interceptPt) < 1.0E-9;
+		}
+		if (!found) {
+			mismatches++;
+		}
+	}
+
+	// Rays through the mesh's vertices and edges cross several triangles at one point,
+	// which must be listed once.
+	for (size_t i = 0; i < targets.size(); i++) {
+		Ray ray(SPHERE_MESH_CENTER, targets[i] - SPHERE_MESH_CENTER);
+		double t[MAX_RAY_HITS];
+		int primitive[MAX_RAY_HITS];
+		if (closed->findHits(ray, MAX_RAY_HITS, t, primitive) != 1) {
+			mismatches++;
+		}
+	}
+
+	cout << "Triangle meshes: " << closed->numTriangles() << " triangles, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// The deferred attribute stage must rebuild the whole hit from t and the primitive,
+// and the primitive must be the triangle the intercept lies on.
+long long checkDeferredAttributes(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildShapes();
+	ITriangleMesh* closed = buildSphereMesh(SPHERE_MESH_CENTER, SPHERE_MESH_RADIUS, 24, 12);
+	long long mismatches = 0;
+
+	for (size_t i = 0; i < rays.size(); i++) {
+		for (size_t s = 0; s < shapes.size(); s++) {
+			HitRecord hit, deferredHit;
+			shapes[s]->findClosestIntersection(rays[i], hit);
+			int primitive;
+			deferredHit.t = shapes[s]->findClosestHit(rays[i], primitive);
+			if (deferredHit.t != hit.t) {
+				mismatches++;
+			} else if (hit.t != FLT_MAX) {
+				shapes[s]->getHitAttributes(rays[i], deferredHit.t, primitive, deferredHit);
+				if (!sameHit(deferredHit, hit)) {
+					mismatches++;
+				}
+			}
+		}
+		int triangle;
+		double t = closed->findClosestHit(rays[i], triangle);
+		if (t != FLT_MAX) {
+			HitRecord hit;
+			closed->getHitAttributes(rays[i], t, triangle, hit);
+			dvec3 p = (1.0 - hit.u - hit.v) * closed->vertices[closed->indices[3 * triangle]] +
+						hit.u * closed->vertices[closed->indices[3 * triangle + 1]] +
+						hit.v * closed->vertices[closed->indices[3 * triangle + 2]];
+			if (glm::distance(p, hit.interceptPt) > 1.0E-9) {
+				mismatches++;
+			}
+		}
+	}
+
+	cout << "Deferred attributes: mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// With every other shape see-through, the BVH and the grid must list exactly the hits
+// the linear pass does, for long and short lists.
+long long checkMultiHits(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> layered = buildSeeThroughShapes();
+	long long mismatches = 0;
+	BVH layeredBVH;
+	layeredBVH.build(layered);
+	Grid layeredGrid;
+	layeredGrid.build(layered);
+	long long layersFound = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		for (int most = 2; most <= MAX_RAY_HITS; most += MAX_RAY_HITS - 2) {
+			RayHits linear(most), bvhHits(most), gridHits(most);
+			VisibleIShape::findHits(rays[i], layered, linear);
+			layeredBVH.findHits(rays[i], bvhHits);
+			layeredGrid.findHits(rays[i], gridHits);
+			const RayHits *found[2] = { &bvhHits, &gridHits };
+			for (int k = 0; k < 2; k++) {
+				if (found[k]->count != linear.count) {
+					mismatches++;
+					continue;
+				}
+				for (int j = 0; j < linear.count; j++) {
+					if (found[k]->t[j] != linear.t[j] || found[k]->object[j] != linear.object[j] ||
+						found[k]->primitive[j] != linear.primitive[j]) {
+						mismatches++;
+					}
+				}
+			}
+			for (int j = 0; j < linear.count; j++) {
+				if ((j > 0 && linear.t[j] < linear.t[j - 1]) ||
+					(j + 1 < linear.count && linear.object[j]->material.alpha >= 1.0)) {
+					mismatches++;
+				}
+			}
+			HitRecord closestHit;
+			VisibleIShape::findIntersection(rays[i], layered, closestHit);
+			if ((linear.count == 0) != (closestHit.t == FLT_MAX) || (linear.count > 0 && linear.t[0] != closestHit.t)) {
+				mismatches++;
+			}
+			layersFound += linear.count;
+		}
+	}
+
+	vector<VisibleIShapePtr> shapes = buildShapes();
+	ITriangleMesh* closed = buildSphereMesh(SPHERE_MESH_CENTER, SPHERE_MESH_RADIUS, 24, 12);
+
+	// Shapes that list their hits directly must agree with IShape's default, which
+	// asks for the closest hit again from just past each one.
+	vector<const IShape*> listers = { closed };
+	for (size_t s = 0; s < shapes.size(); s++) {
+		listers.push_back(shapes[s]->shape);
+	}
+	for (size_t i = 0; i < rays.size(); i++) {
+		Ray throughMesh(rays[i].origin, SPHERE_MESH_CENTER + rays[i].dir - rays[i].origin);
+		for (size_t s = 0; s < listers.size(); s++) {
+			const Ray& ray = s == 0 ? throughMesh : rays[i];
+			double t[MAX_RAY_HITS], expectedT[MAX_RAY_HITS];
+			int primitive[MAX_RAY_HITS], expectedPrimitive[MAX_RAY_HITS];
+			int count = listers[s]->findHits(ray, MAX_RAY_HITS, t, primitive);
+			int expectedCount = listers[s]->IShape::findHits(ray, MAX_RAY_HITS, expectedT, expectedPrimitive);
+			if (count != expectedCount) {
+				mismatches++;
+				continue;
+			}
+			for (int j = 0; j < count; j++) {
+				if (std::abs(t[j] - expectedT[j]) > 1.0E-9 * (1.0 + t[j])) {
+					mismatches++;
+				}
+			}
+		}
+	}
+
+	cout << "Multi-hit lists: " << layersFound << " layers found, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// PACKET_SIZE shadow rays head for one light, some from scattered points and some
+// from right on a surface, with now and then a lane left out. Each must be exactly
+// as occluded as it is when traced on its own.
+long long checkShadowPackets(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> layered = buildSeeThroughShapes();
+	BVH layeredBVH;
+	layeredBVH.build(layered);
+	long long mismatches = 0;
+	long long shadowRaysOccluded = 0;
+	for (size_t i = 0; i + PACKET_SIZE < rays.size(); i += PACKET_SIZE) {
+		dvec3 lightPos = rays[i + PACKET_SIZE].origin;
+		vector<Ray> shadowRays;
+		double tMax[PACKET_SIZE], occlusion[PACKET_SIZE];
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			HitRecord hit;
+			layeredBVH.findIntersection(rays[i + k], hit);
+			dvec3 from = k % 2 == 1 && hit.t != FLT_MAX ? hit.interceptPt : rays[i + k].origin;
+			shadowRays.push_back(Ray(from, lightPos - from));
+			tMax[k] = (i / PACKET_SIZE + k) % 7 == 0 ? -1.0 : glm::distance(lightPos, from);
+		}
+		layeredBVH.findOcclusions(shadowRays.data(), SHADOW_RAY_TMIN, tMax, occlusion);
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			double expected = tMax[k] < 0.0 ? 0.0 : layeredBVH.findOcclusion(shadowRays[k], SHADOW_RAY_TMIN, tMax[k]);
+			if (occlusion[k] != expected) {
+				mismatches++;
+			}
+			shadowRaysOccluded += occlusion[k] > 0.0;
+		}
+	}
+
+	cout << "Shadow packets: " << shadowRaysOccluded << " rays occluded, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// Neighboring points are shadowed from two lights, with each accelerator, one point
+// and one packet at a time, and must get the same shadows with the occluder cache
+// as without it.
+long long checkOccluderCache(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> layered = buildSeeThroughShapes();
+	long long mismatches = 0;
+	IScene cacheScene(nullptr);
+	for (size_t s = 0; s < layered.size(); s++) {
+		cacheScene.addOpaqueObject(layered[s]);
+	}
+	const dvec3 lights[2] = { dvec3(3.0, 14.0, 5.0), dvec3(-12.0, 2.0, -3.0) };
+	OccluderCacheStats cacheStats;
+	for (int a = 0; a < 3; a++) {
+		cacheScene.accelerator = ACCELERATORS[a];
+		cacheScene.buildAccelerator();
+		IScene::takeOccluderCacheStats();
+		for (size_t i = 0; i + PACKET_SIZE <= rays.size(); i += PACKET_SIZE) {
+			HitRecord hits[PACKET_SIZE];
+			for (int k = 0; k < PACKET_SIZE; k++) {
+				Ray ray(dvec3(0.0, 3.0, 25.0), dvec3(i % 200 * 0.1 - 10.0, k * 0.05 + i / 200 * 0.001 - 5.0, -25.0));
+				cacheScene.findIntersection(ray, hits[k]);
+			}
+			for (int light = 0; light < 2; light++) {
+				double sha[PACKET_SIZE], expectedSha[PACKET_SIZE];
+				cacheScene.inShadow(lights[light], hits, sha, light);
+				for (int k = 0; k < PACKET_SIZE; k++) {
+					expectedSha[k] = 0.0;
+					if (hits[k].t != FLT_MAX) {
+						dvec3 Po = IShape::movePointOffSurface(hits[k].interceptPt, hits[k].normal);
+						cacheScene.useOccluderCache = false;
+						expectedSha[k] = cacheScene.inShadow(lights[light], Po, hits[k].normal, light);
+						cacheScene.useOccluderCache = true;
+						if (cacheScene.inShadow(lights[light], Po, hits[k].normal, light) != expectedSha[k]) {
+							mismatches++;
+						}
+					}
+					if (sha[k] != expectedSha[k]) {
+						mismatches++;
+					}
+				}
+			}
+		}
+		OccluderCacheStats stats = IScene::takeOccluderCacheStats();
+		if (stats.hits == 0) {
+			mismatches++;
+		}
+		cacheStats.add(stats);
+	}
+
+	// Two overlapping see-through disks block the light together, but that must not
+	// make either of them fully block a point that only it covers.
+	IScene panes(nullptr);
+	panes.addTransparentObject(new VisibleIShape(new IDisk(dvec3(0.0, 5.0, 0.0), Y_AXIS, 4.0), cyanPlastic), 0.5);
+	panes.addTransparentObject(new VisibleIShape(new IDisk(dvec3(3.0, 6.0, 0.0), Y_AXIS, 2.0), cyanPlastic), 0.5);
+	const dvec3 paneLight(0.0, 20.0, 0.0);
+	const dvec3 behindBoth(3.0, 0.0, 0.0), behindFirst(-2.0, 0.0, 0.0), behindSecond(6.0, 0.0, 0.0);
+	for (int a = 0; a < 3; a++) {
+		panes.accelerator = ACCELERATORS[a];
+		panes.buildAccelerator();
+		if (panes.inShadow(paneLight, behindBoth, Y_AXIS, 0) != 1.0 ||
+			panes.inShadow(paneLight, behindFirst, Y_AXIS, 0) != 0.5 ||
+			panes.inShadow(paneLight, behindBoth, Y_AXIS, 0) != 1.0 ||
+			panes.inShadow(paneLight, behindSecond, Y_AXIS, 0) != 0.5) {
+			mismatches++;
+		}
+	}
+
+	cout << "Occluder cache: " << cacheStats.hits << " hits of " << cacheStats.lookups << ", mismatches "
+		<< mismatches << endl;
+	return mismatches;
+}
+
+// A scaled unit sphere is a sphere, and an instanced mesh is the same mesh with
+// transformed vertices.
+long long checkInstances(const vector<Ray>& rays) {
+	long long mismatches = 0;
+	ISphere unitSphere(ORIGIN3D, 1.0);
+	IInstance sphereInstance(&unitSphere, T(3, -1, 2) * S(5.0));
+	ISphere worldSphere(dvec3(3, -1, 2), 5.0);
+	ITriangleMesh* mesh = buildSphereMesh(ORIGIN3D, 1.0, 16, 8);
+	dmat4 meshTransform = T(-2, 1, 4) * Rz(0.3) * S(2.0, 3.0, 1.0);
+	IInstance meshInstance(mesh, meshTransform);
+	vector<dvec3> movedVertices;
+	for (const dvec3& v : mesh->vertices) {
+		movedVertices.push_back(dvec3(meshTransform * dvec4(v, 1.0)));
+	}
+	ITriangleMesh movedMesh(movedVertices, mesh->indices);
+	const IShape* pairs[2][2] = { { &sphereInstance, &worldSphere }, { &meshInstance, &movedMesh } };
+	for (size_t i = 0; i < rays.size(); i++) {
+		for (int k = 0; k < 2; k++) {
+			HitRecord a, b;
+			pairs[k][0]->findClosestIntersection(rays[i], a);
+			pairs[k][1]->findClosestIntersection(rays[i], b);
+			if ((a.t == FLT_MAX) != (b.t == FLT_MAX)) {
+				mismatches++;
+			} else if (a.t != FLT_MAX && (std::abs(a.t - b.t) > 1.0E-9 * (1.0 + b.t) ||
+						glm::distance(a.interceptPt, b.interceptPt) > 1.0E-9 * (1.0 + b.t) ||
+						(k == 0 && glm::distance(a.normal, b.normal) > 1.0E-9))) {
+				mismatches++;
+			}
+			bool occludedA = pairs[k][0]->hasIntersection(rays[i], 0.0, SHADOW_RAY_LENGTH);
+			bool occludedB = pairs[k][1]->hasIntersection(rays[i], 0.0, SHADOW_RAY_LENGTH);
+			if (occludedA != occludedB && std::abs(b.t - SHADOW_RAY_LENGTH) > 1.0E-9) {
+				mismatches++;
+			}
+		}
+	}
+
+	cout << "Instances: mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// After some shapes move, the refit BVH and a rebuilt grid must again agree with a
+// linear search, and the BVH must refuse to refit around a shape it was not built over.
+long long checkRefit(const vector<Ray>& rays) {
+	long long mismatches = 0;
+	// Move the sphere and the instances, some of them far across the scene
+	vector<VisibleIShapePtr> moving = buildShapes();
+	BVH movingBVH;
+	movingBVH.build(moving);
+	vector<VisibleIShapePtr> moved = { moving[1], moving[17], moving[18], moving[19] };
+	double builtCost = movingBVH.cost();
+	dynamic_cast<ISphere*>(moving[1]->shape)->center = dvec3(6.0, 3.0, -2.0);
+	dynamic_cast<IInstance*>(moving[17]->shape)->setTransform(T(-8, 6, 12) * S(2.0));
+	dynamic_cast<IInstance*>(moving[18]->shape)->setTransform(T(0, 1, -1) * Rx(0.4));
+	dynamic_cast<IInstance*>(moving[19]->shape)->setTransform(T(12, 9, 9) * S(1, 4, 1));
+	if (!movingBVH.refit(moved)) {
+		mismatches++;
+	}
+	Grid movingGrid;
+	movingGrid.build(moving);
+	for (size_t i = 0; i < rays.size(); i++) {
+		HitRecord hit, gridHit, expectedHit;
+		movingBVH.findIntersection(rays[i], hit);
+		movingGrid.findIntersection(rays[i], gridHit);
+		VisibleIShape::findIntersection(rays[i], moving, expectedHit);
+		if (!sameHit(hit, expectedHit) || !sameHit(gridHit, expectedHit)) {
+			mismatches++;
+		}
+		double occlusion = movingBVH.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH);
+		if (occlusion != (expectedHit.t <= SHADOW_RAY_LENGTH ? 1.0 : 0.0)) {
+			mismatches++;
+		}
+	}
+	VisibleIShape stranger(new ISphere(ORIGIN3D, 1.0), gold);
+	if (movingBVH.refit({ &stranger })) {
+		mismatches++;
+	}
+
+	cout << "BVH refit: cost " << builtCost << " when built, " << movingBVH.cost() << " after refit, mismatches "
+		<< mismatches << endl;
+	return mismatches;
+}
+
+// A dense clump of spheres gives the grid finer grids, which must find exactly the
+// hits a linear search does.
+long long checkGrid(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildShapes();
+	long long mismatches = 0;
+
+	// Most of these spheres fall in a few top-level cells, which get finer grids
+	vector<VisibleIShapePtr> clump = { shapes[0], shapes[9] };
+	std::mt19937 rng(NUM_CLUMP_SPHERES);
+	std::uniform_real_distribution<double> near(-2.0, 2.0), far(-15.0, 15.0);
+	for (int i = 0; i < NUM_CLUMP_SPHERES; i++) {
+		dvec3 center = i % 4 == 0 ? dvec3(far(rng), far(rng), far(rng)) : dvec3(near(rng) + 6, near(rng), near(rng));
+		clump.push_back(new VisibleIShape(new ISphere(center, 0.1), gold));
+	}
+	Grid clumpGrid;
+	clumpGrid.build(clump);
+	if (clumpGrid.numSubgrids() == 0) {
+		mismatches++;
+	}
+	for (size_t i = 0; i < rays.size(); i++) {
+		// Aim half the rays into the clump
+		Ray ray = i % 2 == 0 ? rays[i] : Ray(rays[i].origin, dvec3(6, 0, 0) + rays[i].dir - rays[i].origin);
+		HitRecord hit, expectedHit;
+		clumpGrid.findIntersection(ray, hit);
+		VisibleIShape::findIntersection(ray, clump, expectedHit);
+		if (!sameHit(hit, expectedHit)) {
+			mismatches++;
+		}
+		double occlusion = clumpGrid.findOcclusion(ray, 0.0, SHADOW_RAY_LENGTH);
+		if (occlusion != (expectedHit.t <= SHADOW_RAY_LENGTH ? 1.0 : 0.0)) {
+			mismatches++;
+		}
+	}
+
+	cout << "Grid: " << clumpGrid.numCells() << " cells in " << clumpGrid.numSubgrids() << " finer grids, mismatches "
+		<< mismatches << endl;
+	return mismatches;
+}
+
+// An ISphereSet must hit the same spheres, with the same materials, as the equivalent
+// individual ISpheres do.
+long long checkSphereSet(const vector<Ray>& rays) {
+	long long mismatches = 0;
+	// Centers and radii on a grid of 1/1024ths are exact as floats, so both versions
+	// have exactly the same spheres
+	std::mt19937 rng(NUM_SET_SPHERES);
+	std::uniform_real_distribution<double> near(-2.0, 2.0), far(-15.0, 15.0);
+	const Material palette[] = { gold, copper, chrome, redPlastic, cyanPlastic, polishedSilver };
+	ISphereSet sphereSet(vector<Material>(palette, palette + 6));
+	vector<VisibleIShapePtr> setSpheres;
+	for (int i = 0; i < NUM_SET_SPHERES; i++) {
+		dvec3 center(glm::round(dvec3(far(rng), far(rng), far(rng)) * 1024.0) / 1024.0);
+		double radius = std::round((0.05 + 0.5 * (near(rng) + 2.0) / 4.0) * 1024.0) / 1024.0;
+		sphereSet.add(center, radius, i % 6);
+		setSpheres.push_back(new VisibleIShape(new ISphere(center, radius), palette[i % 6]));
+	}
+	sphereSet.build();
+	VisibleIShape visibleSet(&sphereSet, tin);
+	for (size_t i = 0; i < rays.size(); i++) {
+		HitRecord hit, expectedHit;
+		visibleSet.findClosestIntersection(rays[i], hit);
+		VisibleIShape::findIntersection(rays[i], setSpheres, expectedHit);
+		if ((hit.t == FLT_MAX) != (expectedHit.t == FLT_MAX)) {
+			mismatches++;
+		} else if (hit.t != FLT_MAX && (std::abs(hit.t - expectedHit.t) > 1.0E-9 * (1.0 + hit.t) ||
+					glm::distance(hit.normal, expectedHit.normal) > 1.0E-6 ||
+					hit.material.diffuse != expectedHit.material.diffuse)) {
+			mismatches++;
+		}
+		bool occluded = sphereSet.hasIntersection(rays[i], 0.0, SHADOW_RAY_LENGTH);
+		if (occluded != (expectedHit.t <= SHADOW_RAY_LENGTH) && std::abs(expectedHit.t - SHADOW_RAY_LENGTH) > 1.0E-9) {
+			mismatches++;
+		}
+	}
+
+	cout << "Sphere set: " << sphereSet.numSpheres() << " spheres, " << sphereSet.numNodes() << " nodes, "
+		<< sphereSet.memoryBytes() << " bytes, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// An IHeightField must hit exactly where a triangle mesh made from its samples does.
+long long checkHeightField(const vector<Ray>& rays) {
+	long long mismatches = 0;
+	// Rolling hills with some noise, on a grid that does not halve evenly
+	std::mt19937 rng(TERRAIN_WIDTH * TERRAIN_DEPTH);
+	std::uniform_real_distribution<double> near(-2.0, 2.0);
+	vector<float> elevations;
+	for (int z = 0; z < TERRAIN_DEPTH; z++) {
+		for (int x = 0; x < TERRAIN_WIDTH; x++) {
+			double hills = 0.5 + 0.25 * std::sin(x / 7.0) * std::cos(z / 5.0) + 0.1 * std::sin((x + z) / 3.0);
+			elevations.push_back((float)(hills + 0.05 * near(rng)));
+		}
+	}
+	IHeightField terrain(TERRAIN_WIDTH, TERRAIN_DEPTH, elevations, dvec3(-14.0, -3.0, -14.0), dvec3(28.0, 6.0, 28.0));
+	vector<dvec3> terrainVerts;
+	vector<unsigned int> terrainTris;
+	for (int z = 0; z < TERRAIN_DEPTH; z++) {
+		for (int x = 0; x < TERRAIN_WIDTH; x++) {
+			terrainVerts.push_back(terrain.samplePoint(x, z));
+		}
+	}
+	for (int z = 0; z + 1 < TERRAIN_DEPTH; z++) {
+		for (int x = 0; x + 1 < TERRAIN_WIDTH; x++) {
+			unsigned int a = z * TERRAIN_WIDTH + x, b = a + 1, c = a + TERRAIN_WIDTH, d = c + 1;
+			terrainTris.insert(terrainTris.end(), { a, d, b, a, c, d });
+		}
+	}
+	ITriangleMesh terrainMesh(terrainVerts, terrainTris);
+	int terrainHits = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		HitRecord hit, expectedHit;
+		terrain.findClosestIntersection(rays[i], hit);
+		terrainMesh.findClosestIntersection(rays[i], expectedHit);
+		if (hit.t != expectedHit.t || (hit.t != FLT_MAX && hit.normal.y <= 0.0)) {
+			mismatches++;
+		}
+		terrainHits += hit.t != FLT_MAX;
+		int triangle;
+		if (terrain.findClosestHit(rays[i], triangle) != FLT_MAX) {
+			int x = triangle / 2 % (TERRAIN_WIDTH - 1), z = triangle / 2 / (TERRAIN_WIDTH - 1);
+			dvec3 lo = terrain.samplePoint(x, z), hi = terrain.samplePoint(x + 1, z + 1);
+			if (hit.interceptPt.x < lo.x - 1.0E-9 || hit.interceptPt.x > hi.x + 1.0E-9 ||
+				hit.interceptPt.z < lo.z - 1.0E-9 || hit.interceptPt.z > hi.z + 1.0E-9) {
+				mismatches++;
+			}
+		}
+		if (terrain.hasIntersection(rays[i], 0.0, SHADOW_RAY_LENGTH) !=
+			terrainMesh.hasIntersection(rays[i], 0.0, SHADOW_RAY_LENGTH)) {
+			mismatches++;
+		}
+	}
+
+	cout << "Height field: " << terrain.numSamples() << " samples, " << terrain.numLevels() << " levels, "
+		<< terrain.memoryBytes() << " bytes, " << terrainHits << " rays hit, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// The closed-form routines of spheres, cylinders, cones and ellipsoids must agree,
+// within rounding, with the general quadric code they replace.
+long long checkQuadrics(const vector<Ray>& rays) {
+	vector<VisibleIShapePtr> shapes = buildShapes();
+	long long mismatches = 0;
+
+	// Aim half the rays near each quadric's center, so that most of them hit it
+	int quadricHits = 0;
+	for (size_t s = 0; s < shapes.size(); s++) {
+		const IQuadricSurface *quadric = dynamic_cast<const IQuadricSurface *>(shapes[s]->shape);
+		if (quadric == nullptr || typeid(*quadric) == typeid(IQuadricSurface)) {
+			continue;
+		}
+		for (size_t i = 0; i < rays.size(); i++) {
+			Ray ray = i % 2 == 0 ? rays[i] : Ray(rays[i].origin, quadric->center + 2.0 * rays[i].dir - rays[i].origin);
+			HitRecord hit, expectedHit;
+			quadric->findClosestIntersection(ray, hit);
+			quadric->IQuadricSurface::findClosestIntersection(ray, expectedHit);
+			if ((hit.t == FLT_MAX) != (expectedHit.t == FLT_MAX)) {
+				mismatches++;
+			} else if (hit.t != FLT_MAX && (std::abs(hit.t - expectedHit.t) > 1.0E-9 * (1.0 + hit.t) ||
+						glm::distance(hit.normal, expectedHit.normal) > 1.0E-6)) {
+				mismatches++;
+			}
+			quadricHits += hit.t != FLT_MAX;
+			if (quadric->hasIntersection(ray, 0.0, SHADOW_RAY_LENGTH) !=
+				quadric->IQuadricSurface::hasIntersection(ray, 0.0, SHADOW_RAY_LENGTH) &&
+				std::abs(expectedHit.t - SHADOW_RAY_LENGTH) > 1.0E-9) {
+				mismatches++;
+			}
+		}
+	}
+
+	cout << "Quadrics: " << quadricHits << " hits, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// Each kind of ray sees a different subset of the shapes, and every accelerator must
+// find, for each kind, exactly what a linear search over the shapes it can see finds.
+long long checkVisibility(const vector<Ray>& rays) {
+	long long mismatches = 0;
+	vector<VisibleIShapePtr> masked = buildShapes();
+	const unsigned int masks[] = { ALL_RAYS, CAMERA_RAYS, ALL_RAYS & ~SHADOW_RAYS,
+									REFLECTION_RAYS | REFRACTION_RAYS, SHADOW_RAYS, 0 };
+	const unsigned int rayTypes[] = { CAMERA_RAYS, SHADOW_RAYS, REFLECTION_RAYS, REFRACTION_RAYS };
+	for (size_t s = 0; s < masked.size(); s++) {
+		masked[s]->visibility = masks[(s * 7 + 3) % 6];
+	}
+	BVH maskedBVH;
+	maskedBVH.build(masked);
+	Grid maskedGrid;
+	maskedGrid.build(masked);
+	CompactScene compact;
+	compact.build(masked);
+	long long hiddenHits = 0;
+	for (size_t i = 0; i < rays.size(); i++) {
+		HitRecord unmasked;
+		VisibleIShape::findIntersection(rays[i], masked, unmasked);
+		for (int r = 0; r < 4; r++) {
+			HitRecord hit, gridHit, compactHit, expectedHit;
+			VisibleIShape::findIntersection(rays[i], masked, expectedHit, rayTypes[r]);
+			maskedBVH.findIntersection(rays[i], hit, rayTypes[r]);
+			maskedGrid.findIntersection(rays[i], gridHit, rayTypes[r]);
+			compact.findIntersection(rays[i], compactHit, rayTypes[r]);
+			if (!sameHit(hit, expectedHit) || !sameHit(gridHit, expectedHit) || !sameHit(compactHit, expectedHit)) {
+				mismatches++;
+			}
+			hiddenHits += expectedHit.t != unmasked.t;
+
+			RayHits linear, maskedHits, gridHits;
+			VisibleIShape::findHits(rays[i], masked, linear, rayTypes[r]);
+			maskedBVH.findHits(rays[i], maskedHits, rayTypes[r]);
+			maskedGrid.findHits(rays[i], gridHits, rayTypes[r]);
+			if (maskedHits.count != linear.count || gridHits.count != linear.count) {
+				mismatches++;
+			} else {
+				for (int j = 0; j < linear.count; j++) {
+					if (maskedHits.object[j] != linear.object[j] || gridHits.object[j] != linear.object[j]) {
+						mismatches++;
+					}
+				}
+			}
+
+			if (rayTypes[r] == SHADOW_RAYS) {
+				double expectedOcclusion = expectedHit.t <= SHADOW_RAY_LENGTH ? 1.0 : 0.0;
+				if (maskedBVH.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH) != expectedOcclusion ||
+					maskedGrid.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH) != expectedOcclusion ||
+					compact.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH) != expectedOcclusion) {
+					mismatches++;
+				}
+			}
+		}
+	}
+	for (size_t i = 0; i + PACKET_SIZE <= rays.size(); i += PACKET_SIZE) {
+		for (int r = 0; r < 4; r++) {
+			HitRecord hits[PACKET_SIZE];
+			maskedBVH.findIntersections(&rays[i], hits, rayTypes[r]);
+			double tMax[PACKET_SIZE], occlusion[PACKET_SIZE];
+			for (int k = 0; k < PACKET_SIZE; k++) {
+				tMax[k] = SHADOW_RAY_LENGTH;
+			}
+			maskedBVH.findOcclusions(&rays[i], 0.0, tMax, occlusion);
+			for (int k = 0; k < PACKET_SIZE; k++) {
+				HitRecord expectedHit;
+				VisibleIShape::findIntersection(rays[i + k], masked, expectedHit, rayTypes[r]);
+				if (!sameHit(hits[k], expectedHit)) {
+					mismatches++;
+				}
+				if (occlusion[k] != maskedBVH.findOcclusion(rays[i + k], 0.0, SHADOW_RAY_LENGTH)) {
+					mismatches++;
+				}
+			}
+		}
+	}
+	// Shapes that can be seen again must be found again
+	for (size_t s = 0; s < masked.size(); s++) {
+		masked[s]->visibility = ALL_RAYS;
+	}
+	if (!maskedBVH.refit(masked)) {
+		mismatches++;
+	}
+	for (size_t i = 0; i < rays.size(); i++) {
+		HitRecord hit, expectedHit;
+		maskedBVH.findIntersection(rays[i], hit, SHADOW_RAYS);
+		VisibleIShape::findIntersection(rays[i], masked, expectedHit);
+		if (!sameHit(hit, expectedHit)) {
+			mismatches++;
+		}
+	}
+
+	cout << "Visibility masks: " << hiddenHits << " hits changed, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// Only a light's shadow casters may block it, in every accelerator, and a packet of
+// hits traces no shadow ray to a hit the light does not shine on.
+long long checkLightLinking(const vector<Ray>& rays) {
+	const dvec3 lightPos(3.0, 14.0, 5.0);
+	long long mismatches = 0;
+	vector<VisibleIShapePtr> linked = buildShapes();
+	BVH linkedBVH;
+	linkedBVH.build(linked);
+	Grid linkedGrid;
+	linkedGrid.build(linked);
+	CompactScene linkedCompact;
+	linkedCompact.build(linked);
+	IScene linkScene(nullptr);
+	for (size_t s = 0; s < linked.size(); s++) {
+		linkScene.addOpaqueObject(linked[s]);
+	}
+	ObjectLinks includeLinks, excludeLinks;
+	vector<VisibleIShapePtr> included, notExcluded;
+	for (size_t s = 0; s < linked.size(); s++) {
+		if (s % 3 == 0) {
+			includeLinks.include.insert(linked[s]);
+			included.push_back(linked[s]);
+		}
+		if (s % 2 == 0) {
+			excludeLinks.exclude.insert(linked[s]);
+		} else {
+			notExcluded.push_back(linked[s]);
+		}
+	}
+	const ObjectLinks *links[2] = { &includeLinks, &excludeLinks };
+	const vector<VisibleIShapePtr> *casterShapes[2] = { &included, &notExcluded };
+	long long unlinkedOcclusions = 0;
+	for (int l = 0; l < 2; l++) {
+		for (size_t i = 0; i < rays.size(); i++) {
+			HitRecord expectedHit, unlinked;
+			VisibleIShape::findIntersection(rays[i], *casterShapes[l], expectedHit);
+			VisibleIShape::findIntersection(rays[i], linked, unlinked);
+			double expectedOcclusion = expectedHit.t <= SHADOW_RAY_LENGTH ? 1.0 : 0.0;
+			if (linkedBVH.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH, nullptr, links[l]) != expectedOcclusion ||
+				linkedGrid.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH, nullptr, links[l]) != expectedOcclusion ||
+				linkedCompact.findOcclusion(rays[i], 0.0, SHADOW_RAY_LENGTH, nullptr, links[l]) != expectedOcclusion) {
+				mismatches++;
+			}
+			unlinkedOcclusions += (unlinked.t <= SHADOW_RAY_LENGTH) != (expectedOcclusion == 1.0);
+		}
+		for (size_t i = 0; i + PACKET_SIZE <= rays.size(); i += PACKET_SIZE) {
+			double tMax[PACKET_SIZE], occlusion[PACKET_SIZE];
+			for (int k = 0; k < PACKET_SIZE; k++) {
+				tMax[k] = SHADOW_RAY_LENGTH;
+			}
+			linkedBVH.findOcclusions(&rays[i], 0.0, tMax, occlusion, nullptr, links[l]);
+			for (int k = 0; k < PACKET_SIZE; k++) {
+				if (occlusion[k] != linkedBVH.findOcclusion(rays[i + k], 0.0, SHADOW_RAY_LENGTH, nullptr, links[l])) {
+					mismatches++;
+				}
+			}
+		}
+	}
+	PositionalLight linkedLight(lightPos, pureWhiteLight);
+	linkedLight.litObjects = includeLinks;
+	linkedLight.shadowCasters = excludeLinks;
+	linkScene.addLight(&linkedLight);
+	for (int a = 0; a < 3; a++) {
+		linkScene.accelerator = ACCELERATORS[a];
+		linkScene.buildAccelerator();
+		for (size_t i = 0; i + PACKET_SIZE <= rays.size(); i += PACKET_SIZE) {
+			HitRecord hits[PACKET_SIZE];
+			for (int k = 0; k < PACKET_SIZE; k++) {
+				HitRecord expectedHit;
+				linkScene.findIntersection(rays[i + k], hits[k]);
+				VisibleIShape::findIntersection(rays[i + k], linked, expectedHit);
+				if (hits[k].object != expectedHit.object) {
+					mismatches++;
+				}
+			}
+			double sha[PACKET_SIZE];
+			linkScene.inShadow(lightPos, hits, sha, 0);
+			for (int k = 0; k < PACKET_SIZE; k++) {
+				double expectedSha = 0.0;
+				if (hits[k].t != FLT_MAX && linkedLight.illuminates(hits[k].object)) {
+					dvec3 Po = IShape::movePointOffSurface(hits[k].interceptPt, hits[k].normal);
+					Ray shadowRay(Po, glm::normalize(lightPos - Po));
+					HitRecord blocker;
+					VisibleIShape::findIntersection(shadowRay, notExcluded, blocker);
+					expectedSha = blocker.t <= glm::distance(lightPos, Po) ? 1.0 : 0.0;
+					if (linkScene.inShadow(lightPos, Po, hits[k].normal, 0) != expectedSha) {
+						mismatches++;
+					}
+				}
+				if (sha[k] != expectedSha) {
+					mismatches++;
+				}
+			}
+		}
+	}
+	linkScene.Plights.clear();
+
+	cout << "Light linking: " << unlinkedOcclusions << " shadows changed, mismatches " << mismatches << endl;
+	return mismatches;
+}
+
+// A light's range must end where its attenuation falls to the cutoff, and every light
+// left out of a tile must add exactly nothing at any point along any camera ray
+// through the tile, for either kind of camera.
+long long checkLightCulling() {
+	long long mismatches = 0;
+	std::mt19937 rng(NUM_CULLED_LIGHTS);
+	std::uniform_real_distribution<double> far(-15.0, 15.0);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	vector<PositionalLight> pointLights;
+	vector<SpotLight> spotLights;
+	for (int i = 0; i < NUM_CULLED_LIGHTS; i++) {
+		dvec3 lightPos(far(rng), far(rng), far(rng));
+		LightATParams params(0.5 + unit(rng), i % 3 == 0 ? 0.0 : 0.3 * unit(rng),
+								i % 4 == 0 ? 0.0 : 0.05 * unit(rng), 0.05 + 0.5 * unit(rng));
+		double range = params.range();
+		if (range > 0.0 && range < FLT_MAX &&
+			(!params.reaches(range * (1.0 - 1.0E-9)) || params.reaches(range * (1.0 + 1.0E-9)))) {
+			mismatches++;
+		}
+		if (i % 2 == 0) {
+			pointLights.push_back(PositionalLight(lightPos, pureWhiteLight));
+			pointLights.back().setAttenuation(i % 10 != 0);
+			pointLights.back().setAttenuationParams(params);
+		} else {
+			dvec3 spotDir = glm::normalize(dvec3(far(rng), far(rng), far(rng)));
+			spotLights.push_back(SpotLight(lightPos, spotDir, 0.1 + 1.9 * unit(rng), pureWhiteLight));
+			spotLights.back().setAttenuation(i % 5 != 1);
+			spotLights.back().setAttenuationParams(params);
+		}
+	}
+	PerspectiveCamera perspective(dvec3(0, 3, 25), dvec3(0, 0, 0), dvec3(0, 1, 0), glm::radians(60.0), 64, 48);
+	OrthographicCamera orthographic(dvec3(4, 10, 20), dvec3(0, 0, 0), dvec3(0, 1, 0), 64, 48, 0.25);
+	RaytracingCamera *cameras[2] = { &perspective, &orthographic };
+	long long lightsCulled = 0, lightsConsidered = 0;
+	for (int c = 0; c < 2; c++) {
+		IScene lightScene(cameras[c]);
+		for (size_t i = 0; i < pointLights.size(); i++) {
+			lightScene.addLight(&pointLights[i]);
+		}
+		for (size_t i = 0; i < spotLights.size(); i++) {
+			lightScene.addLight(&spotLights[i]);
+		}
+		Frame frm = cameras[c]->getFrame();
+		LightCuller culler;
+		culler.setup(lightScene);
+		vector<int> tileLights;
+		for (int t = 0; t < NUM_CULLED_TILES; t++) {
+			int width = 1 + (int)(16 * unit(rng)), height = 1 + (int)(16 * unit(rng));
+			BoundingBoxi tile((int)((64 - width) * unit(rng)), width, (int)((48 - height) * unit(rng)), height);
+			culler.cull(*cameras[c], tile, tileLights);
+			lightsCulled += culler.lightsOn().size() - tileLights.size();
+			lightsConsidered += culler.lightsOn().size();
+			for (int r = 0; r < 8; r++) {
+				Ray ray = cameras[c]->getRay(tile.lx + width * unit(rng), tile.ly + height * unit(rng));
+				dvec3 point = ray.getPoint(60.0 * unit(rng));
+				for (size_t j = 0, next = 0; j < culler.lightsOn().size(); j++) {
+					int light = culler.lightsOn()[j];
+					if (next < tileLights.size() && tileLights[next] == light) {
+						next++;
+						continue;
+					}
+					color lit = light < (int)pointLights.size() ?
+						pointLights[light].illuminate(point, -ray.dir, gold, frm, 0.0) :
+						spotLights[light - pointLights.size()].illuminate(point, -ray.dir, gold, frm, false);
+					if (lit != black) {
+						mismatches++;
+					}
+				}
+			}
+		}
+	}
+
+	cout << "Light culling: " << lightsCulled << " of " << lightsConsidered << " lights culled from tiles, mismatches "
+		<< mismatches << endl;
+	return mismatches;
+}
+
+int main(int argc, char* argv[]) {
+	vector<Ray> rays = buildRays();
+	long long mismatches = checkThreads(rays);
+	mismatches += checkBvh(rays);
+	mismatches += checkPackets(rays);
+	mismatches += checkTriangleMeshes(rays);
+	mismatches += checkDeferredAttributes(rays);
+	mismatches += checkMultiHits(rays);
+	mismatches += checkShadowPackets(rays);
+	mismatches += checkOccluderCache(rays);
+	mismatches += checkInstances(rays);
+	mismatches += checkRefit(rays);
+	mismatches += checkGrid(rays);
+	mismatches += checkSphereSet(rays);
+	mismatches += checkHeightField(rays);
+	mismatches += checkQuadrics(rays);
+	mismatches += checkVisibility(rays);
+	mismatches += checkLightLinking(rays);
+	mismatches += checkLightCulling();
+	cout << "Mismatches: " << mismatches << endl;
+	cout << (mismatches == 0 ? "PASSED" : "FAILED") << endl;
+	return mismatches == 0 ? 0 : 1;
+}
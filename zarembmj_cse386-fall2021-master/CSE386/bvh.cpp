@@ -0,0 +1,769 @@
+#include <algorithm>
+#include "bvh.h"
+
+const double BVH_TRAVERSAL_COST = 0.125;	//!< cost of visiting a node, relative to one ray/object test.
+
+/**
+ * @fn	static double visitCost(const BVHNode &node)
+ * @brief	What the SAH charges for a ray that enters a node: one test per object in
+ * 			a leaf, or BVH_TRAVERSAL_COST for an interior node.
+ * @param	node	The node.
+ * @return	The cost, relative to one ray/object test.
+ */
+
+static double visitCost(const BVHNode &node) {
+	return node.count > 0 ? node.count : BVH_TRAVERSAL_COST;
+}
+
+/**
+ * @fn	static int binOf(double c, double cmin, double extent)
+ * @brief	Finds the SAH bin that a centroid coordinate falls into.
+ * @param	c	  	The centroid coordinate.
+ * @param	cmin  	The smallest centroid coordinate along this axis.
+ * @param	extent	The range of centroid coordinates along this axis (> 0).
+ * @return	The bin, in [0, BVH_NUM_BINS - 1].
+ */
+
+static int binOf(double c, double cmin, double extent) {
+	int b = (int)(BVH_NUM_BINS * (c - cmin) / extent);
+	return glm::clamp(b, 0, BVH_NUM_BINS - 1);
+}
+
+/**
+ * @fn	static void slab(PacketDouble &tMin, PacketDouble &tMax, double lo, double hi, const PacketDouble &o, const PacketDouble &invD)
+ * @brief	Clips each ray's [tMin, tMax] interval to one pair of slabs, just as
+ * 			BoundingBox::intersects does for a single ray (NaNs are ignored).
+ * @param [in,out]	tMin	Start of each ray's interval.
+ * @param [in,out]	tMax	End of each ray's interval.
+ * @param 		  	lo  	Lower slab.
+ * @param 		  	hi  	Upper slab.
+ * @param 		  	o   	The rays' origins along this axis.
+ * @param 		  	invD	1/direction along this axis.
+ */
+
+static void slab(PacketDouble &tMin, PacketDouble &tMax, double lo, double hi,
+					const PacketDouble &o, const PacketDouble &invD) {
+	PacketDouble t0 = (lo - o) * invD;
+	PacketDouble t1 = (hi - o) * invD;
+	PacketMask swap = t0 > t1;
+	PacketDouble tNear = select(swap, t1, t0);
+	PacketDouble tFar = select(swap, t0, t1);
+	tMin = select(tNear > tMin, tNear, tMin);
+	tMax = select(tFar < tMax, tFar, tMax);
+}
+
+/**
+ * @fn	static bool packetHitsBox(const BoundingBox &box, const RayPacket &packet, const PacketDouble &invDx, const PacketDouble &invDy, const PacketDouble &invDz, const PacketDouble &tMin, const PacketDouble &tMax)
+ * @brief	Slab test of a whole packet against a box.
+ * @param	box   	The box.
+ * @param	packet	The rays.
+ * @param	invDx 	1/direction along x.
+ * @param	invDy 	1/direction along y.
+ * @param	invDz 	1/direction along z.
+ * @param	tMin  	Smallest t of interest along each ray.
+ * @param	tMax  	Largest t of interest along each ray, such as its closest hit so far.
+ * @return	true iff at least one ray passes through the box in [tMin, tMax].
+ */
+
+static bool packetHitsBox(const BoundingBox &box, const RayPacket &packet,
+							const PacketDouble &invDx, const PacketDouble &invDy,
+							const PacketDouble &invDz, const PacketDouble &tMin,
+							const PacketDouble &tMax) {
+	PacketDouble t0 = tMin;
+	PacketDouble t1 = tMax;
+	slab(t0, t1, box.lo.x, box.hi.x, packet.ox, invDx);
+	slab(t0, t1, box.lo.y, box.hi.y, packet.oy, invDy);
+	slab(t0, t1, box.lo.z, box.hi.z, packet.oz, invDz);
+	return (t0 <= t1).any();
+}
+
+/**
+ * @fn	static bool findSAHSplit(const vector<BVHBuildItem> &items, int first, int last, const BoundingBox &box, int &axis, int &splitBin)
+ * @brief	Finds the cheapest way to split a range of items according to the surface
+ * 			area heuristic. Item centroids are sorted into BVH_NUM_BINS bins along each
+ * 			axis and every boundary between bins is evaluated.
+ * @param 		  	items   	The items being placed.
+ * @param 		  	first   	First item of the range.
+ * @param 		  	last		One past the last item of the range.
+ * @param 		  	box			Box around the whole range.
+ * @param [in,out]	axis		The axis to split along.
+ * @param [in,out]	splitBin	Items in this bin and below go to the left child.
+ * @return	false if the range should become a leaf instead.
+ */
+
+static bool findSAHSplit(const vector<BVHBuildItem> &items, int first, int last,
+							const BoundingBox &box, int &axis, int &splitBin) {
+	int count = last - first;
+	if (count <= 1) {
+		return false;
+	}
+
+	BoundingBox centroids;
+	for (int i = first; i < last; i++) {
+		centroids.grow(items[i].centroid);
+	}
+
+	double parentArea = box.surfaceArea();
+	double bestCost = FLT_MAX;
+	for (int a = 0; a < 3; a++) {
+		double cmin = centroids.lo[a];
+		double extent = centroids.hi[a] - cmin;
+		if (extent <= 0.0) {
+			continue;
+		}
+
+		BoundingBox binBoxes[BVH_NUM_BINS];
+		int binCounts[BVH_NUM_BINS] = { 0 };
+		for (int i = first; i < last; i++) {
+			int b = binOf(items[i].centroid[a], cmin, extent);
+			binBoxes[b].grow(items[i].box);
+			binCounts[b]++;
+		}
+
+		// Sweep from the right to get the area and count right of each boundary
+		double rightArea[BVH_NUM_BINS];
+		int rightCount[BVH_NUM_BINS];
+		BoundingBox rightBox;
+		int n = 0;
+		for (int b = BVH_NUM_BINS - 1; b > 0; b--) {
+			rightBox.grow(binBoxes[b]);
+			n += binCounts[b];
+			rightArea[b] = rightBox.surfaceArea();
+			rightCount[b] = n;
+		}
+
+		BoundingBox leftBox;
+		n = 0;
+		for (int b = 0; b < BVH_NUM_BINS - 1; b++) {
+			leftBox.grow(binBoxes[b]);
+			n += binCounts[b];
+			if (n == 0 || rightCount[b + 1] == 0) {
+				continue;
+			}
+			double cost = BVH_TRAVERSAL_COST +
+				(leftBox.surfaceArea() * n + rightArea[b + 1] * rightCount[b + 1]) / parentArea;
+			if (cost < bestCost) {
+				bestCost = cost;
+				axis = a;
+				splitBin = b;
+			}
+		}
+	}
+
+	if (bestCost == FLT_MAX) {
+		return false;		// every centroid is in the same place
+	}
+	return bestCost < count || count > BVH_MAX_LEAF_SIZE;
+}
+
+/**
+ * @fn	static int buildNode(vector<BVHBuildItem> &items, vector<BVHNode> &nodes, int first, int last, int depth)
+ * @brief	Recursively builds the subtree for items[first] through items[last - 1].
+ * @param [in,out]	items	The items being placed. The range is reordered.
+ * @param [in,out]	nodes	The hierarchy's nodes. The new ones are appended.
+ * @param 		  	first	First item of the range.
+ * @param 		  	last 	One past the last item of the range.
+ * @param 		  	depth	Depth of the new node.
+ * @return	Index of the new node in nodes.
+ */
+
+static int buildNode(vector<BVHBuildItem> &items, vector<BVHNode> &nodes,
+						int first, int last, int depth) {
+	int index = (int)nodes.size();
+	nodes.push_back(BVHNode());
+
+	BoundingBox box;
+	for (int i = first; i < last; i++) {
+		box.grow(items[i].box);
+	}
+	nodes[index].box = box;
+
+	int axis = 0;
+	int splitBin = 0;
+	if (depth < BVH_MAX_DEPTH && findSAHSplit(items, first, last, box, axis, splitBin)) {
+		BoundingBox centroids;
+		for (int i = first; i < last; i++) {
+			centroids.grow(items[i].centroid);
+		}
+		double cmin = centroids.lo[axis];
+		double extent = centroids.hi[axis] - cmin;
+		int mid = (int)(std::partition(items.begin() + first, items.begin() + last,
+							[&](const BVHBuildItem &item) {
+								return binOf(item.centroid[axis], cmin, extent) <= splitBin;
+							}) - items.begin());
+		if (mid != first && mid != last) {
+			buildNode(items, nodes, first, mid, depth + 1);
+			int right = buildNode(items, nodes, mid, last, depth + 1);
+			nodes[index].first = right;
+			nodes[index].count = 0;
+			nodes[index].axis = axis;
+			return index;
+		}
+	}
+
+	nodes[index].first = first;
+	nodes[index].count = last - first;
+	nodes[index].axis = 0;
+	return index;
+}
+
+/**
+ * @fn	void buildBVHNodes(vector<BVHBuildItem> &items, vector<BVHNode> &nodes)
+ * @brief	Builds a hierarchy over items from scratch, replacing whatever nodes held.
+ * 			Each item's box is padded slightly, and items are reordered so that every
+ * 			leaf covers a contiguous range of them; the caller should then store its
+ * 			own data in the new order, items[i].index giving where each came from.
+ * @param [in,out]	items	The items to place in the hierarchy. Their boxes must be set.
+ * @param [in,out]	nodes	The hierarchy's nodes. Empty if there are no items.
+ */
+
+void buildBVHNodes(vector<BVHBuildItem> &items, vector<BVHNode> &nodes) {
+	nodes.clear();
+	for (size_t i = 0; i < items.size(); i++) {
+		items[i].box = items[i].box.padded();
+		items[i].centroid = items[i].box.center();
+	}
+	if (!items.empty()) {
+		nodes.reserve(2 * items.size());
+		buildNode(items, nodes, 0, (int)items.size(), 0);
+	}
+}
+
+/**
+ * @fn	BVH::BVH()
+ * @brief	Constructs an empty hierarchy.
+ */
+
+BVH::BVH() {
+}
+
+/**
+ * @fn	void BVH::build(const vector<VisibleIShapePtr> &surfaces)
+ * @brief	Builds the hierarchy from scratch, replacing whatever was there before.
+ * @param	surfaces	The objects to put in the hierarchy.
+ */
+
+void BVH::build(const vector<VisibleIShapePtr> &surfaces) {
+	objects.clear();
+	unbounded.clear();
+
+	vector<BVHBuildItem> items;
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		BVHBuildItem item;
+		if (surfaces[i]->shape->getBoundingBox(item.box)) {
+			item.index = (int)i;
+			items.push_back(item);
+		} else {
+			unbounded.push_back(surfaces[i]);
+		}
+	}
+
+	buildBVHNodes(items, nodes);
+	objects.reserve(items.size());
+	slots.clear();
+	for (size_t i = 0; i < items.size(); i++) {
+		objects.push_back(surfaces[items[i].index]);
+		slots[objects[i]] = (int)i;
+	}
+
+	// Record what refit needs to walk from an object up to the root
+	parents.assign(nodes.size(), -1);
+	leaves.assign(objects.size(), 0);
+	nodeVisibility.assign(nodes.size(), 0);
+	weightedArea = 0.0;
+	for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+		nodeVisibility[i] = visibilityOf(i);
+	}
+	for (int i = 0; i < (int)nodes.size(); i++) {
+		const BVHNode &node = nodes[i];
+		weightedArea += visitCost(node) * node.box.surfaceArea();
+		if (node.count > 0) {
+			for (int j = node.first; j < node.first + node.count; j++) {
+				leaves[j] = i;
+			}
+		} else {
+			parents[i + 1] = i;
+			parents[node.first] = i;
+		}
+	}
+	builtCost = cost();
+}
+
+/**
+ * @fn	bool BVH::refit(const vector<VisibleIShapePtr> &moved)
+ * @brief	Updates the hierarchy after some of its objects have moved. Only the leaves
+ * 			holding the moved objects, and the nodes above them, are recomputed. The
+ * 			tree is not reorganized, so needsRebuild() should be checked afterwards.
+ * @param	moved	The objects that moved. Each must have been passed to build.
+ * @return	false if the hierarchy must be rebuilt instead, because an object is not
+ * 			in it or has gained or lost its bounding box.
+ */
+
+bool BVH::refit(const vector<VisibleIShapePtr> &moved) {
+	for (size_t i = 0; i < moved.size(); i++) {
+		BoundingBox box;
+		bool bounded = moved[i]->shape->getBoundingBox(box);
+		auto slot = slots.find(moved[i]);
+		if (slot == slots.end()) {
+			if (bounded || std::find(unbounded.begin(), unbounded.end(), moved[i]) == unbounded.end()) {
+				return false;
+			}
+		} else if (!bounded) {
+			return false;
+		} else {
+			refitNode(leaves[slot->second]);
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	unsigned int BVH::visibilityOf(int index) const
+ * @brief	Computes which kinds of rays can see something below a node, from its
+ * 			objects or from its children's nodeVisibility.
+ * @param	index	The node.
+ * @return	The union of the visibility of the objects below the node.
+ */
+
+unsigned int BVH::visibilityOf(int index) const {
+	const BVHNode &node = nodes[index];
+	if (node.count == 0) {
+		return nodeVisibility[index + 1] | nodeVisibility[node.first];
+	}
+	unsigned int visibility = 0;
+	for (int i = node.first; i < node.first + node.count; i++) {
+		visibility |= objects[i]->visibility;
+	}
+	return visibility;
+}
+
+/**
+ * @fn	void BVH::refitNode(int index)
+ * @brief	Recomputes the box and visibility of a node from its objects or children,
+ * 			and then those of its ancestors. Stops early at the first node where
+ * 			neither changes.
+ * @param	index	The node.
+ */
+
+void BVH::refitNode(int index) {
+	while (index >= 0) {
+		BVHNode &node = nodes[index];
+		BoundingBox box;
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				BoundingBox objectBox;
+				objects[i]->shape->getBoundingBox(objectBox);
+				box.grow(objectBox.padded());
+			}
+		} else {
+			box = nodes[index + 1].box;
+			box.grow(nodes[node.first].box);
+		}
+		unsigned int visibility = visibilityOf(index);
+		if (box.lo == node.box.lo && box.hi == node.box.hi && visibility == nodeVisibility[index]) {
+			return;
+		}
+		nodeVisibility[index] = visibility;
+		weightedArea += visitCost(node) * (box.surfaceArea() - node.box.surfaceArea());
+		node.box = box;
+		index = parents[index];
+	}
+}
+
+/**
+ * @fn	double BVH::cost() const
+ * @brief	The SAH estimate of the cost of tracing a ray through the hierarchy: the
+ * 			sum over all nodes of the chance that a ray hitting the root also hits the
+ * 			node, times the cost of visiting the node. Refitting only ever changes node
+ * 			boxes, so this is kept up to date one node at a time.
+ * @return	The cost, relative to one ray/object test. 0 if there are no bounded objects.
+ */
+
+double BVH::cost() const {
+	if (nodes.empty()) {
+		return 0.0;
+	}
+	double rootArea = nodes[0].box.surfaceArea();
+	return rootArea > 0.0 ? weightedArea / rootArea : 0.0;
+}
+
+/**
+ * @fn	void BVH::findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType) const
+ * @brief	Finds the closest intersection along the ray. Children are visited near
+ * 			side first, and a subtree is skipped when its box lies entirely beyond the
+ * 			closest hit found so far, or nothing in it can be seen by rayType. Only t,
+ * 			the object and its primitive are tracked during traversal; the rest of the
+ * 			hit is filled in for the winner alone.
+ * @param 		  	ray    	The ray.
+ * @param [in,out]	theHit 	The closest hit, or t == FLT_MAX if nothing was hit.
+ * @param 		  	rayType	The kind of ray; objects it cannot see are skipped.
+ */
+
+void BVH::findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType) const {
+	double bestT = FLT_MAX;
+	int bestPrimitive = 0;
+	VisibleIShapePtr closest = nullptr;
+	auto intersect = [&](VisibleIShapePtr object) {
+		if (!object->isVisibleTo(rayType)) {
+			return;
+		}
+		int primitive;
+		double t = object->findClosestHit(ray, primitive);
+		if (t < bestT) {
+			bestT = t;
+			bestPrimitive = primitive;
+			closest = object;
+		}
+	};
+
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		intersect(unbounded[i]);
+	}
+
+	if (!nodes.empty()) {
+		dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+		int stack[BVH_MAX_DEPTH + 1];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			int index = stack[--top];
+			const BVHNode &node = nodes[index];
+			if (!(nodeVisibility[index] & rayType) || !node.box.intersects(ray.origin, invDir, 0.0, bestT)) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (int i = node.first; i < node.first + node.count; i++) {
+					intersect(objects[i]);
+				}
+			} else if (ray.dir[node.axis] < 0.0) {
+				stack[top++] = index + 1;
+				stack[top++] = node.first;
+			} else {
+				stack[top++] = node.first;
+				stack[top++] = index + 1;
+			}
+		}
+	}
+
+	theHit = HitRecord();
+	if (closest != nullptr) {
+		closest->getHitAttributes(ray, bestT, bestPrimitive, theHit);
+	}
+}
+
+/**
+ * @fn	void BVH::findHits(const Ray &ray, RayHits &hits, unsigned int rayType) const
+ * @brief	Multi-hit query: finds the nearest hits along the ray, up to the first
+ * 			opaque one, in a single traversal. Children are visited near side first,
+ * 			and a subtree is skipped once the list has no room for anything beyond its
+ * 			box, or if nothing in it can be seen by rayType.
+ * @param 		  	ray    	The ray.
+ * @param [in,out]	hits   	The list of hits.
+ * @param 		  	rayType	The kind of ray; objects it cannot see are skipped.
+ */
+
+void BVH::findHits(const Ray &ray, RayHits &hits, unsigned int rayType) const {
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		if (unbounded[i]->isVisibleTo(rayType)) {
+			hits.add(*unbounded[i], ray);
+		}
+	}
+	if (nodes.empty()) {
+		return;
+	}
+
+	dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	int stack[BVH_MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const BVHNode &node = nodes[index];
+		if (!(nodeVisibility[index] & rayType) || !node.box.intersects(ray.origin, invDir, 0.0, hits.tMax)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				if (objects[i]->isVisibleTo(rayType)) {
+					hits.add(*objects[i], ray);
+				}
+			}
+		} else if (ray.dir[node.axis] < 0.0) {
+			stack[top++] = index + 1;
+			stack[top++] = node.first;
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+}
+
+/**
+ * @fn	void BVH::findIntersections(const Ray *rays, HitRecord hits[PACKET_SIZE], unsigned int rayType) const
+ * @brief	Packet version of findIntersection, meant for coherent rays such as
+ * 			neighboring primary rays. A node is entered if its box is hit by any ray
+ * 			that could still find a closer hit inside it, and shapes are intersected
+ * 			with the whole packet at once. Only t and the closest object are tracked
+ * 			during traversal; each ray's HitRecord is then filled in by intersecting
+ * 			that one object again, so the hits are the same as findIntersection's.
+ * @param 		  	rays   	PACKET_SIZE rays.
+ * @param [in,out]	hits   	The closest hit of each ray, or t == FLT_MAX.
+ * @param 		  	rayType	The kind of the rays; objects it cannot see are skipped.
+ */
+
+void BVH::findIntersections(const Ray *rays, HitRecord hits[PACKET_SIZE], unsigned int rayType) const {
+	RayPacket packet(rays);
+	double bestT[PACKET_SIZE];
+	VisibleIShapePtr closest[PACKET_SIZE];
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		bestT[k] = FLT_MAX;
+		closest[k] = nullptr;
+	}
+
+	auto intersect = [&](VisibleIShapePtr object) {
+		if (!object->isVisibleTo(rayType)) {
+			return;
+		}
+		double t[PACKET_SIZE];
+		object->shape->findClosestIntersections(packet, t);
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			if (t[k] < bestT[k]) {
+				bestT[k] = t[k];
+				closest[k] = object;
+			}
+		}
+	};
+
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		intersect(unbounded[i]);
+	}
+
+	if (!nodes.empty()) {
+		PacketDouble one(1.0);
+		PacketDouble invDx = one / packet.dx, invDy = one / packet.dy, invDz = one / packet.dz;
+		int stack[BVH_MAX_DEPTH + 1];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			int index = stack[--top];
+			const BVHNode &node = nodes[index];
+			if (!(nodeVisibility[index] & rayType) ||
+				!packetHitsBox(node.box, packet, invDx, invDy, invDz, PacketDouble(0.0), PacketDouble::load(bestT))) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (int i = node.first; i < node.first + node.count; i++) {
+					intersect(objects[i]);
+				}
+			} else if (rays[0].dir[node.axis] < 0.0) {
+				stack[top++] = index + 1;
+				stack[top++] = node.first;
+			} else {
+				stack[top++] = node.first;
+				stack[top++] = index + 1;
+			}
+		}
+	}
+
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		hits[k].t = FLT_MAX;
+		if (closest[k] != nullptr) {
+			closest[k]->findClosestIntersection(rays[k], hits[k]);
+		}
+	}
+}
+
+/**
+ * @fn	static void setOccluder(const IShape **occluder, const VisibleIShape &object)
+ * @brief	Records the object that ended a shadow ray's search, if it is opaque. A
+ * 			transparent object only finishes blocking light that others have dimmed,
+ * 			so it is not worth remembering.
+ * @param [in,out]	occluder	Where to record it, or nullptr.
+ * @param 		  	object  	The object.
+ */
+
+static void setOccluder(const IShape **occluder, const VisibleIShape &object) {
+	if (occluder != nullptr && object.material.alpha >= 1.0) {
+		*occluder = object.shape;
+	}
+}
+
+/**
+ * @fn	double BVH::findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder, const ObjectLinks *casters) const
+ * @brief	Any-hit query for shadow rays. Adds up the alpha of every object the ray
+ * 			hits in [tMin, tMax], in no particular order, and stops as soon as the
+ * 			total reaches 1. An opaque object (alpha 1) therefore ends the search the
+ * 			moment it is found, while transparent ones only dim the light. Objects
+ * 			hidden from SHADOW_RAYS cast no shadow, and subtrees holding only such
+ * 			objects are skipped. So are the objects not in casters.
+ * @param 		  	ray			The ray.
+ * @param 		  	tMin		Smallest t of interest.
+ * @param 		  	tMax		Largest t of interest, typically the distance to the light.
+ * @param [in,out]	occluder	If not nullptr, set to the shape of the opaque object
+ * 								that ended the search, if one did.
+ * @param 		  	casters 	If not nullptr, the only objects that can block the ray.
+ * @return	The amount of occlusion, from 0 (nothing in the way) to 1.
+ */
+
+double BVH::findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder,
+							const ObjectLinks *casters) const {
+	double occlusion = 0.0;
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		if (unbounded[i]->castsShadow(casters) && unbounded[i]->shape->hasIntersection(ray, tMin, tMax)) {
+			occlusion += unbounded[i]->material.alpha;
+			if (occlusion >= 1.0) {
+				setOccluder(occluder, *unbounded[i]);
+				return 1.0;
+			}
+		}
+	}
+	if (nodes.empty()) {
+		return occlusion;
+	}
+
+	dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	int stack[BVH_MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const BVHNode &node = nodes[index];
+		if (!(nodeVisibility[index] & SHADOW_RAYS) || !node.box.intersects(ray.origin, invDir, tMin, tMax)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				if (objects[i]->castsShadow(casters) && objects[i]->shape->hasIntersection(ray, tMin, tMax)) {
+					occlusion += objects[i]->material.alpha;
+					if (occlusion >= 1.0) {
+						setOccluder(occluder, *objects[i]);
+						return 1.0;
+					}
+				}
+			}
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+	return occlusion;
+}
+
+/**
+ * @fn	static bool boxesOverlap(const BoundingBox &a, const BoundingBox &b)
+ * @brief	Determines whether two boxes share any point.
+ * @param	a	A box.
+ * @param	b	Another box.
+ * @return	True if they overlap.
+ */
+
+static bool boxesOverlap(const BoundingBox &a, const BoundingBox &b) {
+	return a.lo.x <= b.hi.x && b.lo.x <= a.hi.x &&
+			a.lo.y <= b.hi.y && b.lo.y <= a.hi.y &&
+			a.lo.z <= b.hi.z && b.lo.z <= a.hi.z;
+}
+
+/**
+ * @fn	void BVH::findOcclusions(const Ray *rays, double tMin, const double tMax[PACKET_SIZE], double occlusion[PACKET_SIZE], const IShape **occluders, const ObjectLinks *casters) const
+ * @brief	Packet version of findOcclusion, meant for shadow rays that head for the
+ * 			same light from neighboring hits. Every segment lies inside the frustum
+ * 			spanned by the segments' ends, so a node is skipped unless its box overlaps
+ * 			the box around that frustum and at least one ray that is still lit passes
+ * 			through it. Shapes are intersected with the whole packet at once. A ray
+ * 			whose closest hit is clearly inside or clearly beyond [tMin, tMax] needs
+ * 			nothing more; one whose closest hit is near either end, or before tMin, is
+ * 			settled with hasIntersection, so each ray gets findOcclusion's answer.
+ * 			Objects are visited, and those hidden from SHADOW_RAYS or not in casters
+ * 			skipped, in the same order as findOcclusion, so alpha adds up the same way
+ * 			too.
+ * @param 		  	rays	 	PACKET_SIZE rays.
+ * @param 		  	tMin	 	Smallest t of interest.
+ * @param 		  	tMax	 	Largest t of interest along each ray. A ray with
+ * 								tMax < tMin is not traced.
+ * @param [in,out]	occlusion	The occlusion of each ray, from 0 to 1.
+ * @param [in,out]	occluders	If not nullptr, PACKET_SIZE entries, each set as
+ * 								findOcclusion sets its occluder.
+ * @param 		  	casters  	If not nullptr, the only objects that can block the rays.
+ */
+
+void BVH::findOcclusions(const Ray *rays, double tMin, const double tMax[PACKET_SIZE],
+							double occlusion[PACKET_SIZE], const IShape **occluders,
+							const ObjectLinks *casters) const {
+	RayPacket packet(rays);
+	BoundingBox frustum;
+	int lit = 0;				// bit k is set while ray k might still be lit
+	double tLit[PACKET_SIZE];	// tMax of the rays that might still be lit, -1 for the others
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		occlusion[k] = 0.0;
+		tLit[k] = -1.0;
+		if (tMax[k] >= tMin) {
+			lit |= 1 << k;
+			tLit[k] = tMax[k];
+			frustum.grow(rays[k].getPoint(tMin));
+			frustum.grow(rays[k].getPoint(tMax[k]));
+		}
+	}
+
+	auto intersect = [&](VisibleIShapePtr object) {
+		if (!object->castsShadow(casters)) {
+			return;
+		}
+		double t[PACKET_SIZE];
+		object->shape->findClosestIntersections(packet, t);
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			if (!(lit & (1 << k))) {
+				continue;
+			}
+			double margin = 1e-9 * (1.0 + t[k]);
+			bool hit;
+			if (t[k] > tMin + margin && t[k] < tMax[k] - margin) {
+				hit = true;
+			} else if (t[k] > tMax[k] + margin) {
+				hit = false;
+			} else {
+				hit = object->shape->hasIntersection(rays[k], tMin, tMax[k]);
+			}
+			if (hit) {
+				occlusion[k] += object->material.alpha;
+				if (occlusion[k] >= 1.0) {
+					occlusion[k] = 1.0;
+					setOccluder(occluders != nullptr ? &occluders[k] : nullptr, *object);
+					lit &= ~(1 << k);
+					tLit[k] = -1.0;
+				}
+			}
+		}
+	};
+
+	for (size_t i = 0; i < unbounded.size() && lit != 0; i++) {
+		intersect(unbounded[i]);
+	}
+	if (nodes.empty() || lit == 0) {
+		return;
+	}
+
+	PacketDouble one(1.0);
+	PacketDouble invDx = one / packet.dx, invDy = one / packet.dy, invDz = one / packet.dz;
+	PacketDouble t0(tMin);
+	int stack[BVH_MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0 && lit != 0) {
+		int index = stack[--top];
+		const BVHNode &node = nodes[index];
+		if (!(nodeVisibility[index] & SHADOW_RAYS) || !boxesOverlap(node.box, frustum)) {
+			continue;
+		}
+		if (!packetHitsBox(node.box, packet, invDx, invDy, invDz, t0, PacketDouble::load(tLit))) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count && lit != 0; i++) {
+				intersect(objects[i]);
+			}
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+}
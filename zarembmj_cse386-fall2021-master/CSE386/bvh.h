@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "ishape.h"
+
+const int BVH_MAX_LEAF_SIZE = 4;		//!< largest number of objects in a BVH leaf.
+const int BVH_NUM_BINS = 16;			//!< number of bins used when evaluating SAH splits.
+const int BVH_MAX_DEPTH = 48;			//!< nodes this deep in the tree always become leaves.
+const double BVH_REBUILD_RATIO = 1.5;	//!< rebuild once refitting has raised the SAH cost this much.
+
+/**
+ * @struct	BVHNode
+ * @brief	A node of a bounding volume hierarchy. Nodes are stored in one array, with
+ * 			the root first. An interior node's left child immediately follows it;
+ * 			first is the index of its right child. A leaf holds items first through
+ * 			first + count - 1 of whatever array the hierarchy was built over.
+ */
+
+struct BVHNode {
+	BoundingBox box;	//!< box around everything below this node
+	int first;			//!< right child (interior) or first item (leaf)
+	int count;			//!< number of items in a leaf, 0 for interior nodes
+	int axis;			//!< axis the node was split along
+};
+
+/**
+ * @struct	BVHBuildItem
+ * @brief	Something to be placed in a hierarchy: its index in the caller's array and
+ * 			its bounding box. The centroid is filled in by buildBVHNodes.
+ */
+
+struct BVHBuildItem {
+	int index;			//!< the item's index in the caller's array
+	BoundingBox box;	//!< the item's bounding box
+	dvec3 centroid;		//!< center of box
+};
+
+void buildBVHNodes(vector<BVHBuildItem> &items, vector<BVHNode> &nodes);
+
+/**
+ * @struct	BVH
+ * @brief	Bounding volume hierarchy over a set of visible implicit shapes. Shapes that
+ * 			have a bounding box are stored in a binary tree of boxes that is split using
+ * 			the surface area heuristic (SAH). Unbounded shapes, such as planes, are kept
+ * 			in a separate list and tested against every ray. When some objects move,
+ * 			refit updates the boxes of their leaves and of the nodes above them, which
+ * 			costs a few box unions per moved object rather than a full rebuild. The
+ * 			tree's shape is not changed, so its quality decays as objects wander from
+ * 			where they were when it was built; cost() measures this, and the tree
+ * 			should be rebuilt once needsRebuild() says so. Each node also records which
+ * 			kinds of rays can see something below it, so that a query for one kind
+ * 			skips the subtrees holding only objects hidden from it (see
+ * 			VisibleIShape::visibility). Once built or refit, the hierarchy is only
+ * 			read, so it may be traversed by many threads at once.
+ */
+
+struct BVH {
+	BVH();
+	void build(const vector<VisibleIShapePtr> &surfaces);
+	bool refit(const vector<VisibleIShapePtr> &moved);
+	double cost() const;
+	bool needsRebuild() const { return cost() > BVH_REBUILD_RATIO * builtCost; }
+	void findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType = ALL_RAYS) const;
+	void findIntersections(const Ray *rays, HitRecord hits[PACKET_SIZE], unsigned int rayType = ALL_RAYS) const;
+	void findHits(const Ray &ray, RayHits &hits, unsigned int rayType = ALL_RAYS) const;
+	double findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder = nullptr,
+							const ObjectLinks *casters = nullptr) const;
+	void findOcclusions(const Ray *rays, double tMin, const double tMax[PACKET_SIZE],
+						double occlusion[PACKET_SIZE], const IShape **occluders = nullptr,
+						const ObjectLinks *casters = nullptr) const;
+	int numNodes() const { return (int)nodes.size(); }
+	int numBoundedObjects() const { return (int)objects.size(); }
+	int numUnboundedObjects() const { return (int)unbounded.size(); }
+protected:
+	vector<BVHNode> nodes;					//!< nodes[0] is the root, if there are any bounded objects
+	vector<unsigned int> nodeVisibility;	//!< kinds of rays that can see an object below each node
+	vector<VisibleIShapePtr> objects;		//!< bounded objects, in leaf order
+	vector<VisibleIShapePtr> unbounded;		//!< objects that have no bounding box
+	vector<int> parents;					//!< parent of each node, -1 for the root
+	vector<int> leaves;						//!< the leaf that holds each of objects
+	std::unordered_map<VisibleIShapePtr, int> slots;	//!< where each bounded object is in objects
+	double weightedArea = 0.0;				//!< sum of each node's area times the cost of visiting it
+	double builtCost = 0.0;					//!< cost() when the hierarchy was last built
+	unsigned int visibilityOf(int index) const;
+	void refitNode(int index);
+};
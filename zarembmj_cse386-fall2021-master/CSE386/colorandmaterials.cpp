@@ -27,6 +27,7 @@ Material::Material(const color &amb,
 	specular = spec;
 	shininess = S;
 	alpha = 1.0;
+	reflectivity = DEFAULT_REFLECTIVITY;
 }
 
 /**
@@ -55,6 +56,7 @@ Material::Material(const color &oneColor) {
 	diffuse = specular = black;
 	shininess = 0.0;
 	alpha = 1.0;
+	reflectivity = DEFAULT_REFLECTIVITY;
 }
 
 /**
@@ -67,6 +69,7 @@ Material::Material(const color &oneColor) {
 Material Material::operator *(double w) const {
 	Material result = *this;
 	result.alpha *= w;
+	result.reflectivity *= w;
 	result.ambient *= w;
 	result.diffuse *= w;
 	result.specular *= w;
@@ -83,6 +86,7 @@ Material Material::operator *(double w) const {
 Material &Material::operator +=(const Material &mat) {
 	Material result = *this;
 	alpha += mat.alpha;
+	reflectivity += mat.reflectivity;
 	ambient += mat.ambient;
 	diffuse += mat.diffuse;
 	specular += mat.specular;
@@ -99,6 +103,7 @@ Material &Material::operator +=(const Material &mat) {
 Material Material::operator +(const Material &mat) const {
 	Material result = *this;
 	result.alpha += mat.alpha;
+	result.reflectivity += mat.reflectivity;
 	result.ambient += mat.ambient;
 	result.diffuse += mat.diffuse;
 	result.specular += mat.specular;
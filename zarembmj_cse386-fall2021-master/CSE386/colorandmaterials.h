@@ -25,6 +25,8 @@ const color gray(0.5, 0.5, 0.5);
 const color lightGray(0.8, 0.8, 0.8);
 const color darkGray(0.3, 0.3, 0.3);
 
+const double DEFAULT_REFLECTIVITY = 0.1;	//!< fraction of an opaque surface's color that comes from its reflection.
+
 /**
  * @struct	Material
  * @brief	Represents all the material information.
@@ -36,6 +38,7 @@ struct Material {
 	color specular;		//!< specular material property
 	double shininess;	//!< shininess material property
 	double alpha;		//!< alpha value of object. 1 if opaque.
+	double reflectivity;	//!< weight of the reflected color. 0 if the surface does not reflect.
 	Material() : Material(black, black, black, 0.0) { }
 	Material(const color &amb, const color &diff,
 			const color &spec, double shininess);
@@ -0,0 +1,433 @@
+#include <map>
+#include <array>
+#include <algorithm>
+#include <typeinfo>
+#include "compactscene.h"
+
+typedef std::array<double, 12> MaterialKey;
+
+/**
+ * @fn	static MaterialKey materialKey(const Material &mat)
+ * @brief	Packs every field of a material into a key, so that identical materials can
+ * 			share one entry of the material table.
+ * @param	mat	The material.
+ * @return	The key.
+ */
+
+static MaterialKey materialKey(const Material &mat) {
+	return MaterialKey{ mat.ambient.r, mat.ambient.g, mat.ambient.b,
+						mat.diffuse.r, mat.diffuse.g, mat.diffuse.b,
+						mat.specular.r, mat.specular.g, mat.specular.b,
+						mat.shininess, mat.alpha, mat.reflectivity };
+}
+
+/**
+ * @fn	void CompactScene::build(const vector<VisibleIShapePtr> &surfaces)
+ * @brief	Copies the shapes into the typed arrays, replacing whatever was there. Shapes
+ * 			are matched by their exact type, so a subclass that changes how a shape is
+ * 			intersected is handled through its virtual functions, like any other type.
+ * @param	surfaces	The shapes.
+ */
+
+void CompactScene::build(const vector<VisibleIShapePtr> &surfaces) {
+	*this = CompactScene();
+	std::map<MaterialKey, uint32_t> materialIndex;
+
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		const VisibleIShape &surface = *surfaces[i];
+		MaterialKey key = materialKey(surface.material);
+		auto found = materialIndex.find(key);
+		if (found == materialIndex.end()) {
+			found = materialIndex.insert(std::make_pair(key, (uint32_t)materials.size())).first;
+			materials.push_back(surface.material);
+		}
+		uint32_t object = (uint32_t)objects.size();
+		objects.push_back(Object{ surface.shape, &surface, found->second, surface.texture, surface.visibility });
+		hiddenFrom |= ALL_RAYS & ~surface.visibility;
+
+		const IShape &shape = *surface.shape;
+		const std::type_info &type = typeid(shape);
+		if (type == typeid(ISphere)) {
+			const ISphere &sphere = (const ISphere &)shape;
+			spheres.add(sphere.center, sphere.intersector, object);
+		} else if (type == typeid(IPlane)) {
+			const IPlane &plane = (const IPlane &)shape;
+			planes.px.push_back(plane.a.x);
+			planes.py.push_back(plane.a.y);
+			planes.pz.push_back(plane.a.z);
+			planes.nx.push_back(plane.n.x);
+			planes.ny.push_back(plane.n.y);
+			planes.nz.push_back(plane.n.z);
+			planes.object.push_back(object);
+		} else if (type == typeid(IDisk)) {
+			const IDisk &disk = (const IDisk &)shape;
+			disks.cx.push_back(disk.center.x);
+			disks.cy.push_back(disk.center.y);
+			disks.cz.push_back(disk.center.z);
+			disks.nx.push_back(disk.n.x);
+			disks.ny.push_back(disk.n.y);
+			disks.nz.push_back(disk.n.z);
+			disks.radiusSq.push_back(disk.radius * disk.radius);
+			disks.object.push_back(object);
+		} else if (type == typeid(ICylinderY)) {
+			const ICylinderY &cylinder = (const ICylinderY &)shape;
+			cylindersY.add(cylinder.center, cylinder.intersector, object);
+		} else if (type == typeid(ICylinderZ)) {
+			const ICylinderZ &cylinder = (const ICylinderZ &)shape;
+			cylindersZ.add(cylinder.center, cylinder.intersector, object);
+		} else if (type == typeid(IConeY)) {
+			const IConeY &cone = (const IConeY &)shape;
+			cones.add(cone.center, cone.intersector, object);
+		} else if (type == typeid(IEllipsoid)) {
+			const IEllipsoid &ellipsoid = (const IEllipsoid &)shape;
+			ellipsoids.add(ellipsoid.center, ellipsoid.intersector, object);
+		} else if (type == typeid(IQuadricSurface)) {
+			addQuadric((const IQuadricSurface &)shape, object);
+		} else {
+			others.push_back(object);
+		}
+	}
+}
+
+/**
+ * @fn	template <typename Intersector> void CompactScene::ClosedFormArrays<Intersector>::add(const dvec3 &center, const Intersector &intersector, uint32_t index)
+ * @brief	Appends a quadric to the arrays.
+ * @param	center	   	The quadric's center.
+ * @param	intersector	The quadric's intersector.
+ * @param	index	   	Index of the quadric in objects.
+ */
+
+template <typename Intersector>
+void CompactScene::ClosedFormArrays<Intersector>::add(const dvec3 &center, const Intersector &intersector,
+														uint32_t index) {
+	cx.push_back(center.x);
+	cy.push_back(center.y);
+	cz.push_back(center.z);
+	shape.push_back(intersector);
+	object.push_back(index);
+}
+
+/**
+ * @fn	void CompactScene::addQuadric(const IQuadricSurface &quadric, uint32_t object)
+ * @brief	Appends a general quadric to the quadric arrays.
+ * @param	quadric	The quadric.
+ * @param	object 	Index of the quadric in objects.
+ */
+
+void CompactScene::addQuadric(const IQuadricSurface &quadric, uint32_t object) {
+	const QuadricParameters &params = quadric.getParameters();
+	quadrics.cx.push_back(quadric.center.x);
+	quadrics.cy.push_back(quadric.center.y);
+	quadrics.cz.push_back(quadric.center.z);
+	quadrics.A.push_back(params.A);
+	quadrics.B.push_back(params.B);
+	quadrics.C.push_back(params.C);
+	quadrics.D.push_back(params.D);
+	quadrics.E.push_back(params.E);
+	quadrics.F.push_back(params.F);
+	quadrics.G.push_back(params.G);
+	quadrics.H.push_back(params.H);
+	quadrics.I.push_back(params.I);
+	quadrics.J.push_back(params.J);
+	quadrics.object.push_back(object);
+}
+
+/**
+ * @fn	template <typename Intersector> void CompactScene::findClosest(const ClosedFormArrays<Intersector> &arrays, const Ray &ray, unsigned int rayType, double &bestT, uint32_t &bestObject) const
+ * @brief	Intersects a ray with every quadric of one type that it can see, keeping the
+ * 			closest hit.
+ * @param 		  	arrays	  	The quadrics.
+ * @param 		  	ray		  	The ray.
+ * @param 		  	rayType	  	The kind of ray.
+ * @param [in,out]	bestT	  	t of the closest hit so far.
+ * @param [in,out]	bestObject	The object that was hit at bestT.
+ */
+
+template <typename Intersector>
+void CompactScene::findClosest(const ClosedFormArrays<Intersector> &arrays, const Ray &ray, unsigned int rayType,
+								double &bestT, uint32_t &bestObject) const {
+	for (size_t i = 0; i < arrays.object.size(); i++) {
+		if (isHidden(arrays.object[i], rayType)) {
+			continue;
+		}
+		double t = closestRoot(arrays.shape[i], dvec3(arrays.cx[i], arrays.cy[i], arrays.cz[i]), ray);
+		if (t < bestT) {
+			bestT = t;
+			bestObject = arrays.object[i];
+		}
+	}
+}
+
+/**
+ * @fn	template <typename Intersector> bool CompactScene::findOcclusion(const ClosedFormArrays<Intersector> &arrays, const Ray &ray, double tMin, double tMax, double &sha, const IShape **occluder, const ObjectLinks *casters) const
+ * @brief	Adds the alpha of every quadric of one type, other than those that cast no
+ * 			shadow, that the ray hits between tMin and tMax.
+ * @param 		  	arrays	The quadrics.
+ * @param 		  	ray   	The ray.
+ * @param 		  	tMin  	Smallest t of interest.
+ * @param 		  	tMax  	Largest t of interest.
+ * @param [in,out]	sha   	The total alpha so far.
+ * @param [in,out]	occluder	As in addAlpha.
+ * @param 		  	casters 	If not nullptr, the only objects that can block the ray.
+ * @return	true once the light is completely blocked.
+ */
+
+template <typename Intersector>
+bool CompactScene::findOcclusion(const ClosedFormArrays<Intersector> &arrays, const Ray &ray,
+									double tMin, double tMax, double &sha,
+									const IShape **occluder, const ObjectLinks *casters) const {
+	for (size_t i = 0; i < arrays.object.size(); i++) {
+		if (castsNoShadow(arrays.object[i], casters)) {
+			continue;
+		}
+		if (anyRoot(arrays.shape[i], dvec3(arrays.cx[i], arrays.cy[i], arrays.cz[i]), ray, tMin, tMax) &&
+			addAlpha(arrays.object[i], sha, occluder)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool CompactScene::addAlpha(uint32_t object, double &sha, const IShape **occluder) const
+ * @brief	Adds a blocker's alpha to the total.
+ * @param 		  	object  	The blocker.
+ * @param [in,out]	sha	    	The total alpha.
+ * @param [in,out]	occluder	If not nullptr, set to the blocker's shape if it is
+ * 								opaque and completes the block.
+ * @return	true once the light is completely blocked.
+ */
+
+bool CompactScene::addAlpha(uint32_t object, double &sha, const IShape **occluder) const {
+	double alpha = materials[objects[object].material].alpha;
+	sha += alpha;
+	if (sha < 1.0) {
+		return false;
+	}
+	if (occluder != nullptr && alpha >= 1.0) {
+		*occluder = objects[object].shape;
+	}
+	return true;
+}
+
+/**
+ * @fn	void CompactScene::findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType) const
+ * @brief	Finds the closest shape hit by a ray. Each loop below only computes t, with
+ * 			the same arithmetic as the corresponding shape's intersection routine (the
+ * 			quadrics with closed-form intersectors call that very routine). Once the
+ * 			closest shape is known, its getHitAttributes fills in theHit from that t,
+ * 			so the hit is exactly what VisibleIShape::findIntersection reports.
+ * 			Shapes kept in the typed arrays have a single primitive, 0.
+ * @param 		  	ray    	The ray.
+ * @param [in,out]	theHit 	The closest hit, or t == FLT_MAX if nothing was hit.
+ * @param 		  	rayType	The kind of ray; shapes it cannot see are skipped.
+ */
+
+void CompactScene::findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType) const {
+	const double ox = ray.origin.x, oy = ray.origin.y, oz = ray.origin.z;
+	const double dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+	double bestT = FLT_MAX;
+	uint32_t bestObject = 0;
+	int bestPrimitive = 0;
+
+	findClosest(spheres, ray, rayType, bestT, bestObject);
+	findClosest(cylindersY, ray, rayType, bestT, bestObject);
+	findClosest(cylindersZ, ray, rayType, bestT, bestObject);
+	findClosest(cones, ray, rayType, bestT, bestObject);
+	findClosest(ellipsoids, ray, rayType, bestT, bestObject);
+
+	for (size_t i = 0; i < planes.px.size(); i++) {
+		if (isHidden(planes.object[i], rayType)) {
+			continue;
+		}
+		double denom = dx * planes.nx[i] + dy * planes.ny[i] + dz * planes.nz[i];
+		double num = (planes.px[i] - ox) * planes.nx[i] + (planes.py[i] - oy) * planes.ny[i] +
+						(planes.pz[i] - oz) * planes.nz[i];
+		double t = num / denom;
+		if (denom != 0 && t >= 0 && t < bestT) {
+			bestT = t;
+			bestObject = planes.object[i];
+		}
+	}
+
+	for (size_t i = 0; i < disks.cx.size(); i++) {
+		if (isHidden(disks.object[i], rayType)) {
+			continue;
+		}
+		double denom = dx * disks.nx[i] + dy * disks.ny[i] + dz * disks.nz[i];
+		double num = (disks.cx[i] - ox) * disks.nx[i] + (disks.cy[i] - oy) * disks.ny[i] +
+						(disks.cz[i] - oz) * disks.nz[i];
+		double t = num / denom;
+		if (denom != 0 && t >= 0 && t < bestT) {
+			double px = ox + t * dx - disks.cx[i];
+			double py = oy + t * dy - disks.cy[i];
+			double pz = oz + t * dz - disks.cz[i];
+			if (px * px + py * py + pz * pz <= disks.radiusSq[i]) {
+				bestT = t;
+				bestObject = disks.object[i];
+			}
+		}
+	}
+
+	for (size_t i = 0; i < quadrics.cx.size(); i++) {
+		if (isHidden(quadrics.object[i], rayType)) {
+			continue;
+		}
+		double Rox = ox - quadrics.cx[i], Roy = oy - quadrics.cy[i], Roz = oz - quadrics.cz[i];
+		double A = quadrics.A[i], B = quadrics.B[i], C = quadrics.C[i];
+		double D = quadrics.D[i], E = quadrics.E[i], F = quadrics.F[i];
+		double G = quadrics.G[i], H = quadrics.H[i], I = quadrics.I[i];
+		double Aq = A * (dx * dx) + B * (dy * dy) + C * (dz * dz) +
+					D * (dx * dy) + E * (dx * dz) + F * (dy * dz);
+		double Bq = (2.0 * A) * Rox * dx + (2.0 * B) * Roy * dy + (2.0 * C) * Roz * dz +
+					D * (Rox * dy + Roy * dx) + E * (Rox * dz + Roz * dx) + F * (Roy * dz + Roz * dy) +
+					G * dx + H * dy + I * dz;
+		double Cq = A * (Rox * Rox) + B * (Roy * Roy) + C * (Roz * Roz) +
+					D * (Rox * Roy) + E * (Rox * Roz) + F * (Roy * Roz) +
+					G * Rox + H * Roy + I * Roz + quadrics.J[i];
+
+		// As in quadratic(), a tangent ray or a linear equation is a miss.
+		double disc = Bq * Bq - 4.0 * Aq * Cq;
+		if (Aq == 0 || !(disc > 0)) {
+			continue;
+		}
+		double root = std::sqrt(disc);
+		double r0 = (-Bq + root) / (2.0 * Aq);
+		double r1 = (-Bq - root) / (2.0 * Aq);
+		double roots[2] = { std::min(r0, r1), std::max(r0, r1) };
+		for (int k = 0; k < 2 && roots[k] < bestT; k++) {
+			if (roots[k] > 0) {
+				bestT = roots[k];
+				bestObject = quadrics.object[i];
+				break;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < others.size(); i++) {
+		if (isHidden(others[i], rayType)) {
+			continue;
+		}
+		int primitive;
+		double t = objects[others[i]].shape->findClosestHit(ray, primitive);
+		if (t < bestT) {
+			bestT = t;
+			bestObject = others[i];
+			bestPrimitive = primitive;
+		}
+	}
+
+	theHit = HitRecord();
+	if (bestT != FLT_MAX) {
+		const Object &object = objects[bestObject];
+		object.shape->getHitAttributes(ray, bestT, bestPrimitive, theHit);
+		if (!object.shape->hasOwnMaterials()) {
+			theHit.material = materials[object.material];
+		}
+		theHit.texture = object.texture;
+		theHit.object = object.surface;
+	}
+}
+
+/**
+ * @fn	double CompactScene::findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder, const ObjectLinks *casters) const
+ * @brief	Adds up the alpha of every shape the ray hits between tMin and tMax, stopping
+ * 			as soon as the total reaches 1. Shapes hidden from SHADOW_RAYS, or not in
+ * 			casters, cast no shadow. Gives the same result as BVH::findOcclusion.
+ * @param 		  	ray			The ray.
+ * @param 		  	tMin		Smallest t of interest.
+ * @param 		  	tMax		Largest t of interest.
+ * @param [in,out]	occluder	If not nullptr, set to the shape of the opaque object
+ * 								that ended the search, if one did.
+ * @param 		  	casters 	If not nullptr, the only objects that can block the ray.
+ * @return	The total alpha, from 0 (nothing in the way) to 1 (fully blocked).
+ */
+
+double CompactScene::findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder,
+									const ObjectLinks *casters) const {
+	const double ox = ray.origin.x, oy = ray.origin.y, oz = ray.origin.z;
+	const double dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+	double sha = 0.0;
+
+	if (findOcclusion(spheres, ray, tMin, tMax, sha, occluder, casters) ||
+		findOcclusion(cylindersY, ray, tMin, tMax, sha, occluder, casters) ||
+		findOcclusion(cylindersZ, ray, tMin, tMax, sha, occluder, casters) ||
+		findOcclusion(cones, ray, tMin, tMax, sha, occluder, casters) ||
+		findOcclusion(ellipsoids, ray, tMin, tMax, sha, occluder, casters)) {
+		return 1.0;
+	}
+
+	for (size_t i = 0; i < planes.px.size(); i++) {
+		if (castsNoShadow(planes.object[i], casters)) {
+			continue;
+		}
+		double denom = dx * planes.nx[i] + dy * planes.ny[i] + dz * planes.nz[i];
+		double num = (planes.px[i] - ox) * planes.nx[i] + (planes.py[i] - oy) * planes.ny[i] +
+						(planes.pz[i] - oz) * planes.nz[i];
+		double t = num / denom;
+		if (denom != 0 && t >= 0 && t >= tMin && t <= tMax && addAlpha(planes.object[i], sha, occluder)) {
+			return 1.0;
+		}
+	}
+
+	for (size_t i = 0; i < disks.cx.size(); i++) {
+		if (castsNoShadow(disks.object[i], casters)) {
+			continue;
+		}
+		double denom = dx * disks.nx[i] + dy * disks.ny[i] + dz * disks.nz[i];
+		double num = (disks.cx[i] - ox) * disks.nx[i] + (disks.cy[i] - oy) * disks.ny[i] +
+						(disks.cz[i] - oz) * disks.nz[i];
+		double t = num / denom;
+		if (denom != 0 && t >= 0 && t >= tMin && t <= tMax) {
+			double px = ox + t * dx - disks.cx[i];
+			double py = oy + t * dy - disks.cy[i];
+			double pz = oz + t * dz - disks.cz[i];
+			if (px * px + py * py + pz * pz <= disks.radiusSq[i] && addAlpha(disks.object[i], sha, occluder)) {
+				return 1.0;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < quadrics.cx.size(); i++) {
+		if (castsNoShadow(quadrics.object[i], casters)) {
+			continue;
+		}
+		double Rox = ox - quadrics.cx[i], Roy = oy - quadrics.cy[i], Roz = oz - quadrics.cz[i];
+		double A = quadrics.A[i], B = quadrics.B[i], C = quadrics.C[i];
+		double D = quadrics.D[i], E = quadrics.E[i], F = quadrics.F[i];
+		double G = quadrics.G[i], H = quadrics.H[i], I = quadrics.I[i];
+		double Aq = A * (dx * dx) + B * (dy * dy) + C * (dz * dz) +
+					D * (dx * dy) + E * (dx * dz) + F * (dy * dz);
+		double Bq = (2.0 * A) * Rox * dx + (2.0 * B) * Roy * dy + (2.0 * C) * Roz * dz +
+					D * (Rox * dy + Roy * dx) + E * (Rox * dz + Roz * dx) + F * (Roy * dz + Roz * dy) +
+					G * dx + H * dy + I * dz;
+		double Cq = A * (Rox * Rox) + B * (Roy * Roy) + C * (Roz * Roz) +
+					D * (Rox * Roy) + E * (Rox * Roz) + F * (Roy * Roz) +
+					G * Rox + H * Roy + I * Roz + quadrics.J[i];
+		double disc = Bq * Bq - 4.0 * Aq * Cq;
+		if (Aq == 0 || !(disc > 0)) {
+			continue;
+		}
+		double root = std::sqrt(disc);
+		double roots[2] = { (-Bq + root) / (2.0 * Aq), (-Bq - root) / (2.0 * Aq) };
+		for (int k = 0; k < 2; k++) {
+			double t = roots[k];
+			if (t >= 0 && t >= tMin && t <= tMax) {
+				if (addAlpha(quadrics.object[i], sha, occluder)) {
+					return 1.0;
+				}
+				break;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < others.size(); i++) {
+		if (castsNoShadow(others[i], casters)) {
+			continue;
+		}
+		if (objects[others[i]].shape->hasIntersection(ray, tMin, tMax) && addAlpha(others[i], sha, occluder)) {
+			return 1.0;
+		}
+	}
+	return sha;
+}
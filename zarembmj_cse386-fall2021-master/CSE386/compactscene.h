@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "ishape.h"
+
+/**
+ * @struct	CompactScene
+ * @brief	A flat copy of a set of visible shapes, for scenes small enough that every
+ * 			shape can be tested against every ray. Spheres, planes, disks and quadrics
+ * 			are sorted into structure-of-arrays storage: each coordinate and parameter
+ * 			of a shape type has its own contiguous array, so the intersection loops
+ * 			stream through memory with no pointers to follow and no virtual calls.
+ * 			Spheres, cylinders, cones and ellipsoids go through the same closed-form
+ * 			routines as the shapes themselves, instantiated once per type.
+ * 			Materials are stored once, in a table indexed by 32-bit ints. Only the
+ * 			closest hit's HitRecord is filled in, by the original shape. Shapes of any
+ * 			other type are intersected through their virtual functions. A shape hidden
+ * 			from a kind of ray (see VisibleIShape::visibility) is passed over for it;
+ * 			when every shape can be seen by a kind of ray, its loops do not look.
+ * 			Once built, the scene is only read, so it may be traced by many threads at
+ * 			once.
+ */
+
+struct CompactScene {
+	void build(const vector<VisibleIShapePtr> &surfaces);
+	void findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType = ALL_RAYS) const;
+	double findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder = nullptr,
+							const ObjectLinks *casters = nullptr) const;
+	int numObjects() const { return (int)objects.size(); }
+	int numMaterials() const { return (int)materials.size(); }
+protected:
+	/**
+	 * @struct	Object
+	 * @brief	What the intersection loops need to know about a shape once it is hit.
+	 */
+
+	struct Object {
+		const IShape *shape;	//!< the original shape, used to fill in the closest hit
+		const VisibleIShape *surface;	//!< the visible shape it belongs to
+		uint32_t material;		//!< index into materials
+		Image *texture;			//!< the shape's texture, if any
+		unsigned int visibility;	//!< the kinds of rays that can see the shape
+	};
+
+	/**
+	 * @struct	ClosedFormArrays
+	 * @brief	The quadrics of one type that has a closed-form intersector (see
+	 * 			intersectors.h), one entry per quadric in each array.
+	 */
+
+	template <typename Intersector>
+	struct ClosedFormArrays {
+		vector<double> cx, cy, cz;		//!< centers
+		vector<Intersector> shape;		//!< the numbers the intersector needs
+		vector<uint32_t> object;		//!< index into objects
+		void add(const dvec3 &center, const Intersector &intersector, uint32_t index);
+	};
+
+	/**
+	 * @struct	PlaneArrays
+	 * @brief	The planes, one entry per plane in each array.
+	 */
+
+	struct PlaneArrays {
+		vector<double> px, py, pz;		//!< points on the planes
+		vector<double> nx, ny, nz;		//!< normals
+		vector<uint32_t> object;		//!< index into objects
+	};
+
+	/**
+	 * @struct	DiskArrays
+	 * @brief	The disks, one entry per disk in each array.
+	 */
+
+	struct DiskArrays {
+		vector<double> cx, cy, cz;		//!< centers
+		vector<double> nx, ny, nz;		//!< normals
+		vector<double> radiusSq;		//!< squared radii
+		vector<uint32_t> object;		//!< index into objects
+	};
+
+	/**
+	 * @struct	QuadricArrays
+	 * @brief	General quadrics, one entry per quadric in each array.
+	 */
+
+	struct QuadricArrays {
+		vector<double> cx, cy, cz;						//!< centers
+		vector<double> A, B, C, D, E, F, G, H, I, J;	//!< quadric parameters
+		vector<uint32_t> object;						//!< index into objects
+	};
+
+	vector<Material> materials;			//!< every distinct material
+	vector<Object> objects;				//!< every shape, in the order given to build
+	ClosedFormArrays<SphereIntersector> spheres;			//!< ISpheres
+	ClosedFormArrays<CylinderYIntersector> cylindersY;		//!< ICylinderYs
+	ClosedFormArrays<CylinderZIntersector> cylindersZ;		//!< ICylinderZs
+	ClosedFormArrays<ConeYIntersector> cones;				//!< IConeYs
+	ClosedFormArrays<EllipsoidIntersector> ellipsoids;		//!< IEllipsoids
+	PlaneArrays planes;					//!< IPlanes
+	DiskArrays disks;					//!< IDisks
+	QuadricArrays quadrics;				//!< general quadrics
+	vector<uint32_t> others;			//!< objects of any other type
+	unsigned int hiddenFrom = 0;		//!< kinds of rays that cannot see at least one object
+	bool isHidden(uint32_t object, unsigned int rayType) const {
+		return (hiddenFrom & rayType) != 0 && (objects[object].visibility & rayType) == 0;
+	}
+	bool castsNoShadow(uint32_t object, const ObjectLinks *casters) const {
+		return isHidden(object, SHADOW_RAYS) || (casters != nullptr && !casters->contains(objects[object].surface));
+	}
+	void addQuadric(const IQuadricSurface &quadric, uint32_t object);
+	bool addAlpha(uint32_t object, double &sha, const IShape **occluder) const;
+	template <typename Intersector>
+	void findClosest(const ClosedFormArrays<Intersector> &arrays, const Ray &ray, unsigned int rayType,
+						double &bestT, uint32_t &bestObject) const;
+	template <typename Intersector>
+	bool findOcclusion(const ClosedFormArrays<Intersector> &arrays, const Ray &ray,
+						double tMin, double tMax, double &sha, const IShape **occluder,
+						const ObjectLinks *casters) const;
+};
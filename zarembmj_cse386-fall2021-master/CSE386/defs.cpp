@@ -8,6 +8,7 @@
  ****************************************************/
 
 #include <iostream>
+#include <algorithm>
 #include "defs.h"
 #include "utilities.h"
 
@@ -174,3 +175,141 @@ void Frame::setFrame(const dvec3 &O, const dvec3 &U, const dvec3 &V, const dvec3
 	setInverse();
 }
 
+
+/**
+ * @fn	BoundingBox::BoundingBox()
+ * @brief	Constructs an empty bounding box. Growing it by any point gives a box
+ * 			around just that point.
+ */
+
+BoundingBox::BoundingBox()
+	: lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX) {
+}
+
+/**
+ * @fn	BoundingBox::BoundingBox(const dvec3 &low, const dvec3 &high)
+ * @brief	Constructs a bounding box from two opposite corners.
+ * @param	low 	Corner with the smallest coordinates.
+ * @param	high	Corner with the largest coordinates.
+ */
+
+BoundingBox::BoundingBox(const dvec3 &low, const dvec3 &high)
+	: lo(low), hi(high) {
+}
+
+/**
+ * @fn	void BoundingBox::grow(const dvec3 &pt)
+ * @brief	Enlarges the box, if need be, so that it contains a point.
+ * @param	pt	The point.
+ */
+
+void BoundingBox::grow(const dvec3 &pt) {
+	lo = glm::min(lo, pt);
+	hi = glm::max(hi, pt);
+}
+
+/**
+ * @fn	void BoundingBox::grow(const BoundingBox &box)
+ * @brief	Enlarges the box, if need be, so that it contains another box.
+ * @param	box	The other box.
+ */
+
+void BoundingBox::grow(const BoundingBox &box) {
+	lo = glm::min(lo, box.lo);
+	hi = glm::max(hi, box.hi);
+}
+
+/**
+ * @fn	bool BoundingBox::isEmpty() const
+ * @brief	Determines if the box contains no points at all.
+ * @return	true iff the box is empty.
+ */
+
+bool BoundingBox::isEmpty() const {
+	return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z;
+}
+
+/**
+ * @fn	dvec3 BoundingBox::center() const
+ * @brief	Gets the center of the box.
+ * @return	The center of the box.
+ */
+
+dvec3 BoundingBox::center() const {
+	return (lo + hi) * 0.5;
+}
+
+/**
+ * @fn	double BoundingBox::surfaceArea() const
+ * @brief	Computes the surface area of the box. Used by the surface area heuristic.
+ * @return	The surface area, or 0 if the box is empty.
+ */
+
+double BoundingBox::surfaceArea() const {
+	if (isEmpty()) {
+		return 0.0;
+	}
+	dvec3 d = hi - lo;
+	return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+/**
+ * @fn	BoundingBox BoundingBox::padded() const
+ * @brief	Grows the box by a small amount so that intersection points that land a
+ * 			rounding error outside an object's exact bounds are still found.
+ * @return	The padded box.
+ */
+
+BoundingBox BoundingBox::padded() const {
+	dvec3 m = glm::max(glm::abs(lo), glm::abs(hi));
+	double pad = 1.0E-6 * (1.0 + std::max(m.x, std::max(m.y, m.z)));
+	dvec3 d(pad, pad, pad);
+	return BoundingBox(lo - d, hi + d);
+}
+
+/**
+ * @fn	bool BoundingBox::intersects(const dvec3 &origin, const dvec3 &invDir, double tMin, double tMax) const
+ * @brief	Slab test of a ray against the box. A ray that runs parallel to a pair of
+ * 			slabs and starts exactly on one of them produces NaNs; the comparisons
+ * 			in clip ignore those, so such rays are (conservatively) reported as hits.
+ * @param	origin	The ray's origin.
+ * @param	invDir	1/ray.dir, component-wise.
+ * @param	tMin  	Smallest t of interest.
+ * @param	tMax  	Largest t of interest.
+ * @return	true iff the ray passes through the box somewhere in [tMin, tMax].
+ */
+
+bool BoundingBox::intersects(const dvec3 &origin, const dvec3 &invDir, double tMin, double tMax) const {
+	return clip(origin, invDir, tMin, tMax);
+}
+
+/**
+ * @fn	bool BoundingBox::clip(const dvec3 &origin, const dvec3 &invDir, double &tMin, double &tMax) const
+ * @brief	Narrows a ray's interval to the part inside the box, with the same slab
+ * 			test as intersects.
+ * @param 		  	origin	The ray's origin.
+ * @param 		  	invDir	1/ray.dir, component-wise.
+ * @param [in,out]	tMin  	Start of the interval.
+ * @param [in,out]	tMax  	End of the interval.
+ * @return	false if the ray misses the box in [tMin, tMax].
+ */
+
+bool BoundingBox::clip(const dvec3 &origin, const dvec3 &invDir, double &tMin, double &tMax) const {
+	for (int i = 0; i < 3; i++) {
+		double t0 = (lo[i] - origin[i]) * invDir[i];
+		double t1 = (hi[i] - origin[i]) * invDir[i];
+		if (t0 > t1) {
+			std::swap(t0, t1);
+		}
+		if (t0 > tMin) {
+			tMin = t0;
+		}
+		if (t1 < tMax) {
+			tMax = t1;
+		}
+		if (tMin > tMax) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -18,8 +18,13 @@
 #include <limits>
 
 // Glut takes care of all the system-specific chores required for creating windows, 
-// initializing OpenGL contexts, and handling input events
+// initializing OpenGL contexts, and handling input events. Console only builds, such
+// as the headless renderer, do not use OpenGL at all.
+#ifndef CONSOLE_ONLY
 #include <GL/freeglut.h>
+#else
+typedef unsigned char GLubyte;
+#endif
 
 #define GLM_FORCE_CTOR_INIT
 #define GLM_FORCE_SWIZZLE  // Enable GLM "swizzle" operators
@@ -89,6 +94,26 @@ struct BoundingBoxi {
 	}
 };
 
+/**
+ * @struct	BoundingBox
+ * @brief	An axis-aligned bounding box in 3D. A default constructed box is empty.
+ */
+
+struct BoundingBox {
+	dvec3 lo;		//!< corner with the smallest x, y and z values
+	dvec3 hi;		//!< corner with the largest x, y and z values
+	BoundingBox();
+	BoundingBox(const dvec3 &low, const dvec3 &high);
+	void grow(const dvec3 &pt);
+	void grow(const BoundingBox &box);
+	bool isEmpty() const;
+	dvec3 center() const;
+	double surfaceArea() const;
+	BoundingBox padded() const;
+	bool intersects(const dvec3 &origin, const dvec3 &invDir, double tMin, double tMax) const;
+	bool clip(const dvec3 &origin, const dvec3 &invDir, double &tMin, double &tMax) const;
+};
+
 /**
  * @struct	Frame
  * @brief	Represents a coordinate frame
@@ -105,6 +105,10 @@ void keyboardUtility(unsigned char key, int x, int y) {
 	case '+':
 		scene.antiAliasing = 3;
 		break;
+	case '*':
+		scene.adaptiveAntiAliasing = !scene.adaptiveAntiAliasing;
+		cout << "Adaptive anti-aliasing: " << (scene.adaptiveAntiAliasing ? "on" : "off") << endl;
+		break;
 	case '0':
 		scene.numReflections = 0;
 		break;
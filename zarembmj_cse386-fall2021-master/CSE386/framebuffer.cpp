@@ -7,6 +7,7 @@
  * permission is granted.
  ****************************************************/
 
+#include <fstream>
 #include "defs.h"
 #include "utilities.h"
 #include "framebuffer.h"
@@ -18,7 +19,8 @@
  * @param	height	The height.
  */
 
-FrameBuffer::FrameBuffer(const int width, const int height) {
+FrameBuffer::FrameBuffer(const int width, const int height)
+	: colorBuffer(nullptr), depthBuffer(nullptr) {
 	setFrameBufferSize(width, height);
 }
 
@@ -87,9 +89,33 @@ void FrameBuffer::clearColorAndDepthBuffers() {
  */
 
 void FrameBuffer::showColorBuffer() const {
+#ifndef CONSOLE_ONLY
 	glRasterPos2d(-1, -1);
 	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, colorBuffer);
 	glFlush();
+#endif
+}
+
+/**
+ * @fn	bool FrameBuffer::writePPM(const std::string &fileName) const
+ * @brief	Writes the color buffer to a binary (P6) PPM file. Row 0 of the color buffer
+ * 			is the bottom of the image, so rows are written in reverse order.
+ * @param	fileName	Name of the file to write.
+ * @return	True if the file was written.
+ */
+
+bool FrameBuffer::writePPM(const std::string &fileName) const {
+	std::ofstream output(fileName.c_str(), std::ios::binary);
+	if (!output) {
+		std::cerr << "Unable to open " << fileName << " for writing" << endl;
+		return false;
+	}
+	output << "P6\n" << width << ' ' << height << "\n255\n";
+	for (int y = height - 1; y >= 0; y--) {
+		output.write((const char *)(colorBuffer + BYTES_PER_PIXEL * y * width),
+						BYTES_PER_PIXEL * width);
+	}
+	return (bool)output;
 }
 
 /**
@@ -37,6 +37,7 @@ struct FrameBuffer {
 
 	void clearColorAndDepthBuffers();
 	void showColorBuffer() const;
+	bool writePPM(const std::string &fileName) const;
 	int getWindowWidth() const { return width; }
 	int getWindowHeight() const { return height; }
 
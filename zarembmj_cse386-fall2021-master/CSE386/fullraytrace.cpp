@@ -83,10 +83,11 @@ void resize(int width, int height) {
 IPlane *plane = new IPlane(dvec3(0.0, -2.0, 0.0), dvec3(0.0, 1.0, 0.0));
 IPlane *clearPlane = new IPlane(dvec3(0.0, 0.0, 0.0), dvec3(0.0, 0.0, -1.0));
 ISphere *sphere1 = new ISphere(dvec3(0.0, 4.0, 0.0), 2.0);
+VisibleIShapePtr clearPlaneObj = new VisibleIShape(clearPlane, Material(red, red, red, 0.0));
 
 void buildScene() {
 	scene.addOpaqueObject(new VisibleIShape(plane, tin));
-	scene.addTransparentObject(new VisibleIShape(clearPlane, Material(red, red, red, 0.0)), 0.25);
+	scene.addTransparentObject(clearPlaneObj, 0.25);
 	scene.addOpaqueObject(new VisibleIShape(sphere1, gold));
 
 	scene.addLight(lights[0]);
@@ -112,6 +113,7 @@ void timer(int id) {
 		}
 	}
 	clearPlane->a = dvec3(0, 0, z);
+	scene.markMoved(clearPlaneObj);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	glutPostRedisplay();
 }
@@ -197,6 +199,11 @@ void keyboard(unsigned char key, int x, int y) {
 				break;
 	case 'M':
 	case 'm':	break;
+	case 'S':
+	case 's':	clearPlaneObj->visibility ^= SHADOW_RAYS;
+				scene.markMoved(clearPlaneObj);
+				cout << (clearPlaneObj->isVisibleTo(SHADOW_RAYS) ? "Clear plane casts shadows" : "Clear plane casts no shadows") << endl;
+				break;
 	case '+':	antiAliasing = 3; 
 				cout << "Anti aliasing: " << antiAliasing << endl;
 				break;
@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <atomic>
+#include "grid.h"
+
+/**
+ * @struct	GridMailbox
+ * @brief	One thread's record of which objects the current ray has already been
+ * 			tested against. Rays are numbered, and an object is skipped if the number
+ * 			stored for it is the current ray's.
+ */
+
+struct GridMailbox {
+	unsigned int generation = 0;		//!< the build of the grid that lastRay belongs to
+	unsigned int ray = 0;				//!< number of the current ray
+	vector<unsigned int> lastRay;		//!< number of the last ray tested against each object
+};
+
+static thread_local GridMailbox mailbox;				//!< this thread's mailbox
+static std::atomic<unsigned int> nextGeneration(1);		//!< generation of the next grid built
+
+/**
+ * @fn	static GridMailbox &openMailbox(unsigned int generation, size_t numObjects)
+ * @brief	Gets this thread's mailbox ready for a new ray. It is cleared if it was last
+ * 			used for another grid, or if the ray numbers have wrapped around.
+ * @param	generation	The grid's generation.
+ * @param	numObjects	The number of bounded objects in the grid.
+ * @return	The mailbox.
+ */
+
+static GridMailbox &openMailbox(unsigned int generation, size_t numObjects) {
+	if (mailbox.generation != generation || mailbox.lastRay.size() != numObjects) {
+		mailbox.generation = generation;
+		mailbox.ray = 0;
+		mailbox.lastRay.assign(numObjects, 0);
+	}
+	if (++mailbox.ray == 0) {
+		std::fill(mailbox.lastRay.begin(), mailbox.lastRay.end(), 0);
+		mailbox.ray = 1;
+	}
+	return mailbox;
+}
+
+/**
+ * @fn	static int cellOf(const GridLevel &level, double c, int axis)
+ * @brief	Finds the cell that a coordinate falls into along one axis.
+ * @param	level	The grid.
+ * @param	c	 	The coordinate.
+ * @param	axis 	The axis.
+ * @return	The cell, clamped to the grid.
+ */
+
+static int cellOf(const GridLevel &level, double c, int axis) {
+	double cell = (c - level.box.lo[axis]) * level.invCellSize[axis];
+	return (int)glm::clamp(cell, 0.0, level.res[axis] - 1.0);
+}
+
+/**
+ * @fn	static void fillLevel(GridLevel &level, const BoundingBox &box, const vector<int> &ids, const vector<BoundingBox> &boxes)
+ * @brief	Sizes a grid for a set of objects and lists each object in every cell its box
+ * 			overlaps. The cells are made roughly cubical, GRID_CELLS_PER_OBJECT of them
+ * 			per object.
+ * @param [in,out]	level	The grid.
+ * @param 		  	box  	The space the grid covers.
+ * @param 		  	ids  	The objects to place in the grid.
+ * @param 		  	boxes	The padded box of every object, indexed by ids.
+ */
+
+static void fillLevel(GridLevel &level, const BoundingBox &box, const vector<int> &ids,
+						const vector<BoundingBox> &boxes) {
+	level.box = box;
+	dvec3 size = box.hi - box.lo;
+	double largest = std::max(size.x, std::max(size.y, size.z));
+
+	// A flat scene has almost no volume, so give it some thickness before sizing the cells
+	dvec3 extent = glm::max(size, dvec3(largest * 1.0E-3));
+	double cellsPerUnit = std::cbrt(GRID_CELLS_PER_OBJECT * ids.size() / (extent.x * extent.y * extent.z));
+	for (int a = 0; a < 3; a++) {
+		level.res[a] = glm::clamp((int)(extent[a] * cellsPerUnit + 0.5), 1, GRID_MAX_RESOLUTION);
+		level.cellSize[a] = size[a] / level.res[a];
+		level.invCellSize[a] = 1.0 / level.cellSize[a];
+	}
+
+	int numCells = level.res[0] * level.res[1] * level.res[2];
+	auto forEachCell = [&](int id, auto action) {
+		const BoundingBox &b = boxes[id];
+		int lo[3], hi[3];
+		for (int a = 0; a < 3; a++) {
+			lo[a] = cellOf(level, b.lo[a], a);
+			hi[a] = cellOf(level, b.hi[a], a);
+		}
+		for (int z = lo[2]; z <= hi[2]; z++) {
+			for (int y = lo[1]; y <= hi[1]; y++) {
+				for (int x = lo[0]; x <= hi[0]; x++) {
+					action(level.cellIndex(x, y, z));
+				}
+			}
+		}
+	};
+
+	// Count each cell's objects, turn the counts into offsets, then fill the cells in
+	level.start.assign(numCells + 1, 0);
+	for (size_t i = 0; i < ids.size(); i++) {
+		forEachCell(ids[i], [&](int cell) { level.start[cell + 1]++; });
+	}
+	for (int c = 0; c < numCells; c++) {
+		level.start[c + 1] += level.start[c];
+	}
+	level.items.resize(level.start[numCells]);
+	vector<int> next(level.start.begin(), level.start.end() - 1);
+	for (size_t i = 0; i < ids.size(); i++) {
+		forEachCell(ids[i], [&](int cell) { level.items[next[cell]++] = ids[i]; });
+	}
+}
+
+/**
+ * @fn	void Grid::build(const vector<VisibleIShapePtr> &surfaces)
+ * @brief	Builds the grid from scratch, replacing whatever was there before.
+ * @param	surfaces	The objects to put in the grid.
+ */
+
+void Grid::build(const vector<VisibleIShapePtr> &surfaces) {
+	objects.clear();
+	unbounded.clear();
+	subgrids.clear();
+	top = GridLevel();
+	generation = nextGeneration++;
+
+	vector<BoundingBox> boxes;
+	BoundingBox sceneBox;
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		BoundingBox box;
+		if (surfaces[i]->shape->getBoundingBox(box)) {
+			objects.push_back(surfaces[i]);
+			boxes.push_back(box.padded());
+			sceneBox.grow(boxes.back());
+		} else {
+			unbounded.push_back(surfaces[i]);
+		}
+	}
+	if (objects.empty()) {
+		return;
+	}
+
+	vector<int> ids(objects.size());
+	for (size_t i = 0; i < ids.size(); i++) {
+		ids[i] = (int)i;
+	}
+	fillLevel(top, sceneBox, ids, boxes);
+
+	// Give crowded cells a finer grid of their own
+	int numCells = top.res[0] * top.res[1] * top.res[2];
+	top.subgrids.assign(numCells, -1);
+	for (int z = 0; z < top.res[2]; z++) {
+		for (int y = 0; y < top.res[1]; y++) {
+			for (int x = 0; x < top.res[0]; x++) {
+				int cell = top.cellIndex(x, y, z);
+				int first = top.start[cell];
+				int last = top.start[cell + 1];
+				if (last - first <= GRID_SUBGRID_THRESHOLD) {
+					continue;
+				}
+				dvec3 lo = top.box.lo + dvec3(x, y, z) * top.cellSize;
+				vector<int> cellIds(top.items.begin() + first, top.items.begin() + last);
+				top.subgrids[cell] = (int)subgrids.size();
+				subgrids.push_back(GridLevel());
+				fillLevel(subgrids.back(), BoundingBox(lo, lo + top.cellSize), cellIds, boxes);
+			}
+		}
+	}
+}
+
+/**
+ * @fn	template <typename Visit> bool Grid::walk(const GridLevel &level, const Ray &ray, const dvec3 &invDir, double tEnter, double tExit, Visit visit) const
+ * @brief	Steps a ray through the cells of one grid, in the order the ray passes
+ * 			through them, using the 3D-DDA of Amanatides and Woo.
+ * @param	level 	The grid.
+ * @param	ray   	The ray.
+ * @param	invDir	1/ray.dir, component-wise.
+ * @param	tEnter	Where the ray enters the grid.
+ * @param	tExit 	Where the ray leaves the grid, or stops being of interest.
+ * @param	visit 	Called as visit(cell, tEnter, tExit) for each cell along the ray.
+ * 					Returns true to stop the walk.
+ * @return	true iff visit stopped the walk.
+ */
+
+template <typename Visit>
+bool Grid::walk(const GridLevel &level, const Ray &ray, const dvec3 &invDir,
+					double tEnter, double tExit, Visit visit) const {
+	dvec3 p = ray.getPoint(tEnter);
+	int cell[3], step[3], stop[3];
+	double tNext[3], tDelta[3];
+	for (int a = 0; a < 3; a++) {
+		cell[a] = cellOf(level, p[a], a);
+		if (ray.dir[a] > 0.0) {
+			step[a] = 1;
+			stop[a] = level.res[a];
+			tNext[a] = (level.box.lo[a] + (cell[a] + 1) * level.cellSize[a] - ray.origin[a]) * invDir[a];
+			tDelta[a] = level.cellSize[a] * invDir[a];
+		} else if (ray.dir[a] < 0.0) {
+			step[a] = -1;
+			stop[a] = -1;
+			tNext[a] = (level.box.lo[a] + cell[a] * level.cellSize[a] - ray.origin[a]) * invDir[a];
+			tDelta[a] = -level.cellSize[a] * invDir[a];
+		} else {
+			step[a] = 0;
+			stop[a] = -1;
+			tNext[a] = DBL_MAX;
+			tDelta[a] = 0.0;
+		}
+	}
+
+	while (true) {
+		int a = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		double tLeave = std::min(tNext[a], tExit);
+		if (visit(level.cellIndex(cell[0], cell[1], cell[2]), tEnter, tLeave)) {
+			return true;
+		}
+		if (tNext[a] >= tExit) {
+			return false;
+		}
+		cell[a] += step[a];
+		if (cell[a] == stop[a]) {
+			return false;
+		}
+		tEnter = tNext[a];
+		tNext[a] += tDelta[a];
+	}
+}
+
+/**
+ * @fn	template <typename Visit> bool Grid::walkAll(const Ray &ray, double tMin, double tMax, Visit visit) const
+ * @brief	Steps a ray through the cells of the top-level grid and, inside crowded
+ * 			cells, through their finer grids.
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @param	visit	Called as visit(level, cell, tExit) for each cell that lists objects
+ * 					rather than having a finer grid. Returns true to stop the walk.
+ * @return	true iff visit stopped the walk.
+ */
+
+template <typename Visit>
+bool Grid::walkAll(const Ray &ray, double tMin, double tMax, Visit visit) const {
+	dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	if (!top.box.clip(ray.origin, invDir, tMin, tMax)) {
+		return false;
+	}
+	return walk(top, ray, invDir, tMin, tMax, [&](int cell, double tEnter, double tExit) {
+		int sub = top.subgrids[cell];
+		if (sub < 0) {
+			return visit(top, cell, tExit);
+		}
+		const GridLevel &level = subgrids[sub];
+		return walk(level, ray, invDir, tEnter, tExit, [&](int subcell, double, double tSubExit) {
+			return visit(level, subcell, tSubExit);
+		});
+	});
+}
+
+/**
+ * @fn	void Grid::findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType) const
+ * @brief	Finds the closest intersection along the ray. Cells are visited front to
+ * 			back, and the walk stops at the first cell that ends beyond the closest hit.
+ * 			An object may be hit beyond the cell it was tested in, so a hit only ends
+ * 			the walk once the ray has passed it. As in BVH::findIntersection, the
+ * 			rest of the hit is filled in for the winner alone.
+ * @param 		  	ray    	The ray.
+ * @param [in,out]	theHit 	The closest hit, or t == FLT_MAX if nothing was hit.
+ * @param 		  	rayType	The kind of ray; objects it cannot see are skipped.
+ */
+
+void Grid::findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType) const {
+	double bestT = FLT_MAX;
+	int bestPrimitive = 0;
+	VisibleIShapePtr closest = nullptr;
+	auto intersect = [&](VisibleIShapePtr object) {
+		if (!object->isVisibleTo(rayType)) {
+			return;
+		}
+		int primitive;
+		double t = object->findClosestHit(ray, primitive);
+		if (t < bestT) {
+			bestT = t;
+			bestPrimitive = primitive;
+			closest = object;
+		}
+	};
+
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		intersect(unbounded[i]);
+	}
+	if (!objects.empty()) {
+		GridMailbox &tested = openMailbox(generation, objects.size());
+		walkAll(ray, 0.0, bestT, [&](const GridLevel &level, int cell, double tExit) {
+			for (int i = level.start[cell]; i < level.start[cell + 1]; i++) {
+				int object = level.items[i];
+				if (tested.lastRay[object] == tested.ray) {
+					continue;
+				}
+				tested.lastRay[object] = tested.ray;
+				intersect(objects[object]);
+			}
+			return bestT <= tExit;
+		});
+	}
+
+	theHit = HitRecord();
+	if (closest != nullptr) {
+		closest->getHitAttributes(ray, bestT, bestPrimitive, theHit);
+	}
+}
+
+/**
+ * @fn	void Grid::findHits(const Ray &ray, RayHits &hits, unsigned int rayType) const
+ * @brief	Multi-hit query: finds the nearest hits along the ray, up to the first
+ * 			opaque one. Cells are visited front to back, and the walk stops at the
+ * 			first cell that ends beyond the last hit the list has room for. All of an
+ * 			object's hits are added when it is first met, so the mailbox still lets
+ * 			each object be tested once.
+ * @param 		  	ray    	The ray.
+ * @param [in,out]	hits   	The list of hits.
+ * @param 		  	rayType	The kind of ray; objects it cannot see are skipped.
+ */
+
+void Grid::findHits(const Ray &ray, RayHits &hits, unsigned int rayType) const {
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		if (unbounded[i]->isVisibleTo(rayType)) {
+			hits.add(*unbounded[i], ray);
+		}
+	}
+	if (objects.empty()) {
+		return;
+	}
+
+	GridMailbox &tested = openMailbox(generation, objects.size());
+	walkAll(ray, 0.0, hits.tMax, [&](const GridLevel &level, int cell, double tExit) {
+		for (int i = level.start[cell]; i < level.start[cell + 1]; i++) {
+			int object = level.items[i];
+			if (tested.lastRay[object] == tested.ray) {
+				continue;
+			}
+			tested.lastRay[object] = tested.ray;
+			if (objects[object]->isVisibleTo(rayType)) {
+				hits.add(*objects[object], ray);
+			}
+		}
+		return hits.tMax <= tExit;
+	});
+}
+
+/**
+ * @fn	double Grid::findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder, const ObjectLinks *casters) const
+ * @brief	Any-hit query for shadow rays. Adds up the alpha of every object the ray
+ * 			hits in [tMin, tMax] and stops as soon as the total reaches 1, as
+ * 			BVH::findOcclusion does. The mailbox keeps a transparent object that spans
+ * 			several cells from being counted more than once. Objects hidden from
+ * 			SHADOW_RAYS, or not in casters, cast no shadow.
+ * @param 		  	ray			The ray.
+ * @param 		  	tMin		Smallest t of interest.
+ * @param 		  	tMax		Largest t of interest, typically the distance to the light.
+ * @param [in,out]	occluder	If not nullptr, set to the shape of the opaque object
+ * 								that ended the search, if one did.
+ * @param 		  	casters 	If not nullptr, the only objects that can block the ray.
+ * @return	The amount of occlusion, from 0 (nothing in the way) to 1.
+ */
+
+double Grid::findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder,
+							const ObjectLinks *casters) const {
+	double occlusion = 0.0;
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		if (unbounded[i]->castsShadow(casters) && unbounded[i]->shape->hasIntersection(ray, tMin, tMax)) {
+			occlusion += unbounded[i]->material.alpha;
+			if (occlusion >= 1.0) {
+				if (occluder != nullptr && unbounded[i]->material.alpha >= 1.0) {
+					*occluder = unbounded[i]->shape;
+				}
+				return 1.0;
+			}
+		}
+	}
+	if (objects.empty()) {
+		return occlusion;
+	}
+
+	GridMailbox &tested = openMailbox(generation, objects.size());
+	bool blocked = walkAll(ray, tMin, tMax, [&](const GridLevel &level, int cell, double) {
+		for (int i = level.start[cell]; i < level.start[cell + 1]; i++) {
+			int object = level.items[i];
+			if (tested.lastRay[object] == tested.ray) {
+				continue;
+			}
+			tested.lastRay[object] = tested.ray;
+			if (objects[object]->castsShadow(casters) && objects[object]->shape->hasIntersection(ray, tMin, tMax)) {
+				occlusion += objects[object]->material.alpha;
+				if (occlusion >= 1.0) {
+					if (occluder != nullptr && objects[object]->material.alpha >= 1.0) {
+						*occluder = objects[object]->shape;
+					}
+					return true;
+				}
+			}
+		}
+		return false;
+	});
+	return blocked ? 1.0 : occlusion;
+}
+
+/**
+ * @fn	int Grid::numCells() const
+ * @brief	Counts the cells of the top-level grid and of all the finer grids.
+ * @return	The number of cells.
+ */
+
+int Grid::numCells() const {
+	if (objects.empty()) {
+		return 0;
+	}
+	int count = top.res[0] * top.res[1] * top.res[2];
+	for (size_t i = 0; i < subgrids.size(); i++) {
+		count += subgrids[i].res[0] * subgrids[i].res[1] * subgrids[i].res[2];
+	}
+	return count;
+}
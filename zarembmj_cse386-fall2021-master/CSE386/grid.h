@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include "ishape.h"
+
+const double GRID_CELLS_PER_OBJECT = 8.0;	//!< cells in a grid per object it holds.
+const int GRID_MAX_RESOLUTION = 128;		//!< most cells along any axis of one grid.
+const int GRID_SUBGRID_THRESHOLD = 16;		//!< a top-level cell holding more objects gets a grid of its own.
+
+/**
+ * @struct	GridLevel
+ * @brief	One regular grid of cells. Each cell lists the objects whose boxes overlap
+ * 			it: cell c holds items[start[c]] through items[start[c + 1] - 1]. The top
+ * 			level of a Grid also has an entry per cell in subgrids.
+ */
+
+struct GridLevel {
+	BoundingBox box;			//!< box around the whole grid
+	int res[3];					//!< number of cells along x, y and z
+	dvec3 cellSize;				//!< size of one cell
+	dvec3 invCellSize;			//!< 1/cellSize, component-wise
+	vector<int> start;			//!< offset of each cell's objects in items, plus one at the end
+	vector<int> items;			//!< object indices, cell by cell
+	vector<int> subgrids;		//!< grid of each top-level cell, or -1. Empty below the top.
+	int cellIndex(int x, int y, int z) const { return (z * res[1] + y) * res[0] + x; }
+};
+
+/**
+ * @struct	Grid
+ * @brief	Two-level uniform grid over a set of visible implicit shapes, for scenes of
+ * 			many similarly sized objects, such as tens of thousands of spheres, where it
+ * 			is quicker to build than a BVH and quick to traverse. The number of cells is
+ * 			chosen from the number of objects, and rays step from cell to cell with the
+ * 			3D-DDA of Amanatides and Woo, so only the cells along a ray are visited. A
+ * 			top-level cell that ends up holding many objects, because the scene is
+ * 			denser there, is given its own finer grid. Each object is tested at most
+ * 			once per ray even if it overlaps many cells: a per-thread mailbox records
+ * 			which ray tested it last. Unbounded shapes are tested against every ray.
+ * 			Objects hidden from a kind of ray (see VisibleIShape::visibility) are
+ * 			passed over for it without being tested.
+ * 			Once built, the grid is only read, so it may be traversed by many threads
+ * 			at once.
+ */
+
+struct Grid {
+	void build(const vector<VisibleIShapePtr> &surfaces);
+	void findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType = ALL_RAYS) const;
+	void findHits(const Ray &ray, RayHits &hits, unsigned int rayType = ALL_RAYS) const;
+	double findOcclusion(const Ray &ray, double tMin, double tMax, const IShape **occluder = nullptr,
+							const ObjectLinks *casters = nullptr) const;
+	int numCells() const;
+	int numSubgrids() const { return (int)subgrids.size(); }
+	int numBoundedObjects() const { return (int)objects.size(); }
+	int numUnboundedObjects() const { return (int)unbounded.size(); }
+protected:
+	GridLevel top;							//!< the grid over the whole scene
+	vector<GridLevel> subgrids;				//!< finer grids inside crowded top-level cells
+	vector<VisibleIShapePtr> objects;		//!< bounded objects, indexed by the grids' items
+	vector<VisibleIShapePtr> unbounded;		//!< objects that have no bounding box
+	unsigned int generation = 0;			//!< identifies this build of the grid to the mailboxes
+	template <typename Visit>
+	bool walk(const GridLevel &level, const Ray &ray, const dvec3 &invDir,
+				double tEnter, double tExit, Visit visit) const;
+	template <typename Visit>
+	bool walkAll(const Ray &ray, double tMin, double tMax, Visit visit) const;
+};
@@ -0,0 +1,322 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <utility>
+#include <random>
+#include "defs.h"
+#include "io.h"
+#include "ishape.h"
+#include "framebuffer.h"
+#include "raytracer.h"
+#include "iscene.h"
+#include "light.h"
+#include "image.h"
+#include "camera.h"
+#include "trianglemesh.h"
+#include "instance.h"
+#include "utilities.h"
+#include "meshloader.h"
+#include "sphereset.h"
+#include "heightfield.h"
+
+// Renders the scene from exercisecomposite3dshapes.cpp to PPM files, without a window.
+//
+// Usage:
+//
+//   headlessrender [-w width] [-h height] [-depth reflections] [-aa n]
+//                  [-adaptive maxSamples] [-threads n] [-first frame]
+//                  [-frames count] [-accel bvh|compact|grid] [-mesh file]
+//                  [-instances n] [-spheres n] [-particles n] [-terrain file]
+//                  [-lights n] [-cull on|off] [-o prefix]
+//
+//   -w, -h        size of the image in pixels
+//   -depth        number of reflection/refraction bounces
+//   -aa           samples per pixel along each axis
+//   -adaptive     most samples per pixel with adaptive anti-aliasing, 0 for off
+//   -threads      worker threads, 0 for one per hardware thread
+//   -first        number of the first frame; the camera orbits one step per frame
+//   -frames       number of frames to render
+//   -accel        how the scene is searched for hits
+//   -mesh         OBJ or binary PLY file to add to the scene
+//   -instances    copies of the mesh to spread over the floor, all sharing its triangles
+//   -spheres      small spheres to add, half of them packed into one clump
+//   -particles    the same cloud of spheres, added as a single ISphereSet
+//   -terrain      grayscale PPM file of hills to replace the floor with
+//   -lights       dim, short-range lamps to scatter above the floor, one in four a spot light
+//   -cull         shade each tile of the image with only the lamps that reach it
+//   -o            output files are <prefix>_<frame>.ppm
+//
+// Nothing here touches OpenGL. Build it with CONSOLE_ONLY defined and without the
+// other drivers, e.g.
+//
+//   g++ -std=c++17 -O2 -DCONSOLE_ONLY -pthread headlessrender.cpp <library .cpp files>
+
+const double ORBIT_RADIUS = 10.0 * std::sqrt(2.0);	//!< horizontal distance from the camera to the y axis
+const double ORBIT_HEIGHT = 10.0;					//!< height of the camera
+const double ORBIT_STEP = PI / 90.0;				//!< angle the camera moves between frames
+const double INSTANCE_SIZE = 2.0;					//!< largest dimension of each mesh instance
+const double INSTANCE_SPACING = 3.0;				//!< distance between neighboring instances
+const double FLOOR_HEIGHT = -4.0;					//!< height of the floor the instances stand on
+const double PARTICLE_RADIUS = 0.15;				//!< radius of the spheres added by -spheres and -particles
+const double CLOUD_SIZE = 12.0;						//!< half the width of the cloud of spheres
+const double CLUMP_SIZE = 2.0;						//!< half the width of the clump within the cloud
+const double TERRAIN_SIZE = 40.0;					//!< width of the terrain added by -terrain
+const double TERRAIN_HEIGHT = 4.0;					//!< height of the white parts of the terrain
+const double LAMP_HEIGHT = 1.0;						//!< height of the lamps added by -lights above the floor
+const LightATParams LAMP_FALLOFF(1.0, 0.5, 0.25, 0.05);	//!< how quickly the lamps fade out, and where they stop
+const LightColor LAMP_COLOR(vector<double>{0.0, 0.0, 0.0, 0.1, 0.1, 0.08, 0.1, 0.1, 0.08});	//!< color of the lamps
+
+/**
+ * @struct	Options
+ * @brief	Settings read from the command line.
+ */
+
+struct Options {
+	int width = WINDOW_WIDTH;			//!< image width
+	int height = WINDOW_HEIGHT;			//!< image height
+	int depth = 2;						//!< number of reflection/refraction bounces
+	int antiAliasing = 1;				//!< samples per pixel along each axis
+	int adaptiveMaxSamples = 0;			//!< maximum samples per pixel with adaptive AA, 0 for off
+	int threads = 0;					//!< worker threads, 0 for one per hardware thread
+	int firstFrame = 0;					//!< number of the first frame to render
+	int numFrames = 1;					//!< number of frames to render
+	Accelerator accelerator = Accelerator::BVH;	//!< how the scene is searched for hits
+	std::string meshFile;				//!< OBJ or PLY file to add to the scene, if any
+	int instances = 1;					//!< number of copies of the mesh
+	int spheres = 0;					//!< number of small spheres to add
+	int particles = 0;					//!< number of small spheres to add as one ISphereSet
+	std::string terrainFile;			//!< grayscale PPM file of the terrain's elevations, if any
+	int lights = 0;						//!< number of short-range lamps to add
+	bool cullLights = true;				//!< shade each tile with only the lights that reach it
+	std::string prefix = "frame";		//!< output files are <prefix>_<frame>.ppm
+};
+
+/**
+ * @fn	bool parseOptions(int argc, char *argv[], Options &options)
+ * @brief	Reads the command line options.
+ * @param	argc	   	Number of command line arguments.
+ * @param	argv	   	The command line arguments.
+ * @param	options		[out] The options.
+ * @return	False if an option was not recognized or had no value.
+ */
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+	for (int i = 1; i < argc; i += 2) {
+		std::string name = argv[i];
+		if (i + 1 >= argc) {
+			return false;
+		}
+		const char* value = argv[i + 1];
+		if (name == "-w") {
+			options.width = std::atoi(value);
+		} else if (name == "-h") {
+			options.height = std::atoi(value);
+		} else if (name == "-depth") {
+			options.depth = std::atoi(value);
+		} else if (name == "-aa") {
+			options.antiAliasing = std::atoi(value);
+		} else if (name == "-adaptive") {
+			options.adaptiveMaxSamples = std::atoi(value);
+		} else if (name == "-threads") {
+			options.threads = std::atoi(value);
+		} else if (name == "-first") {
+			options.firstFrame = std::atoi(value);
+		} else if (name == "-frames") {
+			options.numFrames = std::atoi(value);
+		} else if (name == "-accel" && std::string(value) == "bvh") {
+			options.accelerator = Accelerator::BVH;
+		} else if (name == "-accel" && std::string(value) == "compact") {
+			options.accelerator = Accelerator::COMPACT_LIST;
+		} else if (name == "-accel" && std::string(value) == "grid") {
+			options.accelerator = Accelerator::GRID;
+		} else if (name == "-mesh") {
+			options.meshFile = value;
+		} else if (name == "-instances") {
+			options.instances = std::atoi(value);
+		} else if (name == "-spheres") {
+			options.spheres = std::atoi(value);
+		} else if (name == "-particles") {
+			options.particles = std::atoi(value);
+		} else if (name == "-terrain") {
+			options.terrainFile = value;
+		} else if (name == "-lights") {
+			options.lights = std::atoi(value);
+		} else if (name == "-cull" && std::string(value) == "on") {
+			options.cullLights = true;
+		} else if (name == "-cull" && std::string(value) == "off") {
+			options.cullLights = false;
+		} else if (name == "-o") {
+			options.prefix = value;
+		} else {
+			return false;
+		}
+	}
+	return options.width > 0 && options.height > 0 && options.numFrames > 0;
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		std::cerr << "usage: " << argv[0] << " [-w width] [-h height] [-depth reflections] [-aa n]"
+					<< " [-adaptive maxSamples] [-threads n] [-first frame] [-frames count]"
+					<< " [-accel bvh|compact|grid] [-mesh file] [-instances n] [-spheres n]"
+					<< " [-particles n] [-terrain file] [-lights n] [-cull on|off] [-o prefix]" << endl;
+		return 1;
+	}
+
+	FrameBuffer frameBuffer(options.width, options.height);
+	RayTracer rayTrace(lightGray, options.threads);
+	rayTrace.cullLights = options.cullLights;
+	PerspectiveCamera pCamera(dvec3(10, 10, 10), ORIGIN3D, Y_AXIS, PI_2, options.width, options.height);
+	IScene scene(&pCamera);
+
+	PositionalLight posLight(dvec3(10, 20, -5), pureWhiteLight);
+	SpotLight spotLight(dvec3(-10, 10, 10), glm::normalize(dvec3(1, -1, -1)), 15 * PI / 180, pureWhiteLight);
+	IClosedCylinderY* closedCylinder = new IClosedCylinderY(dvec3(4.0, 1.0, -8.0), 3.0, 5.0);
+	Image* imageCy = new Image("usflag.ppm");
+
+	if (options.terrainFile.empty()) {
+		scene.addOpaqueObject(new VisibleIShape(new IPlane(dvec3(0, FLOOR_HEIGHT, 0), Y_AXIS), tin));
+	} else {
+		auto loadStart = std::chrono::steady_clock::now();
+		Image elevations(options.terrainFile);
+		IHeightField* terrain = new IHeightField(elevations, dvec3(-TERRAIN_SIZE / 2, FLOOR_HEIGHT, -TERRAIN_SIZE / 2),
+													dvec3(TERRAIN_SIZE, TERRAIN_HEIGHT, TERRAIN_SIZE));
+		double loadSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+		if (terrain->numSamples() == 0) {
+			return 1;
+		}
+		scene.addOpaqueObject(new VisibleIShape(terrain, tin));
+		cout << options.terrainFile << ": " << elevations.W << "x" << elevations.H << " samples, "
+			<< terrain->memoryBytes() / (1024.0 * 1024.0) << " MB, loaded in " << loadSecs << " sec" << endl;
+	}
+	scene.addOpaqueObject(new VisibleIShape(new ICylinderY(dvec3(0.0, 0.0, 6.5), 2, 4.0), gold));
+	scene.addOpaqueObject(new VisibleIShape(new ICylinderZ(dvec3(8.0, -2.0, 0.5), 1.5, 5.0), polishedBronze));
+	scene.addOpaqueObject(new VisibleIShape(new ISphere(dvec3(0.0, 0.0, 0.0), 4.0), copper));
+	scene.addOpaqueObject(new VisibleIShape(new IConeY(dvec3(13.0, -4.0, -4.0), 3, 8), polishedSilver));
+	scene.addOpaqueObject(new VisibleIShape(closedCylinder->diskBottom, chrome));
+	scene.addOpaqueObject(new VisibleIShape(closedCylinder->diskTop, chrome));
+	scene.addOpaqueObject(new VisibleIShape(closedCylinder->cylinder, chrome, imageCy));
+	scene.addTransparentObject(new VisibleIShape(new IPlane(dvec3(0, 0, 0), X_AXIS), polishedGold), 0.4);
+
+	if (!options.meshFile.empty()) {
+		MeshData mesh;
+		MeshLoadStats stats;
+		if (!loadMesh(options.meshFile, mesh, stats, options.threads)) {
+			return 1;
+		}
+		auto buildStart = std::chrono::steady_clock::now();
+		int numTriangles = mesh.numTriangles();
+		ITriangleMesh* triangles = new ITriangleMesh(std::move(mesh.vertices), std::move(mesh.indices),
+														std::move(mesh.normals));
+		double buildSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+		cout << options.meshFile << ": " << numTriangles << " triangles, " << stats
+			<< ", hierarchy " << buildSecs << " sec" << endl;
+
+		BoundingBox box;
+		if (options.instances <= 1 || !triangles->getBoundingBox(box)) {
+			scene.addOpaqueObject(new VisibleIShape(triangles, polishedSilver));
+		} else {
+			// Stand the copies on the floor in a square grid, each turned a little more.
+			dvec3 size = box.hi - box.lo;
+			dvec3 center = box.center();
+			double fit = INSTANCE_SIZE / std::max(size.x, std::max(size.y, size.z));
+			int perRow = (int)std::ceil(std::sqrt((double)options.instances));
+			for (int i = 0; i < options.instances; i++) {
+				double x = (i % perRow - (perRow - 1) / 2.0) * INSTANCE_SPACING;
+				double z = (i / perRow - (perRow - 1) / 2.0) * INSTANCE_SPACING;
+				dmat4 placement = T(x, FLOOR_HEIGHT, z) * Ry(0.7 * i) * S(fit) * T(-center.x, -box.lo.y, -center.z);
+				scene.addOpaqueObject(new VisibleIShape(new IInstance(triangles, placement), polishedSilver));
+			}
+			cout << options.instances << " instances sharing " << numTriangles << " triangles" << endl;
+		}
+	}
+
+	std::mt19937 rng(options.spheres + options.particles);
+	std::uniform_real_distribution<double> cloud(-CLOUD_SIZE, CLOUD_SIZE);
+	std::uniform_real_distribution<double> clump(-CLUMP_SIZE, CLUMP_SIZE);
+	const Material palette[] = { gold, copper, chrome, redPlastic, cyanPlastic, polishedSilver };
+	ISphereSet* particles = nullptr;
+	if (options.particles > 0) {
+		particles = new ISphereSet(vector<Material>(palette, palette + 6));
+	}
+	for (int i = 0; i < options.spheres + options.particles; i++) {
+		dvec3 center = i % 2 == 0 ? dvec3(cloud(rng), cloud(rng) / 4.0 + 2.0, cloud(rng))
+									: dvec3(clump(rng) - 8.0, clump(rng) + 2.0, clump(rng) + 8.0);
+		if (i < options.spheres) {
+			scene.addOpaqueObject(new VisibleIShape(new ISphere(center, PARTICLE_RADIUS), palette[i % 6]));
+		} else {
+			particles->add(center, PARTICLE_RADIUS, i % 6);
+		}
+	}
+	if (particles != nullptr) {
+		auto buildStart = std::chrono::steady_clock::now();
+		particles->build();
+		double buildSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+		scene.addOpaqueObject(new VisibleIShape(particles, tin));
+		cout << options.particles << " particles: " << particles->memoryBytes() / (1024.0 * 1024.0)
+			<< " MB, hierarchy " << buildSecs << " sec" << endl;
+	}
+
+	posLight.setAttenuationParams(LightATParams(1.0, 0.017, 0.0007));
+	spotLight.setAttenuationParams(LightATParams(1.0, 0.017, 0.0007));
+	scene.addLight(&posLight);
+	scene.addLight(&spotLight);
+	for (int i = 0; i < options.lights; i++) {
+		dvec3 lampPos(cloud(rng) * 1.5, FLOOR_HEIGHT + LAMP_HEIGHT, cloud(rng) * 1.5);
+		PositionalLight* lamp;
+		if (i % 4 == 0) {
+			SpotLight* spot = new SpotLight(lampPos + dvec3(0, LAMP_HEIGHT, 0), -Y_AXIS, PI / 6, LAMP_COLOR);
+			scene.addLight(spot);
+			lamp = spot;
+		} else {
+			lamp = new PositionalLight(lampPos, LAMP_COLOR);
+			scene.addLight(lamp);
+		}
+		lamp->setAttenuation(true);
+		lamp->setAttenuationParams(LAMP_FALLOFF);
+	}
+	if (options.lights > 0) {
+		cout << options.lights << " lamps reaching " << LAMP_FALLOFF.range() << " units" << endl;
+	}
+
+	scene.accelerator = options.accelerator;
+	scene.antiAliasing = options.antiAliasing;
+	scene.adaptiveAntiAliasing = options.adaptiveMaxSamples > 0;
+	if (scene.adaptiveAntiAliasing) {
+		scene.maxSamples = options.adaptiveMaxSamples;
+	}
+
+	double totalRenderSecs = 0.0;
+	double totalWriteSecs = 0.0;
+	for (int frame = options.firstFrame; frame < options.firstFrame + options.numFrames; frame++) {
+		double angle = PI_4 + frame * ORBIT_STEP;
+		dvec3 cameraPos(ORBIT_RADIUS * std::sin(angle), ORBIT_HEIGHT, ORBIT_RADIUS * std::cos(angle));
+		pCamera = PerspectiveCamera(cameraPos, ORIGIN3D, Y_AXIS, PI_2, options.width, options.height);
+
+		auto renderStart = std::chrono::steady_clock::now();
+		rayTrace.raytraceScene(frameBuffer, options.depth, scene);
+		auto renderEnd = std::chrono::steady_clock::now();
+
+		char fileName[32];
+		std::snprintf(fileName, sizeof(fileName), "_%04d.ppm", frame);
+		if (!frameBuffer.writePPM(options.prefix + fileName)) {
+			return 1;
+		}
+		auto writeEnd = std::chrono::steady_clock::now();
+
+		double renderSecs = std::chrono::duration<double>(renderEnd - renderStart).count();
+		double writeSecs = std::chrono::duration<double>(writeEnd - renderEnd).count();
+		totalRenderSecs += renderSecs;
+		totalWriteSecs += writeSecs;
+		cout << options.prefix + fileName << ": render " << renderSecs << " sec, write "
+			<< writeSecs << " sec" << endl;
+	}
+
+	double pixels = (double)options.width * options.height * options.numFrames;
+	cout << "Frames: " << options.numFrames
+		<< ", render time: " << totalRenderSecs << " sec (" << totalRenderSecs / options.numFrames << " per frame)"
+		<< ", write time: " << totalWriteSecs << " sec"
+		<< ", " << pixels / totalRenderSecs / 1.0e6 << " Mpixels/sec" << endl;
+	return 0;
+}
@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <utility>
+#include "heightfield.h"
+#include "trianglemesh.h"
+
+/**
+ * @struct	HeightFieldTrace
+ * @brief	A ray on its way through an IHeightField, and the closest hit found so far.
+ */
+
+struct HeightFieldTrace {
+	const Ray &ray;		//!< the ray
+	int axes[3];		//!< set up by setUpWatertightRay
+	dvec3 shear;		//!< set up by setUpWatertightRay
+	dvec3 invDir;		//!< 1/ray.dir, component-wise
+	double tMin;		//!< smallest t of interest
+	double tMax;		//!< largest t of interest
+	double t;			//!< t of the closest hit, or FLT_MAX
+	int x, z;			//!< cell of the closest hit
+	int half;			//!< which of the cell's two triangles was hit
+	HeightFieldTrace(const Ray &theRay, double lo, double hi)
+		: ray(theRay), tMin(lo), tMax(hi), t(FLT_MAX), x(0), z(0), half(0) {
+		setUpWatertightRay(ray, axes, shear);
+		invDir = dvec3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	}
+};
+
+/**
+ * @fn	static vector<float> grayLevels(const Image &image)
+ * @brief	Reads the brightness of each pixel of an image, from 0 to 1.
+ * @param	image	The image.
+ * @return	The average of each pixel's red, green and blue, row by row.
+ */
+
+static vector<float> grayLevels(const Image &image) {
+	vector<float> levels(image.W * image.H);
+	for (size_t i = 0; i < levels.size(); i++) {
+		const color &pixel = image.pixels[i];
+		levels[i] = (float)((pixel.r + pixel.g + pixel.b) / 3.0);
+	}
+	return levels;
+}
+
+/**
+ * @fn	IHeightField::IHeightField(int numX, int numZ, vector<float> elevations, const dvec3 &position, const dvec3 &size)
+ * @brief	Constructs a height field from a grid of elevations.
+ * @param	numX	  	Number of samples along x; at least 2.
+ * @param	numZ	  	Number of samples along z; at least 2.
+ * @param	elevations	numX * numZ elevations, row by row along x. Taken by value,
+ * 						so that a large grid can be moved in.
+ * @param	position  	Position of sample (0, 0) if its elevation were 0.
+ * @param	size	  	Extent of the field along x and z, and the height of an
+ * 						elevation of 1.
+ */
+
+IHeightField::IHeightField(int numX, int numZ, vector<float> elevations, const dvec3 &position, const dvec3 &size)
+	: width(numX), depth(numZ), corner(position), heights(std::move(elevations)) {
+	spacing = dvec3(size.x / (numX - 1), 0.0, size.z / (numZ - 1));
+	for (size_t i = 0; i < heights.size(); i++) {
+		heights[i] = (float)(position.y + heights[i] * size.y);
+	}
+	build();
+}
+
+/**
+ * @fn	IHeightField::IHeightField(const Image &image, const dvec3 &position, const dvec3 &size)
+ * @brief	Constructs a height field from a grayscale image, one sample per pixel.
+ * 			Black is elevation 0 and white elevation 1; the image's rows run along +z.
+ * @param	image   	The image.
+ * @param	position	Position of the top-left pixel's sample if it were black.
+ * @param	size		Extent of the field along x and z, and the height of white.
+ */
+
+IHeightField::IHeightField(const Image &image, const dvec3 &position, const dvec3 &size)
+	: IHeightField(image.W, image.H, grayLevels(image), position, size) {
+}
+
+/**
+ * @fn	void IHeightField::build()
+ * @brief	Builds the pyramid of elevation bounds. Level 0 is the cells themselves,
+ * 			whose bounds are found from their four samples rather than stored; each
+ * 			block of a higher level covers up to 2x2 blocks of the level below, and the
+ * 			top level is a single block over the whole field.
+ */
+
+void IHeightField::build() {
+	levelStart.clear();
+	levelWidth.clear();
+	levelDepth.clear();
+	pyramid.clear();
+	if (width < 2 || depth < 2 || heights.size() != (size_t)width * depth) {
+		return;
+	}
+
+	levelStart.push_back(-1);
+	levelWidth.push_back(width - 1);
+	levelDepth.push_back(depth - 1);
+	int numBlocks = 0;
+	while (levelWidth.back() > 1 || levelDepth.back() > 1) {
+		levelStart.push_back(numBlocks);
+		levelWidth.push_back((levelWidth.back() + 1) / 2);
+		levelDepth.push_back((levelDepth.back() + 1) / 2);
+		numBlocks += levelWidth.back() * levelDepth.back();
+	}
+	pyramid.resize(2 * numBlocks);
+	for (int level = 1; level < numLevels(); level++) {
+		for (int z = 0; z < levelDepth[level]; z++) {
+			for (int x = 0; x < levelWidth[level]; x++) {
+				double lo = FLT_MAX, hi = -FLT_MAX;
+				for (int cz = 2 * z; cz <= 2 * z + 1 && cz < levelDepth[level - 1]; cz++) {
+					for (int cx = 2 * x; cx <= 2 * x + 1 && cx < levelWidth[level - 1]; cx++) {
+						double childLo, childHi;
+						getBlockBounds(level - 1, cx, cz, childLo, childHi);
+						lo = std::min(lo, childLo);
+						hi = std::max(hi, childHi);
+					}
+				}
+				int block = levelStart[level] + z * levelWidth[level] + x;
+				pyramid[2 * block] = (float)lo;
+				pyramid[2 * block + 1] = (float)hi;
+			}
+		}
+	}
+
+	double lo, hi;
+	getBlockBounds(numLevels() - 1, 0, 0, lo, hi);
+	box = BoundingBox(dvec3(corner.x, lo, corner.z), dvec3(samplePoint(width - 1, 0).x, hi, samplePoint(0, depth - 1).z));
+	margin = box.padded().hi.y - box.hi.y;
+}
+
+/**
+ * @fn	void IHeightField::getBlockBounds(int level, int x, int z, double &lo, double &hi) const
+ * @brief	Gets the lowest and highest elevation within a block of the pyramid.
+ * @param 		  	level	The level; 0 for a single cell.
+ * @param 		  	x	 	The block's column.
+ * @param 		  	z	 	The block's row.
+ * @param [in,out]	lo   	The lowest elevation.
+ * @param [in,out]	hi   	The highest elevation.
+ */
+
+void IHeightField::getBlockBounds(int level, int x, int z, double &lo, double &hi) const {
+	if (level > 0) {
+		int block = levelStart[level] + z * levelWidth[level] + x;
+		lo = pyramid[2 * block];
+		hi = pyramid[2 * block + 1];
+		return;
+	}
+	const float *row = &heights[z * width + x];
+	lo = std::min(std::min(row[0], row[1]), std::min(row[width], row[width + 1]));
+	hi = std::max(std::max(row[0], row[1]), std::max(row[width], row[width + 1]));
+}
+
+/**
+ * @fn	dvec3 IHeightField::samplePoint(int x, int z) const
+ * @brief	Gets the position of a sample.
+ * @param	x	The sample's column.
+ * @param	z	The sample's row.
+ * @return	The sample's position.
+ */
+
+dvec3 IHeightField::samplePoint(int x, int z) const {
+	return dvec3(corner.x + x * spacing.x, heights[z * width + x], corner.z + z * spacing.z);
+}
+
+/**
+ * @fn	dvec3 IHeightField::sampleNormal(int x, int z) const
+ * @brief	Estimates the normal of the terrain at a sample from the slope between its
+ * 			neighbors, or between it and its one neighbor on an edge of the field.
+ * @param	x	The sample's column.
+ * @param	z	The sample's row.
+ * @return	The unit normal.
+ */
+
+dvec3 IHeightField::sampleNormal(int x, int z) const {
+	int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, width - 1);
+	int z0 = std::max(z - 1, 0), z1 = std::min(z + 1, depth - 1);
+	double dx = (heights[z * width + x1] - heights[z * width + x0]) / ((x1 - x0) * spacing.x);
+	double dz = (heights[z1 * width + x] - heights[z0 * width + x]) / ((z1 - z0) * spacing.z);
+	return glm::normalize(dvec3(-dx, 1.0, -dz));
+}
+
+/**
+ * @fn	template <bool ANY_HIT> bool IHeightField::traceCell(HeightFieldTrace &trace, int x, int z) const
+ * @brief	Intersects a ray with the two triangles of a cell, which are split along the
+ * 			diagonal from sample (x, z) to sample (x + 1, z + 1) and wound so that
+ * 			their normals point up.
+ * @param [in,out]	trace	The ray. Updated with a closer hit, if one is found.
+ * @param 		  	x	 	The cell's column.
+ * @param 		  	z	 	The cell's row.
+ * @return	true iff either triangle was hit in the ray's range of interest. With
+ * 			ANY_HIT, trace is left as it was.
+ */
+
+template <bool ANY_HIT>
+bool IHeightField::traceCell(HeightFieldTrace &trace, int x, int z) const {
+	dvec3 p00 = samplePoint(x, z), p10 = samplePoint(x + 1, z);
+	dvec3 p01 = samplePoint(x, z + 1), p11 = samplePoint(x + 1, z + 1);
+	bool found = false;
+	for (int half = 0; half < 2; half++) {
+		double t, u, v;
+		bool crosses = half == 0 ? intersectWatertight(p00, p11, p10, trace.ray, trace.axes, trace.shear, t, u, v)
+								 : intersectWatertight(p00, p01, p11, trace.ray, trace.axes, trace.shear, t, u, v);
+		if (!crosses) {
+			continue;
+		}
+		if (ANY_HIT) {
+			if (t >= trace.tMin && t <= trace.tMax) {
+				return true;
+			}
+		} else if (t >= trace.tMin && t < trace.t) {
+			trace.t = t;
+			trace.x = x;
+			trace.z = z;
+			trace.half = half;
+			found = true;
+		}
+	}
+	return found;
+}
+
+/**
+ * @fn	template <bool ANY_HIT> bool IHeightField::traceBlock(HeightFieldTrace &trace, int level, int x, int z, double tEnter, double tExit) const
+ * @brief	Follows a ray through one block of the pyramid. If the ray stays above or
+ * 			below the block's elevations while it crosses the block, it cannot hit
+ * 			anything there. Otherwise the ray's interval is cut where it crosses the
+ * 			lines dividing the block into four, and the sub-blocks are traced in the
+ * 			order the ray reaches them, stopping at the first hit: since sub-blocks do
+ * 			not overlap, no later one can hold a closer hit.
+ * @param [in,out]	trace 	The ray.
+ * @param 		  	level 	The block's level.
+ * @param 		  	x	  	The block's column.
+ * @param 		  	z	  	The block's row.
+ * @param 		  	tEnter	t where the ray enters the block.
+ * @param 		  	tExit 	t where the ray leaves the block.
+ * @return	true iff the ray hits the terrain within the block.
+ */
+
+template <bool ANY_HIT>
+bool IHeightField::traceBlock(HeightFieldTrace &trace, int level, int x, int z, double tEnter, double tExit) const {
+	double lo, hi;
+	getBlockBounds(level, x, z, lo, hi);
+	double yEnter = trace.ray.origin.y + tEnter * trace.ray.dir.y;
+	double yExit = trace.ray.origin.y + tExit * trace.ray.dir.y;
+	if (std::min(yEnter, yExit) > hi + margin || std::max(yEnter, yExit) < lo - margin) {
+		return false;
+	}
+	if (level == 0) {
+		return traceCell<ANY_HIT>(trace, x, z);
+	}
+
+	int below = level - 1;
+	dvec3 middle = samplePoint(std::min((2 * x + 1) << below, width - 1), std::min((2 * z + 1) << below, depth - 1));
+	double cuts[2];
+	int numCuts = 0;
+	double tx = (middle.x - trace.ray.origin.x) * trace.invDir.x;
+	double tz = (middle.z - trace.ray.origin.z) * trace.invDir.z;
+	if (tx > tEnter && tx < tExit) {
+		cuts[numCuts++] = tx;
+	}
+	if (tz > tEnter && tz < tExit) {
+		cuts[numCuts++] = tz;
+	}
+	if (numCuts == 2 && cuts[0] > cuts[1]) {
+		std::swap(cuts[0], cuts[1]);
+	}
+
+	double t0 = tEnter;
+	for (int i = 0; i <= numCuts; i++) {
+		double t1 = i < numCuts ? cuts[i] : tExit;
+		dvec3 pt = trace.ray.getPoint(0.5 * (t0 + t1));
+		int cx = 2 * x + (pt.x >= middle.x ? 1 : 0);
+		int cz = 2 * z + (pt.z >= middle.z ? 1 : 0);
+		if (cx < levelWidth[below] && cz < levelDepth[below] && traceBlock<ANY_HIT>(trace, below, cx, cz, t0, t1)) {
+			return true;
+		}
+		t0 = t1;
+	}
+	return false;
+}
+
+/**
+ * @fn	template <bool ANY_HIT> bool IHeightField::traceField(HeightFieldTrace &trace) const
+ * @brief	Follows a ray through the whole field, from the top of the pyramid down.
+ * @param [in,out]	trace	The ray.
+ * @return	true iff the ray hits the terrain in its range of interest.
+ */
+
+template <bool ANY_HIT>
+bool IHeightField::traceField(HeightFieldTrace &trace) const {
+	if (levelStart.empty()) {
+		return false;
+	}
+	double tEnter = trace.tMin, tExit = trace.tMax;
+	if (!box.padded().clip(trace.ray.origin, trace.invDir, tEnter, tExit)) {
+		return false;
+	}
+	return traceBlock<ANY_HIT>(trace, numLevels() - 1, 0, 0, tEnter, tExit);
+}
+
+/**
+ * @fn	void IHeightField::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Identifies the nearest intersection.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit. u and v locate it across the field's x and z extent.
+ */
+
+void IHeightField::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int triangle;
+	hit.t = IHeightField::findClosestHit(ray, triangle);
+	if (hit.t != FLT_MAX) {
+		IHeightField::getHitAttributes(ray, hit.t, triangle, hit);
+	}
+}
+
+/**
+ * @fn	double IHeightField::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds t of the nearest intersection and the triangle it is on.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	The triangle that was hit: 2 * (z * (width - 1) + x) + half
+ * 								for half of cell (x, z).
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double IHeightField::findClosestHit(const Ray &ray, int &primitive) const {
+	HeightFieldTrace trace(ray, 0.0, FLT_MAX);
+	if (!traceField<false>(trace)) {
+		primitive = -1;
+		return FLT_MAX;
+	}
+	primitive = 2 * (trace.z * (width - 1) + trace.x) + trace.half;
+	return trace.t;
+}
+
+/**
+ * @fn	void IHeightField::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept, normal and texture coordinates of a hit. The one
+ * 			triangle that was hit is intersected again to recover the barycentric
+ * 			coordinates the normal is interpolated with.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	The triangle returned by findClosestHit.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IHeightField::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	int half = primitive % 2;
+	int x = primitive / 2 % (width - 1), z = primitive / 2 / (width - 1);
+	dvec3 p00 = samplePoint(x, z), p10 = samplePoint(x + 1, z);
+	dvec3 p01 = samplePoint(x, z + 1), p11 = samplePoint(x + 1, z + 1);
+	int axes[3];
+	dvec3 shear;
+	setUpWatertightRay(ray, axes, shear);
+	double triT, u, v;
+	if (half == 0) {
+		intersectWatertight(p00, p11, p10, ray, axes, shear, triT, u, v);
+	} else {
+		intersectWatertight(p00, p01, p11, ray, axes, shear, triT, u, v);
+	}
+
+	dvec3 n0 = sampleNormal(x, z);
+	dvec3 n1 = half == 0 ? sampleNormal(x + 1, z + 1) : sampleNormal(x, z + 1);
+	dvec3 n2 = half == 0 ? sampleNormal(x + 1, z) : sampleNormal(x + 1, z + 1);
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = glm::normalize((1.0 - u - v) * n0 + u * n1 + v * n2);
+	hit.u = glm::clamp((hit.interceptPt.x - box.lo.x) / (box.hi.x - box.lo.x), 0.0, 1.0);
+	hit.v = glm::clamp((hit.interceptPt.z - box.lo.z) / (box.hi.z - box.lo.z), 0.0, 1.0);
+}
+
+/**
+ * @fn	bool IHeightField::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the terrain in [tMin, tMax], stopping at the
+ * 			first hit found.
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool IHeightField::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	HeightFieldTrace trace(ray, tMin, tMax);
+	return traceField<true>(trace);
+}
+
+/**
+ * @fn	bool IHeightField::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box around the terrain.
+ * @param [in,out]	box	The box.
+ * @return	False if the field has too few samples to make any cells.
+ */
+
+bool IHeightField::getBoundingBox(BoundingBox &box) const {
+	if (levelStart.empty()) {
+		return false;
+	}
+	box = this->box;
+	return true;
+}
+
+/**
+ * @fn	size_t IHeightField::memoryBytes() const
+ * @brief	Gets the memory taken by the samples and the pyramid.
+ * @return	The number of bytes.
+ */
+
+size_t IHeightField::memoryBytes() const {
+	return sizeof(IHeightField) + (heights.capacity() + pyramid.capacity()) * sizeof(float)
+			+ (levelStart.capacity() + levelWidth.capacity() + levelDepth.capacity()) * sizeof(int);
+}
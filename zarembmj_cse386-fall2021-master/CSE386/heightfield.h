@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include "ishape.h"
+#include "image.h"
+
+struct HeightFieldTrace;
+
+/**
+ * @struct	IHeightField
+ * @brief	Terrain given by a grid of elevations, such as the pixels of a grayscale
+ * 			image. Sample (x, z) of a width by depth grid is at height heights[z * width + x],
+ * 			and the samples are spread evenly over a rectangle of the xz plane. Each
+ * 			cell between four samples is drawn as two triangles, which are never stored:
+ * 			the field takes one float per sample, plus a pyramid of the lowest and
+ * 			highest elevation in blocks of 2x2, 4x4, 8x8, ... cells. A ray walks down the
+ * 			pyramid, visiting the blocks it crosses front to back and skipping every
+ * 			block that it passes above or below, so it only reaches the cells near where
+ * 			it meets the ground. Cells are intersected with the watertight triangle test
+ * 			of ITriangleMesh. Normals are interpolated from ones found at the samples by
+ * 			central differences; a hit's u and v run from 0 to 1 across the field, so an
+ * 			image can be draped over it as a texture.
+ */
+
+struct IHeightField : public IShape {
+	IHeightField(int numX, int numZ, vector<float> elevations, const dvec3 &position, const dvec3 &size);
+	IHeightField(const Image &image, const dvec3 &position, const dvec3 &size);
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	dvec3 samplePoint(int x, int z) const;
+	int numSamples() const { return (int)heights.size(); }
+	int numLevels() const { return (int)levelStart.size(); }
+	size_t memoryBytes() const;
+protected:
+	int width;						//!< number of samples along x
+	int depth;						//!< number of samples along z
+	dvec3 corner;					//!< position of sample (0, 0), at height 0
+	dvec3 spacing;					//!< distance between neighboring samples along x and z
+	vector<float> heights;			//!< elevation of each sample, row by row along x
+	vector<float> pyramid;			//!< lowest and highest elevation of each block, level by level
+	vector<int> levelStart;			//!< offset of each level's first block in pyramid, in blocks
+	vector<int> levelWidth;			//!< number of blocks along x in each level
+	vector<int> levelDepth;			//!< number of blocks along z in each level
+	BoundingBox box;				//!< box around the whole field
+	double margin;					//!< allowance for rounding when deciding a ray misses a block
+	void build();
+	void getBlockBounds(int level, int x, int z, double &lo, double &hi) const;
+	dvec3 sampleNormal(int x, int z) const;
+	template <bool ANY_HIT>
+	bool traceBlock(HeightFieldTrace &trace, int level, int x, int z, double tEnter, double tExit) const;
+	template <bool ANY_HIT>
+	bool traceCell(HeightFieldTrace &trace, int x, int z) const;
+	template <bool ANY_HIT>
+	bool traceField(HeightFieldTrace &trace) const;
+};
@@ -15,6 +15,8 @@
 #include "image.h"
 #include "utilities.h"
 
+struct VisibleIShape;
+
 /**
  * @struct	HitRecord
  * @brief	Stores information regarding a ray-object intersection. Used in raytracing.
@@ -27,6 +29,7 @@ struct HitRecord {
 	Material material;		//!< the Material value of the object.
 	Image *texture;			//!< the texture associated with this object, if any.
 	double u, v;			//!< (u,v) correpsonding to intersection point.
+	const VisibleIShape *object;	//!< the object that was hit, if known.
 
 	/**
 	 * @fn	HitRecord()
@@ -37,6 +40,7 @@ struct HitRecord {
 		t = FLT_MAX;
 		u = v = 0;
 		texture = nullptr; 
+		object = nullptr;
 	}
 
 	/**
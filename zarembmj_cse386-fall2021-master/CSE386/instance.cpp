@@ -0,0 +1,162 @@
+#include "instance.h"
+
+/**
+ * @fn	IInstance::IInstance(const IShape *shape, const dmat4 &transform)
+ * @brief	Places a shared shape in the world.
+ * @param	shape	 	The shape, in object space.
+ * @param	transform	The object-to-world transform. Must be invertible.
+ */
+
+IInstance::IInstance(const IShape *shape, const dmat4 &transform)
+	: geometry(shape) {
+	setTransform(transform);
+}
+
+/**
+ * @fn	void IInstance::setTransform(const dmat4 &transform)
+ * @brief	Moves the instance. The inverse transform and the world-space box are
+ * 			recomputed here, once, rather than for every ray.
+ * @param	transform	The object-to-world transform. Must be invertible.
+ */
+
+void IInstance::setTransform(const dmat4 &transform) {
+	objectToWorld = transform;
+	worldToObject = glm::inverse(transform);
+	normalToWorld = glm::transpose(dmat3(worldToObject));
+
+	BoundingBox objectBox;
+	bounded = geometry->getBoundingBox(objectBox);
+	worldBox = BoundingBox();
+	if (bounded) {
+		for (int corner = 0; corner < 8; corner++) {
+			dvec4 pt(corner & 1 ? objectBox.hi.x : objectBox.lo.x,
+					corner & 2 ? objectBox.hi.y : objectBox.lo.y,
+					corner & 4 ? objectBox.hi.z : objectBox.lo.z, 1.0);
+			worldBox.grow(dvec3(objectToWorld * pt));
+		}
+	}
+}
+
+/**
+ * @fn	Ray IInstance::toObjectSpace(const Ray &ray, double &scale) const
+ * @brief	Transforms a world-space ray into object space. The object-space ray's
+ * 			direction is normalized, so its t values are scale times the world ray's.
+ * @param 		  	ray  	The world-space ray.
+ * @param [in,out]	scale	Object-space distance per unit of world-space distance.
+ * @return	The object-space ray.
+ */
+
+Ray IInstance::toObjectSpace(const Ray &ray, double &scale) const {
+	dvec3 origin(worldToObject * dvec4(ray.origin, 1.0));
+	dvec3 dir(worldToObject * dvec4(ray.dir, 0.0));
+	scale = glm::length(dir);
+	return Ray(origin, dir);
+}
+
+/**
+ * @fn	void IInstance::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Identifies the nearest intersection with the transformed shape.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit, in world space.
+ */
+
+void IInstance::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int primitive;
+	hit.t = IInstance::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		IInstance::getHitAttributes(ray, hit.t, primitive, hit);
+	}
+}
+
+/**
+ * @fn	double IInstance::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds t of the nearest intersection with the transformed shape.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	The shared shape's primitive.
+ * @return	World-space t of the intersection, or FLT_MAX.
+ */
+
+double IInstance::findClosestHit(const Ray &ray, int &primitive) const {
+	double scale;
+	Ray objectRay = toObjectSpace(ray, scale);
+	double t = geometry->findClosestHit(objectRay, primitive);
+	return t == FLT_MAX ? FLT_MAX : t / scale;
+}
+
+/**
+ * @fn	void IInstance::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Has the shared shape fill in the hit in object space, then moves it into
+ * 			world space.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	The primitive returned by findClosestHit.
+ * @param [in,out]	hit		 	The hit, in world space.
+ */
+
+void IInstance::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	double scale;
+	Ray objectRay = toObjectSpace(ray, scale);
+	geometry->getHitAttributes(objectRay, t * scale, primitive, hit);
+	hit.t = t;
+	hit.interceptPt = dvec3(objectToWorld * dvec4(hit.interceptPt, 1.0));
+	hit.normal = glm::normalize(normalToWorld * hit.normal);
+}
+
+/**
+ * @fn	int IInstance::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds the hits along the ray on the transformed shape.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	World-space t of each hit, in increasing order.
+ * @param [in,out]	primitive	The shared shape's primitive of each hit.
+ * @return	The number of hits found.
+ */
+
+int IInstance::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	double scale;
+	Ray objectRay = toObjectSpace(ray, scale);
+	int count = geometry->findHits(objectRay, maxHits, t, primitive);
+	for (int i = 0; i < count; i++) {
+		t[i] /= scale;
+	}
+	return count;
+}
+
+/**
+ * @fn	bool IInstance::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the transformed shape in [tMin, tMax].
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool IInstance::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	double scale;
+	Ray objectRay = toObjectSpace(ray, scale);
+	return geometry->hasIntersection(objectRay, tMin * scale, tMax * scale);
+}
+
+/**
+ * @fn	void IInstance::getTexCoords(const dvec3 &pt, double &u, double &v) const
+ * @brief	Gets the shared shape's texture coordinates of a world-space point.
+ * @param 		  	pt	The point.
+ * @param [in,out]	u 	The u coordinate.
+ * @param [in,out]	v 	The v coordinate.
+ */
+
+void IInstance::getTexCoords(const dvec3 &pt, double &u, double &v) const {
+	geometry->getTexCoords(dvec3(worldToObject * dvec4(pt, 1.0)), u, v);
+}
+
+/**
+ * @fn	bool IInstance::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box around the transformed shape's box.
+ * @param [in,out]	box	The box.
+ * @return	False if the shared shape is unbounded.
+ */
+
+bool IInstance::getBoundingBox(BoundingBox &box) const {
+	box = worldBox;
+	return bounded;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ishape.h"
+
+/**
+ * @struct	IInstance
+ * @brief	A copy of a shape placed in the world by a 4x4 object-to-world transform.
+ * 			The geometry is not copied: any number of instances may refer to the same
+ * 			shape, such as one ITriangleMesh with its own hierarchy, so memory grows
+ * 			with the number of distinct shapes rather than the number of copies. The
+ * 			scene's BVH sees only the instances' world-space boxes. A ray that enters
+ * 			an instance is transformed into object space and intersected with the
+ * 			shared shape, and the hit is transformed back to world space. Any
+ * 			invertible transform, including non-uniform scales, may be used.
+ */
+
+struct IInstance : public IShape {
+	const IShape *geometry;	//!< the shared shape, in object space. Not owned by the instance.
+	IInstance(const IShape *shape, const dmat4 &transform);
+	void setTransform(const dmat4 &transform);
+	const dmat4 &getTransform() const { return objectToWorld; }
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
+	virtual void getTexCoords(const dvec3 &pt, double &u, double &v) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+protected:
+	dmat4 objectToWorld;	//!< places the shape in the world
+	dmat4 worldToObject;	//!< inverse of objectToWorld, cached
+	dmat3 normalToWorld;	//!< inverse transpose of objectToWorld's upper 3x3
+	BoundingBox worldBox;	//!< box around the transformed shape
+	bool bounded;			//!< false if the shape has no bounding box
+	Ray toObjectSpace(const Ray &ray, double &scale) const;
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cmath>
+#include "defs.h"
+#include "simd.h"
+
+/*
+ * Closed-form intersection routines for the quadrics whose shape is known ahead of
+ * time. Each intersector holds the few numbers its shape needs and provides:
+ *
+ *   roots(Rox, Roy, Roz, dx, dy, dz, tNear, tFar)
+ *		the two roots along a ray whose origin, relative to the shape's center, is Ro,
+ *		in increasing order. Returns true (per lane) iff there are two distinct roots;
+ *		as in quadratic(), a tangent ray is a miss. Written once for Real == double and
+ *		Real == PacketDouble, so each lane of a packet gets exactly the scalar result.
+ *   inBounds(y, z)
+ *		whether a point on the infinite surface, relative to the center, is displayed.
+ *   normal(pt)
+ *		the unit normal at a point on the surface, relative to the center.
+ *
+ * closestRoot, closestRoots and anyRoot (ishape.h) are written once against that
+ * interface and instantiated for each intersector, so choosing the routine for a shape
+ * costs nothing at run time: a shape, or a loop of CompactScene, calls the one for its
+ * type.
+ */
+
+/**
+ * @struct	SphereIntersector
+ * @brief	The geometric sphere test. Since rays have unit directions, the quadratic
+ * 			reduces to t^2 + 2bt + c = 0.
+ */
+
+struct SphereIntersector {
+	double radiusSq;		//!< squared radius
+	SphereIntersector(double radius = 1.0) : radiusSq(radius * radius) {}
+	template <typename Real>
+	auto roots(const Real &Rox, const Real &Roy, const Real &Roz,
+				const Real &dx, const Real &dy, const Real &dz,
+				Real &tNear, Real &tFar) const -> decltype(Real() > Real()) {
+		using std::sqrt;
+		Real b = Rox * dx + Roy * dy + Roz * dz;
+		Real c = Rox * Rox + Roy * Roy + Roz * Roz - radiusSq;
+		Real disc = b * b - c;
+		auto hit = disc > 0.0;
+		Real root = sqrt(select(hit, disc, Real(0.0)));
+		tNear = -b - root;
+		tFar = -b + root;
+		return hit;
+	}
+	bool inBounds(double y, double z) const { return true; }
+	dvec3 normal(const dvec3 &pt) const { return glm::normalize(pt); }
+};
+
+/**
+ * @struct	CylinderYIntersector
+ * @brief	Open cylinder along y: a circle test in the xz plane, then a check of y.
+ */
+
+struct CylinderYIntersector {
+	double radiusSq;		//!< squared radius
+	double halfLength;		//!< the cylinder extends this far above and below its center
+	CylinderYIntersector(double radius = 1.0, double length = 1.0)
+		: radiusSq(radius * radius), halfLength(length) {}
+	template <typename Real>
+	auto roots(const Real &Rox, const Real &Roy, const Real &Roz,
+				const Real &dx, const Real &dy, const Real &dz,
+				Real &tNear, Real &tFar) const -> decltype(Real() > Real()) {
+		using std::sqrt;
+		Real a = dx * dx + dz * dz;
+		Real b = Rox * dx + Roz * dz;
+		Real c = Rox * Rox + Roz * Roz - radiusSq;
+		Real disc = b * b - a * c;
+		auto hit = (a != 0.0) & (disc > 0.0);
+		Real root = sqrt(select(hit, disc, Real(0.0)));
+		tNear = (-b - root) / a;
+		tFar = (-b + root) / a;
+		return hit;
+	}
+	bool inBounds(double y, double z) const { return std::abs(y) < halfLength; }
+	dvec3 normal(const dvec3 &pt) const { return glm::normalize(dvec3(pt.x, 0.0, pt.z)); }
+};
+
+/**
+ * @struct	CylinderZIntersector
+ * @brief	Open cylinder along z: a circle test in the xy plane, then a check of z.
+ */
+
+struct CylinderZIntersector {
+	double radiusSq;		//!< squared radius
+	double halfLength;		//!< the cylinder extends this far in front of and behind its center
+	CylinderZIntersector(double radius = 1.0, double length = 1.0)
+		: radiusSq(radius * radius), halfLength(length) {}
+	template <typename Real>
+	auto roots(const Real &Rox, const Real &Roy, const Real &Roz,
+				const Real &dx, const Real &dy, const Real &dz,
+				Real &tNear, Real &tFar) const -> decltype(Real() > Real()) {
+		using std::sqrt;
+		Real a = dx * dx + dy * dy;
+		Real b = Rox * dx + Roy * dy;
+		Real c = Rox * Rox + Roy * Roy - radiusSq;
+		Real disc = b * b - a * c;
+		auto hit = (a != 0.0) & (disc > 0.0);
+		Real root = sqrt(select(hit, disc, Real(0.0)));
+		tNear = (-b - root) / a;
+		tFar = (-b + root) / a;
+		return hit;
+	}
+	bool inBounds(double y, double z) const { return std::abs(z) < halfLength; }
+	dvec3 normal(const dvec3 &pt) const { return glm::normalize(dvec3(pt.x, pt.y, 0.0)); }
+};
+
+/**
+ * @struct	ConeYIntersector
+ * @brief	Cone along y with its tip at the center: x^2 + z^2 = slopeSq * y^2, of which
+ * 			only the nappe below the tip, down to height, is displayed. The leading
+ * 			coefficient may be negative, so the roots are put in order explicitly.
+ */
+
+struct ConeYIntersector {
+	double slopeSq;			//!< (radius / height)^2
+	double height;			//!< distance from the tip down to the base
+	ConeYIntersector(double radius = 1.0, double H = 1.0)
+		: slopeSq(radius * radius / H / H), height(H) {}
+	template <typename Real>
+	auto roots(const Real &Rox, const Real &Roy, const Real &Roz,
+				const Real &dx, const Real &dy, const Real &dz,
+				Real &tNear, Real &tFar) const -> decltype(Real() > Real()) {
+		using std::sqrt;
+		Real a = dx * dx + dz * dz - slopeSq * (dy * dy);
+		Real b = Rox * dx + Roz * dz - slopeSq * (Roy * dy);
+		Real c = Rox * Rox + Roz * Roz - slopeSq * (Roy * Roy);
+		Real disc = b * b - a * c;
+		auto hit = (a != 0.0) & (disc > 0.0);
+		Real root = sqrt(select(hit, disc, Real(0.0)));
+		Real r0 = (-b - root) / a;
+		Real r1 = (-b + root) / a;
+		auto ordered = r0 < r1;
+		tNear = select(ordered, r0, r1);
+		tFar = select(ordered, r1, r0);
+		return hit;
+	}
+	bool inBounds(double y, double z) const { return -y < height && y <= 0; }
+	dvec3 normal(const dvec3 &pt) const { return glm::normalize(dvec3(pt.x, -slopeSq * pt.y, pt.z)); }
+};
+
+/**
+ * @struct	EllipsoidIntersector
+ * @brief	Ellipsoid, intersected as a unit sphere after scaling each axis by the
+ * 			inverse of its semi-axis length.
+ */
+
+struct EllipsoidIntersector {
+	dvec3 invSize;			//!< 1 / semi-axis lengths
+	EllipsoidIntersector(const dvec3 &size = dvec3(1.0, 1.0, 1.0))
+		: invSize(1.0 / size.x, 1.0 / size.y, 1.0 / size.z) {}
+	template <typename Real>
+	auto roots(const Real &Rox, const Real &Roy, const Real &Roz,
+				const Real &dx, const Real &dy, const Real &dz,
+				Real &tNear, Real &tFar) const -> decltype(Real() > Real()) {
+		using std::sqrt;
+		Real ux = Rox * invSize.x, uy = Roy * invSize.y, uz = Roz * invSize.z;
+		Real vx = dx * invSize.x, vy = dy * invSize.y, vz = dz * invSize.z;
+		Real a = vx * vx + vy * vy + vz * vz;
+		Real b = ux * vx + uy * vy + uz * vz;
+		Real c = ux * ux + uy * uy + uz * uz - 1.0;
+		Real disc = b * b - a * c;
+		auto hit = disc > 0.0;
+		Real root = sqrt(select(hit, disc, Real(0.0)));
+		tNear = (-b - root) / a;
+		tFar = (-b + root) / a;
+		return hit;
+	}
+	bool inBounds(double y, double z) const { return true; }
+	dvec3 normal(const dvec3 &pt) const { return glm::normalize(pt * invSize * invSize); }
+};
@@ -7,8 +7,57 @@
  * permission is granted.
  ****************************************************/
 
+#include <atomic>
 #include "iscene.h"
 
+/**
+ * @struct	OccluderCache
+ * @brief	One thread's record of the opaque object that last blocked each light.
+ * 			Neighboring points are usually shadowed by the same object, so it is worth
+ * 			testing first.
+ */
+
+struct OccluderCache {
+	unsigned int generation = 0;			//!< the frame that occluders were found in
+	vector<const IShape *> occluders;		//!< last opaque blocker of each light, or nullptr
+	OccluderCacheStats stats;				//!< counters since they were last taken
+};
+
+static thread_local OccluderCache occluderCache;				//!< this thread's cache
+static std::atomic<unsigned int> nextOccluderCacheGeneration(1);	//!< generation of the next frame
+
+/**
+ * @fn	static const IShape *&cachedOccluder(unsigned int generation, int light)
+ * @brief	Finds this thread's cached occluder of a light. The cache is emptied when it
+ * 			was last used for another frame, so that it never holds an object that has
+ * 			since been removed or made transparent.
+ * @param	generation	The scene's occluderCacheGeneration.
+ * @param	light	  	The light's index.
+ * @return	The cached occluder, nullptr if there is none.
+ */
+
+static const IShape *&cachedOccluder(unsigned int generation, int light) {
+	if (occluderCache.generation != generation) {
+		occluderCache.generation = generation;
+		occluderCache.occluders.clear();
+	}
+	if (light >= (int)occluderCache.occluders.size()) {
+		occluderCache.occluders.resize(light + 1, nullptr);
+	}
+	return occluderCache.occluders[light];
+}
+
+/**
+ * @fn	static const ObjectLinks *castersOf(const PositionalLight *light)
+ * @brief	Finds the objects that can cast a light's shadows, for the occlusion searches.
+ * @param	light	The light, or nullptr.
+ * @return	The light's shadowCasters, or nullptr if any object can cast its shadows.
+ */
+
+static const ObjectLinks *castersOf(const PositionalLight *light) {
+	return light != nullptr && !light->shadowCasters.isEmpty() ? &light->shadowCasters : nullptr;
+}
+
 /**
  * @fn	IScene::IScene(RaytracingCamera *theCamera)
  * @brief	Construct scene using a particular camera.
@@ -27,6 +76,7 @@ IScene::IScene(RaytracingCamera *theCamera) {
 
 void IScene::addOpaqueObject(const VisibleIShapePtr obj) {
 	opaqueObjs.push_back(obj);
+	acceleratorIsStale = true;
 }
 
 /**
@@ -39,6 +89,275 @@ void IScene::addOpaqueObject(const VisibleIShapePtr obj) {
 void IScene::addTransparentObject(const VisibleIShapePtr obj, double alpha) {
 	obj->material.alpha = alpha;
 	transparentObjs.push_back(obj);
+	acceleratorIsStale = true;
+}
+
+/**
+ * @fn	void IScene::markMoved(const VisibleIShapePtr obj)
+ * @brief	Records that an object's shape or visibility has been changed, so that the
+ * 			next buildAccelerator updates it. Marking an object more than once per frame
+ * 			is harmless.
+ * @param	obj	The object, which must already be in the scene.
+ */
+
+void IScene::markMoved(const VisibleIShapePtr obj) {
+	if (!obj->dirty) {
+		obj->dirty = true;
+		movedObjs.push_back(obj);
+	}
+}
+
+/**
+ * @fn	void IScene::buildAccelerator()
+ * @brief	Brings the structure selected by accelerator up to date. Must be called after
+ * 			objects are added or moved, and before rays are traced. It is rebuilt from
+ * 			scratch if objects were added or a different accelerator was selected. If
+ * 			only objects marked with markMoved have changed, the BVH is refit around
+ * 			them, unless that leaves it so poor that a rebuild is cheaper overall.
+ * 			The compact arrays hold copies of the shapes, and grid cells cannot be
+ * 			refit, so those are always rebuilt. Either way, the occluder caches are
+ * 			emptied, since materials may have changed as well.
+ */
+
+void IScene::buildAccelerator() {
+	occluderCacheGeneration = nextOccluderCacheGeneration++;
+	bool rebuild = acceleratorIsStale || accelerator != builtAccelerator;
+	if (!rebuild && !movedObjs.empty()) {
+		if (accelerator == Accelerator::BVH) {
+			rebuild = !bvh.refit(movedObjs) || bvh.needsRebuild();
+		} else {
+			rebuild = true;
+		}
+	}
+	for (size_t i = 0; i < movedObjs.size(); i++) {
+		movedObjs[i]->dirty = false;
+	}
+	movedObjs.clear();
+	if (!rebuild) {
+		return;
+	}
+
+	vector<VisibleIShapePtr> allObjs(opaqueObjs);
+	allObjs.insert(allObjs.end(), transparentObjs.begin(), transparentObjs.end());
+	if (accelerator == Accelerator::COMPACT_LIST) {
+		compact.build(allObjs);
+	} else if (accelerator == Accelerator::GRID) {
+		grid.build(allObjs);
+	} else {
+		bvh.build(allObjs);
+	}
+	builtAccelerator = accelerator;
+	acceleratorIsStale = false;
+}
+
+/**
+ * @fn	void IScene::findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType) const
+ * @brief	Finds the closest opaque or transparent object hit by a ray.
+ * @param 		  	ray    	The ray.
+ * @param [in,out]	theHit 	The closest hit, or t == FLT_MAX if nothing was hit.
+ * @param 		  	rayType	The kind of ray; objects it cannot see are skipped.
+ */
+
+void IScene::findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType) const {
+	if (accelerator == Accelerator::COMPACT_LIST) {
+		compact.findIntersection(ray, theHit, rayType);
+	} else if (accelerator == Accelerator::GRID) {
+		grid.findIntersection(ray, theHit, rayType);
+	} else {
+		bvh.findIntersection(ray, theHit, rayType);
+	}
+}
+
+/**
+ * @fn	void IScene::findIntersections(const Ray *rays, HitRecord hits[PACKET_SIZE], unsigned int rayType) const
+ * @brief	Finds the closest opaque or transparent object hit by each ray of a packet.
+ * @param 		  	rays   	PACKET_SIZE rays, ideally close together.
+ * @param [in,out]	hits   	The closest hit of each ray, or t == FLT_MAX.
+ * @param 		  	rayType	The kind of the rays; objects it cannot see are skipped.
+ */
+
+void IScene::findIntersections(const Ray *rays, HitRecord hits[PACKET_SIZE], unsigned int rayType) const {
+	if (accelerator == Accelerator::COMPACT_LIST) {
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			compact.findIntersection(rays[k], hits[k], rayType);
+		}
+	} else if (accelerator == Accelerator::GRID) {
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			grid.findIntersection(rays[k], hits[k], rayType);
+		}
+	} else {
+		bvh.findIntersections(rays, hits, rayType);
+	}
+}
+
+/**
+ * @fn	void IScene::findHits(const Ray &ray, RayHits &hits, unsigned int rayType) const
+ * @brief	Finds the nearest hits along a ray, up to the first opaque one, in a single
+ * 			search of the scene. The compact arrays only know each object's closest hit,
+ * 			so with COMPACT_LIST every object is tested in a linear pass instead.
+ * @param 		  	ray    	The ray.
+ * @param [in,out]	hits   	The list of hits.
+ * @param 		  	rayType	The kind of ray; objects it cannot see are skipped.
+ */
+
+void IScene::findHits(const Ray &ray, RayHits &hits, unsigned int rayType) const {
+	if (accelerator == Accelerator::COMPACT_LIST) {
+		VisibleIShape::findHits(ray, opaqueObjs, hits, rayType);
+		VisibleIShape::findHits(ray, transparentObjs, hits, rayType);
+	} else if (accelerator == Accelerator::GRID) {
+		grid.findHits(ray, hits, rayType);
+	} else {
+		bvh.findHits(ray, hits, rayType);
+	}
+}
+
+/**
+ * @fn	double IScene::inShadow(const dvec3 &lightPos, const dvec3 &intercept, const dvec3 &normal, int light) const
+ * @brief	Determines how much of the light from lightPos the objects between it and the
+ * 			intercept block. With useOccluderCache, the opaque object that last blocked
+ * 			the same light on this thread is tried first; if it still blocks, the point
+ * 			is fully in shadow and the accelerator need not be searched. Otherwise the
+ * 			opaque object the search stops at, if any, replaces it. The result is the
+ * 			same either way. Only the light's shadowCasters can block it. Since the
+ * 			cache is kept per light, a light's links are only changed between frames.
+ * @param	lightPos 	Where the light is positioned.
+ * @param	intercept	The position of the intercept.
+ * @param	normal   	The normal vector at the intercept point.
+ * @param	light	 	The light's index in Plights followed by Slights, or -1 to
+ * 						not use the cache and let every object cast a shadow.
+ * @return	The amount of shadow, from 0 (fully lit) to 1.
+ */
+
+double IScene::inShadow(const dvec3 &lightPos, const dvec3 &intercept, const dvec3 &normal, int light) const {
+	const ObjectLinks *casters = castersOf(getLight(light));
+	const IShape **occluder = nullptr;
+	if (useOccluderCache && light >= 0) {
+		const IShape *&cached = cachedOccluder(occluderCacheGeneration, light);
+		if (cached != nullptr) {
+			occluderCache.stats.lookups++;
+			Ray ray(intercept, glm::normalize(lightPos - intercept));
+			if (cached->hasIntersection(ray, SHADOW_RAY_TMIN, glm::distance(lightPos, intercept))) {
+				occluderCache.stats.hits++;
+				return 1.0;
+			}
+		}
+		occluder = &cached;
+	}
+	if (accelerator == Accelerator::COMPACT_LIST) {
+		return ::inShadow(lightPos, intercept, normal, compact, occluder, casters);
+	} else if (accelerator == Accelerator::GRID) {
+		return ::inShadow(lightPos, intercept, normal, grid, occluder, casters);
+	}
+	return ::inShadow(lightPos, intercept, normal, bvh, occluder, casters);
+}
+
+/**
+ * @fn	void IScene::inShadow(const dvec3 &lightPos, const HitRecord hits[PACKET_SIZE], double sha[PACKET_SIZE], int light) const
+ * @brief	Finds the shadow cast on each hit of a packet by one light. The shadow
+ * 			rays all head for the same point, so with the BVH they are traced together
+ * 			as a packet; the other accelerators trace them one at a time. Each ray
+ * 			starts just off the surface, as in RayTracer::shadeLocal, and the result is
+ * 			the same as calling inShadow for each hit. The occluder cache is used as
+ * 			there: rays that the cached occluder blocks are left out of the packet.
+ * 			Hits on objects the light does not illuminate are not traced at all.
+ * @param 		  	lightPos	Where the light is positioned.
+ * @param 		  	hits		PACKET_SIZE hits. Rays that missed (t == FLT_MAX), and hits
+ * 								the light is not linked to, are skipped and get 0.
+ * @param [in,out]	sha			The amount of shadow at each hit, from 0 (fully lit) to 1.
+ * @param 		  	light		As in the single ray version.
+ */
+
+void IScene::inShadow(const dvec3 &lightPos, const HitRecord hits[PACKET_SIZE], double sha[PACKET_SIZE],
+						int light) const {
+	const PositionalLight *linkedLight = getLight(light);
+	dvec3 Po[PACKET_SIZE];
+	bool lit[PACKET_SIZE];
+	int first = -1;
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		sha[k] = 0.0;
+		lit[k] = hits[k].t != FLT_MAX && (linkedLight == nullptr || linkedLight->illuminates(hits[k].object));
+		if (lit[k]) {
+			Po[k] = IShape::movePointOffSurface(hits[k].interceptPt, hits[k].normal);
+			first = first < 0 ? k : first;
+		}
+	}
+	if (first < 0) {
+		return;
+	}
+	if (accelerator != Accelerator::BVH) {
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			if (lit[k]) {
+				sha[k] = inShadow(lightPos, Po[k], hits[k].normal, light);
+			}
+		}
+		return;
+	}
+
+	const IShape *cachedNone = nullptr;
+	const IShape *&cached = useOccluderCache && light >= 0 ?
+							cachedOccluder(occluderCacheGeneration, light) : cachedNone;
+	vector<Ray> rays;
+	rays.reserve(PACKET_SIZE);
+	double lightDistance[PACKET_SIZE];
+	bool trace = false;
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		// A lane that is not lit copies a real ray, so the packet holds no NaNs, but is not traced
+		int lane = lit[k] ? k : first;
+		rays.push_back(Ray(Po[lane], glm::normalize(lightPos - Po[lane])));
+		lightDistance[k] = lane == k ? glm::distance(lightPos, Po[k]) : -1.0;
+		if (lane == k && cached != nullptr) {
+			occluderCache.stats.lookups++;
+			if (cached->hasIntersection(rays[k], SHADOW_RAY_TMIN, lightDistance[k])) {
+				occluderCache.stats.hits++;
+				lightDistance[k] = -1.0;
+				sha[k] = 1.0;
+			}
+		}
+		trace = trace || lightDistance[k] >= 0.0;
+	}
+	if (!trace) {
+		return;
+	}
+	double occlusion[PACKET_SIZE];
+	const IShape *occluders[PACKET_SIZE] = {};
+	bvh.findOcclusions(rays.data(), SHADOW_RAY_TMIN, lightDistance, occlusion, occluders, castersOf(linkedLight));
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		if (lightDistance[k] >= 0.0) {
+			sha[k] = occlusion[k];
+			cached = occluders[k] != nullptr ? occluders[k] : cached;
+		}
+	}
+}
+
+/**
+ * @fn	const PositionalLight *IScene::getLight(int light) const
+ * @brief	Finds a light by the index inShadow takes.
+ * @param	light	The light's index in Plights followed by Slights.
+ * @return	The light, or nullptr if there is no such light.
+ */
+
+const PositionalLight *IScene::getLight(int light) const {
+	if (light < 0) {
+		return nullptr;
+	} else if (light < (int)Plights.size()) {
+		return Plights[light];
+	} else if (light < (int)(Plights.size() + Slights.size())) {
+		return Slights[light - Plights.size()];
+	}
+	return nullptr;
+}
+
+/**
+ * @fn	OccluderCacheStats IScene::takeOccluderCacheStats()
+ * @brief	Gets the occluder cache counters of the calling thread, for every scene it
+ * 			has traced shadow rays in, and sets them back to zero.
+ * @return	The counters.
+ */
+
+OccluderCacheStats IScene::takeOccluderCacheStats() {
+	OccluderCacheStats stats = occluderCache.stats;
+	occluderCache.stats = OccluderCacheStats();
+	return stats;
 }
 
 /**
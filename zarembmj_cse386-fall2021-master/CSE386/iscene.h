@@ -16,6 +16,33 @@
 #include "light.h"
 #include "eshape.h"
 #include "ishape.h"
+#include "bvh.h"
+#include "compactscene.h"
+#include "grid.h"
+#include "sampling.h"
+
+/**
+ * @enum	Accelerator
+ * @brief	How a scene's objects are searched for the ones a ray hits.
+ */
+
+enum class Accelerator {
+	BVH,			//!< bounding volume hierarchy; the best choice for all but tiny scenes
+	COMPACT_LIST,	//!< every object is tested, from CompactScene's typed arrays
+	GRID			//!< two-level uniform grid; for many objects of similar size
+};
+
+/**
+ * @struct	OccluderCacheStats
+ * @brief	Counters kept by the occluder caches (see IScene::inShadow).
+ */
+
+struct OccluderCacheStats {
+	long long lookups = 0;		//!< shadow rays that tested a cached occluder first
+	long long hits = 0;			//!< of those, the ones that the cached occluder still blocked
+	double hitRate() const { return lookups > 0 ? (double)hits / lookups : 0.0; }
+	void add(const OccluderCacheStats &other) { lookups += other.lookups; hits += other.hits; }
+};
 
 /**
  * @struct	IScene
@@ -28,14 +55,38 @@ struct IScene {
 	vector<VisibleIShapePtr> opaqueObjs;			//!< All the visible objects in the scene
 	vector<VisibleIShapePtr> transparentObjs;		//!< All the transparent objects in the scene
 	RaytracingCamera *camera;						//!< The one camera in the scene
+	Accelerator accelerator = Accelerator::BVH;		//!< Which of bvh, compact and grid is built and searched
+	BVH bvh;										//!< Hierarchy over opaqueObjs and transparentObjs
+	CompactScene compact;							//!< Typed arrays holding opaqueObjs and transparentObjs
+	Grid grid;										//!< Grid over opaqueObjs and transparentObjs
+	vector<VisibleIShapePtr> movedObjs;				//!< Objects marked moved since the accelerator was updated
+	bool acceleratorIsStale = true;					//!< Objects were added since the accelerator was built
+	Accelerator builtAccelerator = Accelerator::BVH;	//!< Which accelerator was last built
+	bool useOccluderCache = true;					//!< Test the object that last blocked each light first
+	unsigned int occluderCacheGeneration = 0;		//!< Identifies this frame to the occluder caches
+	OccluderCacheStats occluderCacheStats;			//!< Occluder cache counters of the last frame ray traced
 	IScene(RaytracingCamera *theCamera);
 	void addOpaqueObject(const VisibleIShapePtr obj);
 	void addTransparentObject(const VisibleIShapePtr obj, double alpha);
+	void markMoved(const VisibleIShapePtr obj);
+	void buildAccelerator();
+	void findIntersection(const Ray &ray, HitRecord &theHit, unsigned int rayType = ALL_RAYS) const;
+	void findIntersections(const Ray *rays, HitRecord hits[PACKET_SIZE], unsigned int rayType = ALL_RAYS) const;
+	void findHits(const Ray &ray, RayHits &hits, unsigned int rayType = ALL_RAYS) const;
+	double inShadow(const dvec3 &lightPos, const dvec3 &intercept, const dvec3 &normal, int light = -1) const;
+	void inShadow(const dvec3 &lightPos, const HitRecord hits[PACKET_SIZE], double sha[PACKET_SIZE],
+					int light = -1) const;
+	const PositionalLight *getLight(int light) const;
+	static OccluderCacheStats takeOccluderCacheStats();
 	
 	void addLight(const PositionalLightPtr light);
 	void addLight(const SpotLightPtr light);
 
 	int antiAliasing = 1;
+	bool adaptiveAntiAliasing = false;		//!< Sample adaptively instead of on an antiAliasing x antiAliasing grid
+	int maxSamples = 16;					//!< Most samples per pixel when sampling adaptively
+	double aaThreshold = 0.02;				//!< Noise/contrast above which a pixel gets more samples
+	SamplePattern samplePattern = SamplePattern::HALTON;	//!< Where adaptive samples go in a pixel
 	int numReflections = 0;
 	int currentLight = 0;
 	bool animation = true;
@@ -8,9 +8,34 @@
  ****************************************************/
 
 #include <vector>
+#include <algorithm>
 #include "ishape.h"
 #include "io.h"
 
+/**
+ * @fn	RayPacket::RayPacket(const Ray *packetRays)
+ * @brief	Gathers PACKET_SIZE rays into a packet.
+ * @param	packetRays	The rays. Must stay alive as long as the packet does.
+ */
+
+RayPacket::RayPacket(const Ray *packetRays) : rays(packetRays) {
+	double v[6][PACKET_SIZE];
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		v[0][k] = rays[k].origin.x;
+		v[1][k] = rays[k].origin.y;
+		v[2][k] = rays[k].origin.z;
+		v[3][k] = rays[k].dir.x;
+		v[4][k] = rays[k].dir.y;
+		v[5][k] = rays[k].dir.z;
+	}
+	ox = PacketDouble::load(v[0]);
+	oy = PacketDouble::load(v[1]);
+	oz = PacketDouble::load(v[2]);
+	dx = PacketDouble::load(v[3]);
+	dy = PacketDouble::load(v[4]);
+	dz = PacketDouble::load(v[5]);
+}
+
 /**
  * @fn	IShape::IShape()
  * @brief	Constructs a default IShape, centered at the origin.
@@ -32,6 +57,131 @@ void IShape::getTexCoords(const dvec3 &pt, double &u, double &v) const {
 	u = v = 0;
 }
 
+/**
+ * @fn	void IShape::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	Finds the closest intersection of every ray in a packet. Only t is produced;
+ * 			the caller gets the rest of the HitRecord from findClosestIntersection once
+ * 			it knows which shape is closest. This default is the scalar fallback, which
+ * 			handles one ray at a time. The results must match findClosestIntersection
+ * 			exactly, so any SIMD override has to do the same arithmetic.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's closest intersection, or FLT_MAX.
+ */
+
+void IShape::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		int primitive;
+		t[k] = findClosestHit(packet.rays[k], primitive);
+	}
+}
+
+/**
+ * @fn	double IShape::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	The first half of findClosestIntersection: finds only t, and which part of
+ * 			the shape was hit, so that getHitAttributes can fill in the rest without
+ * 			searching the shape again. This default falls back on
+ * 			findClosestIntersection; shapes override it with something cheaper.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	The part of the shape that was hit; 0 for shapes with one part.
+ * @return	t of the closest intersection, or FLT_MAX.
+ */
+
+double IShape::findClosestHit(const Ray &ray, int &primitive) const {
+	HitRecord hit;
+	findClosestIntersection(ray, hit);
+	primitive = 0;
+	return hit.t;
+}
+
+/**
+ * @fn	void IShape::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	The second half of findClosestIntersection: fills in t, the intercept, the
+ * 			normal and the texture coordinates of a hit found by findClosestHit (and
+ * 			the material, for shapes with their own materials). This default
+ * 			intersects the shape again.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	The primitive returned by findClosestHit.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IShape::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	findClosestIntersection(ray, hit);
+}
+
+/**
+ * @fn	int IShape::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds every hit along a ray, nearest first, up to maxHits of them. This
+ * 			default asks findClosestHit again from just past each hit it finds, as a
+ * 			refracted ray would; shapes that know all their hits at once override it.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find; at least 1.
+ * @param [in,out]	t		 	t of each hit, in increasing order.
+ * @param [in,out]	primitive	The primitive of each hit, for getHitAttributes.
+ * @return	The number of hits found.
+ */
+
+int IShape::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	int count = 0;
+	double tStart = 0.0;
+	Ray next = ray;
+	while (count < maxHits) {
+		double tNext = findClosestHit(next, primitive[count]);
+		if (tNext == FLT_MAX) {
+			break;
+		}
+		t[count] = tStart + tNext;
+		next.origin = movePointOffSurface(ray.getPoint(t[count]), ray.dir);
+		tStart = glm::dot(next.origin - ray.origin, ray.dir);
+		count++;
+	}
+	return count;
+}
+
+/**
+ * @fn	bool IShape::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Any-hit query used for shadow rays: determines whether the ray hits the
+ * 			shape anywhere in [tMin, tMax]. Unlike findClosestIntersection, no normal
+ * 			or texture coordinates are needed, and any hit in range will do. This
+ * 			default falls back on findClosestHit; shapes override it with something
+ * 			cheaper.
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool IShape::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	int primitive;
+	double t = findClosestHit(ray, primitive);
+	return t != FLT_MAX && t >= tMin && t <= tMax;
+}
+
+/**
+ * @fn	bool IShape::getBoundingBox(BoundingBox &box) const
+ * @brief	Computes an axis-aligned box that contains every point on the shape that
+ * 			findClosestIntersection can return. The default is to report the shape as
+ * 			unbounded (e.g., planes), in which case it must be tested against every ray.
+ * @param [in,out]	box	The bounding box.
+ * @return	false iff the shape is unbounded and box was not set.
+ */
+
+bool IShape::getBoundingBox(BoundingBox &box) const {
+	return false;
+}
+
+/**
+ * @fn	bool IShape::hasOwnMaterials() const
+ * @brief	Determines if findClosestIntersection fills in the hit's material itself,
+ * 			as a shape made of many parts with different materials does. Otherwise the
+ * 			material of the VisibleIShape that holds the shape is used.
+ * @return	false by default.
+ */
+
+bool IShape::hasOwnMaterials() const {
+	return false;
+}
+
 /**
  * @fn	dvec3 IShape::movePointOffSurface(const dvec3 &pt, const dvec3 &n)
  * @brief	Compute point that is slightly off surface.
@@ -55,6 +205,8 @@ dvec3 IShape::movePointOffSurface(const dvec3 &pt, const dvec3 &n) {
 VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat, Image *image)
 	: material(mat), shape(shapePtr) {
 	texture = image;
+	dirty = false;
+	visibility = ALL_RAYS;
 }
 
 /**
@@ -73,36 +225,175 @@ void VisibleIShape::findClosestIntersection(const Ray &ray, HitRecord &hit) cons
 	IShape& thisShape = *shape;
 	thisShape.findClosestIntersection(ray, hit);
 	if (hit.t != FLT_MAX) {
-		hit.material = material;
+		if (!thisShape.hasOwnMaterials()) {
+			hit.material = material;
+		}
 		hit.texture = texture;
+		hit.object = this;
 	}
 }
 
+/**
+ * @fn	double VisibleIShape::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the closest intersection, and which part of the shape it
+ * 			is on.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	The part of the shape that was hit.
+ * @return	t of the closest intersection, or FLT_MAX.
+ */
+
+double VisibleIShape::findClosestHit(const Ray &ray, int &primitive) const {
+	return shape->findClosestHit(ray, primitive);
+}
+
+/**
+ * @fn	void VisibleIShape::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the whole HitRecord, material, texture and object included, of a
+ * 			hit found by findClosestHit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	The primitive returned by findClosestHit.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void VisibleIShape::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	shape->getHitAttributes(ray, t, primitive, hit);
+	if (!shape->hasOwnMaterials()) {
+		hit.material = material;
+	}
+	hit.texture = texture;
+	hit.object = this;
+}
+
 /**
  * @fn	HitRecord VisibleIShape::findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces)
  * @brief	Searches for the first intersection
  * @param	ray			The ray.
  * @param	surfaces	The surfaces in the scene.
  * @param   theHit      The closest intersection that is in front of the camera.
+ * @param	rayType		The kind of ray; surfaces it cannot see are skipped.
  */
 
 void VisibleIShape::findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces,
-											HitRecord &theHit) {
+											HitRecord &theHit, unsigned int rayType) {
 	/* CSE 386 - todo  */
 	// theHit.t = FLT_MAX;
 	// theHit.interceptPt = ORIGIN3D;
 	// theHit.normal = Y_AXIS;
-	theHit.t = FLT_MAX;
+	// Only t is tracked while searching; the rest of the hit is found for the winner
+	double bestT = FLT_MAX;
+	int bestPrimitive = 0;
+	const VisibleIShape *closest = nullptr;
 	for (unsigned int i = 0; i < surfaces.size(); i++) {
-		VisibleIShape& thisShape = *surfaces[i];
-		HitRecord thisHit;
-		thisShape.findClosestIntersection(ray, thisHit);
-		if (thisHit.t < theHit.t) {
-			theHit = thisHit;
+		if (!surfaces[i]->isVisibleTo(rayType)) {
+			continue;
+		}
+		int primitive;
+		double t = surfaces[i]->findClosestHit(ray, primitive);
+		if (t < bestT) {
+			bestT = t;
+			bestPrimitive = primitive;
+			closest = surfaces[i];
+		}
+	}
+	theHit = HitRecord();
+	if (closest != nullptr) {
+		closest->getHitAttributes(ray, bestT, bestPrimitive, theHit);
+	}
+}
+
+/**
+ * @fn	void VisibleIShape::findHits(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, RayHits &hits, unsigned int rayType)
+ * @brief	Adds the hits of each surface along the ray to a list of the nearest ones.
+ * @param 		  	ray			The ray.
+ * @param 		  	surfaces	The surfaces in the scene.
+ * @param [in,out]	hits		The list of hits.
+ * @param 		  	rayType		The kind of ray; surfaces it cannot see are skipped.
+ */
+
+void VisibleIShape::findHits(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, RayHits &hits,
+								unsigned int rayType) {
+	for (unsigned int i = 0; i < surfaces.size(); i++) {
+		if (surfaces[i]->isVisibleTo(rayType)) {
+			hits.add(*surfaces[i], ray);
+		}
+	}
+}
+
+/**
+ * @fn	RayHits::RayHits(int most, double after)
+ * @brief	Constructs an empty list of hits.
+ * @param	most 	The most hits to keep, from 1 to MAX_RAY_HITS.
+ * @param	after	Hits at or before this t are ignored, such as those in front of a
+ * 					surface already found along the ray.
+ */
+
+RayHits::RayHits(int most, double after)
+	: maxHits(glm::clamp(most, 1, MAX_RAY_HITS)), count(0), tMin(after), tMax(FLT_MAX) {
+}
+
+/**
+ * @fn	void RayHits::add(const VisibleIShape &obj, const Ray &ray)
+ * @brief	Adds an object's hits along the ray, keeping the list in order. A hit on an
+ * 			opaque object drops every hit behind it, and no later hit behind it is
+ * 			taken, so only the part of the scene the ray can see through is kept.
+ * @param	obj	The object.
+ * @param	ray	The ray.
+ */
+
+void RayHits::add(const VisibleIShape &obj, const Ray &ray) {
+	double objT[MAX_RAY_HITS];
+	int objPrimitive[MAX_RAY_HITS];
+	int numHits = obj.shape->findHits(ray, maxHits, objT, objPrimitive);
+	bool opaque = obj.material.alpha >= 1.0;
+	for (int k = 0; k < numHits && objT[k] < tMax; k++) {
+		if (objT[k] <= tMin) {
+			continue;
+		}
+		int i = count < maxHits ? count : maxHits - 1;
+		while (i > 0 && t[i - 1] > objT[k]) {
+			t[i] = t[i - 1];
+			primitive[i] = primitive[i - 1];
+			object[i] = object[i - 1];
+			i--;
+		}
+		t[i] = objT[k];
+		primitive[i] = objPrimitive[k];
+		object[i] = &obj;
+		count = std::min(count + 1, maxHits);
+		if (opaque) {
+			count = i + 1;
+			tMax = objT[k];
+			break;
+		}
+		if (count == maxHits) {
+			tMax = t[count - 1];
 		}
 	}
 }
 
+/**
+ * @fn	bool RayHits::isComplete() const
+ * @brief	Determines whether the list holds every hit the ray can see through to.
+ * @return	True if the last hit is on an opaque object, or the list has room to spare.
+ */
+
+bool RayHits::isComplete() const {
+	return count < maxHits || object[count - 1]->material.alpha >= 1.0;
+}
+
+/**
+ * @fn	void RayHits::getHit(const Ray &ray, int i, HitRecord &hit) const
+ * @brief	Fills in the whole HitRecord of one of the hits.
+ * @param 		  	ray	The ray the hits were found along.
+ * @param 		  	i  	Which hit, 0 being the nearest.
+ * @param [in,out]	hit	The hit.
+ */
+
+void RayHits::getHit(const Ray &ray, int i, HitRecord &hit) const {
+	object[i]->getHitAttributes(ray, t[i], primitive[i], hit);
+}
+
 /**
  * @fn	IDisk::IDisk()
  * @brief	Implicit representation of an implicit disk. Create a unit circle, centered
@@ -133,34 +424,104 @@ IDisk::IDisk(const dvec3 &pos, const dvec3 &normal, double rad)
  */
 
 void IDisk::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	/* CSE 386 - todo  */
-	if (DEBUG_PIXEL) {
-		cout << "";
+	int primitive;
+	hit.t = IDisk::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		IDisk::getHitAttributes(ray, hit.t, primitive, hit);
 	}
+}
+
+/**
+ * @fn	double IDisk::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the intersection.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double IDisk::findClosestHit(const Ray &ray, int &primitive) const {
+	primitive = 0;
 	double denom = glm::dot(ray.dir, n);
-	IPlane plane(center, n);
-	plane.findClosestIntersection(ray, hit);
 	if (denom == 0) {
-		hit.t = FLT_MAX;
+		return FLT_MAX;
 	}
-	else {
-		double num = glm::dot(center - ray.origin, n);
-		double t = num / denom;
-		if (t < 0) {
-			hit.t = FLT_MAX;
-		}
-		else {
-			hit.t = t;
-			hit.interceptPt = ray.getPoint(t);
-			hit.normal = n;
-			if (glm::distance(center, hit.interceptPt) > radius){
-				hit.t = FLT_MAX;
-			}
-			else {
-				getTexCoords(hit.interceptPt, hit.u, hit.v);
-			}
-		}
+	double t = glm::dot(center - ray.origin, n) / denom;
+	if (t < 0 || glm::distance(center, ray.getPoint(t)) > radius) {
+		return FLT_MAX;
 	}
+	return t;
+}
+
+/**
+ * @fn	void IDisk::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept, normal and texture coordinates of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	Unused.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IDisk::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = n;
+	getTexCoords(hit.interceptPt, hit.u, hit.v);
+}
+
+/**
+ * @fn	int IDisk::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds the hits along a ray. A disk is hit at most once.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of the hit.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The number of hits, 0 or 1.
+ */
+
+int IDisk::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	t[0] = IDisk::findClosestHit(ray, primitive[0]);
+	return t[0] == FLT_MAX ? 0 : 1;
+}
+
+/**
+ * @fn	void IDisk::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	SIMD version of findClosestIntersection.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's intersection, or FLT_MAX.
+ */
+
+void IDisk::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	PacketDouble denom = packet.dx * n.x + packet.dy * n.y + packet.dz * n.z;
+	PacketDouble num = (center.x - packet.ox) * n.x + (center.y - packet.oy) * n.y +
+						(center.z - packet.oz) * n.z;
+	PacketDouble T = num / denom;
+	PacketDouble px = (packet.ox + T * packet.dx) - center.x;
+	PacketDouble py = (packet.oy + T * packet.dy) - center.y;
+	PacketDouble pz = (packet.oz + T * packet.dz) - center.z;
+	PacketDouble distance = sqrt(px * px + py * py + pz * pz);
+	PacketMask hit = (denom != 0.0) & (T >= 0.0) & (distance <= radius);
+	select(hit, T, FLT_MAX).store(t);
+}
+
+/**
+ * @fn	bool IDisk::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the disk anywhere in [tMin, tMax].
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool IDisk::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	double denom = glm::dot(ray.dir, n);
+	if (denom == 0) {
+		return false;
+	}
+	double t = glm::dot(center - ray.origin, n) / denom;
+	if (t < 0 || t < tMin || t > tMax) {
+		return false;
+	}
+	return glm::distance(center, ray.getPoint(t)) <= radius;
 }
 
 /**
@@ -177,6 +538,23 @@ void IDisk::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	v = 1.0 - v;
 }
 
+/**
+ * @fn	bool IDisk::getBoundingBox(BoundingBox &box) const
+ * @brief	Computes the bounding box of the disk. The disk's extent along an axis is
+ * 			radius * sqrt(1 - n_i^2), where n_i is that component of the unit normal.
+ * @param [in,out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool IDisk::getBoundingBox(BoundingBox &box) const {
+	dvec3 N = glm::normalize(n);
+	dvec3 extent(radius * std::sqrt(std::max(0.0, 1.0 - N.x * N.x)),
+				radius * std::sqrt(std::max(0.0, 1.0 - N.y * N.y)),
+				radius * std::sqrt(std::max(0.0, 1.0 - N.z * N.z)));
+	box = BoundingBox(center - extent, center + extent);
+	return true;
+}
+
 /**
  * @fn	ISphere::ISphere(const dvec3 & position, double radius)
  * @brief	Implicit representation of a 3D sphere.
@@ -185,7 +563,109 @@ void IDisk::getTexCoords(const dvec3& pt, double& u, double& v) const {
  */
 
 ISphere::ISphere(const dvec3 &position, double radius)
-	: IQuadricSurface(QuadricParameters::sphereQParams(radius), position) {
+	: IQuadricSurface(QuadricParameters::sphereQParams(radius), position), radius(radius),
+		intersector(radius) {
+}
+
+/**
+ * @fn	void ISphere::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Searches for the nearest intersection with the closed-form test for spheres.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit.
+ */
+
+void ISphere::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int primitive;
+	hit.t = ISphere::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		ISphere::getHitAttributes(ray, hit.t, primitive, hit);
+	}
+}
+
+/**
+ * @fn	double ISphere::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the nearest intersection, with the closed-form test for
+ * 			spheres.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double ISphere::findClosestHit(const Ray &ray, int &primitive) const {
+	primitive = 0;
+	return closestRoot(intersector, center, ray);
+}
+
+/**
+ * @fn	void ISphere::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept and normal of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	Unused.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void ISphere::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = intersector.normal(hit.interceptPt - center);
+}
+
+/**
+ * @fn	int ISphere::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds both places the ray meets the sphere, nearest first.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of each hit.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The number of hits, from 0 to 2.
+ */
+
+int ISphere::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	double roots[2];
+	int count = std::min(allRoots(intersector, center, ray, roots), maxHits);
+	for (int i = 0; i < count; i++) {
+		t[i] = roots[i];
+		primitive[i] = 0;
+	}
+	return count;
+}
+
+/**
+ * @fn	void ISphere::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	SIMD version of findClosestIntersection.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's closest intersection, or FLT_MAX.
+ */
+
+void ISphere::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	closestRoots(intersector, center, packet, t);
+}
+
+/**
+ * @fn	bool ISphere::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the sphere anywhere in [tMin, tMax].
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool ISphere::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	return anyRoot(intersector, center, ray, tMin, tMax);
+}
+
+/**
+ * @fn	bool ISphere::getBoundingBox(BoundingBox &box) const
+ * @brief	Computes the bounding box of the sphere.
+ * @param [in,out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool ISphere::getBoundingBox(BoundingBox &box) const {
+	dvec3 extent(radius, radius, radius);
+	box = BoundingBox(center - extent, center + extent);
+	return true;
 }
 
 /**
@@ -392,21 +872,92 @@ bool IPlane::onFrontSide(const dvec3 &point) const {
  */
 
 void IPlane::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	/* CSE 386 - todo  */
+	int primitive;
+	hit.t = IPlane::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		IPlane::getHitAttributes(ray, hit.t, primitive, hit);
+	}
+}
+
+/**
+ * @fn	double IPlane::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the intersection.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double IPlane::findClosestHit(const Ray &ray, int &primitive) const {
+	primitive = 0;
 	double denom = glm::dot(ray.dir, n);
 	if (denom == 0) {
-		hit.t = FLT_MAX;
-	} else {
-		double num = glm::dot(a - ray.origin, n);
-		double t = num / denom;
-		if (t < 0) {
-			hit.t = FLT_MAX;
-		} else {
-			hit.t = t;
-			hit.interceptPt = ray.getPoint(t);
-			hit.normal = n;
-		}
+		return FLT_MAX;
+	}
+	double t = glm::dot(a - ray.origin, n) / denom;
+	return t < 0 ? FLT_MAX : t;
+}
+
+/**
+ * @fn	void IPlane::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept and normal of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	Unused.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IPlane::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = n;
+}
+
+/**
+ * @fn	int IPlane::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds the hits along a ray. A plane is hit at most once.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of the hit.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The number of hits, 0 or 1.
+ */
+
+int IPlane::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	t[0] = IPlane::findClosestHit(ray, primitive[0]);
+	return t[0] == FLT_MAX ? 0 : 1;
+}
+
+/**
+ * @fn	void IPlane::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	SIMD version of findClosestIntersection.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's intersection, or FLT_MAX.
+ */
+
+void IPlane::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	PacketDouble denom = packet.dx * n.x + packet.dy * n.y + packet.dz * n.z;
+	PacketDouble num = (a.x - packet.ox) * n.x + (a.y - packet.oy) * n.y + (a.z - packet.oz) * n.z;
+	PacketDouble T = num / denom;
+	PacketMask hit = (denom != 0.0) & (T >= 0.0);
+	select(hit, T, FLT_MAX).store(t);
+}
+
+/**
+ * @fn	bool IPlane::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the plane anywhere in [tMin, tMax].
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool IPlane::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	double denom = glm::dot(ray.dir, n);
+	if (denom == 0) {
+		return false;
 	}
+	double t = glm::dot(a - ray.origin, n) / denom;
+	return t >= 0 && t >= tMin && t <= tMax;
 }
 
 /**
@@ -604,33 +1155,196 @@ int IQuadricSurface::findIntersections(const Ray &ray, HitRecord hits[2]) const
 	return numIntersections;
 }
 
+/**
+ * @fn	void IQuadricSurface::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	SIMD version of findClosestIntersection. computeAqBqCq and quadratic are
+ * 			evaluated for the whole packet with exactly the same sequence of operations
+ * 			as the scalar code. Choosing between the two roots is done per ray: the
+ * 			closer root is used if it is in front of the ray and isInBounds accepts
+ * 			it, otherwise the farther one. A root at exactly t == 0 is never used.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's closest intersection, or FLT_MAX.
+ */
+
+void IQuadricSurface::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	const double &A = qParams.A;
+	const double &B = qParams.B;
+	const double &C = qParams.C;
+	const double &D = qParams.D;
+	const double &E = qParams.E;
+	const double &F = qParams.F;
+	const double &G = qParams.G;
+	const double &H = qParams.H;
+	const double &I = qParams.I;
+	const double &J = qParams.J;
+	PacketDouble Rox = packet.ox - center.x, Roy = packet.oy - center.y, Roz = packet.oz - center.z;
+	const PacketDouble &Rdx = packet.dx, &Rdy = packet.dy, &Rdz = packet.dz;
+
+	PacketDouble Aq = A * (Rdx * Rdx) +
+		B * (Rdy * Rdy) +
+		C * (Rdz * Rdz) +
+		D * (Rdx * Rdy) +
+		E * (Rdx * Rdz) +
+		F * (Rdy * Rdz);
+
+	PacketDouble Bq = twoA * Rox * Rdx +
+		twoB * Roy * Rdy +
+		twoC * Roz * Rdz +
+		D * (Rox * Rdy + Roy * Rdx) +
+		E * (Rox * Rdz + Roz * Rdx) +
+		F * (Roy * Rdz + Roz * Rdy) +
+		G * Rdx + H * Rdy + I * Rdz;
+
+	PacketDouble Cq = A * (Rox * Rox) +
+		B * (Roy * Roy) +
+		C * (Roz * Roz) +
+		D * (Rox * Roy) +
+		E * (Rox * Roz) +
+		F * (Roy * Roz) +
+		G * Rox +
+		H * Roy +
+		I * Roz + J;
+
+	// quadratic() reports two roots only when A != 0 and D > 0. A single (tangent)
+	// root ends up sorted behind -FLT_MAX and is never used, so it is a miss here too.
+	PacketDouble disc = Bq * Bq - 4.0 * Aq * Cq;
+	PacketDouble root = sqrt(abs(disc));
+	PacketDouble r0 = (-Bq + root) / (2.0 * Aq);
+	PacketDouble r1 = (-Bq - root) / (2.0 * Aq);
+	PacketMask swap = r1 < r0;
+	PacketMask twoRoots = (Aq != 0.0) & (disc > 0.0);
+	double nearT[PACKET_SIZE], farT[PACKET_SIZE];
+	select(swap, r1, r0).store(nearT);
+	select(swap, r0, r1).store(farT);
+
+	int bits = twoRoots.bits();
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		t[k] = FLT_MAX;
+		if ((bits >> k) & 1) {
+			const Ray &ray = packet.rays[k];
+			if (nearT[k] > 0 && isInBounds(ray.getPoint(nearT[k]))) {
+				t[k] = nearT[k];
+			} else if (farT[k] > 0 && isInBounds(ray.getPoint(farT[k]))) {
+				t[k] = farT[k];
+			}
+		}
+	}
+}
+
+/**
+ * @fn	bool IQuadricSurface::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the visible part of the quadric anywhere in
+ * 			[tMin, tMax]. Only the roots are needed; normals are never computed.
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool IQuadricSurface::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	double Aq, Bq, Cq;
+	computeAqBqCq(ray, Aq, Bq, Cq);
+	double roots[2];
+	int numRoots = quadratic(Aq, Bq, Cq, roots);
+	for (int i = 0; i < numRoots; i++) {
+		double t = roots[i];
+		if (t >= 0 && t >= tMin && t <= tMax && isInBounds(ray.getPoint(t))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool IQuadricSurface::isInBounds(const dvec3 &pt) const
+ * @brief	Determines whether a point on the (infinite) quadric belongs to the part of
+ * 			it that is actually displayed. By default the whole quadric is.
+ * @param	pt	A point on the quadric.
+ * @return	true iff the point is on the visible part of the shape.
+ */
+
+bool IQuadricSurface::isInBounds(const dvec3 &pt) const {
+	return true;
+}
+
 /**
  * @fn	void IQuadricSurface::findClosestIntersection(const Ray &ray, HitRecord &hit) const
- * @brief	Searches for the nearest intersection
+ * @brief	Searches for the nearest intersection in front of the ray that isInBounds
+ * 			accepts.
  * @param 		  	ray	The ray.
  * @param [in,out]	hit	The hit.
  */
 
 void IQuadricSurface::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	static HitRecord hits[2];
-	hit.t = FLT_MAX;
-
-	int numIntercepts = findIntersections(ray, hits);
-	if (numIntercepts == 1 && hits[0].t > 0) {
-		hit.t = hits[0].t;
-		hit.interceptPt = hits[0].interceptPt;
-		hit.normal = normal(hit.interceptPt);
-	} else if (numIntercepts == 2) {
-		if (hits[0].t > 0) {
-			hit.t = hits[0].t;
-			hit.interceptPt = hits[0].interceptPt;
-			hit.normal = normal(hit.interceptPt);
-		} else if (hits[1].t > 0) {
-			hit.t = hits[1].t;
-			hit.interceptPt = hits[1].interceptPt;
-			hit.normal = normal(hit.interceptPt);
+	int primitive;
+	hit.t = IQuadricSurface::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		IQuadricSurface::getHitAttributes(ray, hit.t, primitive, hit);
+	}
+}
+
+/**
+ * @fn	double IQuadricSurface::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the nearest intersection in front of the ray that isInBounds
+ * 			accepts. Unlike findIntersections, no normals are computed.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double IQuadricSurface::findClosestHit(const Ray &ray, int &primitive) const {
+	primitive = 0;
+	double Aq, Bq, Cq;
+	computeAqBqCq(ray, Aq, Bq, Cq);
+	double roots[2];
+	int numRoots = quadratic(Aq, Bq, Cq, roots);
+	for (int i = 0; i < numRoots; i++) {
+		if (roots[i] > 0 && isInBounds(ray.getPoint(roots[i]))) {
+			return roots[i];
 		}
 	}
+	return FLT_MAX;
+}
+
+/**
+ * @fn	void IQuadricSurface::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept and normal of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	Unused.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IQuadricSurface::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = normal(hit.interceptPt);
+}
+
+/**
+ * @fn	int IQuadricSurface::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds both roots in front of the ray that isInBounds accepts, nearest first.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of each hit.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The number of hits, from 0 to 2.
+ */
+
+int IQuadricSurface::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	double Aq, Bq, Cq;
+	computeAqBqCq(ray, Aq, Bq, Cq);
+	double roots[2];
+	int numRoots = quadratic(Aq, Bq, Cq, roots);
+	int count = 0;
+	for (int i = 0; i < numRoots && count < maxHits; i++) {
+		if (roots[i] > 0 && isInBounds(ray.getPoint(roots[i]))) {
+			t[count] = roots[i];
+			primitive[count] = 0;
+			count++;
+		}
+	}
+	return count;
 }
 
 /**
@@ -697,35 +1411,122 @@ ICone::ICone(const dvec3& pos, double R, double H, const QuadricParameters& qPar
  */
 
 IConeY::IConeY(const dvec3& pos, double rad, double H)
-	: ICone(pos + dvec3(0.0, H, 0.0), rad, H, QuadricParameters::coneYQParams(rad, H)) {
+	: ICone(pos + dvec3(0.0, H, 0.0), rad, H, QuadricParameters::coneYQParams(rad, H)),
+		intersector(rad, H) {
+}
+
+/**
+ * @fn	bool IConeY::isInBounds(const dvec3 &pt) const
+ * @brief	Determines whether a point on the double cone lies on the displayed nappe,
+ * 			between the tip and the base.
+ * @param	pt	A point on the cone.
+ * @return	true iff the point is on the visible part of the cone.
+ */
+
+bool IConeY::isInBounds(const dvec3 &pt) const {
+	double distance = pt.y - center.y;
+	return (-distance < height) && (distance <= 0);
 }
 
 /**
- * @fn	void ICone::findClosestIntersection(const Ray &ray, HitRecord &hit) const
- * @brief	Searches for the nearest intersection
+ * @fn	bool IConeY::getBoundingBox(BoundingBox &box) const
+ * @brief	Computes the bounding box of the cone. center is the cone's tip; only the
+ * 			nappe that opens downward, to a radius of radius at its base, is visible.
+ * @param [in,out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool IConeY::getBoundingBox(BoundingBox &box) const {
+	box = BoundingBox(center - dvec3(radius, height, radius), center + dvec3(radius, 0.0, radius));
+	return true;
+}
+
+/**
+ * @fn	void IConeY::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Searches for the nearest intersection with the closed-form test for cones.
  * @param 		  	ray	The ray.
  * @param [in,out]	hit	The hit.
  */
 
-void IConeY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	static HitRecord hits[2];
-	int numHits = IQuadricSurface::findIntersections(ray, hits);
-
-	if (numHits == 0) {
-		hit.t = FLT_MAX;
-		return;
+void IConeY::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int primitive;
+	hit.t = IConeY::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		IConeY::getHitAttributes(ray, hit.t, primitive, hit);
 	}
+}
 
-	for (int i = 0; i < numHits; i++) { // return first hit in target area
-		double distance = hits[i].interceptPt.y - this->center.y;
+/**
+ * @fn	double IConeY::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the nearest intersection, with the closed-form test for
+ * 			cones.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	t of the intersection, or FLT_MAX.
+ */
 
-		if ( (-distance < this->height) && (distance <= 0)) {
-			hit = hits[i];
-			return;
-		}
+double IConeY::findClosestHit(const Ray &ray, int &primitive) const {
+	primitive = 0;
+	return closestRoot(intersector, center, ray);
+}
+
+/**
+ * @fn	void IConeY::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept and normal of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	Unused.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IConeY::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = intersector.normal(hit.interceptPt - center);
+}
+
+/**
+ * @fn	int IConeY::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds both places the ray meets the cone, nearest first.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of each hit.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The number of hits, from 0 to 2.
+ */
+
+int IConeY::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	double roots[2];
+	int count = std::min(allRoots(intersector, center, ray, roots), maxHits);
+	for (int i = 0; i < count; i++) {
+		t[i] = roots[i];
+		primitive[i] = 0;
 	}
-	hit.t = FLT_MAX;
+	return count;
+}
 
+/**
+ * @fn	void IConeY::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	SIMD version of findClosestIntersection.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's closest intersection, or FLT_MAX.
+ */
+
+void IConeY::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	closestRoots(intersector, center, packet, t);
+}
+
+/**
+ * @fn	bool IConeY::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the cone anywhere in [tMin, tMax].
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool IConeY::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	return anyRoot(intersector, center, ray, tMin, tMax);
 }
 
 
@@ -738,38 +1539,97 @@ void IConeY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
  */
 
 ICylinderY::ICylinderY(const dvec3 &pos, double rad, double len)
-	: ICylinder(pos, rad, len, QuadricParameters::cylinderYQParams(rad)) {
+	: ICylinder(pos, rad, len, QuadricParameters::cylinderYQParams(rad)),
+		intersector(rad, len) {
 }
 
 /**
  * @fn	void ICylinderY::findClosestIntersection(const Ray &ray, HitRecord &hit) const
- * @brief	Searches for the nearest intersection
+ * @brief	Searches for the nearest intersection with the closed-form test for cylinders along y.
  * @param 		  	ray	The ray.
  * @param [in,out]	hit	The hit.
  */
 
 void ICylinderY::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
-	/* 386 - todo */
-	const dvec3& rayOrigin = ray.origin;
-	const dvec3& raydirection = ray.dir;
-	static HitRecord hits[2];
-	int numHits = IQuadricSurface::findIntersections(ray, hits);
-
-	if (numHits == 0) {
-		hit.t = FLT_MAX;
-		return;
+	int primitive;
+	hit.t = ICylinderY::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		ICylinderY::getHitAttributes(ray, hit.t, primitive, hit);
 	}
+}
 
-	for (int i = 0; i < numHits; i++) { // return first hit in target area
-		double distance = abs(hits[i].interceptPt.y - this->center.y);
+/**
+ * @fn	double ICylinderY::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the nearest intersection, with the closed-form test for
+ * 			cylinders along y.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double ICylinderY::findClosestHit(const Ray &ray, int &primitive) const {
+	primitive = 0;
+	return closestRoot(intersector, center, ray);
+}
+
+/**
+ * @fn	void ICylinderY::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept, normal and texture coordinates of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	Unused.
+ * @param [in,out]	hit		 	The hit.
+ */
 
-		if (distance < this->length) {
-			hit = hits[i];
-			getTexCoords(hit.interceptPt, hit.u, hit.v);
-			return;
-		}		
+void ICylinderY::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = intersector.normal(hit.interceptPt - center);
+	getTexCoords(hit.interceptPt, hit.u, hit.v);
+}
+
+/**
+ * @fn	int ICylinderY::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds both places the ray meets the cylinder, nearest first.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of each hit.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The number of hits, from 0 to 2.
+ */
+
+int ICylinderY::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	double roots[2];
+	int count = std::min(allRoots(intersector, center, ray, roots), maxHits);
+	for (int i = 0; i < count; i++) {
+		t[i] = roots[i];
+		primitive[i] = 0;
 	}
-	hit.t = FLT_MAX;
+	return count;
+}
+
+/**
+ * @fn	void ICylinderY::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	SIMD version of findClosestIntersection.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's closest intersection, or FLT_MAX.
+ */
+
+void ICylinderY::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	closestRoots(intersector, center, packet, t);
+}
+
+/**
+ * @fn	bool ICylinderY::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the cylinder anywhere in [tMin, tMax].
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool ICylinderY::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	return anyRoot(intersector, center, ray, tMin, tMax);
 }
 
 /**
@@ -792,6 +1652,32 @@ void ICylinderY::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	u = map(pt.y, center.y - length, center.y + length, 0.0, 1.0);
 }
 
+/**
+ * @fn	bool ICylinderY::isInBounds(const dvec3 &pt) const
+ * @brief	Determines whether a point on the infinite cylinder is within length of
+ * 			the center.
+ * @param	pt	A point on the cylinder.
+ * @return	true iff the point is on the visible part of the cylinder.
+ */
+
+bool ICylinderY::isInBounds(const dvec3 &pt) const {
+	return abs(pt.y - center.y) < length;
+}
+
+/**
+ * @fn	bool ICylinderY::getBoundingBox(BoundingBox &box) const
+ * @brief	Computes the bounding box of the cylinder, which extends length above and
+ * 			below its center.
+ * @param [in,out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool ICylinderY::getBoundingBox(BoundingBox &box) const {
+	dvec3 extent(radius, length, radius);
+	box = BoundingBox(center - extent, center + extent);
+	return true;
+}
+
 /**
  * @fn	ICylinderZ::ICylinderZ(const dvec3 &pos, double rad, double len)
  * @brief	Constructor
@@ -801,38 +1687,122 @@ void ICylinderY::getTexCoords(const dvec3& pt, double& u, double& v) const {
  */
 
 ICylinderZ::ICylinderZ(const dvec3 &pos, double rad, double len)
-	: ICylinder(pos, rad, len, QuadricParameters::cylinderZQParams(rad)) {
+	: ICylinder(pos, rad, len, QuadricParameters::cylinderZQParams(rad)),
+		intersector(rad, len) {
+}
+
+/**
+ * @fn	bool ICylinderZ::isInBounds(const dvec3 &pt) const
+ * @brief	Determines whether a point on the infinite cylinder is within length of
+ * 			the center.
+ * @param	pt	A point on the cylinder.
+ * @return	true iff the point is on the visible part of the cylinder.
+ */
+
+bool ICylinderZ::isInBounds(const dvec3 &pt) const {
+	return abs(pt.z - center.z) < length;
+}
+
+/**
+ * @fn	bool ICylinderZ::getBoundingBox(BoundingBox &box) const
+ * @brief	Computes the bounding box of the cylinder, which extends length in front
+ * 			of and behind its center.
+ * @param [in,out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool ICylinderZ::getBoundingBox(BoundingBox &box) const {
+	dvec3 extent(radius, radius, length);
+	box = BoundingBox(center - extent, center + extent);
+	return true;
 }
 
 /**
  * @fn	void ICylinderZ::findClosestIntersection(const Ray &ray, HitRecord &hit) const
- * @brief	Searches for the nearest intersection
+ * @brief	Searches for the nearest intersection with the closed-form test for cylinders along z.
  * @param 		  	ray	The ray.
  * @param [in,out]	hit	The hit.
  */
 
-void ICylinderZ::findClosestIntersection(const Ray &ray,
-										HitRecord &hit) const {
-	/* 386 - todo */
-	const dvec3& rayOrigin = ray.origin;
-	const dvec3& raydirection = ray.dir;
-	static HitRecord hits[2];
-	int numHits = IQuadricSurface::findIntersections(ray, hits);
-
-	if (numHits == 0) {
-		hit.t = FLT_MAX;
-		return;
+void ICylinderZ::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int primitive;
+	hit.t = ICylinderZ::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		ICylinderZ::getHitAttributes(ray, hit.t, primitive, hit);
 	}
+}
 
-	for (int i = 0; i < numHits; i++) { // return first hit in target area
-		double distance = abs(hits[i].interceptPt.z - this->center.z);
+/**
+ * @fn	double ICylinderZ::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the nearest intersection, with the closed-form test for
+ * 			cylinders along z.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	t of the intersection, or FLT_MAX.
+ */
 
-		if (distance < this->length) {
-			hit = hits[i];
-			return;
-		}
+double ICylinderZ::findClosestHit(const Ray &ray, int &primitive) const {
+	primitive = 0;
+	return closestRoot(intersector, center, ray);
+}
+
+/**
+ * @fn	void ICylinderZ::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept and normal of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	Unused.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void ICylinderZ::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = intersector.normal(hit.interceptPt - center);
+}
+
+/**
+ * @fn	int ICylinderZ::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds both places the ray meets the cylinder, nearest first.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of each hit.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The number of hits, from 0 to 2.
+ */
+
+int ICylinderZ::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	double roots[2];
+	int count = std::min(allRoots(intersector, center, ray, roots), maxHits);
+	for (int i = 0; i < count; i++) {
+		t[i] = roots[i];
+		primitive[i] = 0;
 	}
-	hit.t = FLT_MAX;
+	return count;
+}
+
+/**
+ * @fn	void ICylinderZ::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	SIMD version of findClosestIntersection.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's closest intersection, or FLT_MAX.
+ */
+
+void ICylinderZ::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	closestRoots(intersector, center, packet, t);
+}
+
+/**
+ * @fn	bool ICylinderZ::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the cylinder anywhere in [tMin, tMax].
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool ICylinderZ::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	return anyRoot(intersector, center, ray, tMin, tMax);
 }
 
 /**
@@ -843,7 +1813,109 @@ void ICylinderZ::findClosestIntersection(const Ray &ray,
  */
 
 IEllipsoid::IEllipsoid(const dvec3 &position, const dvec3 &sz)
-	: IQuadricSurface(QuadricParameters::ellipsoidQParams(sz), position) {
+	: IQuadricSurface(QuadricParameters::ellipsoidQParams(sz), position), size(sz),
+		intersector(sz) {
+}
+
+/**
+ * @fn	void IEllipsoid::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Searches for the nearest intersection with the closed-form test for ellipsoids.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit.
+ */
+
+void IEllipsoid::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int primitive;
+	hit.t = IEllipsoid::findClosestHit(ray, primitive);
+	if (hit.t != FLT_MAX) {
+		IEllipsoid::getHitAttributes(ray, hit.t, primitive, hit);
+	}
+}
+
+/**
+ * @fn	double IEllipsoid::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds only t of the nearest intersection, with the closed-form test for
+ * 			ellipsoids.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double IEllipsoid::findClosestHit(const Ray &ray, int &primitive) const {
+	primitive = 0;
+	return closestRoot(intersector, center, ray);
+}
+
+/**
+ * @fn	void IEllipsoid::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept and normal of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	Unused.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void IEllipsoid::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = intersector.normal(hit.interceptPt - center);
+}
+
+/**
+ * @fn	int IEllipsoid::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds both places the ray meets the ellipsoid, nearest first.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of each hit.
+ * @param [in,out]	primitive	Set to 0.
+ * @return	The number of hits, from 0 to 2.
+ */
+
+int IEllipsoid::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	double roots[2];
+	int count = std::min(allRoots(intersector, center, ray, roots), maxHits);
+	for (int i = 0; i < count; i++) {
+		t[i] = roots[i];
+		primitive[i] = 0;
+	}
+	return count;
+}
+
+/**
+ * @fn	void IEllipsoid::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const
+ * @brief	SIMD version of findClosestIntersection.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's closest intersection, or FLT_MAX.
+ */
+
+void IEllipsoid::findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const {
+	closestRoots(intersector, center, packet, t);
+}
+
+/**
+ * @fn	bool IEllipsoid::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits the ellipsoid anywhere in [tMin, tMax].
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool IEllipsoid::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	return anyRoot(intersector, center, ray, tMin, tMax);
+}
+
+/**
+ * @fn	bool IEllipsoid::getBoundingBox(BoundingBox &box) const
+ * @brief	Computes the bounding box of the ellipsoid.
+ * @param [in,out]	box	The bounding box.
+ * @return	true.
+ */
+
+bool IEllipsoid::getBoundingBox(BoundingBox &box) const {
+	dvec3 extent = glm::abs(size);
+	box = BoundingBox(center - extent, center + extent);
+	return true;
 }
 
 IClosedCylinderY::IClosedCylinderY(const dvec3& pos, double rad, double len) {
@@ -9,12 +9,16 @@
 
 #pragma once
 #include <vector>
+#include <unordered_set>
 #include "hitrecord.h"
+#include "simd.h"
+#include "intersectors.h"
 
 struct IShape;
 typedef IShape *IShapePtr;
 struct VisibleIShape;
 typedef VisibleIShape *VisibleIShapePtr;
+struct RayHits;
 
 /**
  * @struct	Ray
@@ -32,31 +36,237 @@ struct Ray {
 	}
 };
 
+/**
+ * @struct	RayPacket
+ * @brief	PACKET_SIZE rays stored one coordinate per PacketDouble, so that they can
+ * 			be intersected with a shape all at once.
+ */
+
+struct RayPacket {
+	const Ray *rays;				//!< the rays, one per lane
+	PacketDouble ox, oy, oz;		//!< origins
+	PacketDouble dx, dy, dz;		//!< directions
+	RayPacket(const Ray *packetRays);
+};
+
+/**
+ * @fn	template <typename Intersector> double closestRoot(const Intersector &shape, const dvec3 &center, const Ray &ray)
+ * @brief	Finds where a ray first meets the displayed part of a shape: the nearer root
+ * 			if it is in front of the ray and in bounds, otherwise the farther one.
+ * @param	shape	The shape's intersector.
+ * @param	center	The shape's center.
+ * @param	ray  	The ray.
+ * @return	t of the intersection, or FLT_MAX if there is none.
+ */
+
+template <typename Intersector>
+double closestRoot(const Intersector &shape, const dvec3 &center, const Ray &ray) {
+	const double ox = ray.origin.x, oy = ray.origin.y, oz = ray.origin.z;
+	const double dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+	double tNear, tFar;
+	if (!shape.roots(ox - center.x, oy - center.y, oz - center.z, dx, dy, dz, tNear, tFar)) {
+		return FLT_MAX;
+	}
+	if (tNear > 0 && shape.inBounds((oy + tNear * dy) - center.y, (oz + tNear * dz) - center.z)) {
+		return tNear;
+	}
+	if (tFar > 0 && shape.inBounds((oy + tFar * dy) - center.y, (oz + tFar * dz) - center.z)) {
+		return tFar;
+	}
+	return FLT_MAX;
+}
+
+/**
+ * @fn	template <typename Intersector> void closestRoots(const Intersector &shape, const dvec3 &center, const RayPacket &packet, double t[PACKET_SIZE])
+ * @brief	closestRoot for each ray of a packet. The roots are found for the whole
+ * 			packet at once; the bounds are then checked lane by lane.
+ * @param 		  	shape 	The shape's intersector.
+ * @param 		  	center	The shape's center.
+ * @param 		  	packet	The rays.
+ * @param [in,out]	t	  	t of each ray's intersection, or FLT_MAX.
+ */
+
+template <typename Intersector>
+void closestRoots(const Intersector &shape, const dvec3 &center, const RayPacket &packet, double t[PACKET_SIZE]) {
+	PacketDouble tNear, tFar;
+	int bits = shape.roots(packet.ox - center.x, packet.oy - center.y, packet.oz - center.z,
+							packet.dx, packet.dy, packet.dz, tNear, tFar).bits();
+	double nearT[PACKET_SIZE], farT[PACKET_SIZE];
+	tNear.store(nearT);
+	tFar.store(farT);
+	for (int k = 0; k < PACKET_SIZE; k++) {
+		t[k] = FLT_MAX;
+		if ((bits >> k) & 1) {
+			const Ray &ray = packet.rays[k];
+			const double oy = ray.origin.y, oz = ray.origin.z;
+			const double dy = ray.dir.y, dz = ray.dir.z;
+			if (nearT[k] > 0 && shape.inBounds((oy + nearT[k] * dy) - center.y, (oz + nearT[k] * dz) - center.z)) {
+				t[k] = nearT[k];
+			} else if (farT[k] > 0 && shape.inBounds((oy + farT[k] * dy) - center.y, (oz + farT[k] * dz) - center.z)) {
+				t[k] = farT[k];
+			}
+		}
+	}
+}
+
+/**
+ * @fn	template <typename Intersector> int allRoots(const Intersector &shape, const dvec3 &center, const Ray &ray, double t[2])
+ * @brief	Finds every place a ray meets the displayed part of a shape, nearest first.
+ * 			The first one is always closestRoot's.
+ * @param 		  	shape 	The shape's intersector.
+ * @param 		  	center	The shape's center.
+ * @param 		  	ray   	The ray.
+ * @param [in,out]	t	  	t of each intersection in front of the ray.
+ * @return	The number of intersections, from 0 to 2.
+ */
+
+template <typename Intersector>
+int allRoots(const Intersector &shape, const dvec3 &center, const Ray &ray, double t[2]) {
+	const double ox = ray.origin.x, oy = ray.origin.y, oz = ray.origin.z;
+	const double dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+	double tNear, tFar;
+	if (!shape.roots(ox - center.x, oy - center.y, oz - center.z, dx, dy, dz, tNear, tFar)) {
+		return 0;
+	}
+	int count = 0;
+	if (tNear > 0 && shape.inBounds((oy + tNear * dy) - center.y, (oz + tNear * dz) - center.z)) {
+		t[count++] = tNear;
+	}
+	if (tFar > 0 && shape.inBounds((oy + tFar * dy) - center.y, (oz + tFar * dz) - center.z)) {
+		t[count++] = tFar;
+	}
+	return count;
+}
+
+/**
+ * @fn	template <typename Intersector> bool anyRoot(const Intersector &shape, const dvec3 &center, const Ray &ray, double tMin, double tMax)
+ * @brief	Determines whether a ray meets the displayed part of a shape anywhere in
+ * 			[tMin, tMax].
+ * @param	shape	The shape's intersector.
+ * @param	center	The shape's center.
+ * @param	ray  	The ray.
+ * @param	tMin 	Smallest t of interest.
+ * @param	tMax 	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+template <typename Intersector>
+bool anyRoot(const Intersector &shape, const dvec3 &center, const Ray &ray, double tMin, double tMax) {
+	const double ox = ray.origin.x, oy = ray.origin.y, oz = ray.origin.z;
+	const double dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+	double roots[2];
+	if (!shape.roots(ox - center.x, oy - center.y, oz - center.z, dx, dy, dz, roots[0], roots[1])) {
+		return false;
+	}
+	for (int k = 0; k < 2; k++) {
+		double t = roots[k];
+		if (t >= 0 && t >= tMin && t <= tMax && shape.inBounds((oy + t * dy) - center.y, (oz + t * dz) - center.z)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 /**
  * @struct	IShape
- * @brief	Base class for all implicit shapes.
+ * @brief	Base class for all implicit shapes. Intersection routines are called
+ * 			concurrently by the ray tracer's worker threads, so they must only read
+ * 			the shape and write to the caller's HitRecord; no static or global
+ * 			scratch space. findClosestIntersection comes in two halves for searches
+ * 			over many shapes: findClosestHit finds only t, plus a primitive ID saying
+ * 			which part of the shape was hit, and getHitAttributes fills in the rest of
+ * 			the HitRecord once the search knows which hit is closest. findHits goes
+ * 			on past the closest hit, for rays that see through transparent surfaces.
  */
 
 struct IShape {
 	IShape();
+	virtual ~IShape() {}
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const = 0;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
 	virtual void getTexCoords(const dvec3 &pt, double &u, double &v) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	virtual bool hasOwnMaterials() const;
 	static dvec3 movePointOffSurface(const dvec3 &pt, const dvec3 &n);
 };
 
+const unsigned int CAMERA_RAYS = 1 << 0;		//!< rays from the eye
+const unsigned int SHADOW_RAYS = 1 << 1;		//!< rays from a surface toward a light
+const unsigned int REFLECTION_RAYS = 1 << 2;	//!< rays reflected off a surface
+const unsigned int REFRACTION_RAYS = 1 << 3;	//!< rays passing on through a transparent surface
+const unsigned int ALL_RAYS = CAMERA_RAYS | SHADOW_RAYS | REFLECTION_RAYS | REFRACTION_RAYS;	//!< every kind of ray
+
+/**
+ * @struct	ObjectLinks
+ * @brief	A set of objects, such as the ones a light is linked to (see PositionalLight),
+ * 			given as the objects in include, or every object if include is empty, less
+ * 			the objects in exclude.
+ */
+
+struct ObjectLinks {
+	std::unordered_set<const VisibleIShape *> include;	//!< if not empty, the only objects in the set
+	std::unordered_set<const VisibleIShape *> exclude;	//!< objects left out of the set
+	bool isEmpty() const { return include.empty() && exclude.empty(); }
+	bool contains(const VisibleIShape *object) const {
+		return (include.empty() || include.count(object) != 0) && (exclude.empty() || exclude.count(object) == 0);
+	}
+};
+
 /**
  * @struct	VisibleIShape
- * @brief	A visible implicit shape.
+ * @brief	A visible implicit shape. visibility says which kinds of rays can see it;
+ * 			the accelerators skip the shape for any other kind before intersecting
+ * 			it. Like the shape itself, visibility may only be changed between frames,
+ * 			followed by IScene::markMoved.
  */
 
 struct VisibleIShape {
 	Material material;	//!< Material for this shape.
 	IShapePtr shape;	//!< Pointer to underlying implicit shape.
 	Image *texture;		//!< Texture associated with this shape, if any.
+	bool dirty;			//!< Moved since the scene's accelerator was last brought up to date.
+	unsigned int visibility;	//!< The kinds of rays (CAMERA_RAYS, ...) that can see this shape.
 	VisibleIShape(IShapePtr shapePtr, const Material &mat, Image *image = nullptr);
 	void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	double findClosestHit(const Ray &ray, int &primitive) const;
+	void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	bool isVisibleTo(unsigned int rayType) const { return (visibility & rayType) != 0; }
+	bool castsShadow(const ObjectLinks *casters) const {
+		return isVisibleTo(SHADOW_RAYS) && (casters == nullptr || casters->contains(this));
+	}
 	static void findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces,
-								HitRecord &theHit);
+								HitRecord &theHit, unsigned int rayType = ALL_RAYS);
+	static void findHits(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, RayHits &hits,
+							unsigned int rayType = ALL_RAYS);
+};
+
+const int MAX_RAY_HITS = 8;		//!< most hits a RayHits can hold
+
+/**
+ * @struct	RayHits
+ * @brief	The hits along one ray, nearest first, up to and including the first one on
+ * 			an opaque object, since nothing behind that can be seen. Only t, the object
+ * 			and the primitive are kept; getHit fills in a HitRecord for one of them.
+ * 			Once maxHits hits are held, farther ones are dropped, so the list is only
+ * 			known to be complete if it ends with an opaque hit or has room to spare.
+ */
+
+struct RayHits {
+	int maxHits;							//!< most hits to keep, at most MAX_RAY_HITS
+	int count;								//!< number of hits held
+	double tMin;							//!< hits at or before this t are ignored
+	double tMax;							//!< hits at or beyond this t cannot make the list
+	double t[MAX_RAY_HITS];					//!< t of each hit, in increasing order
+	int primitive[MAX_RAY_HITS];			//!< the part of the object that was hit
+	const VisibleIShape *object[MAX_RAY_HITS];	//!< the object that was hit
+	RayHits(int most = MAX_RAY_HITS, double after = 0.0);
+	void add(const VisibleIShape &object, const Ray &ray);
+	bool isComplete() const;
+	void getHit(const Ray &ray, int i, HitRecord &hit) const;
 };
 
 /**
@@ -72,6 +282,11 @@ struct IPlane : public IShape {
 	IPlane(const vector<dvec3> &vertices);
 	IPlane(const dvec3 &p1, const dvec3 &p2, const dvec3 &p3);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
 	bool onFrontSide(const dvec3 &point) const;
 	void findIntersection(const dvec3 &p1, const dvec3 &p2, double &t) const;
 };
@@ -90,7 +305,13 @@ struct IDisk : public IShape {
 	IDisk();
 	IDisk(const dvec3 &position, const dvec3 &n, double rad);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
 	dvec3 center;	//!< center point of disk
 	dvec3 n;		//!< normal vector of disk
 	double radius;
@@ -118,7 +339,11 @@ struct QuadricParameters {
 /**
  * @struct	IQuadricSurface
  * @brief	Implicit representation of quadric surface. These shapes can be
- * 			described by the general quadric surface equation
+ * 			described by the general quadric surface equation. Its intersection
+ * 			routines work from the ten parameters and so handle any quadric; the
+ * 			spheres, cylinders, cones and ellipsoids below override them with the
+ * 			closed-form tests of intersectors.h, which give the same hits with less
+ * 			arithmetic.
  */
 
 struct IQuadricSurface : public IShape {
@@ -129,9 +354,16 @@ struct IQuadricSurface : public IShape {
 					const dvec3 & position);
 	IQuadricSurface(const dvec3 & position);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
+	virtual bool isInBounds(const dvec3 &pt) const;
 	int findIntersections(const Ray &ray, HitRecord hits[2]) const;
 	dvec3 normal(const dvec3 &pt) const;
 	virtual void computeAqBqCq(const Ray &ray, double &Aq, double &Bq, double &Cq) const;
+	const QuadricParameters &getParameters() const { return qParams; }
 protected:
 	QuadricParameters qParams;		//!< The parameters that make up the quadric
 	double twoA;					//!< 2*A
@@ -145,8 +377,17 @@ protected:
  */
 
 struct ISphere : IQuadricSurface {
+	double radius;	//!< radius of the sphere
 	ISphere(const dvec3 &position, double radius);
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
 	virtual void getTexCoords(const dvec3 &pt, double &u, double &v) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	SphereIntersector intersector;	//!< closed-form intersection routines
 };
 
 /**
@@ -178,6 +419,14 @@ struct ICone : public IQuadricSurface {
 struct IConeY : public ICone {
 	IConeY(const dvec3& position, double R, double H);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
+	virtual bool isInBounds(const dvec3 &pt) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	ConeYIntersector intersector;	//!< closed-form intersection routines
 };
 
 /**
@@ -188,7 +437,15 @@ struct IConeY : public ICone {
 struct ICylinderY : public ICylinder {
 	ICylinderY(const dvec3 &position, double R, double len);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
 	void getTexCoords(const dvec3 &pt, double &u, double &v) const;
+	virtual bool isInBounds(const dvec3 &pt) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	CylinderYIntersector intersector;	//!< closed-form intersection routines
 };
 
 /* CSE 386 - To create */
@@ -200,6 +457,14 @@ struct ICylinderY : public ICylinder {
 struct ICylinderZ : public ICylinder {
 	ICylinderZ(const dvec3 &position, double R, double len);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
+	virtual bool isInBounds(const dvec3 &pt) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	CylinderZIntersector intersector;	//!< closed-form intersection routines
 };
 
 struct IClosedCylinderY {
@@ -218,5 +483,14 @@ struct IClosedCylinderY {
  */
 
 struct IEllipsoid : public IQuadricSurface {
+	dvec3 size;		//!< semi-axis lengths along x, y and z
 	IEllipsoid(const dvec3& position, const dvec3& sz);
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual void findClosestIntersections(const RayPacket &packet, double t[PACKET_SIZE]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	EllipsoidIntersector intersector;	//!< closed-form intersection routines
 };
\ No newline at end of file
@@ -98,6 +98,30 @@ color totalColor(const Material &mat, const LightColor &lightColor,
 	}
 }
 
+/**
+ * @fn	double LightATParams::range() const
+ * @brief	Finds how far the light reaches: the distance at which the attenuation factor
+ * 			falls to the cutoff. The coefficients are assumed not to be negative, so the
+ * 			factor only falls with distance.
+ * @return	The distance, FLT_MAX if there is no cutoff or the factor never falls to it,
+ * 			or -1 if the light does not even reach a point right next to it.
+ */
+
+double LightATParams::range() const {
+	if (cutoff <= 0.0) {
+		return FLT_MAX;
+	}
+	double K = 1.0 / cutoff - constant;		// the most linear * d + quadratic * d^2 can be
+	if (K < 0.0) {
+		return -1.0;
+	} else if (quadratic > 0.0) {
+		return (-linear + std::sqrt(linear * linear + 4.0 * quadratic * K)) / (2.0 * quadratic);
+	} else if (linear > 0.0) {
+		return K / linear;
+	}
+	return FLT_MAX;
+}
+
 /**
  * @fn	color PositionalLight::illuminate(const dvec3 &interceptWorldCoords, 
  *										const dvec3 &normal, const Material &material, 
@@ -119,6 +143,9 @@ color PositionalLight::illuminate(const dvec3& interceptWorldCoords,
 	if (!isOn) {
 		return black;
 	}
+	else if (!reaches(actualPosition(eyeFrame), interceptWorldCoords)) {
+		return black;
+	}
 	else {
 		dvec3 v = glm::normalize(eyeFrame.origin - interceptWorldCoords);
 		return(totalColor(material, lightColor, v, normal, actualPosition(eyeFrame), interceptWorldCoords,
@@ -159,6 +186,9 @@ color SpotLight::illuminate(const dvec3 &interceptWorldCoords,
 	else if (!inCone(actualPosition(eyeFrame), this->spotDir, this->fov, interceptWorldCoords)) {
 		return black;
 	}
+	else if (!reaches(actualPosition(eyeFrame), interceptWorldCoords)) {
+		return black;
+	}
 	else {
 		dvec3 v = glm::normalize(eyeFrame.origin - interceptWorldCoords);
 		return(totalColor(material, lightColor, v, normal, actualPosition(eyeFrame), interceptWorldCoords,
@@ -166,6 +196,61 @@ color SpotLight::illuminate(const dvec3 &interceptWorldCoords,
 	}
 }
 
+/**
+ * @fn	LightInfluence PositionalLight::influence(const Frame &eyeFrame) const
+ * @brief	Bounds the points this light can add color to: the sphere it reaches.
+ * @param	eyeFrame	The coordinate frame of the camera.
+ * @return	The bound.
+ */
+
+LightInfluence PositionalLight::influence(const Frame& eyeFrame) const {
+	LightInfluence bound;
+	bound.center = actualPosition(eyeFrame);
+	bound.radius = isOn ? range() : -1.0;
+	return bound;
+}
+
+/**
+ * @fn	LightInfluence SpotLight::influence(const Frame &eyeFrame) const
+ * @brief	Bounds the points this light can add color to: those in its cone (see
+ * 			inCone), and, if its range is limited, in the smallest sphere around the
+ * 			part of the cone within range.
+ * @param	eyeFrame	The coordinate frame of the camera.
+ * @return	The bound.
+ */
+
+LightInfluence SpotLight::influence(const Frame& eyeFrame) const {
+	LightInfluence bound = PositionalLight::influence(eyeFrame);
+	double length = glm::length(spotDir);
+	if (length == 0.0) {
+		return bound;
+	}
+	// inCone compares the cosine to spotDir, unnormalized, against cos(fov)
+	double cosAngle = std::cos(fov) / length;
+	if (cosAngle >= 1.0) {
+		cosAngle = 1.0;
+	} else if (cosAngle <= 0.0) {
+		return bound;		// the cone is 90 degrees or wider
+	}
+	bound.isCone = true;
+	bound.apex = bound.center;
+	bound.axis = spotDir / length;
+	bound.sinAngle = std::sqrt(1.0 - cosAngle * cosAngle);
+	if (bound.radius > 0.0 && bound.radius != FLT_MAX) {
+		double range = bound.radius;
+		if (cosAngle >= std::sqrt(0.5)) {
+			// The sphere through the tip and the rim of the cone
+			bound.radius = range / (2.0 * cosAngle);
+			bound.center = bound.apex + bound.radius * bound.axis;
+		} else {
+			// The sphere around the rim of the cone
+			bound.radius = range * bound.sinAngle;
+			bound.center = bound.apex + range * cosAngle * bound.axis;
+		}
+	}
+	return bound;
+}
+
 /**
 * @fn	void setDir (double dx, double dy, double dz)
 * @brief	Sets the direction of the spotlight.
@@ -200,78 +285,108 @@ bool inCone(const dvec3& spotPos, const dvec3& spotDir, double spotFOV, const dv
 }
 
 /**
-* @fn	bool inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr> objects)
-* @brief	Determines if an intercept point falls in a shadow.
-* @param	lightPos		where the spotlight is positioned
+* @fn	double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr>& Oobjects, const vector<VisibleIShapePtr>& Tobjects)
+* @brief	Determines if an intercept point falls in a shadow. Only objects between the
+*			intercept and the light can cast a shadow. Each one adds its alpha, so an
+*			opaque object blocks the light on its own and the search stops there.
+*			Objects hidden from SHADOW_RAYS cast no shadow.
+* @param	lightPos	where the light is positioned
 * @param	intercept	the position of the intercept.
 * @param	normal		the normal vector at the intercept point
-* @param	objects		the collection of opaque objects in the scene
+* @param	Oobjects	the collection of opaque objects in the scene
+* @param	Tobjects	the collection of transparent objects in the scene
+* @return	The amount of shadow, from 0 (fully lit) to 1.
 */
 
 double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr>& Oobjects, const vector<VisibleIShapePtr>& Tobjects) {
-	/* CSE 386 - todo  */
-
-	// Direction of light w.r.t point of intersection
+	// Direction and distance to the light w.r.t point of intersection
 	dvec3 Lu = glm::normalize(lightPos - intercept);
+	double lightDistance = glm::distance(lightPos, intercept);
 
 	Ray ray(intercept, Lu);
 
 	double sha = 0;
-	sha = 0;
-
-	// Calculate shadow contribution from all the Opaque objects
-	for (int i = 0; i < Oobjects.size(); i++)
-	{
-		VisibleIShape& thisShape = *Oobjects[i];
-		HitRecord hit;
-		thisShape.findClosestIntersection(ray, hit);
-
-		// check if ray intersects the object
-		if (hit.t != FLT_MAX) {
 
-			// apply a small threshold for numerical stability
-			if (abs(hit.t) >= 0.0001) {
-
-				// update shadow co-efficient by adding the transparency value of the node
-				sha = sha + hit.material.alpha;
-
-				// Clip shadow to value 1.0
-				if (sha > 1.0f) {
-					return 1.0;
-				}
+	// Opaque objects first, since any one of them blocks the light completely.
+	// A small threshold on t is applied for numerical stability.
+	for (size_t i = 0; i < Oobjects.size(); i++) {
+		if (Oobjects[i]->isVisibleTo(SHADOW_RAYS) && Oobjects[i]->shape->hasIntersection(ray, SHADOW_RAY_TMIN, lightDistance)) {
+			sha = sha + Oobjects[i]->material.alpha;
+			if (sha >= 1.0) {
+				return 1.0;
 			}
 		}
 	}
 
-	// Calculate shadow contribution from all the Transparent objects
-	for (int i = 0; i < Tobjects.size(); i++)
-	{
-		VisibleIShape& thisShape = *Tobjects[i];
-		HitRecord hit;
-		thisShape.findClosestIntersection(ray, hit);
+	for (size_t i = 0; i < Tobjects.size(); i++) {
+		if (Tobjects[i]->isVisibleTo(SHADOW_RAYS) && Tobjects[i]->shape->hasIntersection(ray, SHADOW_RAY_TMIN, lightDistance)) {
+			sha = sha + Tobjects[i]->material.alpha;
+			if (sha >= 1.0) {
+				return 1.0;
+			}
+		}
+	}
 
-		// check if ray intersects the object
-		if (hit.t != FLT_MAX) {
+	return sha;
+}
 
-			// apply a small threshold for numerical stability
-			if (abs(hit.t) >= 0.0001) {
+/**
+* @fn	double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const BVH& objects, const IShape** occluder, const ObjectLinks* casters)
+* @brief	Determines if an intercept point falls in a shadow. Gives the same result as
+*			the version above, but only tests the objects whose bounding boxes the part
+*			of the shadow ray between the intercept and the light passes through.
+* @param	lightPos	where the light is positioned
+* @param	intercept	the position of the intercept.
+* @param	normal		the normal vector at the intercept point
+* @param	objects		hierarchy over the opaque and transparent objects in the scene
+* @param	occluder	if not nullptr, set to the opaque object that blocks the light, if one is found
+* @param	casters		if not nullptr, the only objects that can block the light
+* @return	The amount of shadow, from 0 (fully lit) to 1.
+*/
 
-				// update shadow co-efficient by adding the transparency value of the node
-				sha = sha + hit.material.alpha;
+double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const BVH& objects, const IShape** occluder,
+				const ObjectLinks* casters) {
+	dvec3 Lu = glm::normalize(lightPos - intercept);
+	double lightDistance = glm::distance(lightPos, intercept);
+	return objects.findOcclusion(Ray(intercept, Lu), SHADOW_RAY_TMIN, lightDistance, occluder, casters);
+}
 
-				// Clip shadow to value 1.0
-				if (sha > 1.0f) {
-					return 1.0;
-				}
-			}
-		}
-	}
+/**
+* @fn	double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const CompactScene& objects, const IShape** occluder, const ObjectLinks* casters)
+* @brief	Determines if an intercept point falls in a shadow, testing every object in
+*			a CompactScene.
+* @param	lightPos	where the light is positioned
+* @param	intercept	the position of the intercept.
+* @param	normal		the normal vector at the intercept point
+* @param	objects		the opaque and transparent objects in the scene
+* @param	occluder	if not nullptr, set to the opaque object that blocks the light, if one is found
+* @param	casters		if not nullptr, the only objects that can block the light
+* @return	The amount of shadow, from 0 (fully lit) to 1.
+*/
 
-	// Clip shadow to value 1.0
-	if (sha > 1.0f) {
-		return 1.0;
-	}
+double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const CompactScene& objects, const IShape** occluder,
+				const ObjectLinks* casters) {
+	dvec3 Lu = glm::normalize(lightPos - intercept);
+	double lightDistance = glm::distance(lightPos, intercept);
+	return objects.findOcclusion(Ray(intercept, Lu), SHADOW_RAY_TMIN, lightDistance, occluder, casters);
+}
 
-	return sha;
+/**
+* @fn	double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const Grid& objects, const IShape** occluder, const ObjectLinks* casters)
+* @brief	Determines if an intercept point falls in a shadow, testing the objects in
+*			the grid cells that the shadow ray passes through.
+* @param	lightPos	where the light is positioned
+* @param	intercept	the position of the intercept.
+* @param	normal		the normal vector at the intercept point
+* @param	objects		grid over the opaque and transparent objects in the scene
+* @param	occluder	if not nullptr, set to the opaque object that blocks the light, if one is found
+* @param	casters		if not nullptr, the only objects that can block the light
+* @return	The amount of shadow, from 0 (fully lit) to 1.
+*/
 
+double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const Grid& objects, const IShape** occluder,
+				const ObjectLinks* casters) {
+	dvec3 Lu = glm::normalize(lightPos - intercept);
+	double lightDistance = glm::distance(lightPos, intercept);
+	return objects.findOcclusion(Ray(intercept, Lu), SHADOW_RAY_TMIN, lightDistance, occluder, casters);
 }
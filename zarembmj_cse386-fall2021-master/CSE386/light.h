@@ -13,22 +13,52 @@
 #include "defs.h"
 #include "hitrecord.h"
 #include "ishape.h"
+#include "bvh.h"
+#include "compactscene.h"
+#include "grid.h"
 
  /**
   * @struct	LightATParams
-  * @brief	A light attenuation parameters.
+  * @brief	A light attenuation parameters. With a cutoff, an attenuated light stops
+  * 		where its attenuation factor falls below the cutoff, and adds nothing, not
+  * 		even ambient light, to points further away (see range).
   */
 
 struct LightATParams {
 	double constant, linear, quadratic;	//!< Parameters controlling attenuation.
-	LightATParams(double C, double L, double Q) {
+	double cutoff;						//!< Smallest factor at which the light still reaches; 0 for no limit.
+	LightATParams(double C, double L, double Q, double cut = 0.0) {
 		constant = C;
 		linear = L;
 		quadratic = Q;
+		cutoff = cut;
 	}
 	double factor(double distance) const {
 		return 1.0 / (constant + linear * distance + quadratic * distance * distance);
 	}
+	bool reaches(double distance) const {
+		return cutoff <= 0.0 || factor(distance) >= cutoff;
+	}
+	double range() const;
+};
+
+/**
+ * @struct	LightInfluence
+ * @brief	A conservative bound on the points a light can add color to: a sphere and,
+ * 			for a spot light, the cone it shines into. A point outside either one gets
+ * 			nothing from the light, which lets the lights that cannot reach a part of
+ * 			the image be left out of its shading (see LightCuller).
+ */
+
+struct LightInfluence {
+	dvec3 center;		//!< center of the bounding sphere
+	double radius;		//!< radius of the bounding sphere; FLT_MAX if unbounded, < 0 if the light reaches nothing
+	bool isCone;		//!< true if the light also only reaches points inside the cone
+	dvec3 apex;			//!< tip of the cone
+	dvec3 axis;			//!< unit direction the cone opens in
+	double sinAngle;	//!< sine of the angle between the cone's axis and its side, at most 90 degrees
+	LightInfluence() : center(0, 0, 0), radius(FLT_MAX), isCone(false),
+						apex(0, 0, 0), axis(0, 0, -1), sinAngle(1.0) {}
 };
 
 /**
@@ -61,6 +91,7 @@ struct LightSource {
 	LightSource() {
 		isOn = true;
 	}
+	virtual ~LightSource() {}
 	virtual color illuminate(const dvec3& interceptWorldCoords,
 		const dvec3& normal,
 		const Material& material,
@@ -69,7 +100,9 @@ struct LightSource {
 
 /**
  * @struct	PositionalLight
- * @brief	Represents a simple positional light source.
+ * @brief	Represents a simple positional light source. Light linking limits the
+ * 			objects the light shines on and the objects that can block it; by default
+ * 			both are every object. The links may only be changed between frames.
  */
 
 struct PositionalLight : public LightSource {
@@ -78,6 +111,8 @@ struct PositionalLight : public LightSource {
 	bool isTiedToWorld;			//!< true if the position is in world (or eye) coordinates.
 	LightATParams atParams;
 	LightColor lightColor;
+	ObjectLinks litObjects;		//!< The objects this light shines on.
+	ObjectLinks shadowCasters;	//!< The objects that can cast this light's shadows.
 
 	PositionalLight(const dvec3& position, const LightColor& color)
 		: LightSource(), lightColor(color), pos(position), atParams(0.0, 1.0, 0.0) {
@@ -90,7 +125,17 @@ struct PositionalLight : public LightSource {
 	void setAttenuationParams(const LightATParams& params) {
 		atParams = params;
 	}
+	bool illuminates(const VisibleIShape* object) const {
+		return litObjects.contains(object);
+	}
+	bool reaches(const dvec3& lightPos, const dvec3& point) const {
+		return !attenuationIsTurnedOn || atParams.reaches(glm::distance(lightPos, point));
+	}
+	double range() const {
+		return attenuationIsTurnedOn ? atParams.range() : FLT_MAX;
+	}
 	dvec3 actualPosition(const Frame& eyeFrame) const;
+	virtual LightInfluence influence(const Frame& eyeFrame) const;
 	virtual color illuminate(const dvec3& interceptWorldCoords,
 		const dvec3& normal,
 		const Material& material,
@@ -114,10 +159,12 @@ struct SpotLight : public PositionalLight {
 		const dvec3& normal,
 		const Material& material,
 		const Frame& eyeFrame, bool inShadow) const;
+	virtual LightInfluence influence(const Frame& eyeFrame) const;
 	void setDir(double dx, double dy, double dz);
 };
 
 const LightColor pureWhiteLight(vector<double>{1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0});
+const double SHADOW_RAY_TMIN = 0.0001;	//!< hits closer than this to a shadow ray's origin are ignored.
 
 color ambientColor(const color& matAmbient, const color& lightAmbient);
 color diffuseColor(const color& matDiffuse, const color& lightDiffuse,
@@ -132,6 +179,12 @@ color totalColor(const Material& mat, const LightColor& lightColor,
 	const LightATParams& ATparams, double sha);
 bool inCone(const dvec3& spotPos, const dvec3& spotDir, double spotFOV, const dvec3& intercept);
 double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr>& Oobjects, const vector<VisibleIShapePtr>& Tobjects);
+double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const BVH& objects, const IShape** occluder = nullptr,
+				const ObjectLinks* casters = nullptr);
+double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const CompactScene& objects, const IShape** occluder = nullptr,
+				const ObjectLinks* casters = nullptr);
+double inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const Grid& objects, const IShape** occluder = nullptr,
+				const ObjectLinks* casters = nullptr);
 
 typedef LightSource* LightSourcePtr;
 typedef PositionalLight* PositionalLightPtr;
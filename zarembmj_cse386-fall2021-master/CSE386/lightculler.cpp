@@ -0,0 +1,94 @@
+#include "lightculler.h"
+#include "iscene.h"
+
+/**
+ * @fn	void LightCuller::setup(const IScene &theScene)
+ * @brief	Finds where each light that is on can reach, as seen from the scene's
+ * 			camera this frame. Must be called again whenever the lights or the camera
+ * 			change.
+ * @param	theScene	The scene.
+ */
+
+void LightCuller::setup(const IScene &theScene) {
+	Frame frm = theScene.camera->getFrame();
+	lightIndex.clear();
+	influences.clear();
+	for (size_t k = 0; k < theScene.Plights.size(); k++) {
+		if (theScene.Plights[k]->isOn) {
+			lightIndex.push_back((int)k);
+			influences.push_back(theScene.Plights[k]->influence(frm));
+		}
+	}
+	for (size_t k = 0; k < theScene.Slights.size(); k++) {
+		if (theScene.Slights[k]->isOn) {
+			lightIndex.push_back((int)(theScene.Plights.size() + k));
+			influences.push_back(theScene.Slights[k]->influence(frm));
+		}
+	}
+}
+
+/**
+ * @fn	void LightCuller::cull(const RaytracingCamera &camera, const BoundingBoxi &tile, vector<int> &lights) const
+ * @brief	Lists the lights that may reach what the camera rays through a tile hit.
+ * 			Each side of the frustum is the plane through the rays at two neighboring
+ * 			corners, which holds every ray along that edge of the tile as long as the
+ * 			camera's rays vary linearly across the image, as they do for the
+ * 			perspective and orthographic cameras. The plane through the rays' origins,
+ * 			facing along the middle ray, closes off the frustum behind the camera.
+ * @param 		  	camera	The camera.
+ * @param 		  	tile  	The tile, in pixels; a sample anywhere within it is covered.
+ * @param [in,out]	lights	Set to the lights, in the order of lightsOn.
+ */
+
+void LightCuller::cull(const RaytracingCamera &camera, const BoundingBoxi &tile, vector<int> &lights) const {
+	const Ray corners[4] = { camera.getRay(tile.lx, tile.ly),
+								camera.getRay(tile.lx + tile.width, tile.ly),
+								camera.getRay(tile.lx + tile.width, tile.ly + tile.height),
+								camera.getRay(tile.lx, tile.ly + tile.height) };
+	const Ray middle = camera.getRay(tile.lx + tile.width / 2.0, tile.ly + tile.height / 2.0);
+	const dvec3 inside = middle.origin + middle.dir;
+
+	// Each plane is given by a unit normal, facing into the frustum, and a point on it
+	dvec3 normals[5], points[5];
+	int numPlanes = 0;
+	bool inFront = true;
+	for (int i = 0; i < 4; i++) {
+		const Ray &a = corners[i];
+		const Ray &b = corners[(i + 1) % 4];
+		dvec3 n = glm::cross(a.dir, b.origin + b.dir - a.origin);
+		double length = glm::length(n);
+		if (length > 0.0) {
+			n /= length;
+			normals[numPlanes] = glm::dot(n, inside - a.origin) < 0.0 ? -n : n;
+			points[numPlanes] = a.origin;
+			numPlanes++;
+		}
+		inFront = inFront && glm::dot(a.dir, middle.dir) > 0.0;
+	}
+	if (inFront) {
+		normals[numPlanes] = glm::normalize(middle.dir);
+		points[numPlanes] = middle.origin;
+		numPlanes++;
+	}
+
+	lights.clear();
+	for (size_t i = 0; i < influences.size(); i++) {
+		const LightInfluence &bound = influences[i];
+		bool outside = bound.radius < 0.0;
+		for (int p = 0; p < numPlanes && !outside; p++) {
+			if (bound.radius != FLT_MAX) {
+				double margin = LIGHT_CULL_MARGIN * (1.0 + glm::distance(bound.center, points[p]) + bound.radius);
+				outside = glm::dot(normals[p], bound.center - points[p]) < -(bound.radius + margin);
+			}
+			if (bound.isCone && !outside) {
+				// The whole cone is outside when its tip is, and it opens away from the plane
+				double margin = LIGHT_CULL_MARGIN * (1.0 + glm::distance(bound.apex, points[p]));
+				outside = glm::dot(normals[p], bound.apex - points[p]) < -margin &&
+							glm::dot(normals[p], bound.axis) < -bound.sinAngle - LIGHT_CULL_MARGIN;
+			}
+		}
+		if (!outside) {
+			lights.push_back(lightIndex[i]);
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "defs.h"
+#include "camera.h"
+#include "light.h"
+
+struct IScene;
+
+const double LIGHT_CULL_MARGIN = 1.0E-6;	//!< relative slack kept when deciding that a light cannot reach a tile
+
+/**
+ * @struct	LightCuller
+ * @brief	Finds, for each tile of the image, the lights that can add color to the
+ * 			points the tile's camera rays hit. The rays through a tile all lie in the
+ * 			frustum bounded by the rays through its corners, so a light whose influence
+ * 			(see PositionalLight::influence) lies wholly outside one of the frustum's
+ * 			planes cannot reach any of them. The frustum is not bounded in depth.
+ * 			Secondary rays leave the frustum, so their hits are still shaded with every
+ * 			light. Lights are identified as in IScene::inShadow: Plights, then Slights.
+ */
+
+struct LightCuller {
+	void setup(const IScene &theScene);
+	void cull(const RaytracingCamera &camera, const BoundingBoxi &tile, vector<int> &lights) const;
+	const vector<int> &lightsOn() const { return lightIndex; }
+protected:
+	vector<int> lightIndex;				//!< index of each light that is on
+	vector<LightInfluence> influences;	//!< where each of those lights can reach
+};
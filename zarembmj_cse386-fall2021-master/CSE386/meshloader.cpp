@@ -0,0 +1,1125 @@
+#ifdef WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include "meshloader.h"
+
+/**
+ * @struct	MappedFile
+ * @brief	A file mapped read-only into memory. Pages are read from disk the first time
+ * 			they are touched, so threads parsing different parts of the file also read
+ * 			those parts in parallel, and the file is never copied into a buffer.
+ */
+
+struct MappedFile {
+	const char *data;		//!< the file's bytes, or nullptr
+	size_t size;			//!< number of bytes
+	MappedFile() : data(nullptr), size(0) {
+#ifdef WINDOWS
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+#endif
+	}
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile();
+	bool open(const std::string &fileName);
+#ifdef WINDOWS
+protected:
+	HANDLE file;			//!< the open file
+	HANDLE mapping;			//!< the file mapping object
+#endif
+};
+
+/**
+ * @fn	bool MappedFile::open(const std::string &fileName)
+ * @brief	Maps a file into memory.
+ * @param	fileName	Name of the file.
+ * @return	False if the file could not be opened or mapped.
+ */
+
+bool MappedFile::open(const std::string &fileName) {
+#ifdef WINDOWS
+	file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+						OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	if (size == 0) {
+		return true;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		return false;
+	}
+	data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	return data != nullptr;
+#else
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		::close(fd);
+		return false;
+	}
+	size = (size_t)info.st_size;
+	if (size == 0) {
+		::close(fd);
+		return true;
+	}
+	void *view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED) {
+		size = 0;
+		return false;
+	}
+	// Start reading the whole file ahead of the parsers.
+	madvise(view, size, MADV_WILLNEED);
+	data = (const char *)view;
+	return true;
+#endif
+}
+
+/**
+ * @fn	MappedFile::~MappedFile()
+ * @brief	Unmaps the file.
+ */
+
+MappedFile::~MappedFile() {
+#ifdef WINDOWS
+	if (data != nullptr) {
+		UnmapViewOfFile(data);
+	}
+	if (mapping != nullptr) {
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+#else
+	if (data != nullptr) {
+		munmap((void *)data, size);
+	}
+#endif
+}
+
+/**
+ * @fn	static double secondsSince(const std::chrono::steady_clock::time_point &start)
+ * @brief	Time elapsed since start.
+ * @param	start	The start time.
+ * @return	Seconds since start.
+ */
+
+static double secondsSince(const std::chrono::steady_clock::time_point &start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @fn	static int workerCount(int numThreads)
+ * @brief	Number of threads to parse with.
+ * @param	numThreads	Threads requested, 0 for one per hardware thread.
+ * @return	The number of threads, at least 1.
+ */
+
+static int workerCount(int numThreads) {
+	int workers = numThreads > 0 ? numThreads : (int)std::thread::hardware_concurrency();
+	return std::max(workers, 1);
+}
+
+/**
+ * @fn	static void parallelFor(int numTasks, int numThreads, const std::function<void(int)> &task)
+ * @brief	Runs task(0) through task(numTasks - 1) on numThreads threads.
+ * @param	numTasks  	Number of tasks.
+ * @param	numThreads	Number of threads.
+ * @param	task	  	The task.
+ */
+
+static void parallelFor(int numTasks, int numThreads, const std::function<void(int)> &task) {
+	std::atomic<int> next(0);
+	auto worker = [&]() {
+		for (int i = next++; i < numTasks; i = next++) {
+			task(i);
+		}
+	};
+	vector<std::thread> threads;
+	for (int i = 1; i < std::min(numThreads, numTasks); i++) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (std::thread &t : threads) {
+		t.join();
+	}
+}
+
+const double POWERS_OF_10[] = {
+	1.0E0, 1.0E1, 1.0E2, 1.0E3, 1.0E4, 1.0E5, 1.0E6, 1.0E7, 1.0E8, 1.0E9, 1.0E10, 1.0E11,
+	1.0E12, 1.0E13, 1.0E14, 1.0E15, 1.0E16, 1.0E17, 1.0E18, 1.0E19, 1.0E20, 1.0E21, 1.0E22
+};	//!< powers of 10 that are exact doubles
+
+const uint64_t MAX_MANTISSA = 100000000000000000ULL;	//!< digits after this many are dropped
+
+/**
+ * @fn	static bool isDigit(char c)
+ * @brief	Query if c is a decimal digit.
+ * @param	c	The character.
+ * @return	true iff c is in '0'..'9'.
+ */
+
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+/**
+ * @fn	static const char *parseInteger(const char *p, const char *end, long long &value)
+ * @brief	Reads an optionally signed decimal integer.
+ * @param 		  	p	 	Where the number starts.
+ * @param 		  	end  	End of the text.
+ * @param [in,out]	value	The number.
+ * @return	Just past the number, or nullptr if there was no number at p.
+ */
+
+static const char *parseInteger(const char *p, const char *end, long long &value) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	if (p == end || !isDigit(*p)) {
+		return nullptr;
+	}
+	long long n = 0;
+	for (; p < end && isDigit(*p); p++) {
+		if (n < (long long)MAX_MANTISSA) {
+			n = 10 * n + (*p - '0');
+		}
+	}
+	value = negative ? -n : n;
+	return p;
+}
+
+/**
+ * @fn	static const char *parseDouble(const char *p, const char *end, double &value)
+ * @brief	Reads a decimal floating point number, such as -1.25e-3. The digits are
+ * 			gathered into a 64-bit integer and scaled by one exact power of 10, so the
+ * 			result is within a couple of units in the last place of the correctly
+ * 			rounded value (and exact for up to 15 digits with small exponents).
+ * 			That is all geometry needs, and it is several times faster than strtod.
+ * @param 		  	p	 	Where the number starts.
+ * @param 		  	end  	End of the text.
+ * @param [in,out]	value	The number.
+ * @return	Just past the number, or nullptr if there was no number at p.
+ */
+
+static const char *parseDouble(const char *p, const char *end, double &value) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+	for (; p < end && isDigit(*p); p++) {
+		anyDigits = true;
+		if (mantissa < MAX_MANTISSA) {
+			mantissa = 10 * mantissa + (*p - '0');
+		} else {
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && isDigit(*p); p++) {
+			anyDigits = true;
+			if (mantissa < MAX_MANTISSA) {
+				mantissa = 10 * mantissa + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if (!anyDigits) {
+		return nullptr;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		long long e;
+		const char *q = parseInteger(p + 1, end, e);
+		if (q != nullptr) {
+			exponent += (int)std::max(-10000LL, std::min(e, 10000LL));
+			p = q;
+		}
+	}
+
+	double x = (double)mantissa;
+	if (exponent < 0) {
+		x = exponent >= -22 ? x / POWERS_OF_10[-exponent] : x * std::pow(10.0, exponent);
+	} else if (exponent > 0) {
+		x = exponent <= 22 ? x * POWERS_OF_10[exponent] : x * std::pow(10.0, exponent);
+	}
+	value = negative ? -x : x;
+	return p;
+}
+
+/**
+ * @fn	static const char *skipSpaces(const char *p, const char *end)
+ * @brief	Skips spaces and tabs.
+ * @param	p  	The current position.
+ * @param	end	End of the text.
+ * @return	The first character that is not a space or tab.
+ */
+
+static const char *skipSpaces(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t')) {
+		p++;
+	}
+	return p;
+}
+
+/**
+ * @fn	static const char *skipLine(const char *p, const char *end)
+ * @brief	Skips to the start of the next line.
+ * @param	p  	The current position.
+ * @param	end	End of the text.
+ * @return	Just past the next newline, or end.
+ */
+
+static const char *skipLine(const char *p, const char *end) {
+	const char *newline = (const char *)std::memchr(p, '\n', end - p);
+	return newline == nullptr ? end : newline + 1;
+}
+
+/**
+ * @fn	static bool atEndOfLine(const char *p, const char *end)
+ * @brief	Query if only a line ending or a comment is left on this line.
+ * @param	p  	The current position, after any spaces.
+ * @param	end	End of the text.
+ * @return	true iff nothing more is on the line.
+ */
+
+static bool atEndOfLine(const char *p, const char *end) {
+	return p == end || *p == '\n' || *p == '\r' || *p == '#';
+}
+
+/**
+ * @struct	ObjChunk
+ * @brief	What one thread finds in its part of an OBJ file. Indices are 0-based and
+ * 			refer to the whole file, except for those listed in relativePositions and
+ * 			relativeNormals: they came from negative OBJ indices and count from this
+ * 			chunk's first vertex until the chunks are joined.
+ */
+
+struct ObjChunk {
+	const char *begin;						//!< first character of the chunk
+	const char *end;						//!< one past the last character
+	vector<dvec3> positions;				//!< "v" lines
+	vector<dvec3> normals;					//!< "vn" lines
+	vector<unsigned int> positionIndices;	//!< three per triangle
+	vector<unsigned int> normalIndices;		//!< three per triangle, if every corner had one
+	vector<size_t> relativePositions;		//!< entries of positionIndices relative to this chunk
+	vector<size_t> relativeNormals;			//!< entries of normalIndices relative to this chunk
+	bool missingNormals = false;			//!< true if some face corner had no normal
+	int lines = 0;							//!< number of lines in the chunk
+	int errorLine = 0;						//!< line of the first error, counting from 1, or 0
+	size_t firstPosition = 0;				//!< number of positions in earlier chunks
+	size_t firstNormal = 0;					//!< number of normals in earlier chunks
+	size_t firstIndex = 0;					//!< number of indices in earlier chunks
+};
+
+/**
+ * @fn	static unsigned int objIndex(long long index, size_t count, bool &relative)
+ * @brief	Converts an OBJ index, 1-based or negative, to a 0-based one.
+ * @param 		  	index   	The OBJ index.
+ * @param 		  	count   	Number of vertices so far in this chunk.
+ * @param [in,out]	relative	Set to true iff the result counts from the chunk's first vertex.
+ * @return	The 0-based index. Invalid indices become values that fail the range check.
+ */
+
+static unsigned int objIndex(long long index, size_t count, bool &relative) {
+	relative = index < 0;
+	if (index > 0) {
+		return (unsigned int)(index - 1);
+	}
+	return index < 0 ? (unsigned int)(count + index) : ~0u;
+}
+
+/**
+ * @fn	static void parseOBJChunk(ObjChunk &chunk)
+ * @brief	Parses the v, vn and f lines of one chunk of an OBJ file. Polygons are split
+ * 			into triangle fans. Everything else (texture coordinates, groups, materials)
+ * 			is skipped.
+ * @param [in,out]	chunk	The chunk.
+ */
+
+static void parseOBJChunk(ObjChunk &chunk) {
+	const char *end = chunk.end;
+	vector<unsigned int> facePositions, faceNormals;
+	vector<bool> faceRelativePositions, faceRelativeNormals;
+
+	for (const char *p = chunk.begin; p < end; p = skipLine(p, end)) {
+		chunk.lines++;
+		p = skipSpaces(p, end);
+		if (end - p < 2 || (p[0] != 'v' && p[0] != 'f')) {
+			continue;
+		}
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t' || p[1] == 'n')) {
+			bool isNormal = p[1] == 'n';
+			p += isNormal ? 2 : 1;
+			double xyz[3];
+			for (int i = 0; i < 3 && p != nullptr; i++) {
+				p = parseDouble(skipSpaces(p, end), end, xyz[i]);
+			}
+			if (p == nullptr) {
+				chunk.errorLine = chunk.lines;
+				return;
+			}
+			(isNormal ? chunk.normals : chunk.positions).push_back(dvec3(xyz[0], xyz[1], xyz[2]));
+		} else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			facePositions.clear();
+			faceNormals.clear();
+			faceRelativePositions.clear();
+			faceRelativeNormals.clear();
+			p = skipSpaces(p + 1, end);
+			while (!atEndOfLine(p, end)) {
+				long long position, texCoord, normal;
+				bool relative;
+				p = parseInteger(p, end, position);
+				if (p == nullptr) {
+					break;
+				}
+				facePositions.push_back(objIndex(position, chunk.positions.size(), relative));
+				faceRelativePositions.push_back(relative);
+				bool hasNormal = false;
+				if (p < end && *p == '/') {
+					p++;
+					if (p < end && *p != '/') {
+						p = parseInteger(p, end, texCoord);
+					}
+					if (p != nullptr && p < end && *p == '/') {
+						p = parseInteger(p + 1, end, normal);
+						hasNormal = p != nullptr;
+						if (hasNormal) {
+							faceNormals.push_back(objIndex(normal, chunk.normals.size(), relative));
+							faceRelativeNormals.push_back(relative);
+						}
+					}
+					if (p == nullptr) {
+						break;
+					}
+				}
+				chunk.missingNormals = chunk.missingNormals || !hasNormal;
+				p = skipSpaces(p, end);
+			}
+			if (p == nullptr || facePositions.size() < 3) {
+				chunk.errorLine = chunk.lines;
+				return;
+			}
+			for (size_t k = 1; k + 1 < facePositions.size(); k++) {
+				const size_t corners[3] = { 0, k, k + 1 };
+				for (size_t c : corners) {
+					if (faceRelativePositions[c]) {
+						chunk.relativePositions.push_back(chunk.positionIndices.size());
+					}
+					chunk.positionIndices.push_back(facePositions[c]);
+					if (!chunk.missingNormals) {
+						if (faceRelativeNormals[c]) {
+							chunk.relativeNormals.push_back(chunk.normalIndices.size());
+						}
+						chunk.normalIndices.push_back(faceNormals[c]);
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @fn	static void weldVertices(const vector<dvec3> &positions, const vector<dvec3> &normals, const vector<unsigned int> &normalIndices, MeshData &mesh)
+ * @brief	Makes one vertex for each distinct (position, normal) pair that a corner
+ * 			uses, for files whose faces do not give the same index for both. Pairs are
+ * 			found with an open-addressing hash table held in two flat arrays.
+ * @param 		  	positions	 	The file's positions.
+ * @param 		  	normals		 	The file's normals.
+ * @param 		  	normalIndices	The normal of each corner.
+ * @param [in,out]	mesh		 	On entry, indices holds each corner's position.
+ */
+
+static void weldVertices(const vector<dvec3> &positions, const vector<dvec3> &normals,
+							const vector<unsigned int> &normalIndices, MeshData &mesh) {
+	const uint64_t EMPTY = ~0ULL;
+	int bits = 1;
+	while (((size_t)1 << bits) < 2 * mesh.indices.size()) {
+		bits++;
+	}
+	vector<uint64_t> keys((size_t)1 << bits, EMPTY);
+	vector<unsigned int> values(keys.size());
+	size_t mask = keys.size() - 1;
+
+	mesh.vertices.clear();
+	mesh.normals.clear();
+	for (size_t i = 0; i < mesh.indices.size(); i++) {
+		uint64_t key = ((uint64_t)mesh.indices[i] << 32) | normalIndices[i];
+		size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+		while (keys[slot] != EMPTY && keys[slot] != key) {
+			slot = (slot + 1) & mask;
+		}
+		if (keys[slot] == EMPTY) {
+			keys[slot] = key;
+			values[slot] = (unsigned int)mesh.vertices.size();
+			mesh.vertices.push_back(positions[mesh.indices[i]]);
+			mesh.normals.push_back(normals[normalIndices[i]]);
+		}
+		mesh.indices[i] = values[slot];
+	}
+}
+
+/**
+ * @fn	bool loadOBJ(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads)
+ * @brief	Loads the triangles of a Wavefront OBJ file. The file is mapped into memory
+ * 			and split at line boundaries into one chunk per thread; the chunks are
+ * 			parsed in parallel and then copied, also in parallel, into one set of
+ * 			buffers. Vertex normals are kept if every face corner has one.
+ * @param 		  	fileName  	Name of the file.
+ * @param [in,out]	mesh	  	The triangles.
+ * @param [in,out]	stats	  	How long loading took.
+ * @param 		  	numThreads	Number of threads, 0 for one per hardware thread.
+ * @return	False if the file could not be read or is not a valid OBJ file.
+ */
+
+bool loadOBJ(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads) {
+	auto start = std::chrono::steady_clock::now();
+	MappedFile file;
+	if (!file.open(fileName)) {
+		std::cerr << "Cannot open OBJ file: " << fileName << endl;
+		return false;
+	}
+	stats = MeshLoadStats();
+	stats.bytes = file.size;
+	stats.threads = workerCount(numThreads);
+	stats.mapSecs = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	const char *end = file.data + file.size;
+	vector<ObjChunk> chunks(stats.threads);
+	const char *p = file.data;
+	for (int i = 0; i < stats.threads; i++) {
+		chunks[i].begin = p;
+		p = i + 1 == stats.threads ? end : std::max(p, file.data + file.size * (i + 1) / stats.threads);
+		if (p != end && p != file.data && p[-1] != '\n') {
+			p = skipLine(p, end);
+		}
+		chunks[i].end = p;
+	}
+	parallelFor(stats.threads, stats.threads, [&](int i) { parseOBJChunk(chunks[i]); });
+	stats.parseSecs = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	int linesBefore = 0;
+	size_t numPositions = 0, numNormals = 0, numIndices = 0;
+	bool missingNormals = false;
+	for (ObjChunk &chunk : chunks) {
+		if (chunk.errorLine != 0) {
+			std::cerr << "Problem with OBJ file: " << fileName << "(line " << linesBefore + chunk.errorLine << ")" << endl;
+			return false;
+		}
+		linesBefore += chunk.lines;
+		chunk.firstPosition = numPositions;
+		chunk.firstNormal = numNormals;
+		chunk.firstIndex = numIndices;
+		numPositions += chunk.positions.size();
+		numNormals += chunk.normals.size();
+		numIndices += chunk.positionIndices.size();
+		missingNormals = missingNormals || chunk.missingNormals;
+	}
+	bool useNormals = numNormals > 0 && !missingNormals;
+
+	vector<dvec3> normals(useNormals ? numNormals : 0);
+	vector<unsigned int> normalIndices(useNormals ? numIndices : 0);
+	mesh.vertices.resize(numPositions);
+	mesh.indices.resize(numIndices);
+	std::atomic<bool> badIndex(false);
+	std::atomic<bool> sameIndices(true);
+	parallelFor(stats.threads, stats.threads, [&](int i) {
+		ObjChunk &chunk = chunks[i];
+		for (size_t k : chunk.relativePositions) {
+			chunk.positionIndices[k] += (unsigned int)chunk.firstPosition;
+		}
+		std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.vertices.begin() + chunk.firstPosition);
+		std::copy(chunk.positionIndices.begin(), chunk.positionIndices.end(), mesh.indices.begin() + chunk.firstIndex);
+		bool bad = false;
+		for (unsigned int index : chunk.positionIndices) {
+			bad = bad || index >= numPositions;
+		}
+		if (useNormals) {
+			for (size_t k : chunk.relativeNormals) {
+				chunk.normalIndices[k] += (unsigned int)chunk.firstNormal;
+			}
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.firstNormal);
+			std::copy(chunk.normalIndices.begin(), chunk.normalIndices.end(), normalIndices.begin() + chunk.firstIndex);
+			bool same = true;
+			for (size_t k = 0; k < chunk.normalIndices.size(); k++) {
+				bad = bad || chunk.normalIndices[k] >= numNormals;
+				same = same && chunk.normalIndices[k] == chunk.positionIndices[k];
+			}
+			if (!same) {
+				sameIndices = false;
+			}
+		}
+		if (bad) {
+			badIndex = true;
+		}
+		chunk = ObjChunk();
+	});
+	if (badIndex) {
+		std::cerr << "Problem with OBJ file: " << fileName << "(face index out of range)" << endl;
+		return false;
+	}
+
+	if (!useNormals) {
+		mesh.normals.clear();
+	} else if (sameIndices && numNormals == numPositions) {
+		mesh.normals.swap(normals);
+	} else {
+		vector<dvec3> positions;
+		positions.swap(mesh.vertices);
+		weldVertices(positions, normals, normalIndices, mesh);
+	}
+	stats.mergeSecs = secondsSince(start);
+	return true;
+}
+
+/**
+ * @enum	PlyType
+ * @brief	The scalar types a binary PLY property can have.
+ */
+
+enum class PlyType { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64 };
+
+/**
+ * @struct	PlyProperty
+ * @brief	One property of a PLY element, as declared in the header.
+ */
+
+struct PlyProperty {
+	std::string name;		//!< name of the property
+	PlyType type;			//!< type of the value, or of each list entry
+	PlyType countType;		//!< type of a list's length
+	bool isList;			//!< true for list properties
+};
+
+/**
+ * @struct	PlyElement
+ * @brief	One element of a PLY file, such as "vertex" or "face".
+ */
+
+struct PlyElement {
+	std::string name;					//!< name of the element
+	size_t count;						//!< number of records
+	vector<PlyProperty> properties;		//!< the properties of each record, in order
+	int find(const std::string &propertyName) const {
+		for (size_t i = 0; i < properties.size(); i++) {
+			if (properties[i].name == propertyName) {
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+};
+
+/**
+ * @fn	static bool parsePlyType(const std::string &name, PlyType &type)
+ * @brief	Looks up a PLY type by either of its names.
+ * @param 		  	name	The name, such as "float" or "float32".
+ * @param [in,out]	type	The type.
+ * @return	False if the name is not a PLY type.
+ */
+
+static bool parsePlyType(const std::string &name, PlyType &type) {
+	static const char *names[][2] = {
+		{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+		{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+	};
+	for (int i = 0; i < 8; i++) {
+		if (name == names[i][0] || name == names[i][1]) {
+			type = (PlyType)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	static size_t plySize(PlyType type)
+ * @brief	Size of a PLY value.
+ * @param	type	The type.
+ * @return	Number of bytes.
+ */
+
+static size_t plySize(PlyType type) {
+	static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+	return sizes[(int)type];
+}
+
+/**
+ * @fn	static double readPlyValue(const char *p, PlyType type, bool swapBytes)
+ * @brief	Reads one binary PLY value.
+ * @param	p		 	Where the value is.
+ * @param	type	 	The value's type.
+ * @param	swapBytes	true if the file's byte order is not this machine's.
+ * @return	The value.
+ */
+
+static double readPlyValue(const char *p, PlyType type, bool swapBytes) {
+	unsigned char bytes[8];
+	size_t size = plySize(type);
+	std::memcpy(bytes, p, size);
+	if (swapBytes) {
+		std::reverse(bytes, bytes + size);
+	}
+	switch (type) {
+	case PlyType::INT8:		{ int8_t v; std::memcpy(&v, bytes, 1); return v; }
+	case PlyType::UINT8:	{ uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+	case PlyType::INT16:	{ int16_t v; std::memcpy(&v, bytes, 2); return v; }
+	case PlyType::UINT16:	{ uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+	case PlyType::INT32:	{ int32_t v; std::memcpy(&v, bytes, 4); return v; }
+	case PlyType::UINT32:	{ uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+	case PlyType::FLOAT32:	{ float v; std::memcpy(&v, bytes, 4); return v; }
+	default:				{ double v; std::memcpy(&v, bytes, 8); return v; }
+	}
+}
+
+/**
+ * @fn	static bool readPlyCount(const char *p, PlyType type, bool swapBytes, uint32_t &count)
+ * @brief	Reads one binary PLY value that is a list length or a vertex index.
+ * @param 		  	p		 	Where the value is.
+ * @param 		  	type	 	The value's type.
+ * @param 		  	swapBytes	true if the file's byte order is not this machine's.
+ * @param [in,out]	count	 	Receives the value.
+ * @return	False if the value is negative, not finite or larger than UINT32_MAX.
+ */
+
+static bool readPlyCount(const char *p, PlyType type, bool swapBytes, uint32_t &count) {
+	double value = readPlyValue(p, type, swapBytes);
+	if (!std::isfinite(value) || value < 0.0 || value > (double)UINT32_MAX) {
+		return false;
+	}
+	count = (uint32_t)value;
+	return true;
+}
+
+/**
+ * @fn	static bool readPlyHeader(const MappedFile &file, vector<PlyElement> &elements, bool &swapBytes, size_t &dataStart)
+ * @brief	Parses the text header of a binary PLY file.
+ * @param 		  	file	 	The file.
+ * @param [in,out]	elements 	The elements declared in the header.
+ * @param [in,out]	swapBytes	true if the file's byte order is not this machine's.
+ * @param [in,out]	dataStart	Offset of the first byte after the header.
+ * @return	False if the header is not valid, or the file is ASCII PLY.
+ */
+
+static bool readPlyHeader(const MappedFile &file, vector<PlyElement> &elements,
+							bool &swapBytes, size_t &dataStart) {
+	const char *end = file.data + file.size;
+	const char *p = file.data;
+	const char *headerEnd = nullptr;
+	while (p < end && headerEnd == nullptr) {
+		const char *next = skipLine(p, end);
+		if (end - p >= 10 && std::strncmp(p, "end_header", 10) == 0) {
+			headerEnd = next;
+		}
+		p = next;
+	}
+	if (file.size < 4 || std::strncmp(file.data, "ply", 3) != 0 || headerEnd == nullptr) {
+		return false;
+	}
+	dataStart = headerEnd - file.data;
+
+	const uint16_t one = 1;
+	bool bigEndianHost = *(const unsigned char *)&one == 0;
+	std::istringstream header(std::string(file.data, headerEnd));
+	std::string line;
+	while (std::getline(header, line)) {
+		std::istringstream words(line);
+		std::string keyword;
+		words >> keyword;
+		if (keyword == "format") {
+			std::string format;
+			words >> format;
+			if (format == "binary_little_endian") {
+				swapBytes = bigEndianHost;
+			} else if (format == "binary_big_endian") {
+				swapBytes = !bigEndianHost;
+			} else {
+				return false;
+			}
+		} else if (keyword == "element") {
+			PlyElement element;
+			if (!(words >> element.name >> element.count)) {
+				return false;
+			}
+			elements.push_back(element);
+		} else if (keyword == "property") {
+			PlyProperty property;
+			std::string type;
+			words >> type;
+			property.isList = type == "list";
+			property.countType = PlyType::UINT8;
+			if (property.isList) {
+				std::string countType;
+				words >> countType >> type;
+				if (!parsePlyType(countType, property.countType)) {
+					return false;
+				}
+			}
+			if (!parsePlyType(type, property.type) || !(words >> property.name) || elements.empty()) {
+				return false;
+			}
+			elements.back().properties.push_back(property);
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	static bool readPlyVertices(const MappedFile &file, const PlyElement &element, bool swapBytes, size_t &offset, int numThreads, MeshData &mesh)
+ * @brief	Reads the positions, and normals if there are any, of the vertex element.
+ * 			Vertex records all have the same size, so the records are split evenly
+ * 			between the threads.
+ * @param 		  	file	  	The file.
+ * @param 		  	element   	The vertex element.
+ * @param 		  	swapBytes 	true if the file's byte order is not this machine's.
+ * @param [in,out]	offset	  	Offset of the first vertex, then of the byte after the vertices.
+ * @param 		  	numThreads	Number of threads.
+ * @param [in,out]	mesh	  	Receives the vertices.
+ * @return	False if there is no x, y or z, a property is a list, or the file is too short.
+ */
+
+static bool readPlyVertices(const MappedFile &file, const PlyElement &element, bool swapBytes,
+							size_t &offset, int numThreads, MeshData &mesh) {
+	const char *names[] = { "x", "y", "z", "nx", "ny", "nz" };
+	size_t offsets[6];
+	PlyType types[6];
+	bool found[6];
+	size_t stride = 0;
+	for (int i = 0; i < 6; i++) {
+		found[i] = false;
+	}
+	for (const PlyProperty &property : element.properties) {
+		if (property.isList) {
+			return false;
+		}
+		for (int i = 0; i < 6; i++) {
+			if (property.name == names[i]) {
+				offsets[i] = stride;
+				types[i] = property.type;
+				found[i] = true;
+			}
+		}
+		stride += plySize(property.type);
+	}
+	bool hasNormals = found[3] && found[4] && found[5];
+	if (!found[0] || !found[1] || !found[2] || element.count > (file.size - offset) / stride) {
+		return false;
+	}
+
+	mesh.vertices.resize(element.count);
+	mesh.normals.resize(hasNormals ? element.count : 0);
+	size_t perThread = (element.count + numThreads - 1) / numThreads;
+	parallelFor(numThreads, numThreads, [&](int t) {
+		size_t last = std::min(element.count, (t + 1) * perThread);
+		for (size_t i = t * perThread; i < last; i++) {
+			const char *record = file.data + offset + i * stride;
+			double v[6];
+			for (int k = 0; k < (hasNormals ? 6 : 3); k++) {
+				v[k] = readPlyValue(record + offsets[k], types[k], swapBytes);
+			}
+			mesh.vertices[i] = dvec3(v[0], v[1], v[2]);
+			if (hasNormals) {
+				mesh.normals[i] = dvec3(v[3], v[4], v[5]);
+			}
+		}
+	});
+	offset += element.count * stride;
+	return true;
+}
+
+/**
+ * @fn	static bool readPlyFaces(const MappedFile &file, const PlyElement &element, bool swapBytes, size_t &offset, int numThreads, MeshData &mesh)
+ * @brief	Reads the faces, splitting polygons into triangle fans. Face records can
+ * 			differ in size, but in most files every face is a triangle, so the records
+ * 			are first read in parallel as if that were so. If any face turns out not to
+ * 			be a triangle, the faces are read again one after the other.
+ * @param 		  	file	  	The file.
+ * @param 		  	element   	The face element.
+ * @param 		  	swapBytes 	true if the file's byte order is not this machine's.
+ * @param [in,out]	offset	  	Offset of the first face, then of the byte after the faces.
+ * @param 		  	numThreads	Number of threads.
+ * @param [in,out]	mesh	  	Receives the indices.
+ * @return	False if there is no vertex index list, a length or an index is not a
+ * 			valid count, or the file is too short.
+ */
+
+static bool readPlyFaces(const MappedFile &file, const PlyElement &element, bool swapBytes,
+							size_t &offset, int numThreads, MeshData &mesh) {
+	int list = element.find("vertex_indices");
+	if (list < 0) {
+		list = element.find("vertex_index");
+	}
+	if (list < 0) {
+		return false;
+	}
+	const PlyProperty &indexList = element.properties[list];
+
+	bool fixedSize = true;
+	size_t before = 0, after = 0;
+	for (int i = 0; i < (int)element.properties.size(); i++) {
+		const PlyProperty &property = element.properties[i];
+		if (i == list) {
+			continue;
+		} else if (property.isList) {
+			fixedSize = false;
+		} else {
+			(i < list ? before : after) += plySize(property.type);
+		}
+	}
+	size_t stride = before + plySize(indexList.countType) + 3 * plySize(indexList.type) + after;
+	if (fixedSize && element.count <= (file.size - offset) / stride) {
+		mesh.indices.resize(3 * element.count);
+		std::atomic<bool> allTriangles(true), validIndices(true);
+		size_t perThread = (element.count + numThreads - 1) / numThreads;
+		parallelFor(numThreads, numThreads, [&](int t) {
+			size_t last = std::min(element.count, (t + 1) * perThread);
+			for (size_t i = t * perThread; i < last && allTriangles && validIndices; i++) {
+				const char *record = file.data + offset + i * stride + before;
+				if (readPlyValue(record, indexList.countType, swapBytes) != 3.0) {
+					allTriangles = false;
+					break;
+				}
+				record += plySize(indexList.countType);
+				for (int k = 0; k < 3; k++) {
+					uint32_t index;
+					if (!readPlyCount(record + k * plySize(indexList.type), indexList.type, swapBytes, index)) {
+						validIndices = false;
+						break;
+					}
+					mesh.indices[3 * i + k] = index;
+				}
+			}
+		});
+		if (!validIndices) {
+			return false;
+		}
+		if (allTriangles) {
+			offset += element.count * stride;
+			return true;
+		}
+	}
+
+	mesh.indices.clear();
+	const char *p = file.data + offset;
+	const char *end = file.data + file.size;
+	for (size_t i = 0; i < element.count; i++) {
+		for (int j = 0; j < (int)element.properties.size(); j++) {
+			const PlyProperty &property = element.properties[j];
+			uint32_t n = 1;
+			if (property.isList) {
+				if (p + plySize(property.countType) > end ||
+					!readPlyCount(p, property.countType, swapBytes, n)) {
+					return false;
+				}
+				p += plySize(property.countType);
+			}
+			size_t size = plySize(property.type);
+			if (n > (size_t)(end - p) / size) {
+				return false;
+			}
+			if (j == list) {
+				for (size_t k = 1; k + 1 < n; k++) {
+					const size_t corners[3] = { 0, k, k + 1 };
+					for (size_t c : corners) {
+						uint32_t index;
+						if (!readPlyCount(p + c * size, property.type, swapBytes, index)) {
+							return false;
+						}
+						mesh.indices.push_back(index);
+					}
+				}
+			}
+			p += n * size;
+		}
+	}
+	offset = p - file.data;
+	return true;
+}
+
+/**
+ * @fn	static bool skipPlyElement(const MappedFile &file, const PlyElement &element, bool swapBytes, size_t &offset)
+ * @brief	Skips over the records of an element that is not needed.
+ * @param 		  	file	 	The file.
+ * @param 		  	element  	The element.
+ * @param 		  	swapBytes	true if the file's byte order is not this machine's.
+ * @param [in,out]	offset   	Offset of the first record, then of the byte after the element.
+ * @return	False if a list length is not a valid count, or the file is too short.
+ */
+
+static bool skipPlyElement(const MappedFile &file, const PlyElement &element, bool swapBytes, size_t &offset) {
+	for (size_t i = 0; i < element.count; i++) {
+		for (const PlyProperty &property : element.properties) {
+			uint32_t n = 1;
+			if (property.isList) {
+				if (offset + plySize(property.countType) > file.size ||
+					!readPlyCount(file.data + offset, property.countType, swapBytes, n)) {
+					return false;
+				}
+				offset += plySize(property.countType);
+			}
+			offset += n * plySize(property.type);
+			if (offset > file.size) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	bool loadPLY(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads)
+ * @brief	Loads the triangles of a binary PLY file, in either byte order. The file is
+ * 			mapped into memory, and the vertex and face records are decoded in
+ * 			parallel. Vertex normals are kept if the vertices have nx, ny and nz.
+ * @param 		  	fileName  	Name of the file.
+ * @param [in,out]	mesh	  	The triangles.
+ * @param [in,out]	stats	  	How long loading took.
+ * @param 		  	numThreads	Number of threads, 0 for one per hardware thread.
+ * @return	False if the file could not be read or is not a valid binary PLY file.
+ */
+
+bool loadPLY(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads) {
+	auto start = std::chrono::steady_clock::now();
+	MappedFile file;
+	if (!file.open(fileName)) {
+		std::cerr << "Cannot open PLY file: " << fileName << endl;
+		return false;
+	}
+	stats = MeshLoadStats();
+	stats.bytes = file.size;
+	stats.threads = workerCount(numThreads);
+	stats.mapSecs = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	vector<PlyElement> elements;
+	bool swapBytes = false;
+	size_t offset = 0;
+	if (!readPlyHeader(file, elements, swapBytes, offset)) {
+		std::cerr << "Problem with PLY file: " << fileName << "(not a binary PLY header)" << endl;
+		return false;
+	}
+	mesh = MeshData();
+	for (const PlyElement &element : elements) {
+		bool ok;
+		if (element.name == "vertex") {
+			ok = readPlyVertices(file, element, swapBytes, offset, stats.threads, mesh);
+		} else if (element.name == "face") {
+			ok = readPlyFaces(file, element, swapBytes, offset, stats.threads, mesh);
+		} else {
+			ok = skipPlyElement(file, element, swapBytes, offset);
+		}
+		if (!ok) {
+			std::cerr << "Problem with PLY file: " << fileName << "(" << element.name << ")" << endl;
+			return false;
+		}
+	}
+	stats.parseSecs = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned int index : mesh.indices) {
+		if (index >= mesh.vertices.size()) {
+			std::cerr << "Problem with PLY file: " << fileName << "(face index out of range)" << endl;
+			return false;
+		}
+	}
+	stats.mergeSecs = secondsSince(start);
+	return true;
+}
+
+/**
+ * @fn	bool loadMesh(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads)
+ * @brief	Loads an OBJ or binary PLY file, chosen by the file's extension.
+ * @param 		  	fileName  	Name of the file.
+ * @param [in,out]	mesh	  	The triangles.
+ * @param [in,out]	stats	  	How long loading took.
+ * @param 		  	numThreads	Number of threads, 0 for one per hardware thread.
+ * @return	False if the file could not be loaded.
+ */
+
+bool loadMesh(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads) {
+	std::string extension = fileName.substr(std::min(fileName.size(), fileName.rfind('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == ".obj") {
+		return loadOBJ(fileName, mesh, stats, numThreads);
+	} else if (extension == ".ply") {
+		return loadPLY(fileName, mesh, stats, numThreads);
+	}
+	std::cerr << "Unknown mesh file type: " << fileName << endl;
+	return false;
+}
+
+/**
+ * @fn	vector<VertexData> MeshData::toEShapeData(const Material &mat) const
+ * @brief	Expands the mesh into a triangle soup (EShapeData), three vertices per
+ * 			triangle. Triangles get their face normal if the mesh has no normals.
+ * @param	mat	Material of every vertex.
+ * @return	The triangles.
+ */
+
+vector<VertexData> MeshData::toEShapeData(const Material &mat) const {
+	vector<VertexData> result;
+	result.reserve(indices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		dvec4 A(vertices[indices[i]], 1.0);
+		dvec4 B(vertices[indices[i + 1]], 1.0);
+		dvec4 C(vertices[indices[i + 2]], 1.0);
+		if (normals.empty()) {
+			VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
+		} else {
+			result.push_back(VertexData(A, normals[indices[i]], mat));
+			result.push_back(VertexData(B, normals[indices[i + 1]], mat));
+			result.push_back(VertexData(C, normals[indices[i + 2]], mat));
+		}
+	}
+	return result;
+}
+
+/**
+ * @fn	ostream& operator << (ostream& os, const MeshLoadStats& stats)
+ * @brief	Prints the size of the file, the time of each stage and the throughput.
+ * @param	os   	The output stream.
+ * @param	stats	The statistics.
+ * @return	The output stream.
+ */
+
+ostream& operator << (ostream& os, const MeshLoadStats& stats) {
+	os << stats.bytes / 1.0E6 << " MB with " << stats.threads << " threads: map "
+		<< stats.mapSecs << " sec, parse " << stats.parseSecs << " sec, merge "
+		<< stats.mergeSecs << " sec, " << stats.megabytesPerSecond() << " MB/sec";
+	return os;
+}
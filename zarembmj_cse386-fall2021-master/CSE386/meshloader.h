@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include "defs.h"
+#include "vertexdata.h"
+
+/**
+ * @struct	MeshData
+ * @brief	Triangles read from a mesh file, in the layout ITriangleMesh takes: one
+ * 			shared vertex buffer and three indices per triangle.
+ */
+
+struct MeshData {
+	vector<dvec3> vertices;			//!< shared vertex buffer
+	vector<dvec3> normals;			//!< one normal per vertex, or empty if the file had none
+	vector<unsigned int> indices;	//!< three vertex indices per triangle
+	int numTriangles() const { return (int)indices.size() / 3; }
+	vector<VertexData> toEShapeData(const Material &mat) const;
+};
+
+/**
+ * @struct	MeshLoadStats
+ * @brief	How long each stage of loading a mesh file took.
+ */
+
+struct MeshLoadStats {
+	size_t bytes = 0;			//!< size of the file
+	int threads = 0;			//!< number of threads that parsed the file
+	double mapSecs = 0.0;		//!< time to open and map the file
+	double parseSecs = 0.0;		//!< time to parse the file's chunks, including reading it from disk
+	double mergeSecs = 0.0;		//!< time to join the chunks into one set of buffers
+	double totalSecs() const { return mapSecs + parseSecs + mergeSecs; }
+	double megabytesPerSecond() const { return bytes / totalSecs() / 1.0E6; }
+};
+
+bool loadMesh(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads = 0);
+bool loadOBJ(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads = 0);
+bool loadPLY(const std::string &fileName, MeshData &mesh, MeshLoadStats &stats, int numThreads = 0);
+
+ostream& operator << (ostream& os, const MeshLoadStats& stats);
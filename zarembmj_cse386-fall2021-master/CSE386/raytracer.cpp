@@ -6,202 +6,568 @@
  * of this material is prohibited unless prior written
  * permission is granted.
  ****************************************************/
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 #include "raytracer.h"
 #include "ishape.h"
 #include "io.h"
 
  /**
-  * @fn	RayTracer::RayTracer(const color &defa)
+  * @fn	RayTracer::RayTracer(const color &defa, int threads, int tile)
   * @brief	Constructs a raytracers.
   * @param	defa	The clear color.
+  * @param	threads	The number of worker threads. 0 means one per hardware thread.
+  * @param	tile	The width and height of the tiles handed to the worker threads.
   */
 
-RayTracer::RayTracer(const color& defa)
-	: defaultColor(defa) {
+RayTracer::RayTracer(const color& defa, int threads, int tile)
+	: defaultColor(defa), numThreads(threads), tileSize(tile), usePackets(true),
+	minRayWeight(DEFAULT_MIN_RAY_WEIGHT), russianRoulette(false), cullLights(true) {
 }
 
-color RayTracer::traceRay(const IScene& theScene, const PositionalLight& Light,
-	const Ray& ray, int depth) const {
+/**
+ * @fn	color RayTracer::traceRay(const IScene &theScene, const Ray &ray, int depth, const vector<int> *lights) const
+ * @brief	Traces a camera ray into the scene and shades the closest hit.
+ * @param	theScene	The scene.
+ * @param	ray			The ray.
+ * @param	depth		The number of reflection/refraction bounces left.
+ * @param	lights		As in shadeHit.
+ * @return	The sum of the colors produced by each light.
+ */
 
+color RayTracer::traceRay(const IScene& theScene, const Ray& ray, int depth, const vector<int> *lights) const {
 	HitRecord hit;
+	theScene.findIntersection(ray, hit, CAMERA_RAYS);
+	return shadeHit(theScene, ray, hit, depth, nullptr, lights);
+}
 
-	HitRecord hitO;
-	VisibleIShape::findIntersection(ray, theScene.opaqueObjs, hitO);
-
-	HitRecord hitT;
-	VisibleIShape::findIntersection(ray, theScene.transparentObjs, hitT);
+/**
+ * @fn	static int countLightsOn(const IScene &theScene)
+ * @brief	Counts the positional and spot lights that are on.
+ * @param	theScene	The scene.
+ * @return	The number of lights that are on.
+ */
 
-	if (hitT.t < hitO.t) {
-		hit = hitT;
+static int countLightsOn(const IScene& theScene) {
+	int numLights = 0;
+	for (size_t k = 0; k < theScene.Plights.size(); k++) {
+		numLights += theScene.Plights[k]->isOn ? 1 : 0;
 	}
-	else {
-		hit = hitO;
+	for (size_t k = 0; k < theScene.Slights.size(); k++) {
+		numLights += theScene.Slights[k]->isOn ? 1 : 0;
 	}
+	return numLights;
+}
 
-	if (hit.t != FLT_MAX) {
-
-		// add a small offset to point of intersection for numerical stability
-		dvec3 Po = IShape::movePointOffSurface(hit.interceptPt, hit.normal);
-
-		Frame frm = theScene.camera->getFrame();
-		double sha = inShadow(Light.actualPosition(frm), Po, hit.normal, theScene.opaqueObjs, theScene.transparentObjs);
-		color finalColor = Light.illuminate(hit.interceptPt, hit.normal, hit.material, frm, sha);
+/**
+ * @fn	static unsigned int seedFromRay(const Ray &ray)
+ * @brief	Hashes a ray into a seed for Russian roulette, so that a ray makes the same
+ * 			random choices no matter which thread traces it.
+ * @param	ray	The ray.
+ * @return	A non-zero seed.
+ */
 
-		if ((hit.texture != nullptr) &&
-			(hit.texture->H != 0) &&
-			(hit.texture->W != 0)) {
-			color texColor = hit.texture->getPixelUV(hit.u, hit.v);
-			finalColor = (finalColor + texColor) * 0.5;
-		}
+static unsigned int seedFromRay(const Ray& ray) {
+	const double values[] = { ray.origin.x, ray.origin.y, ray.origin.z,
+								ray.dir.x, ray.dir.y, ray.dir.z };
+	const unsigned char* bytes = (const unsigned char*)values;
+	unsigned int h = 2166136261u;
+	for (size_t i = 0; i < sizeof(values); i++) {
+		h = (h ^ bytes[i]) * 16777619u;
+	}
+	return h | 1;
+}
 
-		if (depth > 0) {
-			// Viewing direction for specular
-			dvec3 inci = glm::normalize(ray.dir);
-			dvec3 R = inci - 2.0f * glm::dot(hit.normal, inci) * hit.normal;
-			dvec3 RR = glm::normalize(R);
+/**
+ * @fn	color RayTracer::shadeHit(const IScene &theScene, const Ray &ray, const HitRecord &hit, int depth, const double *shadows, const vector<int> *lights) const
+ * @brief	Computes the color seen along a ray whose closest hit is already known. The
+ * 			tree of reflected and refracted rays below the hit is walked with an explicit
+ * 			stack. Each ray carries its weight in the final color, so a surface's own
+ * 			shading is added as soon as it is found. Refraction rays are only spawned by
+ * 			surfaces with alpha < 1, reflection rays only by surfaces with reflectivity > 0,
+ * 			and rays whose weight falls below minRayWeight are dropped (or, with
+ * 			russianRoulette, randomly kept at a higher weight). Each light contributes a
+ * 			fully shaded sample, so the background and texture colors are weighted by the
+ * 			number of active lights. A ray that passes through a transparent surface
+ * 			keeps going in the same direction, so rather than spawning a new ray for
+ * 			each layer, the layers behind the first transparent surface are found with
+ * 			one multi-hit query along the ray and composited front to back from that
+ * 			list. A new ray is only spawned if there are more layers than the list holds.
+ * 			Each ray only sees the objects visible to its kind (see
+ * 			VisibleIShape::visibility); the layers are those visible to refraction rays.
+ * 			Hits along the camera ray itself are shaded with only the given lights,
+ * 			while those of reflected and refracted rays are shaded with every light.
+ * @param	theScene	The scene.
+ * @param	ray			The camera ray.
+ * @param	hit			The closest hit along the ray, or t == FLT_MAX for none.
+ * @param	depth		The number of reflection/refraction bounces left.
+ * @param	shadows		The shadow at hit from each of lights, as found by findShadows,
+ * 						or nullptr to trace the shadow rays here.
+ * @param	lights		The lights that can reach what the camera ray hits (see
+ * 						LightCuller), or nullptr for every light that is on.
+ * @return	The sum of the colors produced by each light.
+ */
 
-			color colReflection = traceRay(theScene, Light, Ray(Po, RR), depth - 1);
+color RayTracer::shadeHit(const IScene& theScene, const Ray& ray, const HitRecord& hit, int depth,
+							const double *shadows, const vector<int> *lights) const {
+	int numLights = countLightsOn(theScene);
+	unsigned int rngState = russianRoulette ? seedFromRay(ray) : 0;
+	color finalColor = black;
+	vector<RayTreeNode> pending;
+
+	RayTreeNode node(ray, 1.0, depth, CAMERA_RAYS);
+	HitRecord nodeHit = hit;
+	const double *nodeShadows = shadows;	// only known for the first hit
+	const vector<int> *nodeLights = lights;	// only known for hits along the camera ray
+	RayHits layers;			// hits along node.ray, found when it first meets a transparent surface
+	int nextLayer = -1;		// the layer behind nodeHit, or -1 if layers has not been found
+	while (true) {
+		if (nodeHit.t == FLT_MAX) {
+			finalColor += node.weight * (double)numLights * this->defaultColor;
+		} else if (node.depth == 0) {
+			finalColor += node.weight * shadeLocal(theScene, nodeHit, numLights, nodeShadows, nodeLights);
+		} else {
+			const Material& mat = nodeHit.material;
+			double localWeight = node.weight * mat.alpha * (1.0 - mat.reflectivity);
+			if (localWeight > 0.0) {
+				finalColor += localWeight * shadeLocal(theScene, nodeHit, numLights, nodeShadows, nodeLights);
+			}
 
-			dvec3 Pr = IShape::movePointOffSurface(hit.interceptPt, -hit.normal);
-			color colRefraction = traceRay(theScene, Light, Ray(Pr, ray.dir), depth - 1);
+			double reflectionWeight = node.weight * mat.alpha * mat.reflectivity;
+			if (mat.reflectivity > 0.0 && keepRay(reflectionWeight, rngState)) {
+				dvec3 Po = IShape::movePointOffSurface(nodeHit.interceptPt, nodeHit.normal);
+				dvec3 inci = glm::normalize(node.ray.dir);
+				dvec3 R = inci - 2.0f * glm::dot(nodeHit.normal, inci) * nodeHit.normal;
+				pending.push_back(RayTreeNode(Ray(Po, glm::normalize(R)), reflectionWeight, node.depth - 1,
+												REFLECTION_RAYS));
+			}
 
-			double refractionFactor = 0.1;
-			finalColor = hit.material.alpha *
-				((1.0f - refractionFactor) * finalColor +
-					refractionFactor * colReflection) +
-					(1.0f - hit.material.alpha) * colRefraction;
+			double refractionWeight = node.weight * (1.0 - mat.alpha);
+			if (mat.alpha < 1.0 && keepRay(refractionWeight, rngState)) {
+				if (nextLayer < 0) {
+					layers = RayHits(MAX_RAY_HITS, nodeHit.t);
+					theScene.findHits(node.ray, layers, REFRACTION_RAYS);
+					nextLayer = 0;
+				}
+				if (nextLayer < layers.count || layers.isComplete()) {
+					// Go on along the same ray to the next layer, or out of the scene
+					node = RayTreeNode(node.ray, refractionWeight, node.depth - 1, REFRACTION_RAYS);
+					nodeHit = HitRecord();
+					nodeShadows = nullptr;
+					if (nextLayer < layers.count) {
+						layers.getHit(node.ray, nextLayer++, nodeHit);
+					}
+					continue;
+				}
+				dvec3 Pr = IShape::movePointOffSurface(nodeHit.interceptPt, -nodeHit.normal);
+				pending.push_back(RayTreeNode(Ray(Pr, node.ray.dir), refractionWeight, node.depth - 1,
+												REFRACTION_RAYS));
+			}
 		}
 
-		return finalColor;
+		if (pending.empty()) {
+			break;
+		}
+		node = pending.back();
+		pending.pop_back();
+		nextLayer = -1;
+		nodeHit = HitRecord();
+		nodeShadows = nullptr;
+		nodeLights = nullptr;
+		theScene.findIntersection(node.ray, nodeHit, node.type);
 	}
-
-	return this->defaultColor;
+	return finalColor;
 }
 
-color RayTracer::traceRay(const IScene& theScene, const SpotLight& Light,
-	const Ray& ray, int depth) const {
+/**
+ * @fn	bool RayTracer::keepRay(double &weight, unsigned int &rngState) const
+ * @brief	Decides whether a secondary ray is worth tracing. Rays of at least minRayWeight
+ * 			always are. Lighter rays are dropped or, with Russian roulette, survive with
+ * 			probability weight / minRayWeight and have their weight raised to
+ * 			minRayWeight, which keeps the expected color unchanged.
+ * @param	weight  	[in,out] The ray's weight.
+ * @param	rngState	[in,out] State of the random number generator used by Russian roulette.
+ * @return	True if the ray should be traced.
+ */
 
-	HitRecord hit;
+bool RayTracer::keepRay(double& weight, unsigned int& rngState) const {
+	if (weight >= minRayWeight) {
+		return true;
+	}
+	if (!russianRoulette || weight <= 0.0) {
+		return false;
+	}
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	double u = (rngState >> 8) * (1.0 / 16777216.0);
+	if (u * minRayWeight >= weight) {
+		return false;
+	}
+	weight = minRayWeight;
+	return true;
+}
 
-	HitRecord hitO;
-	VisibleIShape::findIntersection(ray, theScene.opaqueObjs, hitO);
+/**
+ * @fn	color RayTracer::shadeLocal(const IScene &theScene, const HitRecord &hit, int numLights, const double *shadows, const vector<int> *lights) const
+ * @brief	Shades a hit with every light that is on, without following any secondary rays.
+ * 			A light that is not linked to the hit's object (see
+ * 			PositionalLight::illuminates) adds nothing and traces no shadow ray.
+ * @param	theScene 	The scene.
+ * @param	hit		 	The hit.
+ * @param	numLights	The number of lights that are on, linked or not.
+ * @param	shadows  	The shadow from each of lights, or nullptr to trace the shadow
+ * 						rays here.
+ * @param	lights   	The lights, indexed as in IScene::inShadow, that can reach the
+ * 						hit, or nullptr for every light that is on. Any other light
+ * 						must add nothing to it.
+ * @return	The sum of the colors produced by each light, blended with the hit's texture.
+ */
 
-	HitRecord hitT;
-	VisibleIShape::findIntersection(ray, theScene.transparentObjs, hitT);
+color RayTracer::shadeLocal(const IScene& theScene, const HitRecord& hit, int numLights,
+							const double *shadows, const vector<int> *lights) const {
+	const vector<PositionalLightPtr>& pLights = theScene.Plights;
+	const vector<SpotLightPtr>& sLights = theScene.Slights;
 
-	if (hitT.t < hitO.t) {
-		hit = hitT;
-	}
-	else {
-		hit = hitO;
+	// add a small offset to point of intersection for numerical stability
+	dvec3 Po = IShape::movePointOffSurface(hit.interceptPt, hit.normal);
+
+	Frame frm = theScene.camera->getFrame();
+	color finalColor = black;
+	int count = lights != nullptr ? (int)lights->size() : (int)(pLights.size() + sLights.size());
+
+	for (int i = 0; i < count; i++) {
+		int light = lights != nullptr ? (*lights)[i] : i;
+		const SpotLight* spot = light >= (int)pLights.size() ? sLights[light - pLights.size()] : nullptr;
+		const PositionalLight* Light = spot != nullptr ? spot : pLights[light];
+		if (Light->isOn && Light->illuminates(hit.object)) {
+			double sha = shadows != nullptr ? shadows[i] :
+						theScene.inShadow(Light->actualPosition(frm), Po, hit.normal, light);
+			if (spot != nullptr) {
+				finalColor += spot->illuminate(hit.interceptPt, hit.normal, hit.material, frm, sha);
+			} else {
+				finalColor += Light->illuminate(hit.interceptPt, hit.normal, hit.material, frm, sha);
+			}
+		}
 	}
 
-	if (hit.t != FLT_MAX) {
-
-		// add a small offset to point of intersection for numerical stability
-		dvec3 Po = IShape::movePointOffSurface(hit.interceptPt, hit.normal);
+	if ((hit.texture != nullptr) &&
+		(hit.texture->H != 0) &&
+		(hit.texture->W != 0)) {
+		color texColor = hit.texture->getPixelUV(hit.u, hit.v);
+		finalColor = (finalColor + (double)numLights * texColor) * 0.5;
+	}
+	return finalColor;
+}
 
-		Frame frm = theScene.camera->getFrame();
-		double sha = inShadow(Light.actualPosition(frm), Po, hit.normal, theScene.opaqueObjs, theScene.transparentObjs);
-		color finalColor = Light.illuminate(hit.interceptPt, hit.normal, hit.material, frm, sha);
+/**
+ * @fn	void RayTracer::findShadows(const IScene &theScene, const HitRecord hits[PACKET_SIZE], const vector<int> &lights, vector<double> &shadows) const
+ * @brief	Finds the shadow at each hit of a packet of primary rays, one light at a
+ * 			time. The shadow rays toward one positional or spot light converge on it, so
+ * 			they are traced together as a packet (see IScene::inShadow) rather than one
+ * 			by one in shadeLocal.
+ * @param 		  	theScene	The scene.
+ * @param 		  	hits		PACKET_SIZE hits.
+ * @param 		  	lights  	The lights to find the shadows of, indexed as in
+ * 								IScene::inShadow.
+ * @param [in,out]	shadows 	The shadow at hit k from lights[i] is put in
+ * 								shadows[k * lights.size() + i].
+ */
 
-		if ( (hit.texture != nullptr) && 
-			(hit.texture->H != 0) &&
-			(hit.texture->W != 0)) {
-			color texColor = hit.texture->getPixelUV(hit.u, hit.v);
-			finalColor = (finalColor + texColor) * 0.5;
+void RayTracer::findShadows(const IScene& theScene, const HitRecord hits[PACKET_SIZE], const vector<int>& lights,
+							vector<double>& shadows) const {
+	Frame frm = theScene.camera->getFrame();
+	size_t numLights = lights.size();
+	shadows.resize(PACKET_SIZE * numLights);
+	for (size_t i = 0; i < numLights; i++) {
+		double sha[PACKET_SIZE];
+		theScene.inShadow(theScene.getLight(lights[i])->actualPosition(frm), hits, sha, lights[i]);
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			shadows[k * numLights + i] = sha[k];
 		}
+	}
+}
 
-		if (depth > 0) {
-			// View direction for specular
-			dvec3 inci = glm::normalize(ray.dir);
-			dvec3 R = inci - 2.0f * glm::dot(hit.normal, inci) * hit.normal;
-			dvec3 RR = glm::normalize(R);
-
-			color colReflection = traceRay(theScene, Light, Ray(Po, RR), depth - 1);
+/**
+ * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, IScene &theScene) const
+ * @brief	Raytrace scene. The scene's accelerator is brought up to date first, since
+ * 			objects may have moved since the last frame. The framebuffer is then split into tiles, which
+ * 			are rendered by numThreads worker threads. Every tile is computed
+ * 			independently of the others, so the image does not depend on the number
+ * 			of threads. The worker threads' occluder cache counters are added up in
+ * 			theScene.occluderCacheStats. With cullLights, the lights that can reach each
+ * 			tile are found before it is rendered (see LightCuller), and only those are
+ * 			shaded and shadow tested at the hits of its camera rays.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	depth	   	The current depth of recursion.
+ * @param 		  	theScene   	The scene.
+ */
 
-			dvec3 Pr = IShape::movePointOffSurface(hit.interceptPt, -hit.normal);
-			color colRefraction = traceRay(theScene, Light, Ray(Pr, ray.dir), depth - 1);
+void RayTracer::raytraceScene(FrameBuffer & frameBuffer, int depth,
+	IScene & theScene) const {
+
+	theScene.buildAccelerator();
+
+	int workers = numThreads > 0 ? numThreads : (int)std::thread::hardware_concurrency();
+	workers = std::max(workers, 1);
+
+	TileScheduler scheduler(frameBuffer.getWindowWidth(), frameBuffer.getWindowHeight(),
+							tileSize, workers);
+	std::atomic<int> tilesDone(0);
+	std::atomic<long long> samplesTraced(0);
+	std::mutex progressLock;
+	OccluderCacheStats cacheStats;
+	LightCuller culler;
+	culler.setup(theScene);
+	std::atomic<long long> tileLights(0);
+
+	auto worker = [&](int id) {
+		IScene::takeOccluderCacheStats();		// drop whatever this thread counted before
+		BoundingBoxi tile(0, 0, 0, 0);
+		vector<int> lights;
+		while (scheduler.nextTile(id, tile)) {
+			if (cullLights) {
+				culler.cull(*theScene.camera, tile, lights);
+			} else {
+				lights = culler.lightsOn();
+			}
+			tileLights += lights.size();
+			if (theScene.adaptiveAntiAliasing) {
+				samplesTraced += raytraceTileAdaptive(frameBuffer, tile, depth, theScene, lights);
+			} else {
+				samplesTraced += raytraceTile(frameBuffer, tile, depth, theScene, lights);
+			}
 
-			double refractionFactor = 0.1;
-			finalColor = hit.material.alpha *
-				((1.0f - refractionFactor) * finalColor +
-					refractionFactor * colReflection) +
-					(1.0f - hit.material.alpha) * colRefraction;
+			// Report progress every time another 10% of the tiles is finished
+			int N = scheduler.numTiles();
+			int done = ++tilesDone;
+			if ((done * 10) / N != ((done - 1) * 10) / N) {
+				std::lock_guard<std::mutex> guard(progressLock);
+				cout << "Progress " << (done * 100.0) / N << "%. \n";
+			}
+		}
+		std::lock_guard<std::mutex> guard(progressLock);
+		cacheStats.add(IScene::takeOccluderCacheStats());
+	};
+
+	if (workers == 1) {
+		worker(0);
+	} else {
+		vector<std::thread> threads;
+		for (int i = 0; i < workers; i++) {
+			threads.push_back(std::thread(worker, i));
 		}
+		for (std::thread& t : threads) {
+			t.join();
+		}
+	}
 
-		return finalColor;
+	if (theScene.adaptiveAntiAliasing) {
+		double numPixels = (double)frameBuffer.getWindowWidth() * frameBuffer.getWindowHeight();
+		cout << "Average samples per pixel: " << samplesTraced / numPixels << endl;
+	}
+	theScene.occluderCacheStats = cacheStats;
+	if (cacheStats.lookups > 0) {
+		cout << "Occluder cache hit rate: " << 100.0 * cacheStats.hitRate() << "% of "
+			<< cacheStats.lookups << " shadow rays" << endl;
+	}
+	if (cullLights && culler.lightsOn().size() > 1) {
+		cout << "Lights per tile: " << (double)tileLights / scheduler.numTiles() << " of "
+			<< culler.lightsOn().size() << endl;
 	}
 
-	return this->defaultColor;
+	frameBuffer.showColorBuffer();
 }
 
 /**
- * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene) const
- * @brief	Raytrace scene
+ * @fn	int RayTracer::raytraceTile(FrameBuffer &frameBuffer, const BoundingBoxi &tile, int depth, const IScene &theScene, const vector<int> &lights) const
+ * @brief	Raytrace the pixels inside one tile of the framebuffer, using a regular
+ * 			antiAliasing x antiAliasing grid of samples in every pixel. When usePackets
+ * 			is set, each row is traced PACKET_SIZE pixels at a time: the primary rays
+ * 			for the same sample position in neighboring pixels form a packet, and so do
+ * 			the shadow rays from their hits toward each light. Whatever is left over at
+ * 			the end of a row is traced one ray at a time.
  * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	tile	   	The pixels to render.
  * @param 		  	depth	   	The current depth of recursion.
  * @param 		  	theScene   	The scene.
+ * @param 		  	lights	   	The lights that can reach what the tile's camera rays hit.
+ * @return	The number of primary rays traced.
  */
 
-void RayTracer::raytraceScene(FrameBuffer & frameBuffer, int depth,
-	const IScene & theScene) const {
+int RayTracer::raytraceTile(FrameBuffer& frameBuffer, const BoundingBoxi& tile, int depth,
+	const IScene& theScene, const vector<int>& lights) const {
 
 	const RaytracingCamera& camera = *theScene.camera;
-	const vector<VisibleIShapePtr>& objs = theScene.opaqueObjs;
+	int antiAliasing = theScene.antiAliasing;
+	size_t numLights = lights.size();
+	vector<Ray> rays;
+	rays.reserve(PACKET_SIZE);
+	vector<double> shadows;
+
+	for (int y = tile.ly; y < tile.ly + tile.height; ++y) {
+		for (int x0 = tile.lx; x0 < tile.lx + tile.width; x0 += PACKET_SIZE) {
+
+			int numPixels = std::min(PACKET_SIZE, tile.lx + tile.width - x0);
+			bool packet = usePackets && numPixels == PACKET_SIZE;
+			color finalColor[PACKET_SIZE];
+			for (int k = 0; k < numPixels; k++) {
+				finalColor[k] = dvec3(0, 0, 0);
+			}
 
-	const vector<PositionalLightPtr>& pLights = theScene.Plights;
-	const vector<SpotLightPtr>& sLights = theScene.Slights;
+			// One primary ray per sample; each is shaded with the tile's lights
+			for (int i = 0; i < antiAliasing; i++) {
+				for (int j = 0; j < antiAliasing; j++) {
 
-	for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
+					rays.clear();
+					for (int k = 0; k < numPixels; k++) {
+						rays.push_back(camera.getRay(x0 + k + (i / (antiAliasing * 1.0)), y + (j / (antiAliasing * 1.0))));
+					}
 
-		cout << "Progress " << (y * 100.0) / frameBuffer.getWindowHeight() << "%. \n";
+					if (packet) {
+						HitRecord hits[PACKET_SIZE];
+						theScene.findIntersections(rays.data(), hits, CAMERA_RAYS);
+						findShadows(theScene, hits, lights, shadows);
+						for (int k = 0; k < numPixels; k++) {
+							finalColor[k] = finalColor[k] + shadeHit(theScene, rays[k], hits[k], depth,
+																		shadows.data() + k * numLights, &lights);
+						}
+					} else {
+						for (int k = 0; k < numPixels; k++) {
+							finalColor[k] = finalColor[k] + traceRay(theScene, rays[k], depth, &lights);
+						}
+					}
+				}
+			}
 
-		for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
+            // Set alias scale and compute final pixel color
+			double aliasScale = antiAliasing * antiAliasing;
+			for (int k = 0; k < numPixels; k++) {
+				frameBuffer.setColor(x0 + k, y, finalColor[k] / aliasScale);
+			}
 
-			color finalColor = dvec3(0, 0, 0);
+			//			frameBuffer.showAxes(x, y, camera.getRay(x,y), 0.25);			// Displays R/x, G/y, B/z axes
+		}
+	}
+	return tile.width * tile.height * antiAliasing * antiAliasing;
+}
 
-			int antiAliasing = theScene.antiAliasing;
+/**
+ * @fn	int RayTracer::raytraceTileAdaptive(FrameBuffer &frameBuffer, const BoundingBoxi &tile, int depth, const IScene &theScene, const vector<int> &lights) const
+ * @brief	Raytrace the pixels inside one tile of the framebuffer with adaptive
+ * 			anti-aliasing. Every pixel first gets AA_SAMPLES_PER_PASS samples, placed
+ * 			by theScene.samplePattern. A pixel is then refined if its samples are noisy
+ * 			or its color differs from a neighbor's (within the tile) by more than
+ * 			theScene.aaThreshold in some channel. Refined pixels keep getting samples,
+ * 			AA_SAMPLES_PER_PASS at a time, until they are no longer noisy or
+ * 			theScene.maxSamples is reached. The samples of one pass over a pixel, and
+ * 			their shadow rays toward each light, are traced as packets when usePackets
+ * 			is set.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	tile	   	The pixels to render.
+ * @param 		  	depth	   	The current depth of recursion.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	lights	   	The lights that can reach what the tile's camera rays hit.
+ * @return	The number of primary rays traced.
+ */
 
-			// Calculate positional light
-			for (int k = 0; k < pLights.size(); k++) {
-				if (pLights[k]->isOn) {
-					for (int i = 0; i < antiAliasing; i++) {
-						for (int j = 0; j < antiAliasing; j++) {
+int RayTracer::raytraceTileAdaptive(FrameBuffer& frameBuffer, const BoundingBoxi& tile, int depth,
+	const IScene& theScene, const vector<int>& lights) const {
 
-							Ray ray = camera.getRay(x + (i / (antiAliasing * 1.0)), y + (j / (antiAliasing * 1.0)));
-							color col = traceRay(theScene, *pLights[k], ray, depth);
-							finalColor = finalColor + col;
-						}
-					}
-				}
+	const RaytracingCamera& camera = *theScene.camera;
+	int maxSamples = std::max(theScene.maxSamples, 1);
+	double threshold = theScene.aaThreshold;
+	vector<PixelStats> stats(tile.width * tile.height);
+	size_t numLights = lights.size();
+	vector<Ray> rays;
+	rays.reserve(AA_SAMPLES_PER_PASS);
+	vector<double> shadows;
+	int samplesTraced = 0;
+
+	auto addSamples = [&](int px, int py) {
+		PixelStats& ps = stats[py * tile.width + px];
+		int x = tile.lx + px;
+		int y = tile.ly + py;
+		int n = std::min(AA_SAMPLES_PER_PASS, maxSamples - ps.count);
+		rays.clear();
+		for (int k = 0; k < n; k++) {
+			dvec2 offset = pixelSample(theScene.samplePattern, x, y, ps.count + k);
+			rays.push_back(camera.getRay(x + offset.x, y + offset.y));
+		}
+		if (usePackets && n == PACKET_SIZE) {
+			HitRecord hits[PACKET_SIZE];
+			theScene.findIntersections(rays.data(), hits, CAMERA_RAYS);
+			findShadows(theScene, hits, lights, shadows);
+			for (int k = 0; k < n; k++) {
+				ps.add(shadeHit(theScene, rays[k], hits[k], depth, shadows.data() + k * numLights, &lights));
 			}
+		} else {
+			for (int k = 0; k < n; k++) {
+				ps.add(traceRay(theScene, rays[k], depth, &lights));
+			}
+		}
+		samplesTraced += n;
+	};
 
-			// Calculate spotlight
-			for (int k = 0; k < sLights.size(); k++) {
-				if (sLights[k]->isOn) {
-					for (int i = 0; i < antiAliasing; i++) {
-						for (int j = 0; j < antiAliasing; j++) {
+	for (int py = 0; py < tile.height; py++) {
+		for (int px = 0; px < tile.width; px++) {
+			addSamples(px, py);
+		}
+	}
 
-							Ray ray = camera.getRay(x + (i / (antiAliasing * 1.0)), y + (j / (antiAliasing * 1.0)));
+	// Decide which pixels to refine before any of them change
+	vector<bool> refine(stats.size());
+	for (int py = 0; py < tile.height; py++) {
+		for (int px = 0; px < tile.width; px++) {
+			const PixelStats& ps = stats[py * tile.width + px];
+			bool needsMore = ps.noise() > threshold;
+			const int neighbors[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+			for (int i = 0; i < 4 && !needsMore; i++) {
+				int nx = px + neighbors[i][0];
+				int ny = py + neighbors[i][1];
+				if (nx >= 0 && nx < tile.width && ny >= 0 && ny < tile.height) {
+					dvec3 diff = glm::abs(ps.mean() - stats[ny * tile.width + nx].mean());
+					needsMore = std::max(diff.x, std::max(diff.y, diff.z)) > threshold;
+				}
+			}
+			refine[py * tile.width + px] = needsMore;
+		}
+	}
 
-							color col = traceRay(theScene, *sLights[k], ray, depth);
-							finalColor = finalColor + col;
-						}
+	for (int py = 0; py < tile.height; py++) {
+		for (int px = 0; px < tile.width; px++) {
+			PixelStats& ps = stats[py * tile.width + px];
+			if (refine[py * tile.width + px]) {
+				while (ps.count < maxSamples) {
+					addSamples(px, py);
+					if (ps.noise() <= threshold) {
+						break;
 					}
 				}
 			}
-
-            // Set alias scale and compute final pixel color
-			double aliasScale = antiAliasing * antiAliasing;
-			finalColor = finalColor / aliasScale;
-			frameBuffer.setColor(x, y, finalColor);
-
-			//			frameBuffer.showAxes(x, y, camera.getRay(x,y), 0.25);			// Displays R/x, G/y, B/z axes
+			frameBuffer.setColor(tile.lx + px, tile.ly + py, ps.mean());
 		}
 	}
+	return samplesTraced;
+}
 
-	frameBuffer.showColorBuffer();
+/**
+ * @fn	double RayTracer::PixelStats::noise() const
+ * @brief	Estimates how far the mean of the samples may be from the pixel's true
+ * 			color: the standard error of the mean, in the worst color channel.
+ * @return	The estimated error.
+ */
+
+double RayTracer::PixelStats::noise() const {
+	if (count < 2) {
+		return 0.0;
+	}
+	color m = mean();
+	color variance = glm::max(sumSq / (double)count - m * m, color(0, 0, 0));
+	double worst = std::max(variance.x, std::max(variance.y, variance.z));
+	return std::sqrt(worst / count);
 }
 
 /**
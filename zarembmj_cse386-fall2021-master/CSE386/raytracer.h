@@ -13,6 +13,11 @@
 #include "framebuffer.h"
 #include "camera.h"
 #include "iscene.h"
+#include "tilescheduler.h"
+#include "lightculler.h"
+
+const int AA_SAMPLES_PER_PASS = PACKET_SIZE;	//!< samples added to a pixel at a time by adaptive anti-aliasing.
+const double DEFAULT_MIN_RAY_WEIGHT = 1.0 / 512.0;	//!< secondary rays that would contribute less than this are not traced.
 
 /**
  * @struct	RayTracer
@@ -21,16 +26,59 @@
 
 struct RayTracer {
 	color defaultColor;
-	RayTracer(const color &defaultColor);
+	int numThreads;		//!< Number of worker threads. 0 means one per hardware thread.
+	int tileSize;		//!< Width and height of the tiles handed to the worker threads.
+	bool usePackets;	//!< Trace primary rays PACKET_SIZE at a time.
+	double minRayWeight;	//!< Secondary rays whose weight in the pixel falls below this are cut off.
+	bool russianRoulette;	//!< Instead of dropping low weight rays, keep a random, reweighted few of them.
+	bool cullLights;	//!< Shade the camera rays of each tile with only the lights that can reach it.
+	RayTracer(const color &defaultColor, int numThreads = 0, int tileSize = DEFAULT_TILE_SIZE);
 	void raytraceScene(FrameBuffer &frameBuffer, int depth,
-						const IScene &theScene) const;
-
-	color traceRay(const IScene& theScene, const PositionalLight& Light,
-		const Ray& ray, int depth) const;
+						IScene &theScene) const;
 
-	color traceRay(const IScene& theScene, const SpotLight& Light,
-		const Ray& ray, int depth) const;
+	color traceRay(const IScene& theScene, const Ray& ray, int depth,
+					const vector<int> *lights = nullptr) const;
+	color shadeHit(const IScene& theScene, const Ray& ray, const HitRecord& hit, int depth,
+					const double *shadows = nullptr, const vector<int> *lights = nullptr) const;
 
 protected:
+	/**
+	 * @struct	RayTreeNode
+	 * @brief	A reflected or refracted ray that is waiting to be traced.
+	 */
+
+	struct RayTreeNode {
+		Ray ray;			//!< the ray
+		double weight;		//!< fraction of the pixel's color that comes from this ray
+		int depth;			//!< number of reflection/refraction bounces left after this one
+		unsigned int type;	//!< CAMERA_RAYS, REFLECTION_RAYS or REFRACTION_RAYS
+		RayTreeNode(const Ray &r, double w, int d, unsigned int t)
+			: ray(r), weight(w), depth(d), type(t) {}
+	};
+
+	/**
+	 * @struct	PixelStats
+	 * @brief	Running totals of the samples taken in one pixel.
+	 */
+
+	struct PixelStats {
+		color sum;			//!< sum of the samples
+		color sumSq;		//!< sum of the squares of the samples
+		int count;			//!< number of samples
+		PixelStats() : sum(0, 0, 0), sumSq(0, 0, 0), count(0) {}
+		void add(const color &sample) { sum += sample; sumSq += sample * sample; count++; }
+		color mean() const { return sum / (double)count; }
+		double noise() const;
+	};
+
+	int raytraceTile(FrameBuffer &frameBuffer, const BoundingBoxi &tile, int depth,
+						const IScene &theScene, const vector<int> &lights) const;
+	int raytraceTileAdaptive(FrameBuffer &frameBuffer, const BoundingBoxi &tile, int depth,
+						const IScene &theScene, const vector<int> &lights) const;
 	color traceIndividualRay(const Ray &ray, const IScene &theScene, int recursionLevel) const;
+	color shadeLocal(const IScene &theScene, const HitRecord &hit, int numLights,
+						const double *shadows = nullptr, const vector<int> *lights = nullptr) const;
+	void findShadows(const IScene &theScene, const HitRecord hits[PACKET_SIZE], const vector<int> &lights,
+						vector<double> &shadows) const;
+	bool keepRay(double &weight, unsigned int &rngState) const;
 };
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "sampling.h"
+
+/**
+ * @fn	static unsigned int hashPixel(int x, int y, unsigned int salt)
+ * @brief	Scrambles a pixel position into a pseudo-random number. The same pixel
+ * 			always gets the same number, so images do not depend on which thread
+ * 			renders which pixel.
+ * @param	x   	The x coordinate.
+ * @param	y   	The y coordinate.
+ * @param	salt	Distinguishes different uses of the same pixel.
+ * @return	A pseudo-random 32-bit number.
+ */
+
+static unsigned int hashPixel(int x, int y, unsigned int salt) {
+	unsigned int h = (unsigned int)x * 0x8da6b343u ^ (unsigned int)y * 0xd8163841u ^ salt * 0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * @fn	static double toUnit(unsigned int h)
+ * @brief	Maps a 32-bit number to [0, 1).
+ * @param	h	The number.
+ * @return	A double in [0, 1).
+ */
+
+static double toUnit(unsigned int h) {
+	return h / 4294967296.0;
+}
+
+/**
+ * @fn	double radicalInverse(int base, unsigned int index)
+ * @brief	Mirrors the digits of index, written in the given base, about the decimal
+ * 			point. Successive indices give the van der Corput sequence in that base.
+ * @param	base 	The base.
+ * @param	index	The index.
+ * @return	A number in [0, 1).
+ * @test	radicalInverse(2, 1) --> 0.5
+ * @test	radicalInverse(2, 3) --> 0.75
+ * @test	radicalInverse(3, 1) --> 0.333...
+ */
+
+double radicalInverse(int base, unsigned int index) {
+	double invBase = 1.0 / base;
+	double scale = invBase;
+	double result = 0.0;
+	while (index > 0) {
+		result += (index % base) * scale;
+		index /= base;
+		scale *= invBase;
+	}
+	return result;
+}
+
+/**
+ * @fn	dvec2 pixelSample(SamplePattern pattern, int x, int y, int index)
+ * @brief	Gets the position of a sample within a pixel.
+ * 			STRATIFIED: every group of 4 samples covers the 4 quarters of the pixel,
+ * 			one jittered sample in each.
+ * 			HALTON: the 2D Halton sequence (bases 2 and 3), shifted by a per-pixel
+ * 			random offset so that neighboring pixels do not share a pattern.
+ * @param	pattern	The pattern.
+ * @param	x	   	The pixel's x coordinate.
+ * @param	y	   	The pixel's y coordinate.
+ * @param	index  	Which sample of the pixel this is: 0, 1, 2, ...
+ * @return	The sample's offset from the pixel's lower left corner, in [0, 1) x [0, 1).
+ */
+
+dvec2 pixelSample(SamplePattern pattern, int x, int y, int index) {
+	if (pattern == SamplePattern::STRATIFIED) {
+		int quarter = index % 4;
+		double jx = toUnit(hashPixel(x, y, 2 * index));
+		double jy = toUnit(hashPixel(x, y, 2 * index + 1));
+		return dvec2(((quarter % 2) + jx) / 2.0, ((quarter / 2) + jy) / 2.0);
+	} else {
+		double u = radicalInverse(2, index + 1) + toUnit(hashPixel(x, y, 0x9e3779b9u));
+		double v = radicalInverse(3, index + 1) + toUnit(hashPixel(x, y, 0x7f4a7c15u));
+		return dvec2(u - std::floor(u), v - std::floor(v));
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "defs.h"
+
+/**
+ * @enum	SamplePattern
+ * @brief	Where the samples inside a pixel are placed when anti-aliasing adaptively.
+ * 			Both patterns can be extended one sample at a time and stay well spread
+ * 			out, so a pixel can stop after any number of samples.
+ */
+
+enum class SamplePattern { STRATIFIED, HALTON };
+
+double radicalInverse(int base, unsigned int index);
+dvec2 pixelSample(SamplePattern pattern, int x, int y, int index);
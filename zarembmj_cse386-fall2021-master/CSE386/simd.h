@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cmath>
+
+// Picks the widest instruction set the compiler has been told it may use. Building
+// with /arch:AVX (MSVC) or -mavx (gcc/clang) selects the AVX backend; every x64
+// build has at least SSE2. Anything else falls back on plain loops over the lanes.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
+
+const int PACKET_SIZE = 4;		//!< number of rays traced together in a packet.
+
+/**
+ * @struct	PacketDouble
+ * @brief	PACKET_SIZE doubles that are operated on together. Every operation is
+ * 			carried out lane by lane with the same IEEE double arithmetic as scalar
+ * 			code, so a computation written with PacketDouble gives bit-for-bit the
+ * 			same result in each lane as the scalar version of it. Floats are widened
+ * 			to doubles as they are loaded.
+ */
+
+struct PacketDouble {
+#if defined(SIMD_AVX)
+	__m256d v;			//!< all four lanes
+	PacketDouble() {}
+	PacketDouble(__m256d a) : v(a) {}
+	PacketDouble(double x) : v(_mm256_set1_pd(x)) {}
+	static PacketDouble load(const double *p) { return PacketDouble(_mm256_loadu_pd(p)); }
+	static PacketDouble load(const float *p) { return PacketDouble(_mm256_cvtps_pd(_mm_loadu_ps(p))); }
+	void store(double *p) const { _mm256_storeu_pd(p, v); }
+#elif defined(SIMD_SSE2)
+	__m128d lo;			//!< lanes 0 and 1
+	__m128d hi;			//!< lanes 2 and 3
+	PacketDouble() {}
+	PacketDouble(__m128d a, __m128d b) : lo(a), hi(b) {}
+	PacketDouble(double x) : lo(_mm_set1_pd(x)), hi(_mm_set1_pd(x)) {}
+	static PacketDouble load(const double *p) { return PacketDouble(_mm_loadu_pd(p), _mm_loadu_pd(p + 2)); }
+	static PacketDouble load(const float *p) {
+		__m128 f = _mm_loadu_ps(p);
+		return PacketDouble(_mm_cvtps_pd(f), _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+	}
+	void store(double *p) const { _mm_storeu_pd(p, lo); _mm_storeu_pd(p + 2, hi); }
+#else
+	double v[PACKET_SIZE];	//!< the lanes
+	PacketDouble() {}
+	PacketDouble(double x) { for (int k = 0; k < PACKET_SIZE; k++) v[k] = x; }
+	static PacketDouble load(const double *p) { PacketDouble r; for (int k = 0; k < PACKET_SIZE; k++) r.v[k] = p[k]; return r; }
+	static PacketDouble load(const float *p) { PacketDouble r; for (int k = 0; k < PACKET_SIZE; k++) r.v[k] = p[k]; return r; }
+	void store(double *p) const { for (int k = 0; k < PACKET_SIZE; k++) p[k] = v[k]; }
+#endif
+};
+
+/**
+ * @struct	PacketMask
+ * @brief	The result of comparing two PacketDoubles: one true/false flag per lane.
+ */
+
+struct PacketMask {
+#if defined(SIMD_AVX)
+	__m256d m;			//!< all ones in lanes that are true
+	PacketMask(__m256d a) : m(a) {}
+	int bits() const { return _mm256_movemask_pd(m); }
+#elif defined(SIMD_SSE2)
+	__m128d lo;			//!< lanes 0 and 1
+	__m128d hi;			//!< lanes 2 and 3
+	PacketMask(__m128d a, __m128d b) : lo(a), hi(b) {}
+	int bits() const { return _mm_movemask_pd(lo) | (_mm_movemask_pd(hi) << 2); }
+#else
+	int b;				//!< bit k is set iff lane k is true
+	PacketMask(int a) : b(a) {}
+	int bits() const { return b; }
+#endif
+	bool any() const { return bits() != 0; }
+	bool lane(int k) const { return (bits() >> k) & 1; }
+};
+
+#if defined(SIMD_AVX)
+
+inline PacketDouble operator +(const PacketDouble &a, const PacketDouble &b) { return _mm256_add_pd(a.v, b.v); }
+inline PacketDouble operator -(const PacketDouble &a, const PacketDouble &b) { return _mm256_sub_pd(a.v, b.v); }
+inline PacketDouble operator *(const PacketDouble &a, const PacketDouble &b) { return _mm256_mul_pd(a.v, b.v); }
+inline PacketDouble operator /(const PacketDouble &a, const PacketDouble &b) { return _mm256_div_pd(a.v, b.v); }
+inline PacketDouble operator -(const PacketDouble &a) { return _mm256_xor_pd(a.v, _mm256_set1_pd(-0.0)); }
+inline PacketDouble sqrt(const PacketDouble &a) { return _mm256_sqrt_pd(a.v); }
+inline PacketDouble abs(const PacketDouble &a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v); }
+inline PacketMask operator <(const PacketDouble &a, const PacketDouble &b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+inline PacketMask operator <=(const PacketDouble &a, const PacketDouble &b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+inline PacketMask operator >(const PacketDouble &a, const PacketDouble &b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+inline PacketMask operator >=(const PacketDouble &a, const PacketDouble &b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ); }
+inline PacketMask operator !=(const PacketDouble &a, const PacketDouble &b) { return _mm256_cmp_pd(a.v, b.v, _CMP_NEQ_UQ); }
+inline PacketMask operator &(const PacketMask &a, const PacketMask &b) { return _mm256_and_pd(a.m, b.m); }
+inline PacketMask operator |(const PacketMask &a, const PacketMask &b) { return _mm256_or_pd(a.m, b.m); }
+inline PacketDouble select(const PacketMask &m, const PacketDouble &a, const PacketDouble &b) { return _mm256_blendv_pd(b.v, a.v, m.m); }
+
+#elif defined(SIMD_SSE2)
+
+#define SIMD_SSE2_BINARY(op, intrinsic, Result)											\
+	inline Result op(const PacketDouble &a, const PacketDouble &b) {					\
+		return Result(intrinsic(a.lo, b.lo), intrinsic(a.hi, b.hi));					\
+	}
+SIMD_SSE2_BINARY(operator +, _mm_add_pd, PacketDouble)
+SIMD_SSE2_BINARY(operator -, _mm_sub_pd, PacketDouble)
+SIMD_SSE2_BINARY(operator *, _mm_mul_pd, PacketDouble)
+SIMD_SSE2_BINARY(operator /, _mm_div_pd, PacketDouble)
+SIMD_SSE2_BINARY(operator <, _mm_cmplt_pd, PacketMask)
+SIMD_SSE2_BINARY(operator <=, _mm_cmple_pd, PacketMask)
+SIMD_SSE2_BINARY(operator >, _mm_cmpgt_pd, PacketMask)
+SIMD_SSE2_BINARY(operator >=, _mm_cmpge_pd, PacketMask)
+SIMD_SSE2_BINARY(operator !=, _mm_cmpneq_pd, PacketMask)
+#undef SIMD_SSE2_BINARY
+
+inline PacketDouble operator -(const PacketDouble &a) {
+	__m128d sign = _mm_set1_pd(-0.0);
+	return PacketDouble(_mm_xor_pd(a.lo, sign), _mm_xor_pd(a.hi, sign));
+}
+inline PacketDouble sqrt(const PacketDouble &a) { return PacketDouble(_mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi)); }
+inline PacketDouble abs(const PacketDouble &a) {
+	__m128d sign = _mm_set1_pd(-0.0);
+	return PacketDouble(_mm_andnot_pd(sign, a.lo), _mm_andnot_pd(sign, a.hi));
+}
+inline PacketMask operator &(const PacketMask &a, const PacketMask &b) { return PacketMask(_mm_and_pd(a.lo, b.lo), _mm_and_pd(a.hi, b.hi)); }
+inline PacketMask operator |(const PacketMask &a, const PacketMask &b) { return PacketMask(_mm_or_pd(a.lo, b.lo), _mm_or_pd(a.hi, b.hi)); }
+inline PacketDouble select(const PacketMask &m, const PacketDouble &a, const PacketDouble &b) {
+	return PacketDouble(_mm_or_pd(_mm_and_pd(m.lo, a.lo), _mm_andnot_pd(m.lo, b.lo)),
+						_mm_or_pd(_mm_and_pd(m.hi, a.hi), _mm_andnot_pd(m.hi, b.hi)));
+}
+
+#else
+
+#define SIMD_SCALAR_BINARY(op, expr)													\
+	inline PacketDouble op(const PacketDouble &a, const PacketDouble &b) {				\
+		PacketDouble r;																	\
+		for (int k = 0; k < PACKET_SIZE; k++) r.v[k] = expr;							\
+		return r;																		\
+	}
+SIMD_SCALAR_BINARY(operator +, a.v[k] + b.v[k])
+SIMD_SCALAR_BINARY(operator -, a.v[k] - b.v[k])
+SIMD_SCALAR_BINARY(operator *, a.v[k] * b.v[k])
+SIMD_SCALAR_BINARY(operator /, a.v[k] / b.v[k])
+#undef SIMD_SCALAR_BINARY
+
+#define SIMD_SCALAR_COMPARE(op)															\
+	inline PacketMask operator op(const PacketDouble &a, const PacketDouble &b) {		\
+		int bits = 0;																	\
+		for (int k = 0; k < PACKET_SIZE; k++) bits |= (a.v[k] op b.v[k]) << k;			\
+		return PacketMask(bits);														\
+	}
+SIMD_SCALAR_COMPARE(<)
+SIMD_SCALAR_COMPARE(<=)
+SIMD_SCALAR_COMPARE(>)
+SIMD_SCALAR_COMPARE(>=)
+SIMD_SCALAR_COMPARE(!=)
+#undef SIMD_SCALAR_COMPARE
+
+inline PacketDouble operator -(const PacketDouble &a) { PacketDouble r; for (int k = 0; k < PACKET_SIZE; k++) r.v[k] = -a.v[k]; return r; }
+inline PacketDouble sqrt(const PacketDouble &a) { PacketDouble r; for (int k = 0; k < PACKET_SIZE; k++) r.v[k] = std::sqrt(a.v[k]); return r; }
+inline PacketDouble abs(const PacketDouble &a) { PacketDouble r; for (int k = 0; k < PACKET_SIZE; k++) r.v[k] = std::abs(a.v[k]); return r; }
+inline PacketMask operator &(const PacketMask &a, const PacketMask &b) { return PacketMask(a.b & b.b); }
+inline PacketMask operator |(const PacketMask &a, const PacketMask &b) { return PacketMask(a.b | b.b); }
+inline PacketDouble select(const PacketMask &m, const PacketDouble &a, const PacketDouble &b) {
+	PacketDouble r;
+	for (int k = 0; k < PACKET_SIZE; k++) r.v[k] = m.lane(k) ? a.v[k] : b.v[k];
+	return r;
+}
+
+#endif
+
+// The scalar counterpart of select, so that code templated on double or PacketDouble
+// can be written once.
+inline double select(bool m, double a, double b) { return m ? a : b; }
@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <numeric>
+#include "sphereset.h"
+
+static_assert(PACKET_SIZE == 4, "ISphereSet::intersectLeaf numbers its lanes 0 to 3");
+
+/**
+ * @fn	static float roundDown(double x)
+ * @brief	Converts a double to the largest float that is not greater than it.
+ * @param	x	The double.
+ * @return	The float.
+ */
+
+static float roundDown(double x) {
+	float f = (float)x;
+	return f > x ? std::nextafter(f, -FLT_MAX) : f;
+}
+
+/**
+ * @fn	static float roundUp(double x)
+ * @brief	Converts a double to the smallest float that is not less than it.
+ * @param	x	The double.
+ * @return	The float.
+ */
+
+static float roundUp(double x) {
+	float f = (float)x;
+	return f < x ? std::nextafter(f, FLT_MAX) : f;
+}
+
+/**
+ * @fn	static BoundingBox boxOf(const SphereSetNode &node)
+ * @brief	Gets the box of a node in double precision.
+ * @param	node	The node.
+ * @return	The node's box.
+ */
+
+static BoundingBox boxOf(const SphereSetNode &node) {
+	return BoundingBox(dvec3(node.lo[0], node.lo[1], node.lo[2]), dvec3(node.hi[0], node.hi[1], node.hi[2]));
+}
+
+/**
+ * @fn	template <typename T> static void permute(vector<T> &values, const vector<uint32_t> &order, size_t padding)
+ * @brief	Reorders an array so that values[i] becomes what values[order[i]] was.
+ * @param [in,out]	values 	The array.
+ * @param 		  	order  	The new order.
+ * @param 		  	padding	Room to leave for elements that will be added later.
+ */
+
+template <typename T>
+static void permute(vector<T> &values, const vector<uint32_t> &order, size_t padding) {
+	vector<T> reordered;
+	reordered.reserve(order.size() + padding);
+	for (size_t i = 0; i < order.size(); i++) {
+		reordered.push_back(values[order[i]]);
+	}
+	values.swap(reordered);
+}
+
+/**
+ * @fn	ISphereSet::ISphereSet(const vector<Material> &palette)
+ * @brief	Constructs an empty set of spheres.
+ * @param	palette	The materials the spheres may have. Only the first
+ * 					SPHERE_SET_MAX_MATERIALS are kept, and an empty palette is
+ * 					given one default material.
+ */
+
+ISphereSet::ISphereSet(const vector<Material> &palette)
+	: materials(palette) {
+	if (materials.empty()) {
+		materials.push_back(Material());
+	} else if (materials.size() > (size_t)SPHERE_SET_MAX_MATERIALS) {
+		materials.resize(SPHERE_SET_MAX_MATERIALS);
+	}
+}
+
+/**
+ * @fn	void ISphereSet::add(const dvec3 &center, double radius, int material)
+ * @brief	Adds a sphere. build must be called once all the spheres have been added.
+ * @param	center  	The sphere's center.
+ * @param	radius  	The sphere's radius.
+ * @param	material	Index of the sphere's material in materials, clamped to the
+ * 						indices materials has.
+ */
+
+void ISphereSet::add(const dvec3 &center, double radius, int material) {
+	// Drop the padding that build left at the ends of the arrays
+	size_t n = materialIndex.size();
+	cx.resize(n);
+	cy.resize(n);
+	cz.resize(n);
+	this->radius.resize(n);
+
+	cx.push_back((float)center.x);
+	cy.push_back((float)center.y);
+	cz.push_back((float)center.z);
+	this->radius.push_back((float)radius);
+	materialIndex.push_back((uint16_t)glm::clamp(material, 0, (int)materials.size() - 1));
+}
+
+/**
+ * @fn	void ISphereSet::build()
+ * @brief	Builds the hierarchy over the spheres, replacing any earlier one, and puts
+ * 			the spheres in leaf order. Each node is split at the median of its sphere
+ * 			centers along the widest axis, so the tree is balanced and needs only one
+ * 			index per sphere while it is being built. The split falls on a multiple of
+ * 			SPHERE_SET_LEAF_SIZE so that the leaves are full.
+ */
+
+void ISphereSet::build() {
+	int n = numSpheres();
+	cx.resize(n);
+	cy.resize(n);
+	cz.resize(n);
+	radius.resize(n);
+	nodes.clear();
+	if (n == 0) {
+		return;
+	}
+
+	vector<uint32_t> order(n);
+	std::iota(order.begin(), order.end(), 0);
+	nodes.reserve(2 * (n / SPHERE_SET_LEAF_SIZE + 1));
+	buildNode(order, 0, n);
+	permute(cx, order, PACKET_SIZE - 1);
+	permute(cy, order, PACKET_SIZE - 1);
+	permute(cz, order, PACKET_SIZE - 1);
+	permute(radius, order, PACKET_SIZE - 1);
+	permute(materialIndex, order, 0);
+
+	// Pad the arrays so that the last leaf can be loaded PACKET_SIZE spheres at a time
+	cx.resize(n + PACKET_SIZE - 1, 0.0f);
+	cy.resize(n + PACKET_SIZE - 1, 0.0f);
+	cz.resize(n + PACKET_SIZE - 1, 0.0f);
+	radius.resize(n + PACKET_SIZE - 1, 0.0f);
+}
+
+/**
+ * @fn	int ISphereSet::buildNode(vector<uint32_t> &order, int first, int last)
+ * @brief	Recursively builds the subtree for spheres order[first] through
+ * 			order[last - 1].
+ * @param [in,out]	order	Sphere indices, in leaf order once the build is done.
+ * @param 		  	first	First sphere of the range.
+ * @param 		  	last 	One past the last sphere of the range.
+ * @return	Index of the new node in nodes.
+ */
+
+int ISphereSet::buildNode(vector<uint32_t> &order, int first, int last) {
+	int index = (int)nodes.size();
+	nodes.push_back(SphereSetNode());
+
+	BoundingBox box;
+	BoundingBox centers;
+	for (int i = first; i < last; i++) {
+		uint32_t s = order[i];
+		dvec3 c(cx[s], cy[s], cz[s]);
+		dvec3 r(radius[s], radius[s], radius[s]);
+		box.grow(BoundingBox(c - r, c + r));
+		centers.grow(c);
+	}
+	box = box.padded();
+	for (int a = 0; a < 3; a++) {
+		nodes[index].lo[a] = roundDown(box.lo[a]);
+		nodes[index].hi[a] = roundUp(box.hi[a]);
+	}
+
+	int count = last - first;
+	if (count <= SPHERE_SET_LEAF_SIZE) {
+		nodes[index].first = first;
+		nodes[index].count = (uint16_t)count;
+		nodes[index].axis = 0;
+		return index;
+	}
+
+	dvec3 extent = centers.hi - centers.lo;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	const vector<float> &key = axis == 0 ? cx : (axis == 1 ? cy : cz);
+	int leaves = (count + SPHERE_SET_LEAF_SIZE - 1) / SPHERE_SET_LEAF_SIZE;
+	int mid = first + SPHERE_SET_LEAF_SIZE * ((leaves + 1) / 2);
+	std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last,
+						[&](uint32_t a, uint32_t b) { return key[a] < key[b]; });
+	buildNode(order, first, mid);
+	int right = buildNode(order, mid, last);
+	nodes[index].first = right;
+	nodes[index].count = 0;
+	nodes[index].axis = (uint16_t)axis;
+	return index;
+}
+
+/**
+ * @fn	template <bool ANY_HIT> int ISphereSet::intersectLeaf(const SphereSetNode &node, const Ray &ray, double tMin, double &tMax) const
+ * @brief	Intersects a ray with the spheres of a leaf, PACKET_SIZE spheres at a time.
+ * 			The distance from each center to the ray is found from the center's offset
+ * 			from the ray rather than as the difference of two large squared lengths, so
+ * 			small spheres far from the ray's origin are still hit accurately.
+ * @param 		  	node	The leaf.
+ * @param 		  	ray 	The ray.
+ * @param 		  	tMin	Smallest t of interest.
+ * @param [in,out]	tMax	Largest t of interest. When looking for the closest hit,
+ * 							lowered to the t of each closer hit found.
+ * @return	The sphere that was hit, or -1. With ANY_HIT, the first sphere found with a
+ * 			hit in [tMin, tMax]; otherwise the sphere with the closest hit in (tMin, tMax).
+ */
+
+template <bool ANY_HIT>
+int ISphereSet::intersectLeaf(const SphereSetNode &node, const Ray &ray, double tMin, double &tMax) const {
+	static const double LANES[PACKET_SIZE] = { 0.0, 1.0, 2.0, 3.0 };
+	PacketDouble ox(ray.origin.x), oy(ray.origin.y), oz(ray.origin.z);
+	PacketDouble dx(ray.dir.x), dy(ray.dir.y), dz(ray.dir.z);
+	PacketDouble lanes = PacketDouble::load(LANES);
+	PacketDouble zero(0.0);
+	PacketDouble tLo(tMin);
+
+	int hit = -1;
+	int end = node.first + node.count;
+	for (int base = node.first; base < end; base += PACKET_SIZE) {
+		PacketDouble ocx = PacketDouble::load(&cx[base]) - ox;
+		PacketDouble ocy = PacketDouble::load(&cy[base]) - oy;
+		PacketDouble ocz = PacketDouble::load(&cz[base]) - oz;
+		PacketDouble r = PacketDouble::load(&radius[base]);
+		PacketDouble b = ocx * dx + ocy * dy + ocz * dz;
+		PacketDouble px = ocx - b * dx, py = ocy - b * dy, pz = ocz - b * dz;
+		PacketDouble disc = r * r - (px * px + py * py + pz * pz);
+		PacketDouble root = sqrt(select(disc >= zero, disc, zero));
+		PacketDouble tNear = b - root;
+		PacketDouble tHi(tMax);
+		PacketDouble t = select(ANY_HIT ? tNear >= tLo : tNear > tLo, tNear, b + root);
+		PacketMask inRange = ANY_HIT ? (t >= tLo) & (t <= tHi) : (t > tLo) & (t < tHi);
+		PacketMask valid = (disc >= zero) & (lanes < PacketDouble(end - base)) & inRange;
+		if (!valid.any()) {
+			continue;
+		}
+		if (ANY_HIT) {
+			return base;
+		}
+		double ts[PACKET_SIZE];
+		t.store(ts);
+		for (int k = 0; k < PACKET_SIZE; k++) {
+			if (valid.lane(k) && ts[k] < tMax) {
+				tMax = ts[k];
+				hit = base + k;
+			}
+		}
+	}
+	return hit;
+}
+
+/**
+ * @fn	void ISphereSet::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the closest sphere hit by the ray.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit, with the sphere's material, or t == FLT_MAX.
+ */
+
+void ISphereSet::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int sphere;
+	hit.t = ISphereSet::findClosestHit(ray, sphere);
+	if (hit.t != FLT_MAX) {
+		ISphereSet::getHitAttributes(ray, hit.t, sphere, hit);
+	}
+}
+
+/**
+ * @fn	double ISphereSet::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds t of the closest sphere hit by the ray, walking the hierarchy near
+ * 			side first as BVH::findIntersection does.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	The index of the sphere that was hit.
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double ISphereSet::findClosestHit(const Ray &ray, int &primitive) const {
+	double tBest = FLT_MAX;
+	primitive = -1;
+	if (nodes.empty()) {
+		return tBest;
+	}
+
+	dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	int stack[SPHERE_SET_MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const SphereSetNode &node = nodes[index];
+		if (!boxOf(node).intersects(ray.origin, invDir, 0.0, tBest)) {
+			continue;
+		}
+		if (node.count > 0) {
+			int sphere = intersectLeaf<false>(node, ray, 0.0, tBest);
+			if (sphere >= 0) {
+				primitive = sphere;
+			}
+		} else if (ray.dir[node.axis] < 0.0) {
+			stack[top++] = index + 1;
+			stack[top++] = node.first;
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+	return primitive < 0 ? FLT_MAX : tBest;
+}
+
+/**
+ * @fn	void ISphereSet::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept, normal, material and texture coordinates of a hit.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	The sphere returned by findClosestHit.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void ISphereSet::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	dvec3 center(cx[primitive], cy[primitive], cz[primitive]);
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	hit.normal = glm::normalize(hit.interceptPt - center);
+	hit.material = materials[materialIndex[primitive]];
+	double R, az, el;
+	computeAzimuthAndElevationFromXYZ(hit.interceptPt - center, R, az, el);
+	hit.u = map(az, -PI, PI, 0.0, 1.0);
+	hit.v = 1.0 - map(el, -PI_2, PI_2, 0.0, 1.0);
+}
+
+/**
+ * @fn	bool ISphereSet::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits any sphere in [tMin, tMax], stopping at the
+ * 			first one found.
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool ISphereSet::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	if (nodes.empty()) {
+		return false;
+	}
+
+	dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	int stack[SPHERE_SET_MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const SphereSetNode &node = nodes[index];
+		if (!boxOf(node).intersects(ray.origin, invDir, tMin, tMax)) {
+			continue;
+		}
+		if (node.count > 0) {
+			double t = tMax;
+			if (intersectLeaf<true>(node, ray, tMin, t) >= 0) {
+				return true;
+			}
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool ISphereSet::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box around all the spheres.
+ * @param [in,out]	box	The box.
+ * @return	False if the set has no spheres or has not been built.
+ */
+
+bool ISphereSet::getBoundingBox(BoundingBox &box) const {
+	if (nodes.empty()) {
+		return false;
+	}
+	box = boxOf(nodes[0]);
+	return true;
+}
+
+/**
+ * @fn	bool ISphereSet::hasOwnMaterials() const
+ * @brief	Each sphere has its own material.
+ * @return	true.
+ */
+
+bool ISphereSet::hasOwnMaterials() const {
+	return true;
+}
+
+/**
+ * @fn	size_t ISphereSet::memoryBytes() const
+ * @brief	Counts the memory the set occupies, including its hierarchy.
+ * @return	The number of bytes.
+ */
+
+size_t ISphereSet::memoryBytes() const {
+	return sizeof(ISphereSet) +
+		(cx.capacity() + cy.capacity() + cz.capacity() + radius.capacity()) * sizeof(float) +
+		materialIndex.capacity() * sizeof(uint16_t) +
+		nodes.capacity() * sizeof(SphereSetNode) +
+		materials.capacity() * sizeof(Material);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "ishape.h"
+
+const int SPHERE_SET_LEAF_SIZE = 8;		//!< most spheres in a leaf of an ISphereSet's hierarchy.
+const int SPHERE_SET_MAX_DEPTH = 64;	//!< deeper than any balanced tree over 2^32 spheres.
+const int SPHERE_SET_MAX_MATERIALS = 65536;	//!< most materials a 16-bit index can refer to.
+
+/**
+ * @struct	SphereSetNode
+ * @brief	A node of an ISphereSet's hierarchy, laid out as BVHNode is but in 32 bytes:
+ * 			an interior node's left child immediately follows it and first is its
+ * 			right child, while a leaf holds spheres first through first + count - 1.
+ */
+
+struct SphereSetNode {
+	float lo[3];		//!< corner of the box around the node's spheres
+	float hi[3];		//!< opposite corner
+	uint32_t first;		//!< right child (interior) or first sphere (leaf)
+	uint16_t count;		//!< number of spheres in a leaf, 0 for interior nodes
+	uint16_t axis;		//!< axis the node was split along
+};
+
+/**
+ * @struct	ISphereSet
+ * @brief	Many spheres stored as one shape, for particle systems and point clouds with
+ * 			millions of spheres. Each sphere takes 18 bytes: a float center and radius
+ * 			and a 16-bit index into the set's table of materials, kept in separate
+ * 			arrays. The spheres are placed in a hierarchy of their own, with up to
+ * 			SPHERE_SET_LEAF_SIZE spheres per leaf, and a leaf's spheres are intersected
+ * 			PACKET_SIZE at a time with SIMD instructions. Intersections are computed in
+ * 			double precision from the stored floats. Each hit takes its material from
+ * 			the table; shadows use the alpha of the VisibleIShape holding the set.
+ */
+
+struct ISphereSet : public IShape {
+	vector<Material> materials;		//!< the spheres' materials
+	ISphereSet(const vector<Material> &palette);
+	void add(const dvec3 &center, double radius, int material = 0);
+	void build();
+	int numSpheres() const { return (int)materialIndex.size(); }
+	int numNodes() const { return (int)nodes.size(); }
+	size_t memoryBytes() const;
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	virtual bool hasOwnMaterials() const;
+protected:
+	vector<float> cx, cy, cz;			//!< centers, in leaf order once built
+	vector<float> radius;				//!< radii, in leaf order once built
+	vector<uint16_t> materialIndex;		//!< index into materials of each sphere
+	vector<SphereSetNode> nodes;		//!< hierarchy over the spheres, nodes[0] is the root
+	int buildNode(vector<uint32_t> &order, int first, int last);
+	template <bool ANY_HIT>
+	int intersectLeaf(const SphereSetNode &node, const Ray &ray, double tMin, double &tMax) const;
+};
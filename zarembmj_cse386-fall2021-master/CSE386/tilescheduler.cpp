@@ -0,0 +1,110 @@
+#include <algorithm>
+#include "tilescheduler.h"
+
+/**
+ * @fn	TileScheduler::TileScheduler(int width, int height, int tileSize, int numWorkers)
+ * @brief	Splits a width x height frame into tiles and deals them out to the workers.
+ * 			Each worker starts with a contiguous run of tiles so that neighboring
+ * 			tiles (which tend to touch the same objects) stay on the same thread.
+ * @param	width	  	The width of the frame.
+ * @param	height	  	The height of the frame.
+ * @param	tileSize  	The width and height of each tile.
+ * @param	numWorkers	The number of worker threads.
+ */
+
+TileScheduler::TileScheduler(int width, int height, int tileSize, int numWorkers)
+	: tiles(splitIntoTiles(width, height, tileSize)) {
+	numWorkers = std::max(numWorkers, 1);
+	for (int i = 0; i < numWorkers; i++) {
+		queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+	}
+	int N = (int)tiles.size();
+	for (int i = 0; i < N; i++) {
+		int owner = (int)((long long)i * numWorkers / N);
+		queues[owner]->indices.push_back(i);
+	}
+}
+
+/**
+ * @fn	vector<BoundingBoxi> TileScheduler::splitIntoTiles(int width, int height, int tileSize)
+ * @brief	Covers a width x height frame with tiles, in scanline order. Tiles along
+ * 			the right and top edges are clipped to the frame.
+ * @param	width   	The width of the frame.
+ * @param	height  	The height of the frame.
+ * @param	tileSize	The width and height of each tile.
+ * @return	The tiles.
+ */
+
+vector<BoundingBoxi> TileScheduler::splitIntoTiles(int width, int height, int tileSize) {
+	vector<BoundingBoxi> result;
+	tileSize = std::max(tileSize, 1);
+	for (int y = 0; y < height; y += tileSize) {
+		for (int x = 0; x < width; x += tileSize) {
+			result.push_back(BoundingBoxi(x, std::min(tileSize, width - x),
+											y, std::min(tileSize, height - y)));
+		}
+	}
+	return result;
+}
+
+/**
+ * @fn	bool TileScheduler::nextTile(int worker, BoundingBoxi &tile)
+ * @brief	Gets the next tile for a worker. The worker's own queue is drained first;
+ * 			after that the other queues are visited in turn and a tile is stolen from
+ * 			the first one that still has work.
+ * @param 		  	worker	The worker asking for work.
+ * @param [in,out]	tile  	The tile to render.
+ * @return	false iff every tile has been handed out.
+ */
+
+bool TileScheduler::nextTile(int worker, BoundingBoxi &tile) {
+	int index;
+	int N = (int)queues.size();
+	bool found = popOwn(worker, index);
+	for (int i = 1; !found && i < N; i++) {
+		found = steal((worker + i) % N, index);
+	}
+	if (found) {
+		tile = tiles[index];
+	}
+	return found;
+}
+
+/**
+ * @fn	bool TileScheduler::popOwn(int worker, int &index)
+ * @brief	Takes the tile at the front of a worker's own queue.
+ * @param 		  	worker	The worker.
+ * @param [in,out]	index 	The index of the tile.
+ * @return	false iff the queue was empty.
+ */
+
+bool TileScheduler::popOwn(int worker, int &index) {
+	WorkerQueue &q = *queues[worker];
+	std::lock_guard<std::mutex> guard(q.lock);
+	if (q.indices.empty()) {
+		return false;
+	}
+	index = q.indices.front();
+	q.indices.pop_front();
+	return true;
+}
+
+/**
+ * @fn	bool TileScheduler::steal(int victim, int &index)
+ * @brief	Takes the tile at the back of another worker's queue. Stealing from the
+ * 			opposite end keeps the thief away from the tiles the owner is about to render.
+ * @param 		  	victim	The worker being robbed.
+ * @param [in,out]	index 	The index of the tile.
+ * @return	false iff the queue was empty.
+ */
+
+bool TileScheduler::steal(int victim, int &index) {
+	WorkerQueue &q = *queues[victim];
+	std::lock_guard<std::mutex> guard(q.lock);
+	if (q.indices.empty()) {
+		return false;
+	}
+	index = q.indices.back();
+	q.indices.pop_back();
+	return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <memory>
+#include "defs.h"
+
+const int DEFAULT_TILE_SIZE = 16;		//!< default width/height of a render tile, in pixels.
+
+/**
+ * @struct	TileScheduler
+ * @brief	Hands out rectangular tiles of the framebuffer to a set of worker threads.
+ * 			Each worker owns a queue of tiles and takes work from the front of it. A worker
+ * 			that runs out of work steals from the back of another worker's queue, so the
+ * 			load evens out even when some tiles are much more expensive than others.
+ */
+
+struct TileScheduler {
+	TileScheduler(int width, int height, int tileSize, int numWorkers);
+	bool nextTile(int worker, BoundingBoxi &tile);
+	int numTiles() const { return (int)tiles.size(); }
+	static vector<BoundingBoxi> splitIntoTiles(int width, int height, int tileSize);
+protected:
+	/**
+	 * @struct	WorkerQueue
+	 * @brief	The tiles (indices into tiles) that belong to a single worker.
+	 */
+
+	struct WorkerQueue {
+		std::mutex lock;			//!< guards indices
+		std::deque<int> indices;	//!< tiles not yet rendered
+	};
+	vector<BoundingBoxi> tiles;						//!< all the tiles in the frame
+	vector<std::unique_ptr<WorkerQueue>> queues;	//!< one queue per worker
+	bool popOwn(int worker, int &index);
+	bool steal(int victim, int &index);
+};
@@ -0,0 +1,386 @@
+#include <map>
+#include <array>
+#include <utility>
+#include "trianglemesh.h"
+
+/**
+ * @fn	void setUpWatertightRay(const Ray &ray, int axes[3], dvec3 &shear)
+ * @brief	Per-ray setup for the watertight ray/triangle test. The axis along which the
+ * 			ray's direction is largest becomes z, and the other two are chosen so that
+ * 			the winding of the triangles is preserved. The shear maps the ray onto the
+ * 			+z axis of that space.
+ * @param 		  	ray  	The ray.
+ * @param [in,out]	axes 	The x, y and z axes of the ray's space.
+ * @param [in,out]	shear	Shear constants Sx, Sy and Sz.
+ */
+
+void setUpWatertightRay(const Ray &ray, int axes[3], dvec3 &shear) {
+	dvec3 absDir = glm::abs(ray.dir);
+	int kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+	int kx = (kz + 1) % 3;
+	int ky = (kx + 1) % 3;
+	if (ray.dir[kz] < 0.0) {
+		std::swap(kx, ky);
+	}
+	axes[0] = kx;
+	axes[1] = ky;
+	axes[2] = kz;
+	shear = dvec3(ray.dir[kx] / ray.dir[kz], ray.dir[ky] / ray.dir[kz], 1.0 / ray.dir[kz]);
+}
+
+/**
+ * @fn	bool intersectWatertight(const dvec3 &a, const dvec3 &b, const dvec3 &c, const Ray &ray, const int axes[3], const dvec3 &shear, double &t, double &u, double &v)
+ * @brief	Watertight ray/triangle test. The triangle is translated to the ray's origin
+ * 			and sheared so that the ray runs along +z; the ray then hits the triangle iff
+ * 			the three 2D edge functions at the origin have the same sign. Points on an
+ * 			edge are counted as inside, so no ray passes between adjacent triangles.
+ * @param 		  	a	 	The triangle's first vertex.
+ * @param 		  	b	 	The triangle's second vertex.
+ * @param 		  	c	 	The triangle's third vertex.
+ * @param 		  	ray  	The ray.
+ * @param 		  	axes 	Set up by setUpWatertightRay.
+ * @param 		  	shear	Set up by setUpWatertightRay.
+ * @param [in,out]	t	 	t of the intersection.
+ * @param [in,out]	u	 	Barycentric coordinate of b.
+ * @param [in,out]	v	 	Barycentric coordinate of c.
+ * @return	true iff the ray's line crosses the triangle. t may be negative.
+ */
+
+bool intersectWatertight(const dvec3 &a, const dvec3 &b, const dvec3 &c, const Ray &ray,
+							const int axes[3], const dvec3 &shear, double &t, double &u, double &v) {
+	const int kx = axes[0], ky = axes[1], kz = axes[2];
+	dvec3 A = a - ray.origin;
+	dvec3 B = b - ray.origin;
+	dvec3 C = c - ray.origin;
+
+	double Ax = A[kx] - shear.x * A[kz];
+	double Ay = A[ky] - shear.y * A[kz];
+	double Bx = B[kx] - shear.x * B[kz];
+	double By = B[ky] - shear.y * B[kz];
+	double Cx = C[kx] - shear.x * C[kz];
+	double Cy = C[ky] - shear.y * C[kz];
+
+	double U = Cx * By - Cy * Bx;
+	double V = Ax * Cy - Ay * Cx;
+	double W = Bx * Ay - By * Ax;
+	if ((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0)) {
+		return false;
+	}
+	double det = U + V + W;
+	if (det == 0.0) {
+		return false;
+	}
+
+	double T = U * shear.z * A[kz] + V * shear.z * B[kz] + W * shear.z * C[kz];
+	t = T / det;
+	u = V / det;
+	v = W / det;
+	return true;
+}
+
+/**
+ * @fn	ITriangleMesh::ITriangleMesh(vector<dvec3> verts, vector<unsigned int> tris, vector<dvec3> vertNormals)
+ * @brief	Constructs a mesh from a vertex buffer and an index buffer. The buffers are
+ * 			taken by value, so large ones can be moved in rather than copied.
+ * @param	verts	   	The vertices.
+ * @param	tris	   	Three indices into verts per triangle.
+ * @param	vertNormals	One normal per vertex, or empty to shade each triangle flat.
+ */
+
+ITriangleMesh::ITriangleMesh(vector<dvec3> verts, vector<unsigned int> tris, vector<dvec3> vertNormals)
+	: vertices(std::move(verts)), normals(std::move(vertNormals)), indices(std::move(tris)) {
+	build();
+}
+
+/**
+ * @fn	ITriangleMesh::ITriangleMesh(const vector<VertexData> &triangles)
+ * @brief	Constructs a mesh from a triangle soup, such as the EShapeData made by EShape.
+ * 			Vertices with the same position and normal are merged. The per-vertex
+ * 			materials are ignored; the mesh is drawn with its VisibleIShape's material.
+ * @param	triangles	Three vertices per triangle.
+ */
+
+ITriangleMesh::ITriangleMesh(const vector<VertexData> &triangles) {
+	std::map<std::array<double, 6>, unsigned int> welded;
+	indices.reserve(triangles.size());
+	for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+		for (size_t j = i; j < i + 3; j++) {
+			const VertexData &vert = triangles[j];
+			std::array<double, 6> key = { vert.pos.x, vert.pos.y, vert.pos.z,
+											vert.normal.x, vert.normal.y, vert.normal.z };
+			auto found = welded.find(key);
+			if (found == welded.end()) {
+				found = welded.insert(std::make_pair(key, (unsigned int)vertices.size())).first;
+				vertices.push_back(dvec3(vert.pos.x, vert.pos.y, vert.pos.z));
+				normals.push_back(vert.normal);
+			}
+			indices.push_back(found->second);
+		}
+	}
+	build();
+}
+
+/**
+ * @fn	void ITriangleMesh::build()
+ * @brief	Builds the mesh's hierarchy from scratch. Must be called again after the
+ * 			vertices or indices are changed. The triangles are reordered in indices so
+ * 			that each leaf's triangles are contiguous.
+ */
+
+void ITriangleMesh::build() {
+	vector<BVHBuildItem> items(numTriangles());
+	for (int i = 0; i < numTriangles(); i++) {
+		items[i].index = i;
+		for (int j = 0; j < 3; j++) {
+			items[i].box.grow(vertices[indices[3 * i + j]]);
+		}
+	}
+	buildBVHNodes(items, nodes);
+
+	vector<unsigned int> sorted(indices.size());
+	for (size_t i = 0; i < items.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			sorted[3 * i + j] = indices[3 * items[i].index + j];
+		}
+	}
+	indices.swap(sorted);
+}
+
+/**
+ * @fn	bool ITriangleMesh::intersectTriangle(int tri, const Ray &ray, const int axes[3], const dvec3 &shear, double &t, double &u, double &v) const
+ * @brief	Intersects the ray with one of the mesh's triangles using intersectWatertight.
+ * @param 		  	tri  	The triangle.
+ * @param 		  	ray  	The ray.
+ * @param 		  	axes 	Set up by setUpWatertightRay.
+ * @param 		  	shear	Set up by setUpWatertightRay.
+ * @param [in,out]	t	 	t of the intersection.
+ * @param [in,out]	u	 	Barycentric coordinate of the triangle's second vertex.
+ * @param [in,out]	v	 	Barycentric coordinate of the triangle's third vertex.
+ * @return	true iff the ray's line crosses the triangle. t may be negative.
+ */
+
+bool ITriangleMesh::intersectTriangle(int tri, const Ray &ray, const int axes[3], const dvec3 &shear,
+										double &t, double &u, double &v) const {
+	return intersectWatertight(vertices[indices[3 * tri]], vertices[indices[3 * tri + 1]],
+								vertices[indices[3 * tri + 2]], ray, axes, shear, t, u, v);
+}
+
+/**
+ * @fn	void ITriangleMesh::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Identifies the nearest intersection. The normal is interpolated from the
+ * 			vertex normals when there are any, and is the face normal otherwise.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit.
+ */
+
+void ITriangleMesh::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	int closest;
+	hit.t = ITriangleMesh::findClosestHit(ray, closest);
+	if (hit.t != FLT_MAX) {
+		ITriangleMesh::getHitAttributes(ray, hit.t, closest, hit);
+	}
+}
+
+/**
+ * @fn	double ITriangleMesh::findClosestHit(const Ray &ray, int &primitive) const
+ * @brief	Finds t of the nearest intersection and the triangle it is on. The
+ * 			barycentric coordinates of the triangles passed over are not kept.
+ * @param 		  	ray		 	The ray.
+ * @param [in,out]	primitive	The index of the triangle that was hit.
+ * @return	t of the intersection, or FLT_MAX.
+ */
+
+double ITriangleMesh::findClosestHit(const Ray &ray, int &primitive) const {
+	double bestT = FLT_MAX;
+	primitive = -1;
+	if (nodes.empty()) {
+		return bestT;
+	}
+	int axes[3];
+	dvec3 shear;
+	setUpWatertightRay(ray, axes, shear);
+	dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+
+	int stack[BVH_MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const BVHNode &node = nodes[index];
+		if (!node.box.intersects(ray.origin, invDir, 0.0, bestT)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				double t, u, v;
+				if (intersectTriangle(i, ray, axes, shear, t, u, v) && t >= 0.0 && t < bestT) {
+					bestT = t;
+					primitive = i;
+				}
+			}
+		} else if (ray.dir[node.axis] < 0.0) {
+			stack[top++] = index + 1;
+			stack[top++] = node.first;
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+	return bestT;
+}
+
+/**
+ * @fn	void ITriangleMesh::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const
+ * @brief	Fills in the intercept, normal and barycentric coordinates of a hit. The
+ * 			one triangle that was hit is intersected again to recover u and v.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	t		 	t returned by findClosestHit.
+ * @param 		  	primitive	The triangle returned by findClosestHit.
+ * @param [in,out]	hit		 	The hit.
+ */
+
+void ITriangleMesh::getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const {
+	int axes[3];
+	dvec3 shear;
+	setUpWatertightRay(ray, axes, shear);
+	double triT, u, v;
+	intersectTriangle(primitive, ray, axes, shear, triT, u, v);
+
+	unsigned int i0 = indices[3 * primitive];
+	unsigned int i1 = indices[3 * primitive + 1];
+	unsigned int i2 = indices[3 * primitive + 2];
+	hit.t = t;
+	hit.interceptPt = ray.getPoint(t);
+	if (normals.empty()) {
+		hit.normal = glm::normalize(glm::cross(vertices[i1] - vertices[i0], vertices[i2] - vertices[i0]));
+	} else {
+		hit.normal = glm::normalize((1.0 - u - v) * normals[i0] + u * normals[i1] + v * normals[i2]);
+	}
+	hit.u = u;
+	hit.v = v;
+}
+
+/**
+ * @fn	int ITriangleMesh::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const
+ * @brief	Finds the nearest maxHits triangles hit by the ray, in one walk of the
+ * 			hierarchy. Once maxHits are held, subtrees beyond the farthest are skipped.
+ * 			A ray through an edge or vertex shared by several triangles may hit each of
+ * 			them at the same t; that point is reported once.
+ * @param 		  	ray		 	The ray.
+ * @param 		  	maxHits  	The most hits to find.
+ * @param [in,out]	t		 	t of each hit, in increasing order.
+ * @param [in,out]	primitive	The triangle of each hit.
+ * @return	The number of hits found.
+ */
+
+int ITriangleMesh::findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const {
+	int count = 0;
+	if (nodes.empty()) {
+		return count;
+	}
+	int axes[3];
+	dvec3 shear;
+	setUpWatertightRay(ray, axes, shear);
+	dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+
+	int stack[BVH_MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const BVHNode &node = nodes[index];
+		double tFarthest = count < maxHits ? FLT_MAX : t[count - 1];
+		if (!node.box.intersects(ray.origin, invDir, 0.0, tFarthest)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (int tri = node.first; tri < node.first + node.count; tri++) {
+				double triT, u, v;
+				if (!intersectTriangle(tri, ray, axes, shear, triT, u, v) || triT < 0.0 ||
+					(count == maxHits && triT >= t[count - 1])) {
+					continue;
+				}
+				bool seen = false;
+				for (int k = 0; k < count && !seen; k++) {
+					seen = std::abs(t[k] - triT) <= 1.0E-9 * (1.0 + triT);
+				}
+				if (seen) {
+					continue;
+				}
+				int i = count < maxHits ? count++ : maxHits - 1;
+				while (i > 0 && t[i - 1] > triT) {
+					t[i] = t[i - 1];
+					primitive[i] = primitive[i - 1];
+					i--;
+				}
+				t[i] = triT;
+				primitive[i] = tri;
+			}
+		} else if (ray.dir[node.axis] < 0.0) {
+			stack[top++] = index + 1;
+			stack[top++] = node.first;
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+	return count;
+}
+
+/**
+ * @fn	bool ITriangleMesh::hasIntersection(const Ray &ray, double tMin, double tMax) const
+ * @brief	Determines whether the ray hits any triangle in [tMin, tMax]. Stops at the
+ * 			first one found.
+ * @param	ray 	The ray.
+ * @param	tMin	Smallest t of interest.
+ * @param	tMax	Largest t of interest.
+ * @return	true iff there is an intersection with tMin <= t <= tMax.
+ */
+
+bool ITriangleMesh::hasIntersection(const Ray &ray, double tMin, double tMax) const {
+	if (nodes.empty()) {
+		return false;
+	}
+	int axes[3];
+	dvec3 shear;
+	setUpWatertightRay(ray, axes, shear);
+	dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+
+	int stack[BVH_MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const BVHNode &node = nodes[index];
+		if (!node.box.intersects(ray.origin, invDir, tMin, tMax)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				double t, u, v;
+				if (intersectTriangle(i, ray, axes, shear, t, u, v) && t >= 0.0 && t >= tMin && t <= tMax) {
+					return true;
+				}
+			}
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool ITriangleMesh::getBoundingBox(BoundingBox &box) const
+ * @brief	Gets the box around all the triangles.
+ * @param [in,out]	box	The box.
+ * @return	False if the mesh has no triangles.
+ */
+
+bool ITriangleMesh::getBoundingBox(BoundingBox &box) const {
+	if (nodes.empty()) {
+		return false;
+	}
+	box = nodes[0].box;
+	return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include "ishape.h"
+#include "vertexdata.h"
+#include "bvh.h"
+
+/**
+ * @struct	ITriangleMesh
+ * @brief	A set of triangles that share one vertex buffer. Each triangle is three
+ * 			indices into the buffer. The triangles are kept in a hierarchy of their
+ * 			own, so the scene's BVH treats the whole mesh as a single object. Rays are
+ * 			intersected with the watertight test of Woop, Benthin and Wald, so a ray
+ * 			cannot slip through the shared edge of two triangles. A hit's u and v are
+ * 			its barycentric coordinates: the intercept is (1-u-v)*v0 + u*v1 + v*v2.
+ */
+
+struct ITriangleMesh : public IShape {
+	vector<dvec3> vertices;			//!< shared vertex buffer
+	vector<dvec3> normals;			//!< one normal per vertex, or empty to use face normals
+	vector<unsigned int> indices;	//!< three vertex indices per triangle, in leaf order
+	ITriangleMesh(vector<dvec3> verts, vector<unsigned int> tris,
+					vector<dvec3> vertNormals = vector<dvec3>());
+	ITriangleMesh(const vector<VertexData> &triangles);
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual double findClosestHit(const Ray &ray, int &primitive) const;
+	virtual void getHitAttributes(const Ray &ray, double t, int primitive, HitRecord &hit) const;
+	virtual int findHits(const Ray &ray, int maxHits, double t[], int primitive[]) const;
+	virtual bool hasIntersection(const Ray &ray, double tMin, double tMax) const;
+	virtual bool getBoundingBox(BoundingBox &box) const;
+	void build();
+	int numTriangles() const { return (int)indices.size() / 3; }
+	int numNodes() const { return (int)nodes.size(); }
+protected:
+	vector<BVHNode> nodes;			//!< hierarchy over the triangles, nodes[0] is the root
+	bool intersectTriangle(int tri, const Ray &ray, const int axes[3], const dvec3 &shear,
+							double &t, double &u, double &v) const;
+};
+
+void setUpWatertightRay(const Ray &ray, int axes[3], dvec3 &shear);
+bool intersectWatertight(const dvec3 &a, const dvec3 &b, const dvec3 &c, const Ray &ray,
+							const int axes[3], const dvec3 &shear, double &t, double &u, double &v);
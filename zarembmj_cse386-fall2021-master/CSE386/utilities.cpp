@@ -927,13 +927,13 @@ bool DEBUG_PIXEL = false;
 int xDebug = -1, yDebug = -1;
 
 void mouseUtility(int b, int s, int x, int y) {
+#ifndef CONSOLE_ONLY
 	if (b == GLUT_RIGHT_BUTTON && s == GLUT_DOWN) {
 		xDebug = x;
-#ifndef CONSOLE_ONLY
 		yDebug = glutGet(GLUT_WINDOW_HEIGHT) - y - 1;
-#endif
 		cout << "(" << xDebug << "," << yDebug << ") = " << endl;
 	}
+#endif
 }
 
 void graphicsInit(int argc, char *argv [], const std::string &windowName, int width, int height) {